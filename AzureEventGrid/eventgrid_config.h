@@ -22,6 +22,16 @@
 #define TOPIC_BUFFER_SIZE                   256
 #define MQTT_MESSAGE_QOS                    MQTT_PUBLISH_QOS_1
 
+// Outbound publish queue (see mqtt_publish_queue.h)
+#define PUBLISH_QUEUE_SIZE                  4096  // bytes, holds the messages MQTT-C's send buffer can't take yet
+#define PUBLISH_MAX_INFLIGHT                4     // max QoS1 messages awaiting PUBACK
+
+// Reconnection
+#define RECONNECT_BACKOFF_MIN_MS            1000            // first retry delay, doubled after each failed attempt
+#define RECONNECT_BACKOFF_MAX_MS            120000          // retry delay cap
+#define TLS_CONTEXT_MAX_AGE_SECONDS         (60 * 60)       // the TLS context (and device certificate) is reloaded after this
+#define EVENT_GRID_TLS_SESSION_RESUMPTION   1               // offer the previous TLS session on reconnect (0 = always full handshake)
+
 typedef struct {
     const char *port;
     const char *hostname;
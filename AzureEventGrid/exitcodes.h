@@ -66,7 +66,10 @@ typedef enum {
 
     ExitCode_SetSubscription_NullTopic = 41,
 
-    ExitCode_SendTelemetry_NullTopic = 42
+    ExitCode_SendTelemetry_NullTopic = 42,
+
+    ExitCode_PublishFlushTimer_Consume = 43,
+    ExitCode_Init_PublishFlushTimer = 44
 
 } ExitCode;
 
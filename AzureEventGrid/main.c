@@ -50,7 +50,20 @@ static void PublishMessageTimerHandler(EventLoopTimer *eventLoopTimer)
     UpdateTelemetry(mqtt_msg.message, sizeof(mqtt_msg.message));
     mqtt_msg.message_length = strnlen(mqtt_msg.message, sizeof(mqtt_msg.message));
 
-    SendTelemetry(mqtt_msg.message, mqtt_msg.message_length, GetPublishTopicName());
+    MQTT_PQ_RESULT result = SendTelemetry(mqtt_msg.message, mqtt_msg.message_length, GetPublishTopicName());
+    if (result < 0) {
+        Log_Debug("WARNING: Telemetry message dropped (%d)\n", result);
+    } else if (result == MQTT_PQ_QUEUED_HIGH_WATER) {
+        // A real application would reduce its publish rate here (i.e. aggregate readings).
+        Log_Debug("WARNING: Publish queue is above its high-water mark\n");
+    }
+
+    // Log the publish queue and connection counters once a minute.
+    static unsigned int publishCount = 0;
+    if (++publishCount % 60 == 0) {
+        LogPublishQueueStats();
+        LogConnectionStats();
+    }
 }
 
 /// <summary>
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <applibs/networking.h>
 #include <applibs/application.h>
@@ -26,6 +27,17 @@ static void ClientRefresherHandler(EventLoop *el, int fd, EventLoop_IoEvents eve
 static ExitCode HandleWolfsslSetup(void);
 static void MqttPingHandler(EventLoopTimer* eventLoopTimer);
 static void MqttReconnectHandler(EventLoopTimer* eventLoopTimer);
+static void PublishFlushHandler(EventLoopTimer *eventLoopTimer);
+static void SchedulePublishFlush(void);
+static void FlushPublishQueue(void);
+static void UpdateSocketEvents(void);
+static void StartConnectionAttempt(void);
+static void HandleConnectionFailure(ExitCode exitCode);
+static void HandleConnectAcknowledged(void);
+static void ScheduleReconnect(void);
+static ExitCode EnsureTlsContext(void);
+static void FreeConnection(void);
+static void FreeTlsContext(void);
 static void MqttSetSubscriptions(const char *topic, size_t topicSize);
 static void ReconnectClient(struct mqtt_client* client, void** reconnect_state_vptr);
 static void StartOneShotTimer(EventLoopTimer *timer, const struct timespec *delay);
@@ -38,20 +50,60 @@ static void FreeResources(void);
 static ExitCode_CallbackType failureCallbackFunction = NULL;
 static EventLoopTimer *mqttReconnectTimer = NULL;
 static EventLoopTimer *mqttPingTimer = NULL;
+static EventLoopTimer *publishFlushTimer = NULL;
+static bool publishFlushPending = false;
 
+// The WOLFSSL_CTX (device certificate, CA, SNI) is kept across reconnects, and rebuilt when it is
+// older than TLS_CONTEXT_MAX_AGE_SECONDS (the device certificate is renewed periodically) or after a
+// failed handshake. The TLS session of the last connection is kept to resume the next one.
 static WOLFSSL_CTX *wolfSslCtx = NULL;
+static struct timespec wolfSslCtxCreationTime;
 static WOLFSSL *wolfSslSession = NULL;
+static WOLFSSL_SESSION *cachedTlsSession = NULL;
 static bool wolfSslInitialized = false;
 static int sockFd = -1;
 static EventRegistration *sockReg = NULL;
 static Mqtt_Reconnect_State *mqttReconnectStatePtr = NULL;
 
 static bool isMqttConnected = false;
+// The client is bound to an open connection (mqtt_reinit was called on it): mqtt_sync can be called.
+static bool isConnectionOpen = false;
+// A socket connection or TLS handshake is in progress.
+static bool isConnectionAttemptInProgress = false;
+static bool isReconnectScheduled = false;
+// CONNECT sent on the current connection, CONNACK not received yet.
+static bool isConnectPending = false;
+
+// Reconnect backoff: the delay doubles from RECONNECT_BACKOFF_MIN_MS up to RECONNECT_BACKOFF_MAX_MS,
+// and is randomized (between half and all of it) so that devices don't reconnect in lockstep.
+static unsigned int reconnectAttempt = 0;
+static uint32_t backoffRandomState = 0;
+static struct timespec disconnectTime;
+static struct timespec handshakeStartTime;
+static bool isTlsSessionResumed = false;
+
+typedef struct {
+    uint32_t attempts;          // connection attempts (TCP connect started)
+    uint32_t failures;          // attempts that failed before the TLS handshake completed
+    uint32_t connections;       // CONNACKs received
+    uint32_t resumed;           // handshakes that resumed the previous TLS session
+    uint32_t lastHandshakeMs;
+    uint64_t totalHandshakeMs;
+    uint32_t handshakes;
+    uint32_t lastReconnectMs;   // from losing the connection to the CONNACK
+    uint32_t maxReconnectMs;
+} ConnectionStats;
+
+static ConnectionStats connectionStats;
 static char formattedPublishTopicBuffer[TOPIC_BUFFER_SIZE] = {0};
 static char formattedSubscribeTopicBuffer[TOPIC_BUFFER_SIZE] = {0};
 static EventLoop *eventLoopRef = NULL;
 static MQTT_Context *mqttClientContext = NULL;
 static struct mqtt_client mqttClient;
+static MQTT_PUBLISH_QUEUE publishQueue;
+static uint8_t publishQueueBuffer[PUBLISH_QUEUE_SIZE];
+static MQTT_SG_PUBLISHER sgPublisher;
+static EventLoop_IoEvents socketEvents = EventLoop_Input;
 
 /// <summary>
 /// Function to check if networking is ready.
@@ -79,8 +131,181 @@ static void StartOneShotTimer(EventLoopTimer *timer, const struct timespec *dela
     }
 }
 
+/// <summary>
+/// Milliseconds elapsed on the monotonic clock, in 64 bits so that long durations (such as the age
+/// of the TLS context) don't wrap.
+/// </summary>
+static uint64_t ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsedMs = (int64_t)(now.tv_sec - since->tv_sec) * 1000 +
+                        (int64_t)(now.tv_nsec - since->tv_nsec) / 1000000;
+    return elapsedMs > 0 ? (uint64_t)elapsedMs : 0;
+}
+
+/// <summary>
+/// Clamps a duration to the 32-bit connection statistics.
+/// </summary>
+static uint32_t StatMs(uint64_t ms)
+{
+    return ms < UINT32_MAX ? (uint32_t)ms : UINT32_MAX;
+}
+
+/// <summary>
+/// xorshift32, seeded from the device ID and the time (see InitializeMqtt) so that the devices of a
+/// fleet don't draw the same delays after a broker outage.
+/// </summary>
+static uint32_t NextBackoffRandom(void)
+{
+    uint32_t x = backoffRandomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    backoffRandomState = x;
+    return x;
+}
+
+/// <summary>
+/// Arm the reconnect timer with the next backoff delay (if it isn't already armed).
+/// </summary>
+static void ScheduleReconnect(void)
+{
+    if (isReconnectScheduled) {
+        return;
+    }
+
+    uint32_t delayMs = RECONNECT_BACKOFF_MAX_MS;
+    if (reconnectAttempt < 16 && (RECONNECT_BACKOFF_MIN_MS << reconnectAttempt) < RECONNECT_BACKOFF_MAX_MS) {
+        delayMs = RECONNECT_BACKOFF_MIN_MS << reconnectAttempt;
+    }
+    delayMs = delayMs / 2 + NextBackoffRandom() % (delayMs / 2 + 1);
+    reconnectAttempt++;
+
+    Log_Debug("Reconnecting in %u ms (attempt %u)\n", delayMs, reconnectAttempt);
+    const struct timespec delay = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000};
+    StartOneShotTimer(mqttReconnectTimer, &delay);
+    isReconnectScheduled = true;
+}
+
+/// <summary>
+/// Called when the connection is lost (or the network is down): close it, and reconnect after the
+/// backoff delay. Messages stay in the publish queue.
+/// </summary>
+static void HandleConnectionLost(void)
+{
+    if (isConnectionOpen) {
+        clock_gettime(CLOCK_MONOTONIC, &disconnectTime);
+    }
+
+    isMqttConnected = false;
+    isConnectPending = false;
+    FreeConnection();
+    ScheduleReconnect();
+}
+
+static bool IsTransientConnectionError(ExitCode exitCode)
+{
+    switch (exitCode) {
+    case ExitCode_ConnectRaw_GetAddrInfo:
+    case ExitCode_ConnectRaw_GetAddrInfo_Result:
+    case ExitCode_ConnectRaw_Connect:
+    case ExitCode_HandleWolfSslSetup_Failed:
+    case ExitCode_TlsHandshake_Fail:
+    case ExitCode_TlsHandshake_UnexpectedError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+/// A connection attempt failed. Network errors (DNS, TCP connect, TLS handshake) are retried with
+/// backoff, other errors (i.e. certificates) are fatal.
+/// </summary>
+static void HandleConnectionFailure(ExitCode exitCode)
+{
+    isConnectionAttemptInProgress = false;
+
+    if (!IsTransientConnectionError(exitCode)) {
+        failureCallbackFunction(exitCode);
+        return;
+    }
+
+    Log_Debug("Connection attempt failed (exit code %d)\n", exitCode);
+    connectionStats.failures++;
+
+    if (exitCode == ExitCode_TlsHandshake_Fail || exitCode == ExitCode_TlsHandshake_UnexpectedError) {
+        // Don't offer the same session again, and reload the device certificate in case it was renewed.
+        FreeTlsContext();
+    }
+
+    FreeConnection();
+    ScheduleReconnect();
+}
+
+/// <summary>
+/// Returns true while the CONNECT sent on the current connection hasn't been acknowledged.
+/// </summary>
+static bool IsConnectAwaitingAck(void)
+{
+    for (ssize_t i = 0; i < mqtt_mq_length(&mqttClient.mq); i++) {
+        struct mqtt_queued_message *msg = mqtt_mq_get(&mqttClient.mq, i);
+        if (msg->control_type == MQTT_CONTROL_CONNECT && msg->state != MQTT_QUEUED_COMPLETE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+/// CONNACK received: the reconnect is complete, so reset the backoff, and keep the TLS session to
+/// resume it on the next connection (TLS 1.3 session tickets arrive after the handshake).
+/// </summary>
+static void HandleConnectAcknowledged(void)
+{
+    isConnectPending = false;
+    reconnectAttempt = 0;
+    connectionStats.connections++;
+
+    uint32_t reconnectMs = 0;
+    if (disconnectTime.tv_sec != 0 || disconnectTime.tv_nsec != 0) {
+        reconnectMs = StatMs(ElapsedMs(&disconnectTime));
+        connectionStats.lastReconnectMs = reconnectMs;
+        if (reconnectMs > connectionStats.maxReconnectMs) {
+            connectionStats.maxReconnectMs = reconnectMs;
+        }
+    }
+
+#if EVENT_GRID_TLS_SESSION_RESUMPTION
+    WOLFSSL_SESSION *session = wolfSSL_get1_session(wolfSslSession);
+    if (session != NULL) {
+        if (cachedTlsSession != NULL) {
+            wolfSSL_SESSION_free(cachedTlsSession);
+        }
+        cachedTlsSession = session;
+    }
+#endif
+
+    Log_Debug("MQTT connection acknowledged: TLS handshake %u ms (%s), %u ms since the connection was lost\n",
+              connectionStats.lastHandshakeMs, isTlsSessionResumed ? "resumed" : "full", reconnectMs);
+}
+
+void LogConnectionStats(void)
+{
+    const ConnectionStats *s = &connectionStats;
+
+    Log_Debug("Connection: %u attempts, %u failed, %u connected; TLS handshakes %u (%u resumed), last %u ms, "
+              "mean %u ms; reconnect last %u ms, max %u ms\n",
+              s->attempts, s->failures, s->connections, s->handshakes, s->resumed, s->lastHandshakeMs,
+              s->handshakes ? (unsigned)(s->totalHandshakeMs / s->handshakes) : 0u, s->lastReconnectMs,
+              s->maxReconnectMs);
+}
+
 void DisconnectMqtt(void) {
     mqtt_disconnect(&mqttClient);
+    mqtt_pq_log_stats(&publishQueue);
+    LogConnectionStats();
 
     isMqttConnected = false;
     FreeResources();
@@ -103,35 +328,140 @@ const char *GetPublishTopicName(void)
 }
 
 /// <summary>
-/// Publish message to Azure Event Grid
+/// Queue a message to publish to Azure Event Grid. The queue is flushed on the next event loop
+/// turn, so the messages queued in one turn are sent with a single mqtt_sync.
 /// </summary>
 /// <param name="data">Message to publish</param>
 /// <param name="data_length">Length of message to publish</param>
 /// <param name="topic">Topic to publish the message on</param>
-void SendTelemetry(const void *data, size_t data_length, const char *topic)
+MQTT_PQ_RESULT SendTelemetry(const void *data, size_t data_length, const char *topic)
 {
+    if (!topic || !strlen(topic)) {
+        Log_Debug("Publish topic is null or empty. Not sending telemetry.\n");
+        failureCallbackFunction(ExitCode_SendTelemetry_NullTopic);
+        return MQTT_PQ_DROPPED_INVALID;
+    }
+
+    MQTT_PQ_RESULT result = mqtt_pq_enqueue(&publishQueue, topic, data, data_length);
+
+    if (!isMqttConnected) {
+        // Messages stay queued (up to PUBLISH_QUEUE_SIZE bytes) until the connection is re-established.
+        return result;
+    }
+
+    SchedulePublishFlush();
+
+    return result;
+}
+
+/// <summary>
+/// Publish a QoS 0 message made of fragments, written from the caller's memory instead of being copied
+/// to the MQTT-C send buffer. The packet is written on the next event loop turn(s).
+/// </summary>
+MQTT_SG_RESULT SendTelemetryFragments(const MQTT_SG_FRAGMENT *fragments, size_t fragmentCount,
+                                      const char *topic, MQTT_SG_CALLBACK complete, void *context)
+{
+    if (!isMqttConnected) {
+        return MQTT_SG_NOT_CONNECTED;
+    }
+
+    MQTT_SG_RESULT result = mqtt_sg_publish(&sgPublisher, topic, fragments, fragmentCount,
+                                            MQTT_PUBLISH_QOS_0, complete, context);
+    if (result == MQTT_SG_OK) {
+        SchedulePublishFlush();
+    }
+
+    return result;
+}
+
+void LogPublishQueueStats(void)
+{
+    mqtt_pq_log_stats(&publishQueue);
+    mqtt_sg_log_stats(&sgPublisher);
+}
+
+/// <summary>
+/// Arm the publish flush timer to fire on the next event loop turn (if it isn't already armed).
+/// </summary>
+static void SchedulePublishFlush(void)
+{
+    if (!publishFlushPending) {
+        const struct timespec nextTurn = {.tv_sec = 0, .tv_nsec = 1};
+        StartOneShotTimer(publishFlushTimer, &nextTurn);
+        publishFlushPending = true;
+    }
+}
+
+/// <summary>
+/// Wait for the socket to be writable too while a scatter-gather publish is pending, so the rest of
+/// its packet is written as soon as the socket can take it. While part of the packet is written,
+/// received packets are left in the socket, so only wait for it to be writable.
+/// </summary>
+static void UpdateSocketEvents(void)
+{
+    EventLoop_IoEvents events = EventLoop_Input;
+
+    if (mqtt_sg_writing(&sgPublisher)) {
+        events = EventLoop_Output;
+    } else if (mqtt_sg_pending(&sgPublisher)) {
+        events = EventLoop_Input | EventLoop_Output;
+    }
+
+    if (sockReg != NULL && events != socketEvents) {
+        if (EventLoop_ModifyIoEvents(eventLoopRef, sockReg, events) != 0) {
+            Log_Debug("ERROR: EventLoop_ModifyIoEvents: %d (%s)\n", errno, strerror(errno));
+            return;
+        }
+        socketEvents = events;
+    }
+}
+
+/// <summary>
+/// Hand the queued messages to MQTT-C and sync once. If PUBACKs received during the sync opened the
+/// in-flight window, flush again on the next event loop turn. While a scatter-gather publish is part
+/// way through its packet MQTT-C must not write, so the queue waits for it to complete.
+/// </summary>
+static void FlushPublishQueue(void)
+{
+    // Nothing to sync while reconnecting: messages stay queued.
+    if (!isConnectionOpen) {
+        return;
+    }
+
     if (!IsNetworkReady()) {
         Log_Debug("Network is not ready. Cannot send telemetry.\n");
+        HandleConnectionLost();
         return;
     }
 
-    if (!isMqttConnected) {
-        Log_Debug("Not connected to Azure Event Grid. Not sending telemetry.\n");
-        return;
+    if (mqtt_sg_pending(&sgPublisher)) {
+        mqtt_sg_sync(&sgPublisher);
     }
 
-    if (!topic || !strlen(topic)) {
-        Log_Debug("Publish topic is null or empty. Not sending telemetry.\n");
-        failureCallbackFunction(ExitCode_SendTelemetry_NullTopic);
+    if (!mqtt_sg_pending(&sgPublisher)) {
+        mqtt_pq_flush(&publishQueue);
+
+        if (mqtt_pq_can_publish(&publishQueue)) {
+            SchedulePublishFlush();
+        }
+    }
+
+    if (isConnectPending && mqttClient.error == MQTT_OK && !IsConnectAwaitingAck()) {
+        HandleConnectAcknowledged();
     }
 
-    mqtt_mq_clean(&mqttClient.mq);
+    UpdateSocketEvents();
+}
 
-    if (mqttClient.mq.curr_sz >= data_length) {
-        mqtt_publish(&mqttClient, topic, data, data_length, MQTT_MESSAGE_QOS);
+static void PublishFlushHandler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        failureCallbackFunction(ExitCode_PublishFlushTimer_Consume);
+        return;
     }
 
-    mqtt_sync(&mqttClient);
+    publishFlushPending = false;
+    FlushPublishQueue();
 }
 
 /// <summary>
@@ -206,17 +536,13 @@ static void MqttReconnectHandler(EventLoopTimer *eventLoopTimer)
         return;
     }
 
-    ReconnectClient(&mqttClient, &mqttClient.reconnect_state);
-    return;
+    isReconnectScheduled = false;
+    StartConnectionAttempt();
 }
 
 static void ClientRefresherHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
-    if (IsNetworkReady()) {
-        mqtt_sync(&mqttClient);
-    } else {
-        const struct timespec reconnectTime = {.tv_sec = 1, .tv_nsec = 0};
-        StartOneShotTimer(mqttReconnectTimer, &reconnectTime);
-    }
+    // mqtt_pq_flush processes the received packets (mqtt_sync), and publishes the queued messages.
+    FlushPublishQueue();
 }
 
 
@@ -228,7 +554,7 @@ static void HandleSockEvent(EventLoop *el, int fd, EventLoop_IoEvents events, vo
 {
     int retExitCode = nextHandler();
     if (retExitCode != ExitCode_Success) {
-        failureCallbackFunction(retExitCode);
+        HandleConnectionFailure(retExitCode);
     }
 }
 
@@ -305,30 +631,29 @@ static ExitCode ConnectRawSocketToServer(const char *hostname)
 }
 
 /// <summary>
-///     Called from the event loop when socket connection has completed,
-///     successfully or otherwise. If the connection was successful, then
-///     uses wolfSSL to start the SSL handshake. Otherwise, set exitCode to
-///     the appropriate value.
+///     Creates the wolfSSL context (device certificate, CA certificate, SNI), or reuses the one
+///     created for a previous connection if it is less than TLS_CONTEXT_MAX_AGE_SECONDS old.
 /// </summary>
-static ExitCode HandleWolfsslSetup(void)
+static ExitCode EnsureTlsContext(void)
 {
     int ret;
-    // Check whether the connection succeeded.
-    int error;
-    socklen_t errSize = sizeof(error);
-    int r = getsockopt(sockFd, SOL_SOCKET, SO_ERROR, &error, &errSize);
-    if (!(r == 0 && error == 0)) {
-        Log_Debug("ERROR: Socket connection failed\n");
-        return ExitCode_HandleWolfSslSetup_Failed;
+
+    if (wolfSslCtx != NULL) {
+        if (ElapsedMs(&wolfSslCtxCreationTime) / 1000 < TLS_CONTEXT_MAX_AGE_SECONDS) {
+            return ExitCode_Success;
+        }
+        // Reload the device certificate, which is renewed periodically.
+        FreeTlsContext();
     }
 
-    // Connection was made successfully, so allocate wolfSSL session and context.
-    r = wolfSSL_Init();
-    if (r != WOLFSSL_SUCCESS) {
-        Log_Debug("ERROR: wolfSSL_init failed\n");
-        return ExitCode_HandleWolfSslSetup_Init;
+    if (!wolfSslInitialized) {
+        ret = wolfSSL_Init();
+        if (ret != WOLFSSL_SUCCESS) {
+            Log_Debug("ERROR: wolfSSL_init failed\n");
+            return ExitCode_HandleWolfSslSetup_Init;
+        }
+        wolfSslInitialized = true;
     }
-    wolfSslInitialized = true;
 
     WOLFSSL_METHOD *wolfSslMethod = wolfTLSv1_3_client_method();
     if (wolfSslMethod == NULL) {
@@ -341,6 +666,7 @@ static ExitCode HandleWolfsslSetup(void)
         Log_Debug("ERROR: failed to create WOLFSSL_CTX\n");
         return ExitCode_HandleWolfSslSetup_Context;
     }
+    clock_gettime(CLOCK_MONOTONIC, &wolfSslCtxCreationTime);
 
     if (deviceCertPath == NULL) {
         Log_Debug("HandleWolfsslSetup: Device cert path is null.\n");
@@ -382,6 +708,32 @@ static ExitCode HandleWolfsslSetup(void)
         return ExitCode_HandleWolfSslSetup_UseSni;
     }
 
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     Called from the event loop when socket connection has completed,
+///     successfully or otherwise. If the connection was successful, then
+///     uses wolfSSL to start the SSL handshake, resuming the previous TLS session if there is one.
+///     Otherwise, set exitCode to the appropriate value.
+/// </summary>
+static ExitCode HandleWolfsslSetup(void)
+{
+    // Check whether the connection succeeded.
+    int error;
+    socklen_t errSize = sizeof(error);
+    int r = getsockopt(sockFd, SOL_SOCKET, SO_ERROR, &error, &errSize);
+    if (!(r == 0 && error == 0)) {
+        Log_Debug("ERROR: Socket connection failed\n");
+        return ExitCode_HandleWolfSslSetup_Failed;
+    }
+
+    // Connection was made successfully, so allocate the wolfSSL session (and context, if needed).
+    ExitCode ret = EnsureTlsContext();
+    if (ret != ExitCode_Success) {
+        return ret;
+    }
+
     wolfSslSession = wolfSSL_new(wolfSslCtx);
     if (wolfSslSession == NULL) {
         Log_Debug("ERROR: Failed to open new WOlfSsl session\n");
@@ -402,9 +754,20 @@ static ExitCode HandleWolfsslSetup(void)
         return ExitCode_HandleWolfSslSetup_SetFd;
     }
 
+#if EVENT_GRID_TLS_SESSION_RESUMPTION
+    // Offer the session of the previous connection (a TLS 1.3 session ticket, or a TLS 1.2 session ID
+    // or ticket). If the broker doesn't accept it, wolfSSL falls back to a full handshake.
+    if (cachedTlsSession != NULL && wolfSSL_set_session(wolfSslSession, cachedTlsSession) != WOLFSSL_SUCCESS) {
+        Log_Debug("WARNING: Cached TLS session could not be used\n");
+        wolfSSL_SESSION_free(cachedTlsSession);
+        cachedTlsSession = NULL;
+    }
+#endif
+
     // Perform TLS handshake.
     // Asynchronous handshakes require repeated calls to wolfSSL_connect, so jump to the
     // handler to avoid repeating code.
+    clock_gettime(CLOCK_MONOTONIC, &handshakeStartTime);
     ret = HandleTlsHandshake();
     if (ret != ExitCode_Success) {
         return ret;
@@ -441,6 +804,16 @@ static ExitCode HandleTlsHandshake(void)
         return ExitCode_TlsHandshake_UnexpectedError;
     }
 
+    connectionStats.lastHandshakeMs = StatMs(ElapsedMs(&handshakeStartTime));
+    connectionStats.totalHandshakeMs += connectionStats.lastHandshakeMs;
+    connectionStats.handshakes++;
+#if EVENT_GRID_TLS_SESSION_RESUMPTION
+    isTlsSessionResumed = wolfSSL_session_reused(wolfSslSession) == 1;
+    if (isTlsSessionResumed) {
+        connectionStats.resumed++;
+    }
+#endif
+
     // Handshake completed, now handle mqtt connection.
     HandleMqttConnection();
 
@@ -454,13 +827,13 @@ static ExitCode HandleTlsHandshake(void)
 static void HandleMqttConnection(void)
 {
     if (wolfSslSession == NULL) {
-        const struct timespec reconnectTime = {.tv_sec = 2, .tv_nsec = 0};
-        StartOneShotTimer(mqttReconnectTimer, &reconnectTime);
         Log_Debug("Failed to open socket: ");
+        HandleConnectionFailure(ExitCode_TlsHandshake_UnexpectedError);
         return;
     }
 
     int r = EventLoop_UnregisterIo(eventLoopRef, sockReg);
+    sockReg = NULL;
     if (r != 0) {
         failureCallbackFunction(ExitCode_MqttConnection_UnregisterIO);
         return;
@@ -471,37 +844,40 @@ static void HandleMqttConnection(void)
         failureCallbackFunction(ExitCode_MqttConnection_RegisterIO);
         return;
     }
+    socketEvents = EventLoop_Input;
+
+    isConnectionAttemptInProgress = false;
 
     // Reinitialize the client.
     mqtt_reinit(&mqttClient, wolfSslSession, mqttReconnectStatePtr->sendbuf,
                 mqttReconnectStatePtr->sendbufsz, mqttReconnectStatePtr->recvbuf,
                 mqttReconnectStatePtr->recvbufsz);
+    isConnectionOpen = true;
 
-    // Send connection request to the broker.
+    // Send connection request to the broker, now rather than on the next publish.
     uint8_t connect_flags = MQTT_CONNECT_CLEAN_SESSION;
     mqtt_connect(&mqttClient, deviceId, NULL, NULL, 0, deviceId, NULL, connect_flags, 30);
+    isConnectPending = true;
+    SchedulePublishFlush();
 
     // Subscribe to the desired topic.
     MqttSetSubscriptions(formattedSubscribeTopicBuffer, sizeof(formattedSubscribeTopicBuffer));
 }
 
 /// <summary>
-///     Function to free all resources
+///     Function to free the resources of the current connection (the wolfSSL context and the
+///     TLS session to resume are kept for the next one).
 /// </summary>
-static void FreeResources(void)
+static void FreeConnection(void)
 {
+    // The rest of a partly written packet must not be sent on the next connection.
+    mqtt_sg_abort(&sgPublisher);
+    isConnectionOpen = false;
+
     if (wolfSslSession != NULL) {
         wolfSSL_free(wolfSslSession);
         wolfSslSession = NULL;
     }
-    if (wolfSslCtx != NULL) {
-        wolfSSL_CTX_free(wolfSslCtx);
-        wolfSslCtx = NULL;
-    }
-    if (wolfSslInitialized) {
-        wolfSSL_Cleanup();
-        wolfSslInitialized = false;
-    }
     if (sockFd != -1) {
         close(sockFd);
         sockFd = -1;
@@ -511,6 +887,36 @@ static void FreeResources(void)
         EventLoop_UnregisterIo(eventLoopRef, sockReg);
         sockReg = NULL;
     }
+    socketEvents = EventLoop_Input;
+}
+
+/// <summary>
+///     Function to free the wolfSSL context and the cached TLS session.
+/// </summary>
+static void FreeTlsContext(void)
+{
+    if (cachedTlsSession != NULL) {
+        wolfSSL_SESSION_free(cachedTlsSession);
+        cachedTlsSession = NULL;
+    }
+    if (wolfSslCtx != NULL) {
+        wolfSSL_CTX_free(wolfSslCtx);
+        wolfSslCtx = NULL;
+    }
+}
+
+/// <summary>
+///     Function to free all resources
+/// </summary>
+static void FreeResources(void)
+{
+    FreeConnection();
+    FreeTlsContext();
+
+    if (wolfSslInitialized) {
+        wolfSSL_Cleanup();
+        wolfSslInitialized = false;
+    }
 }
 
 /// <summary>
@@ -520,6 +926,7 @@ void DisposeMqttTimers(void)
 {
     DisposeEventLoopTimer(mqttReconnectTimer);
     DisposeEventLoopTimer(mqttPingTimer);
+    DisposeEventLoopTimer(publishFlushTimer);
 }
 
 /// <summary>
@@ -594,19 +1001,39 @@ cleanupLabel:
 ///      - HandleTlsHandshake
 ///      - HandleMqttConnection
 ///      - MqttSetSubscriptions
-///     This function is also called as a callback from MQTT-C library to connect/reconnect
-///     to Event Grid.
+///     A transient failure at any step schedules another attempt (see ScheduleReconnect).
 /// </summary>
-static void ReconnectClient(struct mqtt_client *client, void **reconnect_state_vptr)
+static void StartConnectionAttempt(void)
 {
-    int retExitCode = -1;
+    if (!IsNetworkReady()) {
+        Log_Debug("Network not ready.\n");
+        ScheduleReconnect();
+        return;
+    }
+
+    FreeConnection();
+    connectionStats.attempts++;
 
+    int retExitCode = ConnectRawSocketToServer(mqttClientContext->hostname);
+    if (retExitCode != ExitCode_Success) {
+        Log_Debug("ERROR: ConnectRawSocketToServer: exitcode= %d, %d (%s)\n", retExitCode, errno,
+                  strerror(errno));
+        HandleConnectionFailure(retExitCode);
+        return;
+    }
+
+    isConnectionAttemptInProgress = true;
+}
+
+/// <summary>
+///     Called from the MQTT-C library (mqtt_sync) while the client is in an error state. Starts
+///     the reconnection, unless a connection attempt is already in progress or scheduled.
+/// </summary>
+static void ReconnectClient(struct mqtt_client *client, void **reconnect_state_vptr)
+{
     mqttReconnectStatePtr = *((Mqtt_Reconnect_State **)reconnect_state_vptr);
 
-    if (!IsNetworkReady()) {
-        const struct timespec reconnectTime = {.tv_sec = 2, .tv_nsec = 0};
-        StartOneShotTimer(mqttReconnectTimer, &reconnectTime);
-        Log_Debug("Network not ready.\n");
+    if (isConnectionAttemptInProgress || isReconnectScheduled) {
         return;
     }
 
@@ -617,17 +1044,7 @@ static void ReconnectClient(struct mqtt_client *client, void **reconnect_state_v
         );
     }
 
-    FreeResources();
-
-    retExitCode = ConnectRawSocketToServer(mqttClientContext->hostname);
-    if (retExitCode != ExitCode_Success) {
-        Log_Debug("ERROR: ConnectRawSocketToServer: exitcode= %d, %d (%s)\n", retExitCode, errno,
-                  strerror(errno));
-        failureCallbackFunction(retExitCode);
-        return;
-    }
-
-    return;
+    HandleConnectionLost();
 }
 
 static void MqttSetSubscriptions(const char* topic, size_t topicSize)
@@ -644,6 +1061,11 @@ static void MqttSetSubscriptions(const char* topic, size_t topicSize)
      
         isMqttConnected = true;
         Log_Debug("Connected to MQTT Broker\n");
+
+        // publish the messages queued while disconnected.
+        if (mqtt_pq_depth(&publishQueue) > 0) {
+            SchedulePublishFlush();
+        }
     }
 }
 
@@ -673,6 +1095,18 @@ ExitCode InitializeMqtt(EventLoop *eventLoop,
         return ret;
     }
 
+    // Seed the backoff jitter from the device ID (FNV-1a) and the time.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    backoffRandomState = 2166136261u;
+    for (const char *c = deviceId; *c != '\0'; c++) {
+        backoffRandomState = (backoffRandomState ^ (uint8_t)*c) * 16777619u;
+    }
+    backoffRandomState ^= (uint32_t)now.tv_sec ^ (uint32_t)now.tv_nsec;
+    if (backoffRandomState == 0) {
+        backoffRandomState = 1;
+    }
+
     // Format the publish and subscribe topic spaces to replace "${client.authenticationName}"
     // with the device ID.
     ret = FormatTopic(EVENT_GRID_PUBLISH_TOPIC, strlen(EVENT_GRID_PUBLISH_TOPIC),
@@ -699,13 +1133,18 @@ ExitCode InitializeMqtt(EventLoop *eventLoop,
 
     mqtt_init_reconnect(&mqttClient, ReconnectClient, &reconnect_state, publish_callback);
 
+    mqtt_pq_init(&publishQueue, &mqttClient, publishQueueBuffer, sizeof(publishQueueBuffer),
+                 MQTT_MESSAGE_QOS, PUBLISH_MAX_INFLIGHT);
+    mqtt_sg_init(&sgPublisher, &mqttClient);
+
     return ExitCode_Success;
 }
 
 
 void ConnectMqtt(void)
 {
-    ReconnectClient(&mqttClient, &mqttClient.reconnect_state);
+    mqttReconnectStatePtr = (Mqtt_Reconnect_State *)mqttClient.reconnect_state;
+    StartConnectionAttempt();
 }
 
 void CreateMqttTimers(void)
@@ -718,6 +1157,12 @@ void CreateMqttTimers(void)
         failureCallbackFunction(ExitCode_Init_MqttPingTimer);
     }
 
+    publishFlushTimer = CreateEventLoopDisarmedTimer(eventLoopRef, PublishFlushHandler);
+    if (publishFlushTimer == NULL) {
+        Log_Debug("ERROR: Failed to create publish flush timer: %s (%d)\n", strerror(errno), errno);
+        failureCallbackFunction(ExitCode_Init_PublishFlushTimer);
+    }
+
     struct timespec pingTimerPeriod = {.tv_sec = 30, .tv_nsec = 0};
     mqttPingTimer = CreateEventLoopPeriodicTimer(eventLoopRef, &MqttPingHandler, &pingTimerPeriod);
     if (mqttPingTimer == NULL) {
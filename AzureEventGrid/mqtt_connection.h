@@ -13,6 +13,8 @@
 #include <wolfssl/ssl.h>
 
 #include "mqtt.h"
+#include "mqtt_publish_queue.h"
+#include "mqtt_sg_publish.h"
 #include "exitcodes.h"
 
 /// <summary>
@@ -44,13 +46,48 @@ ExitCode InitializeMqtt(EventLoop *eventLoop,
                    MQTT_Context *mqttContext);
 
 /// <summary>
-/// Send telemetry message to the publish topic. Sends the message only if MQTT is connected.
-/// If network is not ready, logs a message and disconnects.
+/// Queue a telemetry message for the publish topic. Messages are published (in order) as the
+/// QoS1 in-flight window and the MQTT-C send buffer allow, and are kept queued while disconnected.
+/// All the messages queued during one event loop turn are sent with a single mqtt_sync.
 /// </summary>
 /// <param name="data">Telemetry message to send</param>
 /// <param name="data_length">Length of message to send</param>
 /// <param name="topic">Topic to publish the message on</param>
-void SendTelemetry(const void *data, size_t data_length, const char *topic);
+/// <returns>MQTT_PQ_QUEUED, MQTT_PQ_QUEUED_HIGH_WATER if the caller should slow down, or a negative
+/// MQTT_PQ_DROPPED_* value if the message was dropped</returns>
+MQTT_PQ_RESULT SendTelemetry(const void *data, size_t data_length, const char *topic);
+
+/// <summary>
+/// Publish a QoS 0 telemetry message made of fragments (i.e. a header and a large payload buffer)
+/// without copying it to the MQTT-C send buffer: wolfSSL encrypts the fragments straight from the
+/// caller's memory, so the message can be larger than SEND_BUFFER_SIZE. Only one such message can be
+/// pending, and it isn't ordered with messages queued by SendTelemetry (QoS 1).
+/// </summary>
+/// <param name="fragments">Message fragments, sent in order. The fragment data must stay valid until
+/// 'complete' is called</param>
+/// <param name="fragmentCount">Number of fragments, up to MQTT_SG_MAX_FRAGMENTS</param>
+/// <param name="topic">Topic to publish the message on</param>
+/// <param name="complete">Called once the whole packet was written (MQTT_SG_OK), or the connection
+/// failed (MQTT_SG_ABORTED)</param>
+/// <param name="context">Passed to 'complete'</param>
+/// <returns>MQTT_SG_OK if accepted, MQTT_SG_BUSY if the previous message is still pending, or another
+/// negative MQTT_SG_RESULT if the message was rejected</returns>
+MQTT_SG_RESULT SendTelemetryFragments(const MQTT_SG_FRAGMENT *fragments, size_t fragmentCount,
+                                      const char *topic, MQTT_SG_CALLBACK complete, void *context);
+
+/// <summary>
+/// Log the publish queue counters (drops, queueing delay, in-flight window usage) and the
+/// scatter-gather publish counters.
+/// </summary>
+/// <param name=""></param>
+void LogPublishQueueStats(void);
+
+/// <summary>
+/// Log the connection counters: attempts and failures, TLS handshake times (full or resumed)
+/// and the time taken to reconnect after the connection was lost.
+/// </summary>
+/// <param name=""></param>
+void LogConnectionStats(void);
 
 /// <summary>
 /// Disconnect the MQTT connection. Called when application is exiting, or if network is lost.
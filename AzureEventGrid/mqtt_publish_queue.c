@@ -0,0 +1,257 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "mqtt_publish_queue.h"
+
+// Messages are stored back to back in the queue buffer (a byte ring): header, topic (null terminated),
+// payload, padded to 4 bytes. A message never wraps: when it doesn't fit at the end of the buffer it is
+// stored at the start, and a header with size 0 marks the skipped space (if there is room for it).
+typedef struct {
+    uint32_t size;           // size of the record, including the header and padding
+    uint32_t enqueue_ms;
+    uint32_t data_length;
+    uint16_t topic_length;   // including the terminating null
+    uint16_t reserved;
+} queued_message_header;
+
+#define RECORD_ALIGN(x) (((x) + 3u) & ~(size_t)3u)
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/// <summary>
+///     Size of the PUBLISH packet MQTT-C builds in its send buffer for this message.
+/// </summary>
+static size_t packed_publish_size(size_t topic_length, size_t data_length, uint8_t publish_flags)
+{
+    size_t remaining = 2 + topic_length + data_length + ((publish_flags & MQTT_PUBLISH_QOS_MASK) ? 2 : 0);
+    size_t fixed_header = 2;
+    for (size_t r = remaining; r >= 128; r /= 128) {
+        fixed_header++;
+    }
+    return fixed_header + remaining;
+}
+
+/// <summary>
+///     Largest packet that fits in an empty MQTT-C send buffer (the queued message descriptors are
+///     stored at the end of the same buffer).
+/// </summary>
+static size_t max_packed_size(const MQTT_PUBLISH_QUEUE *pq)
+{
+    size_t capacity = (size_t)((uint8_t *)pq->client->mq.mem_end - (uint8_t *)pq->client->mq.mem_start);
+    return capacity > sizeof(struct mqtt_queued_message) ? capacity - sizeof(struct mqtt_queued_message) : 0;
+}
+
+static queued_message_header *oldest_message(MQTT_PUBLISH_QUEUE *pq)
+{
+    return (queued_message_header *)(pq->buf + pq->head);
+}
+
+static void remove_oldest_message(MQTT_PUBLISH_QUEUE *pq)
+{
+    queued_message_header *hdr = oldest_message(pq);
+    pq->head += hdr->size;
+    pq->used -= hdr->size;
+    pq->count--;
+
+    if (pq->count == 0) {
+        pq->head = pq->tail = pq->used = 0;
+        return;
+    }
+
+    // skip the space at the end of the buffer if the next message was stored at the start.
+    if (pq->head == pq->bufsz || oldest_message(pq)->size == 0) {
+        pq->used -= pq->bufsz - pq->head;
+        pq->head = 0;
+    }
+}
+
+void mqtt_pq_init(MQTT_PUBLISH_QUEUE *pq, struct mqtt_client *client, uint8_t *buf, size_t bufsz,
+                  uint8_t publish_flags, size_t max_inflight)
+{
+    memset(pq, 0, sizeof(*pq));
+    pq->client = client;
+    pq->buf = buf;
+    pq->bufsz = bufsz & ~(size_t)3u;
+    pq->high_water = pq->bufsz / 4 * 3;
+    pq->publish_flags = publish_flags;
+    pq->max_inflight = max_inflight > 0 ? max_inflight : 1;
+}
+
+MQTT_PQ_RESULT mqtt_pq_enqueue(MQTT_PUBLISH_QUEUE *pq, const char *topic, const void *data, size_t data_length)
+{
+    if (topic == NULL || topic[0] == '\0') {
+        return MQTT_PQ_DROPPED_INVALID;
+    }
+
+    size_t topic_length = strlen(topic) + 1;
+    size_t size = RECORD_ALIGN(sizeof(queued_message_header) + topic_length + data_length);
+
+    // the MQTT-C send buffer is only known once the client is initialized (mqtt_reinit).
+    if (size > pq->bufsz || topic_length > UINT16_MAX ||
+        (pq->client->mq.mem_start != NULL &&
+         packed_publish_size(topic_length - 1, data_length, pq->publish_flags) > max_packed_size(pq))) {
+        pq->stats.dropped_too_large++;
+        return MQTT_PQ_DROPPED_TOO_LARGE;
+    }
+
+    size_t offset;
+    if (pq->used + size > pq->bufsz) {
+        offset = pq->bufsz;
+    } else if (pq->tail >= pq->head) {
+        size_t end_space = pq->bufsz - pq->tail;
+        if (size <= end_space) {
+            offset = pq->tail;
+        } else if (size <= pq->head) {
+            // store the message at the start of the buffer, and mark the space skipped at the end.
+            if (end_space >= sizeof(uint32_t)) {
+                ((queued_message_header *)(pq->buf + pq->tail))->size = 0;
+            }
+            pq->used += end_space;
+            offset = 0;
+        } else {
+            offset = pq->bufsz;
+        }
+    } else {
+        offset = size <= pq->head - pq->tail ? pq->tail : pq->bufsz;
+    }
+
+    if (offset == pq->bufsz) {
+        pq->stats.dropped_full++;
+        return MQTT_PQ_DROPPED_FULL;
+    }
+
+    queued_message_header *hdr = (queued_message_header *)(pq->buf + offset);
+    hdr->size = (uint32_t)size;
+    hdr->enqueue_ms = now_ms();
+    hdr->data_length = (uint32_t)data_length;
+    hdr->topic_length = (uint16_t)topic_length;
+    hdr->reserved = 0;
+    memcpy(pq->buf + offset + sizeof(queued_message_header), topic, topic_length);
+    memcpy(pq->buf + offset + sizeof(queued_message_header) + topic_length, data, data_length);
+
+    pq->tail = offset + size;
+    pq->used += size;
+    pq->count++;
+
+    pq->stats.enqueued++;
+    if (pq->count > pq->stats.max_depth) {
+        pq->stats.max_depth = (uint32_t)pq->count;
+    }
+
+    if (pq->used > pq->high_water) {
+        pq->stats.high_water_events++;
+        return MQTT_PQ_QUEUED_HIGH_WATER;
+    }
+    return MQTT_PQ_QUEUED;
+}
+
+size_t mqtt_pq_flush(MQTT_PUBLISH_QUEUE *pq)
+{
+    size_t published = 0;
+
+    if (pq->client->error != MQTT_OK) {
+        mqtt_sync(pq->client);
+        pq->stats.syncs++;
+        return 0;
+    }
+
+    mqtt_mq_clean(&pq->client->mq);
+    size_t inflight = mqtt_pq_inflight(pq);
+
+    while (pq->count > 0) {
+        if (inflight >= pq->max_inflight) {
+            pq->stats.window_stalls++;
+            break;
+        }
+
+        queued_message_header *hdr = oldest_message(pq);
+        const char *topic = (const char *)hdr + sizeof(queued_message_header);
+        const uint8_t *data = (const uint8_t *)topic + hdr->topic_length;
+
+        size_t packed_size = packed_publish_size(hdr->topic_length - 1u, hdr->data_length, pq->publish_flags);
+        if (packed_size > max_packed_size(pq)) {
+            // queued before the client was initialized, and doesn't fit its send buffer.
+            remove_oldest_message(pq);
+            pq->stats.dropped_too_large++;
+            continue;
+        }
+
+        // mqtt_publish puts the client in an error state if the packet doesn't fit, so check first.
+        if (pq->client->mq.curr_sz < packed_size) {
+            pq->stats.buffer_stalls++;
+            break;
+        }
+
+        if (mqtt_publish(pq->client, topic, data, hdr->data_length, pq->publish_flags) != MQTT_OK) {
+            break;
+        }
+
+        uint32_t delay = now_ms() - hdr->enqueue_ms;
+        pq->stats.total_delay_ms += delay;
+        if (delay > pq->stats.max_delay_ms) {
+            pq->stats.max_delay_ms = delay;
+        }
+
+        remove_oldest_message(pq);
+        pq->stats.published++;
+        published++;
+        inflight++;
+    }
+
+    if (inflight > pq->stats.max_inflight) {
+        pq->stats.max_inflight = (uint32_t)inflight;
+    }
+
+    mqtt_sync(pq->client);
+    pq->stats.syncs++;
+
+    return published;
+}
+
+bool mqtt_pq_can_publish(const MQTT_PUBLISH_QUEUE *pq)
+{
+    return pq->count > 0 && pq->client->error == MQTT_OK && mqtt_pq_inflight(pq) < pq->max_inflight;
+}
+
+size_t mqtt_pq_depth(const MQTT_PUBLISH_QUEUE *pq)
+{
+    return pq->count;
+}
+
+size_t mqtt_pq_inflight(const MQTT_PUBLISH_QUEUE *pq)
+{
+    size_t inflight = 0;
+    struct mqtt_message_queue *mq = &pq->client->mq;
+
+    for (ssize_t i = 0; i < mqtt_mq_length(mq); i++) {
+        struct mqtt_queued_message *msg = mqtt_mq_get(mq, i);
+        if (msg->control_type == MQTT_CONTROL_PUBLISH && msg->state != MQTT_QUEUED_COMPLETE) {
+            inflight++;
+        }
+    }
+
+    return inflight;
+}
+
+void mqtt_pq_log_stats(const MQTT_PUBLISH_QUEUE *pq)
+{
+    const MQTT_PQ_STATS *s = &pq->stats;
+
+    Log_Debug("Publish queue: depth %u (max %u), in-flight %u (max %u, window %u)\n", (unsigned)pq->count,
+              s->max_depth, (unsigned)mqtt_pq_inflight(pq), s->max_inflight, (unsigned)pq->max_inflight);
+    Log_Debug("  enqueued %u, published %u, dropped %u (full) %u (too large), high-water %u\n", s->enqueued,
+              s->published, s->dropped_full, s->dropped_too_large, s->high_water_events);
+    Log_Debug("  queueing delay mean %u ms, max %u ms; stalls: window %u, send buffer %u; syncs %u\n",
+              s->published ? (unsigned)(s->total_delay_ms / s->published) : 0u, s->max_delay_ms,
+              s->window_stalls, s->buffer_stalls, s->syncs);
+}
@@ -0,0 +1,132 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt.h"
+
+// Zero-copy (scatter-gather) PUBLISH for MQTT-C.
+//
+// mqtt_publish packs the whole packet (topic and payload) into the MQTT-C send buffer, and wolfSSL
+// then encrypts it into its own output buffer: the send buffer must be larger than the largest
+// message, and the payload is copied twice. A scatter-gather publish only builds the fixed header
+// and topic (in a small buffer in MQTT_SG_PUBLISHER), then writes the payload fragments straight from
+// the caller's memory to the socket (wolfSSL_write with MQTT_USE_WOLFSSL), so the size of a message
+// isn't limited by the MQTT-C send buffer.
+//
+// Limitations:
+//  - QoS 0 only: MQTT-C keeps QoS 1/2 packets in its send buffer until they are acknowledged (to
+//    resend them), which is the copy this avoids. Use mqtt_publish (or the publish queue) for QoS 1.
+//  - One scatter-gather publish at a time. The fragments must stay valid (and unchanged) until the
+//    completion callback is called.
+//  - MQTT-C must not write to the socket while the packet is part way through: call mqtt_sg_sync
+//    instead of mqtt_sync while mqtt_sg_pending returns true. Received packets are only processed
+//    once the packet is complete, so while mqtt_sg_writing returns true only wait for the socket to
+//    be writable. Packets MQTT-C has queued are sent before the stream starts.
+//  - Not ordered with messages published with mqtt_publish after it was accepted.
+//
+// All functions must be called from the event loop thread.
+
+#define MQTT_SG_MAX_FRAGMENTS 8
+
+// Fixed header (up to 5 bytes), topic length (2 bytes) and the topic if it fits. A longer topic is
+// written from the caller's string, as an extra fragment.
+#define MQTT_SG_HEADER_SIZE 128
+
+typedef struct {
+    const void *data;
+    size_t length;
+} MQTT_SG_FRAGMENT;
+
+typedef enum {
+    MQTT_SG_OK = 0,                 // publish accepted / packet written (completion callback)
+    MQTT_SG_BUSY = -1,              // a scatter-gather publish is already pending, try again later
+    MQTT_SG_INVALID = -2,           // null or empty topic, too many fragments, too large, or QoS > 0
+    MQTT_SG_NOT_CONNECTED = -3,     // the client is in an error state (i.e. reconnecting)
+    MQTT_SG_ABORTED = -4            // completion callback: the connection failed before the whole
+                                    // packet was written, the client reconnects
+} MQTT_SG_RESULT;
+
+/// <summary>
+///     Called once for every accepted publish, with MQTT_SG_OK when the whole packet was written to
+///     the socket, or MQTT_SG_ABORTED. The fragments can be reused from this point.
+/// </summary>
+typedef void (*MQTT_SG_CALLBACK)(void *context, MQTT_SG_RESULT result);
+
+typedef enum {
+    MQTT_SG_IDLE,
+    MQTT_SG_WAITING,    // accepted, waiting for MQTT-C to send the packets it has queued
+    MQTT_SG_SENDING     // part of the packet written
+} MQTT_SG_STATE;
+
+typedef struct {
+    uint32_t published;       // packets written completely
+    uint32_t aborted;
+    uint32_t busy;            // publishes rejected with MQTT_SG_BUSY
+    uint32_t would_block;     // writes stopped by a full socket (or TLS) buffer
+    uint64_t bytes;           // bytes written, including the headers
+} MQTT_SG_STATS;
+
+typedef struct {
+    struct mqtt_client *client;
+    MQTT_SG_STATE state;
+    uint8_t header[MQTT_SG_HEADER_SIZE];
+    MQTT_SG_FRAGMENT parts[MQTT_SG_MAX_FRAGMENTS + 2];    // header, long topic, payload fragments
+    size_t part_count;
+    size_t part_index;        // part being written
+    size_t part_offset;       // bytes of the part already written
+    MQTT_SG_CALLBACK complete;
+    void *context;
+    MQTT_SG_STATS stats;
+} MQTT_SG_PUBLISHER;
+
+/// <summary>
+///     Initializes a scatter-gather publisher for 'client'.
+/// </summary>
+void mqtt_sg_init(MQTT_SG_PUBLISHER *sg, struct mqtt_client *client);
+
+/// <summary>
+///     Accepts a QoS 0 PUBLISH of the concatenation of 'fragments' on 'topic'. Nothing is written until
+///     the next mqtt_sg_sync. 'publish_flags' may only contain MQTT_PUBLISH_RETAIN. The fragment list
+///     (and the topic, if it's longer than the header buffer) is copied, the fragment data isn't.
+///     Returns MQTT_SG_OK if accepted ('complete' is then called once, from mqtt_sg_sync or
+///     mqtt_sg_abort), or a negative MQTT_SG_RESULT if the publish was rejected.
+/// </summary>
+MQTT_SG_RESULT mqtt_sg_publish(MQTT_SG_PUBLISHER *sg, const char *topic, const MQTT_SG_FRAGMENT *fragments,
+                               size_t fragment_count, uint8_t publish_flags, MQTT_SG_CALLBACK complete,
+                               void *context);
+
+/// <summary>
+///     Use instead of mqtt_sync. With a publish pending, writes as much of it as the socket takes once
+///     MQTT-C has sent the packets it queued before; while the packet is incomplete nothing else is
+///     sent or received (mqtt_sync is called again once it is complete). Otherwise calls mqtt_sync.
+///     Returns the client error (MQTT_OK if none).
+/// </summary>
+enum MQTTErrors mqtt_sg_sync(MQTT_SG_PUBLISHER *sg);
+
+/// <summary>
+///     Returns true while a publish is accepted and not complete: MQTT-C must not write to the socket
+///     (call mqtt_sg_sync, not mqtt_sync), and mqtt_sg_sync should be called when the socket is writable.
+/// </summary>
+bool mqtt_sg_pending(const MQTT_SG_PUBLISHER *sg);
+
+/// <summary>
+///     Returns true while part of the packet is written: mqtt_sg_sync doesn't receive until the rest
+///     is, so the socket should only be watched for output.
+/// </summary>
+bool mqtt_sg_writing(const MQTT_SG_PUBLISHER *sg);
+
+/// <summary>
+///     Drops the pending publish, if any (i.e. when the connection is closed), calling its completion
+///     callback with MQTT_SG_ABORTED.
+/// </summary>
+void mqtt_sg_abort(MQTT_SG_PUBLISHER *sg);
+
+/// <summary>
+///     Logs the publisher counters.
+/// </summary>
+void mqtt_sg_log_stats(const MQTT_SG_PUBLISHER *sg);
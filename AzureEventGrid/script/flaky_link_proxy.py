@@ -0,0 +1,95 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+#!/usr/bin/env python3
+# encoding: utf-8
+#
+# TCP proxy emulating an unreliable link between the device and an MQTT broker (i.e. a local
+# mosquitto listening with TLS on 8883), to measure how long the app takes to reconnect.
+# Every connection is closed after --drop-after seconds (0 = never), --latency-ms is added to each
+# direction, and --outage seconds of refused connections follow every drop.
+# The TLS session is end to end (the proxy only forwards bytes), so resumption can be observed
+# in the device log ("TLS handshake ... ms (resumed)").
+#
+# Usage: python3 flaky_link_proxy.py --target host:8883 [--port 8883] [--drop-after 30]
+#                                    [--outage 0] [--latency-ms 0]
+
+import argparse
+import asyncio
+import time
+
+
+class Link:
+    def __init__(self, args):
+        self.args = args
+        self.down_until = 0.0
+
+    async def pipe(self, reader, writer):
+        try:
+            while True:
+                data = await reader.read(16384)
+                if not data:
+                    break
+                if self.args.latency_ms > 0:
+                    await asyncio.sleep(self.args.latency_ms / 1000.0)
+                writer.write(data)
+                await writer.drain()
+        except (ConnectionError, asyncio.CancelledError):
+            pass
+        finally:
+            writer.close()
+
+    async def on_client(self, client_reader, client_writer):
+        peer = client_writer.get_extra_info("peername")
+        if time.monotonic() < self.down_until:
+            print("%s: refused (link down)" % (peer,), flush=True)
+            client_writer.close()
+            return
+
+        host, port = self.args.target.rsplit(":", 1)
+        try:
+            server_reader, server_writer = await asyncio.open_connection(host, int(port))
+        except OSError as e:
+            print("%s: cannot reach %s: %s" % (peer, self.args.target, e), flush=True)
+            client_writer.close()
+            return
+
+        start = time.monotonic()
+        print("%s: connected" % (peer,), flush=True)
+        tasks = [asyncio.ensure_future(self.pipe(client_reader, server_writer)),
+                 asyncio.ensure_future(self.pipe(server_reader, client_writer))]
+        timeout = self.args.drop_after if self.args.drop_after > 0 else None
+        done, pending = await asyncio.wait(tasks, timeout=timeout, return_when=asyncio.FIRST_COMPLETED)
+
+        if not done:
+            # Drop the link: the device sees a socket error, and the next attempts fail during the outage.
+            self.down_until = time.monotonic() + self.args.outage
+            print("%s: dropped after %.1fs" % (peer, time.monotonic() - start), flush=True)
+        for task in pending:
+            task.cancel()
+        client_writer.close()
+        server_writer.close()
+
+
+async def main():
+    parser = argparse.ArgumentParser(description="Unreliable TCP link between the device and a broker.")
+    parser.add_argument("--target", required=True, help="broker host:port")
+    parser.add_argument("--port", type=int, default=8883)
+    parser.add_argument("--drop-after", type=float, default=30, help="close each connection after this (s)")
+    parser.add_argument("--outage", type=float, default=0, help="refuse connections for this long after a drop (s)")
+    parser.add_argument("--latency-ms", type=float, default=0, help="added to each direction")
+    args = parser.parse_args()
+
+    link = Link(args)
+    server = await asyncio.start_server(link.on_client, "0.0.0.0", args.port)
+    print("Forwarding 0.0.0.0:%d to %s (drop after %gs, outage %gs, latency %g ms)" %
+          (args.port, args.target, args.drop_after, args.outage, args.latency_ms), flush=True)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
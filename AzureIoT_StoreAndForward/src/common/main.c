@@ -32,8 +32,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
@@ -45,8 +47,10 @@
 #include "user_interface.h"
 #include "exitcodes.h"
 #include "cloud.h"
+#include "azure_iot.h"
 #include "options.h"
 #include "connection.h"
+#include "store_and_forward.h"
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
@@ -93,6 +97,34 @@ typedef struct
 
 FileData fileData;
 
+// Store and forward drain, see DrainStoredTelemetry.
+#define DRAIN_BATCH_MIN             1
+#define DRAIN_BATCH_MAX             64      // max items packed into one message
+#define DRAIN_MAX_MESSAGES          4       // max messages waiting for the IoT Hub confirmation
+#define DRAIN_READ_CHUNK            16      // max items read from storage per FS_ReadFilesForIndex call
+#define DRAIN_TIME_BUDGET_MS        400     // max time spent draining per (1 second) tick
+#define DRAIN_FAST_CONFIRMATION_MS  2000    // the batch grows while messages are confirmed within this time
+#define DRAIN_CONFIRMATION_TIMEOUT_MS 120000 // a message not confirmed by then is sent again
+#define DRAIN_MAX_BACKOFF_TICKS     32
+#define DRAIN_ITEM_JSON_SIZE        64      // {"temperature":-1234.56,"timestamp":"2024-01-01T00:00:00Z"},
+
+typedef struct
+{
+    uint32_t id;                // context passed to AzureIoT_SendTelemetry
+    size_t count;               // stored items packed into the message
+    bool confirmed;
+    struct timespec sentAt;
+} DrainMessage;
+
+// Messages waiting for their confirmation, oldest first. Together they hold the oldest stored items, in order.
+static DrainMessage drainMessages[DRAIN_MAX_MESSAGES];
+static size_t drainMessageCount = 0;
+static uint32_t drainNextMessageId = 1;
+
+static size_t drainBatchSize = DRAIN_BATCH_MIN;
+static unsigned int drainBackoffTicks = 0;
+static unsigned int drainSkipTicks = 0;
+
 static int ReadBlock(uint32_t block, uint8_t* buffer, size_t size);
 static int WriteBlock(uint32_t block, uint8_t* buffer, size_t size);
 
@@ -246,6 +278,247 @@ static void ConnectionChangedCallbackHandler(bool connected)
     }
 }
 
+/// <summary>
+///     Milliseconds elapsed since 'start' (CLOCK_MONOTONIC).
+/// </summary>
+static long ElapsedMs(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/// <summary>
+///     Halves the batch size and skips an exponentially growing number of ticks.
+/// </summary>
+static void DrainBackOff(void)
+{
+    drainBatchSize = drainBatchSize / 2 > DRAIN_BATCH_MIN ? drainBatchSize / 2 : DRAIN_BATCH_MIN;
+    drainBackoffTicks = drainBackoffTicks == 0 ? 1 : (drainBackoffTicks * 2 > DRAIN_MAX_BACKOFF_TICKS ? DRAIN_MAX_BACKOFF_TICKS : drainBackoffTicks * 2);
+    drainSkipTicks = drainBackoffTicks;
+}
+
+/// <summary>
+///     Forgets the messages waiting for their confirmation. Their items stay in storage and are sent
+///     again from the oldest one, confirmations arriving later for these messages are ignored.
+/// </summary>
+static void DrainAbandonMessages(void)
+{
+    drainMessageCount = 0;
+}
+
+void StoreAndForward_TelemetrySentCallback(bool success, void *context)
+{
+    uint32_t id = (uint32_t)(uintptr_t)context;
+    size_t index = 0;
+
+    while (index < drainMessageCount && drainMessages[index].id != id)
+    {
+        index++;
+    }
+
+    if (id == 0 || index == drainMessageCount)
+    {
+        // live telemetry, or a message that has been abandoned
+        return;
+    }
+
+    if (!success)
+    {
+        Log_Debug("WARNING: Stored telemetry was not delivered, it will be sent again\n");
+        // the messages after this one may still be delivered, and be sent twice: the items are only
+        // deleted oldest first, so sending again from the oldest item is the only way to not lose any.
+        DrainAbandonMessages();
+        DrainBackOff();
+        return;
+    }
+
+    DrainMessage *message = &drainMessages[index];
+    message->confirmed = true;
+    drainBackoffTicks = 0;
+
+    if (ElapsedMs(&message->sentAt) < DRAIN_FAST_CONFIRMATION_MS)
+    {
+        if (message->count == drainBatchSize && drainBatchSize < DRAIN_BATCH_MAX)
+        {
+            drainBatchSize = drainBatchSize * 2 < DRAIN_BATCH_MAX ? drainBatchSize * 2 : DRAIN_BATCH_MAX;
+        }
+    }
+    else
+    {
+        drainBatchSize = drainBatchSize / 2 > DRAIN_BATCH_MIN ? drainBatchSize / 2 : DRAIN_BATCH_MIN;
+    }
+
+    // the items are deleted oldest first, so a message is deleted once the messages before it are confirmed too.
+    size_t confirmed = 0;
+    size_t deleteCount = 0;
+    while (confirmed < drainMessageCount && drainMessages[confirmed].confirmed)
+    {
+        deleteCount += drainMessages[confirmed].count;
+        confirmed++;
+    }
+
+    if (deleteCount == 0)
+    {
+        return;
+    }
+
+    if (FS_DeleteOldestFilesInDirectory("data", deleteCount) != 0)
+    {
+        Log_Debug("WARNING: Could not delete uploaded telemetry from storage\n");
+        // the messages still waiting no longer line up with the stored items.
+        DrainAbandonMessages();
+        return;
+    }
+
+    memmove(drainMessages, drainMessages + confirmed, (drainMessageCount - confirmed) * sizeof(DrainMessage));
+    drainMessageCount -= confirmed;
+
+    Log_Debug("%u stored telemetry items delivered, next batch %u\n", (unsigned)deleteCount, (unsigned)drainBatchSize);
+}
+
+/// <summary>
+///     Packs up to 'count' stored items, starting at 'first', into a JSON array in 'json'.
+///     Returns the number of items packed, 0 when nothing could be read.
+/// </summary>
+static size_t DrainPackMessage(size_t first, size_t count, char *json, size_t jsonSize, time_t *oldest)
+{
+    static FileData records[DRAIN_READ_CHUNK];
+    size_t length = 0;
+    size_t packed = 0;
+
+    json[length++] = '[';
+
+    while (packed < count)
+    {
+        size_t chunk = count - packed < DRAIN_READ_CHUNK ? count - packed : DRAIN_READ_CHUNK;
+        int numRead = FS_ReadFilesForIndex("data", first + packed, chunk, (uint8_t*)records, sizeof(FileData), NULL);
+        if (numRead <= 0)
+        {
+            Log_Debug("WARNING: Could not read stored telemetry\n");
+            break;
+        }
+
+        if (packed == 0)
+        {
+            *oldest = records[0].timestamp;
+        }
+
+        for (int x = 0; x < numRead; x++)
+        {
+            char timestamp[32];
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&records[x].timestamp));
+
+            // leave room for the closing bracket
+            int n = snprintf(json + length, jsonSize - length - 1, "%s{\"temperature\":%.2f,\"timestamp\":\"%s\"}",
+                packed == 0 ? "" : ",", records[x].temperature, timestamp);
+            if (n < 0 || (size_t)n >= jsonSize - length - 1)
+            {
+                json[length] = '\0';
+                count = packed;
+                break;
+            }
+            length += (size_t)n;
+            packed++;
+        }
+    }
+
+    json[length++] = ']';
+    json[length] = '\0';
+
+    return packed;
+}
+
+/// <summary>
+///     Sends stored telemetry items, oldest first, as JSON arrays of up to drainBatchSize items per
+///     message, with at most DRAIN_MAX_MESSAGES messages waiting for their confirmation. Items are read
+///     from storage DRAIN_READ_CHUNK at a time (one remote disk request per FS_MAX_READ_SIZE bytes), and
+///     they are only deleted by StoreAndForward_TelemetrySentCallback, once the IoT Hub confirmed the
+///     delivery of their message: a connection lost after the IoT Hub client accepted a message doesn't
+///     lose its items. The batch size adapts to the link: it grows while messages are confirmed within
+///     DRAIN_FAST_CONFIRMATION_MS, shrinks when they are slower, and is halved (with an exponential
+///     back-off of the following ticks) when a message fails.
+/// </summary>
+static void DrainStoredTelemetry(int numFiles)
+{
+    static char json[2 + DRAIN_BATCH_MAX * DRAIN_ITEM_JSON_SIZE];
+
+    if (drainSkipTicks > 0)
+    {
+        drainSkipTicks--;
+        return;
+    }
+
+    if (drainMessageCount > 0 && ElapsedMs(&drainMessages[0].sentAt) >= DRAIN_CONFIRMATION_TIMEOUT_MS)
+    {
+        Log_Debug("WARNING: Stored telemetry was not confirmed, it will be sent again\n");
+        DrainAbandonMessages();
+        DrainBackOff();
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // the items already in a message waiting for its confirmation
+    size_t waiting = 0;
+    for (size_t i = 0; i < drainMessageCount; i++)
+    {
+        waiting += drainMessages[i].count;
+    }
+
+    size_t sent = 0;
+    unsigned int messages = 0;
+    time_t oldest = 0;
+
+    while (drainMessageCount < DRAIN_MAX_MESSAGES && waiting < (size_t)numFiles && ElapsedMs(&start) < DRAIN_TIME_BUDGET_MS)
+    {
+        size_t count = drainBatchSize < (size_t)numFiles - waiting ? drainBatchSize : (size_t)numFiles - waiting;
+        time_t first = 0;
+        size_t packed = DrainPackMessage(waiting, count, json, sizeof(json), &first);
+        if (packed == 0)
+        {
+            break;
+        }
+
+        uint32_t id = drainNextMessageId++;
+        if (drainNextMessageId == 0)
+        {
+            drainNextMessageId = 1;
+        }
+
+        AzureIoT_Result result = AzureIoT_SendTelemetry(json, NULL, (void *)(uintptr_t)id);
+        if (result != AzureIoT_Result_OK)
+        {
+            Log_Debug("WARNING: Could not send stored telemetry to cloud: %d\n", result);
+            DrainBackOff();
+            break;
+        }
+
+        DrainMessage *message = &drainMessages[drainMessageCount++];
+        message->id = id;
+        message->count = packed;
+        message->confirmed = false;
+        clock_gettime(CLOCK_MONOTONIC, &message->sentAt);
+
+        if (messages == 0)
+        {
+            oldest = first;
+        }
+        waiting += packed;
+        sent += packed;
+        messages++;
+    }
+
+    if (sent > 0)
+    {
+        struct tm* t = gmtime(&oldest);
+        Log_Debug("(%d telemetry items in storage) sent %u in %u message%sfrom %04d/%02d/%02d - %02d:%02d:%02d in %ld ms, %u waiting for confirmation\n",
+            numFiles, (unsigned)sent, messages, messages == 1 ? " " : "s ", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+            t->tm_hour, t->tm_min, t->tm_sec, ElapsedMs(&start), (unsigned)waiting);
+    }
+}
+
 static void TelemetryTimerCallbackHandler(EventLoopTimer *timer)
 {
     static Cloud_Telemetry telemetry = {.temperature = 50.f};
@@ -255,78 +528,66 @@ static void TelemetryTimerCallbackHandler(EventLoopTimer *timer)
         return;
     }
 
+    if (!isConnected) {
+        // the batch size is re-learned on the next connection. Messages waiting for their confirmation are
+        // kept: the IoT Hub client delivers them after it reconnects, or reports them as failed.
+        drainBatchSize = DRAIN_BATCH_MIN;
+        return;
+    }
+
     time_t now;
     time(&now);
     struct tm* t = gmtime(&now);
     int numFiles = 0;
 
-    if (isConnected) {
-        if (t->tm_sec % 5 == 0)
-        {
-            // Generate a simulated temperature.
-            float delta = ((float)(rand() % 41)) / 20.0f - 1.0f; // between -1.0 and +1.0
-            telemetry.temperature += delta;
-
-            numFiles = FS_GetNumberOfFilesInDirectory("data");
-
-            // if we can upload, and there aren't any files in storage, then upload the data
-            if (telemetryUploadEnabled && numFiles == 0)
-            {
-                Cloud_Result result = Cloud_SendTelemetry(&telemetry, now);
-                if (result != Cloud_Result_OK) {
-                    Log_Debug("WARNING: Could not send thermometer telemetry to cloud: %s\n",
-                        CloudResultToString(result));
-                }
-            }
-            else
-            {
-                // if upload isn't enabled, or there are still files in storage, then store the data (data order is preserved)
+    if (t->tm_sec % 5 == 0)
+    {
+        // Generate a simulated temperature.
+        float delta = ((float)(rand() % 41)) / 20.0f - 1.0f; // between -1.0 and +1.0
+        telemetry.temperature += delta;
 
-                fileData.temperature = telemetry.temperature;
-                fileData.timestamp = now;
+        numFiles = FS_GetNumberOfFilesInDirectory("data");
 
-                // write temperature and time of iso8601 time format event data/time
-                assert(FS_WriteFile("data", "temperature.txt", (uint8_t*)&fileData, sizeof(fileData)) == 0);
-                numFiles = FS_GetNumberOfFilesInDirectory("data");
-                Log_Debug("%d telemetry item%sstored\n", numFiles, numFiles == 1 ? " " : "s ");
-            }
-        }
-        else
+        // if we can upload, and there aren't any files in storage, then upload the data
+        if (telemetryUploadEnabled && numFiles == 0)
         {
-            if (!telemetryUploadEnabled)
-            {
-                return;
+            Cloud_Result result = Cloud_SendTelemetry(&telemetry, now);
+            if (result != Cloud_Result_OK) {
+                Log_Debug("WARNING: Could not send thermometer telemetry to cloud: %s\n",
+                    CloudResultToString(result));
             }
-            // See if there's anything in storage that we need to upload.
-            // Note that this is happening every second (skipping seconds % 5 == 0).
-            numFiles = FS_GetNumberOfFilesInDirectory("data");
-            if (numFiles == 0)
-            {
-                // nothing to upload, bail...
-                return;
-            }
-
-            struct fileEntry fileInfo;
-            FS_GetOldestFileInfo("data", &fileInfo);
-            uint8_t* data = (uint8_t*)malloc(fileInfo.fileSize);
-            memset(data, 0x00, fileInfo.fileSize);
-            FS_ReadOldestFile("data", data, fileInfo.fileSize);
+            return;
+        }
 
-            FileData* fData = (FileData*)data;
+        // if upload isn't enabled, or there are still files in storage, then store the data (data order is preserved)
 
-            // Send the telemetry
-            telemetry.temperature = fData->temperature;
-            // get the date/time.
-            t = gmtime(&(fData->timestamp));
-            Log_Debug("(%d telemetry items in storage) upload: %04d/%02d/%02d - %02d:%02d:%02d - %3.2f\n",numFiles,t->tm_year+1900,t->tm_mon+1,t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, fData->temperature);
-            Cloud_Result result = Cloud_SendTelemetry(&telemetry, fData->timestamp);
+        fileData.temperature = telemetry.temperature;
+        fileData.timestamp = now;
 
-            // if upload was ok, delete the oldest file.
-            if (result == Cloud_Result_OK) {
-                FS_DeleteOldestFileInDirectory("data");
-            }
-            free(data);
+        // write temperature and time of iso8601 time format event data/time
+        assert(FS_WriteFile("data", "temperature.txt", (uint8_t*)&fileData, sizeof(fileData)) == 0);
+        int storedFiles = numFiles;
+        numFiles = FS_GetNumberOfFilesInDirectory("data");
+        if (numFiles <= storedFiles)
+        {
+            // storage is full and the oldest item was overwritten, the messages waiting for their
+            // confirmation no longer line up with the stored items.
+            DrainAbandonMessages();
         }
+        Log_Debug("%d telemetry item%sstored\n", numFiles, numFiles == 1 ? " " : "s ");
+    }
+
+    if (!telemetryUploadEnabled)
+    {
+        return;
+    }
+
+    // See if there's anything in storage that we need to upload (this is happening every second).
+    // FS_GetNumberOfFilesInDirectory is cheap, it's computed from the directory head/tail in the cached root block.
+    numFiles = FS_GetNumberOfFilesInDirectory("data");
+    if (numFiles > 0)
+    {
+        DrainStoredTelemetry(numFiles);
     }
 }
 
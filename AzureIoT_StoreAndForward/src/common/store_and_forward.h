@@ -0,0 +1,16 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+/// <summary>
+/// Confirmation of a telemetry message sent with AzureIoT_SendTelemetry. The cloud layer
+/// (common/cloud.c) must call this from the sendTelemetryCallbackFunction of the AzureIoT_Callbacks
+/// it passes to AzureIoT_Initialize: stored telemetry is only deleted once its message is confirmed.
+/// Messages that aren't stored telemetry are ignored.
+/// </summary>
+/// <param name="success">true if the IoT Hub confirmed the delivery of the message</param>
+/// <param name="context">The context passed to AzureIoT_SendTelemetry</param>
+void StoreAndForward_TelemetrySentCallback(bool success, void *context);
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include "utils.h"
 #include <string.h>
+#include <time.h>
 
 #include "soc/mt3620_i2cs.h"
 #include "applibs/i2c.h"
@@ -17,11 +18,20 @@
 #define SSD1306_TALL_LCDWIDTH 128
 #define SSD1306_TALL_LCDHEIGHT 32
 
+// largest I2C write of display data tried; halved if the I2C driver rejects it.
+#define SSD1306_MAX_TRANSFER 1024
+
 static uint8_t displayBuffer[1024]; // 128*64 pixels (128/8)*64 bytes - also covers 32*128 (4x128) = 512
 
+// what the display currently shows, so that SSD1306_Display only sends the pages/columns that changed.
+static uint8_t sentBuffer[1024];
+static bool sentBufferValid = false;
+static size_t maxTransfer = SSD1306_MAX_TRANSFER;
+static SSD1306_RefreshStats lastRefresh;
+
 static void ssd1306_command(uint8_t c);
-static void ssd1306_commands(uint8_t* commands, int numCommands); 
-static void i2cSendBytes(uint8_t* data, size_t length);
+static bool ssd1306_commands(uint8_t* commands, int numCommands); 
+static bool i2cSendBytes(uint8_t* data, size_t length);
 static bool IsPixel(uint8_t* image, int width, int height, int x, int y);
 static void SSD1306_SetPixelInternal(int x, int y, bool turnOn);
 
@@ -47,6 +57,8 @@ bool SSD1306_Init(bool useVerticalDisplay)
         DisplayHeight = SSD1306_WIDE_LCDHEIGHT;
     }
 
+    sentBufferValid = false;
+
     if (_i2cfd > -1)
     {
         return true;
@@ -165,18 +177,64 @@ bool SSD1306_Init(bool useVerticalDisplay)
     return true;
 }
 
-static void ssd1306_commands(uint8_t* commands, int numCommands)
+static bool ssd1306_commands(uint8_t* commands, int numCommands)
 {
     // need to stick '0x00' on the front to make this a command.
     uint8_t* buffer = (uint8_t*)malloc(numCommands + 1);
+    if (buffer == NULL)
+    {
+        return false;
+    }
     memset(buffer, 0x00, numCommands + 1);
     memcpy(&buffer[1], commands, numCommands);
-    i2cSendBytes(buffer, numCommands+1);
+    bool ok = i2cSendBytes(buffer, numCommands+1);
     free(buffer);
+    return ok;
 }
 
 void SSD1306_DrawImage(uint8_t* image, int width, int height, int xOffset, int yOffset)
 {
+    // byte-aligned blit when the image rows land on whole display pages: each 8 rows of an image
+    // byte (one bit per column, MSB first) become 8 display bytes (one bit per row).
+    if (yOffset % 8 == 0 && width % 8 == 0 && height % 8 == 0)
+    {
+        int bytesPerLine = width / 8;
+        for (int row = 0; row < height; row += 8)
+        {
+            int page = (row + yOffset) / 8;
+            if (row + yOffset < 0 || page >= DisplayHeight / 8)
+            {
+                continue;
+            }
+
+            for (int xByte = 0; xByte < bytesPerLine; xByte++)
+            {
+                uint8_t block[8];
+                for (int r = 0; r < 8; r++)
+                {
+                    block[r] = image[(row + r) * bytesPerLine + xByte];
+                }
+
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    int x = xOffset + xByte * 8 + bit;
+                    if (x < 0 || x >= DisplayWidth)
+                    {
+                        continue;
+                    }
+
+                    uint8_t column = 0;
+                    for (int r = 0; r < 8; r++)
+                    {
+                        column |= ((block[r] >> (7 - bit)) & 1) << r;
+                    }
+                    displayBuffer[x + page * DisplayWidth] = column;
+                }
+            }
+        }
+        return;
+    }
+
     for (int y = 0; y < height; y++)
     {
         for (int x = 0; x < width; x++)
@@ -317,45 +375,147 @@ static void ssd1306_command(uint8_t c)
     i2cSendBytes(command, 2);
 }
 
-void SSD1306_Display(void)
+// send the display window (columns, pages) and its data, in as few I2C writes as allowed.
+static bool SendWindow(int firstColumn, int lastColumn, int firstPage, int lastPage)
 {
-    uint8_t pagecol[5] = { 0x22,0x00,0xff,0x21,0x00 };
-    ssd1306_commands(pagecol, 5);
-    ssd1306_command(0x7f);
+    uint8_t window[6] = { 0x21, (uint8_t)firstColumn, (uint8_t)lastColumn, 0x22, (uint8_t)firstPage, (uint8_t)lastPage };
+    if (!ssd1306_commands(window, 6))
+    {
+        return false;
+    }
+    lastRefresh.transfers++;
+
+    // horizontal addressing: the data fills the window column by column, then page by page.
+    static uint8_t dataBuffer[1 + sizeof(displayBuffer)];
+    size_t length = 0;
+
+    for (int page = firstPage; page <= lastPage; page++)
+    {
+        memcpy(&dataBuffer[1 + length], &displayBuffer[page * DisplayWidth + firstColumn], (size_t)(lastColumn - firstColumn + 1));
+        length += (size_t)(lastColumn - firstColumn + 1);
+    }
+
+    size_t sent = 0;
+    while (sent < length)
+    {
+        size_t chunk = length - sent < maxTransfer ? length - sent : maxTransfer;
+
+        // data control byte in front of the chunk (over data already sent).
+        dataBuffer[sent] = 0x40;
+        if (!i2cSendBytes(&dataBuffer[sent], chunk + 1))
+        {
+            if ((errno == EINVAL || errno == E2BIG || errno == ENOMEM) && maxTransfer > 16)
+            {
+                // too large for the I2C driver: retry in smaller pieces.
+                maxTransfer /= 2;
+                continue;
+            }
+            return false;
+        }
+        sent += chunk;
+        lastRefresh.transfers++;
+        lastRefresh.bytesSent += (unsigned int)chunk;
+    }
 
-    uint8_t dataBuffer[32];
-    dataBuffer[0x00] = 0x40;
-    int copyPos = 0;
-    int copyLen = 31;
-    bool haveData = true;
-    int totalSent = 0;
+    return true;
+}
 
-    int totalBytes = 1024;
+void SSD1306_Display(void)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&lastRefresh, 0, sizeof(lastRefresh));
 
-    //DumpDisplayBuffer(displayBuffer,DisplayWidth, DisplayHeight);
+    int pages = DisplayHeight / 8;
+    bool ok = true;
 
-    while (haveData)
+    // dirty rectangle: consecutive pages with changes are sent as one window, spanning the
+    // leftmost to rightmost changed column of those pages.
+    int page = 0;
+    while (page < pages && ok)
     {
-        memcpy(&dataBuffer[1], &displayBuffer[copyPos], copyLen);
-        totalSent += copyLen;
-        i2cSendBytes(dataBuffer, copyLen + 1);
-        copyPos += copyLen;
-        if (totalBytes - copyPos >= 31)
-            copyLen = 31;
+        int firstColumn = DisplayWidth;
+        int lastColumn = -1;
+        int firstPage = page;
+
+        while (page < pages)
+        {
+            const uint8_t* current = &displayBuffer[page * DisplayWidth];
+            const uint8_t* sent = &sentBuffer[page * DisplayWidth];
+            int first = 0;
+            int last = DisplayWidth - 1;
+            if (sentBufferValid)
+            {
+                while (first < DisplayWidth && current[first] == sent[first])
+                {
+                    first++;
+                }
+                while (last >= first && current[last] == sent[last])
+                {
+                    last--;
+                }
+            }
+            if (first > last)
+            {
+                break;  // page unchanged, ends the window.
+            }
+            if (first < firstColumn)
+            {
+                firstColumn = first;
+            }
+            if (last > lastColumn)
+            {
+                lastColumn = last;
+            }
+            page++;
+        }
+
+        if (lastColumn >= 0)
+        {
+            ok = SendWindow(firstColumn, lastColumn, firstPage, page - 1);
+            lastRefresh.pages += (unsigned int)(page - firstPage);
+        }
         else
         {
-            copyLen = totalBytes - copyPos;
+            page++;
         }
+    }
 
-        if (copyPos >= totalBytes)
-            haveData = false;
+    if (ok)
+    {
+        memcpy(sentBuffer, displayBuffer, sizeof(sentBuffer));
+        sentBufferValid = true;
     }
+    else
+    {
+        // the display contents are unknown: send everything next time.
+        sentBufferValid = false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lastRefresh.durationUs = (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
 }
 
-static void i2cSendBytes(uint8_t* data, size_t length)
+void SSD1306_GetRefreshStats(SSD1306_RefreshStats* stats)
 {
-    I2CMaster_Write(_i2cfd, oledDisplayAddress, data, length);
-    delay(1);
+    *stats = lastRefresh;
+}
+
+static bool i2cSendBytes(uint8_t* data, size_t length)
+{
+    ssize_t written = I2CMaster_Write(_i2cfd, oledDisplayAddress, data, length);
+    if (written == -1)
+    {
+        return false;
+    }
+    if (written != (ssize_t)length)
+    {
+        // a short write leaves errno as it was: set it for the callers.
+        Log_Debug("I2CMaster_Write: %zd of %zu bytes written\n", written, length);
+        errno = EIO;
+        return false;
+    }
+    return true;
 }
 
 void SSD1306_FillRegion(uint8_t *image, int width, int height, int x, int y, int regionWidth, int regionHeight, bool turnOn)
@@ -5,8 +5,17 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// the last SSD1306_Display call: only the pages/columns that changed since the previous one are sent.
+typedef struct {
+    unsigned int pages;         // pages with changes.
+    unsigned int bytesSent;     // display data bytes.
+    unsigned int transfers;     // I2C writes (window commands and data).
+    long long durationUs;
+} SSD1306_RefreshStats;
+
 bool SSD1306_Init(bool useVerticalDisplay);
 void SSD1306_Display(void);
+void SSD1306_GetRefreshStats(SSD1306_RefreshStats* stats);
 void SSD1306_Clear(void);
 void SSD1306_FillRegion(uint8_t* image, int width, int height, int x, int y, int regionWidth, int regionHeight, bool turnOn);
 void SSD1306_SetPixel(uint8_t *image, int width, int height, int x, int y, bool turnOn);
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <applibs/log.h>
+#include "intercore.h"
+#include "looptrace.h"
+
+static int traceSock = -1;
+static struct sockaddr_in traceAddr;
+
+// summary since the last log.
+static uint32_t summaryIterations = 0;
+static uint32_t summaryMisses = 0;
+static uint32_t summaryDropped = 0;
+static int summaryMaxJitterUs = 0;
+static unsigned int summaryMaxExecUs = 0;
+
+static bool OpenTraceSocket(void)
+{
+    if (traceSock != -1) {
+        return true;
+    }
+
+    traceSock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (traceSock == -1) {
+        Log_Debug("ERROR: Unable to create the loop trace socket: %d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+
+    int yes = 1;
+    if (setsockopt(traceSock, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)) == -1) {
+        Log_Debug("ERROR: Unable to enable broadcast on the loop trace socket: %d (%s)\n", errno, strerror(errno));
+        close(traceSock);
+        traceSock = -1;
+        return false;
+    }
+
+    memset(&traceAddr, 0, sizeof(traceAddr));
+    traceAddr.sin_family = AF_INET;
+    traceAddr.sin_port = htons(LOOP_TRACE_PORT);
+    traceAddr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    return true;
+}
+
+void SetLoopTraceStreaming(bool enabled)
+{
+    if (enabled && !OpenTraceSocket()) {
+        return;
+    }
+
+    struct LOOP_TRACE_CONTROL control = {
+        .id = MSG_LOOP_TRACE_CONTROL,
+        .enabled = enabled
+    };
+    EnqueueIntercoreMessage(&control, sizeof(control));
+    Log_Debug("INFO: Control loop trace %s\n", enabled ? "started" : "stopped");
+}
+
+void ForwardLoopTrace(const struct LOOP_TRACE* trace, size_t length)
+{
+    if (length < offsetof(struct LOOP_TRACE, samples) || trace->count > LOOP_TRACE_BATCH_SIZE ||
+        length < offsetof(struct LOOP_TRACE, samples) + trace->count * sizeof(struct LOOP_TRACE_SAMPLE)) {
+        Log_Debug("ERROR: Malformed loop trace (%zu bytes)\n", length);
+        return;
+    }
+
+    if (traceSock != -1 && sendto(traceSock, trace, length, MSG_DONTWAIT, (struct sockaddr*)&traceAddr, sizeof(traceAddr)) == -1 &&
+        errno != EAGAIN) {
+        Log_Debug("ERROR: Unable to send the loop trace: %d (%s)\n", errno, strerror(errno));
+    }
+
+    // an iteration misses its deadline if it ends after the next one was due to start.
+    for (unsigned int i = 0; i < trace->count; i++) {
+        const struct LOOP_TRACE_SAMPLE* sample = &trace->samples[i];
+        if (sample->jitterUs + (int)sample->execUs > (int)trace->periodUs) {
+            summaryMisses++;
+        }
+        if (sample->jitterUs > summaryMaxJitterUs) {
+            summaryMaxJitterUs = sample->jitterUs;
+        }
+        if (sample->execUs > summaryMaxExecUs) {
+            summaryMaxExecUs = sample->execUs;
+        }
+    }
+    summaryIterations += trace->count;
+    summaryDropped += trace->dropped;
+
+    if (trace->periodUs != 0 && summaryIterations >= 1000000 / trace->periodUs) {
+        Log_Debug("INFO: Control loop: %u iterations, %u deadline misses, max jitter %d us, max execution %u us, %u not traced\n",
+            summaryIterations, summaryMisses, summaryMaxJitterUs, summaryMaxExecUs, summaryDropped);
+        summaryIterations = 0;
+        summaryMisses = 0;
+        summaryDropped = 0;
+        summaryMaxJitterUs = 0;
+        summaryMaxExecUs = 0;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "intercore_messages.h"
+
+// UDP port the control loop trace is broadcast on (the debug log uses 1824, remote commands 1825).
+#define LOOP_TRACE_PORT 1826
+
+/// <summary>
+///     Asks the real-time app to start or stop streaming its control loop trace.
+/// </summary>
+void SetLoopTraceStreaming(bool enabled);
+
+/// <summary>
+///     Broadcasts a MSG_LOOP_TRACE batch over UDP as is, and logs a summary of the deadline
+///     misses about once a second.
+/// </summary>
+void ForwardLoopTrace(const struct LOOP_TRACE* trace, size_t length);
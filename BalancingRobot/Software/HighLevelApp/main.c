@@ -23,6 +23,7 @@
 #include "MutableStorageKVP.h"
 #include "utils.h"
 #include "intercore.h"
+#include "looptrace.h"
 #include "parson.h"
 #include "pthread.h"
 
@@ -63,6 +64,18 @@ static void* UDPReadThread(void* arg);
 void error(char* msg);
 static pthread_t UDP_Thread = 0;
 
+// Remote command latency: when each command was queued to the RT app, indexed by sequence,
+// matched with the MSG_REMOTE_CMD_ACK sent once the motors have been updated.
+#define REMOTE_CMD_HISTORY 16
+static struct timespec remoteCmdSentAt[REMOTE_CMD_HISTORY];
+static uint16_t remoteCmdSentSequence[REMOTE_CMD_HISTORY];
+static pthread_mutex_t remoteCmdLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long remoteCmdAckCount = 0;
+static long remoteCmdLatencyMinUs = 0;
+static long remoteCmdLatencyMaxUs = 0;
+static long long remoteCmdLatencyTotalUs = 0;
+static void HandleRemoteCmdAck(const struct REMOTE_CMD_ACK* pAck);
+
 // contains current device information (pitch, yaw, roll, battery).
 struct DEVICE_STATUS device_status;
 
@@ -778,6 +791,10 @@ void UpdateDisplay(uint8_t batteryLevel, bool haveNetwork, bool haveIoTC, int Ap
     // don't update the display if we're applying an update or waiting for IMU stability.
     if (updateApplied || WaitForIMU)
         return;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     // update the display.
     SSD1306_Clear();
     memset(BatteryIcon_Rot180, 0x00, 128);
@@ -887,6 +904,14 @@ void UpdateDisplay(uint8_t batteryLevel, bool haveNetwork, bool haveIoTC, int Ap
     }
 
     SSD1306_Display();
+
+    // refresh time: only the icons that changed are sent to the display.
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    SSD1306_RefreshStats refresh;
+    SSD1306_GetRefreshStats(&refresh);
+    Log_Debug("UpdateDisplay: %lld us (display: %u pages, %u bytes in %u I2C writes, %lld us)\n",
+        (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000,
+        refresh.pages, refresh.bytesSent, refresh.transfers, refresh.durationUs);
 }
 
 /// <summary>
@@ -960,7 +985,7 @@ static void IntercoreTimerEventHandler(EventLoopTimer* timer)
 void SocketEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context)
 {
     // Read response from real-time capable application.
-    char rxBuf[64];
+    char rxBuf[256];    // large enough for MSG_LOOP_TRACE.
     int bytesReceived = recv(fd, rxBuf, sizeof(rxBuf), 0);
     char spBuffer[10];  // used to write the current setpoint to isolated storage.
 
@@ -1031,12 +1056,58 @@ void SocketEventHandler(EventLoop* el, int fd, EventLoop_IoEvents events, void*
             }
         }
         break;
+    case MSG_LOOP_TRACE:
+        ForwardLoopTrace((struct LOOP_TRACE*)rxBuf, (size_t)bytesReceived);
+        break;
+    case MSG_REMOTE_CMD_ACK:
+        if (bytesReceived >= sizeof(struct REMOTE_CMD_ACK))
+        {
+            HandleRemoteCmdAck((struct REMOTE_CMD_ACK*)rxBuf);
+        }
+        break;
     default:
         Log_Debug("ERROR: Unexpected message id %d from bare-metal\n", rxBuf[0]);
         break;
     }
 }
 
+/// <summary>
+///     Logs the command-to-actuation latency of a remote command: from when it was queued to the
+///     RT app to when its acknowledgement arrived, the RT app having updated the motors with it.
+/// </summary>
+static void HandleRemoteCmdAck(const struct REMOTE_CMD_ACK* pAck)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&remoteCmdLock);
+    bool known = remoteCmdSentSequence[pAck->sequence % REMOTE_CMD_HISTORY] == pAck->sequence;
+    struct timespec sentAt = remoteCmdSentAt[pAck->sequence % REMOTE_CMD_HISTORY];
+    pthread_mutex_unlock(&remoteCmdLock);
+
+    if (!known)
+    {
+        Log_Debug("WARNING: Remote command %u acknowledged after too many newer commands\n", pAck->sequence);
+        return;
+    }
+
+    long latencyUs = (now.tv_sec - sentAt.tv_sec) * 1000000 + (now.tv_nsec - sentAt.tv_nsec) / 1000;
+    if (remoteCmdAckCount == 0 || latencyUs < remoteCmdLatencyMinUs)
+    {
+        remoteCmdLatencyMinUs = latencyUs;
+    }
+    if (latencyUs > remoteCmdLatencyMaxUs)
+    {
+        remoteCmdLatencyMaxUs = latencyUs;
+    }
+    remoteCmdLatencyTotalUs += latencyUs;
+    remoteCmdAckCount++;
+
+    Log_Debug("INFO: Remote command %u actuated in %ld us (RT: queued %u ms, actuation %u ms) | min %ld us, avg %lld us, max %ld us over %lu commands\n",
+        pAck->sequence, latencyUs, pAck->queuedMs, pAck->actuationMs, remoteCmdLatencyMinUs,
+        remoteCmdLatencyTotalUs / (long long)remoteCmdAckCount, remoteCmdLatencyMaxUs, remoteCmdAckCount);
+}
+
 void SendIoTMessageRaw(const char* message)
 {
     bool isNetworkingReady = false;
@@ -1143,6 +1214,7 @@ static void* UDPReadThread(void* arg)
     struct REMOTE_CMD remoteCmd;
     remoteCmd.id = MSG_REMOTE_CMD;
     remoteCmd.cmd = 0x04;   //stop (default message).
+    remoteCmd.sequence = 0;
 
     Log_Debug("UDP Rx Thread starting...\n");
 
@@ -1195,11 +1267,18 @@ static void* UDPReadThread(void* arg)
         if (n < 0)
             error("ERROR in recvfrom");
 
-        if (n == 3 && buf[0] == 'R' && buf[1] == 'T' && buf[2] <= 6)
+        if (n == 3 && buf[0] == 'R' && buf[1] == 'T' && buf[2] <= 8)
         {
             Log_Debug("UDP Command %d\n", buf[2]);
             // 0-4 = left, right, forward, back, and stop
             // 5 = reboot.
+            // 6 = clear device twin version.
+            // 7, 8 = start, stop broadcasting the control loop trace.
+            if (buf[2] == 0x07 || buf[2] == 0x08)
+            {
+                SetLoopTraceStreaming(buf[2] == 0x07);
+                continue;
+            }
             if (buf[2] == 0x05 || buf[2] == 0x06)
             {
                 switch (buf[2])
@@ -1221,6 +1300,11 @@ static void* UDPReadThread(void* arg)
             {
                 remoteCmd.cmd = buf[2];
             }
+            remoteCmd.sequence++;
+            pthread_mutex_lock(&remoteCmdLock);
+            remoteCmdSentSequence[remoteCmd.sequence % REMOTE_CMD_HISTORY] = remoteCmd.sequence;
+            clock_gettime(CLOCK_MONOTONIC, &remoteCmdSentAt[remoteCmd.sequence % REMOTE_CMD_HISTORY]);
+            pthread_mutex_unlock(&remoteCmdLock);
             EnqueueIntercoreMessage(&remoteCmd, sizeof(remoteCmd));
         }
     }
@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mt3620-baremetal.h"
+#include "LoopTrace.h"
+
+// Cortex-M4 DWT cycle counter.
+#define DEMCR_BASE 0xE000EDFC
+#define DEMCR_TRCENA (1U << 24)
+#define DWT_BASE 0xE0001000
+#define DWT_CTRL 0x00
+#define DWT_CTRL_CYCCNTENA (1U << 0)
+#define DWT_CYCCNT 0x04
+
+// core clock, as SYSTEM_CLOCK in tx_initialize_low_level.S.
+#define CYCLES_PER_US 200
+
+// ring entries, power of 2 - 64 * 5ms == 320ms of iterations.
+#define LOOP_TRACE_RING_SIZE 64
+
+typedef struct {
+	uint32_t iteration;
+	struct LOOP_TRACE_SAMPLE sample;
+} LoopTraceEntry;
+
+static LoopTraceEntry ring[LOOP_TRACE_RING_SIZE];
+// free running counts: head is only written by the producer, tail only by the consumer.
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile bool enabled = false;
+
+// producer state.
+static uint32_t iteration = 0;
+static uint32_t periodCycles = 0;
+static uint32_t lastStartCycles = 0;
+static bool haveLastStart = false;
+
+// consumer state.
+static uint16_t tracePeriodUs = 0;
+static uint32_t nextIteration = 0;
+static bool resync = true;
+
+// order the ring accesses against the index updates.
+static inline void MemoryBarrier(void)
+{
+	__asm__ volatile("dmb" ::: "memory");
+}
+
+static int16_t ClampInt16(int32_t value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)value;
+}
+
+void LoopTrace_Init(uint16_t periodUs)
+{
+	tracePeriodUs = periodUs;
+	periodCycles = (uint32_t)periodUs * CYCLES_PER_US;
+
+	SetReg32(DEMCR_BASE, 0, DEMCR_TRCENA);
+	WriteReg32(DWT_BASE, DWT_CYCCNT, 0);
+	SetReg32(DWT_BASE, DWT_CTRL, DWT_CTRL_CYCCNTENA);
+}
+
+void LoopTrace_Enable(bool enable)
+{
+	if (enable && !enabled)
+	{
+		// drop whatever is left from the last time.
+		tail = head;
+		resync = true;
+	}
+	enabled = enable;
+}
+
+uint32_t LoopTrace_Start(void)
+{
+	return ReadReg32(DWT_BASE, DWT_CYCCNT);
+}
+
+bool LoopTrace_End(uint32_t startCycles, double input, double output, uint16_t tofFront, uint16_t tofRear)
+{
+	uint32_t endCycles = ReadReg32(DWT_BASE, DWT_CYCCNT);
+
+	int32_t jitterCycles = haveLastStart ? (int32_t)(startCycles - lastStartCycles - periodCycles) : 0;
+	lastStartCycles = startCycles;
+	haveLastStart = true;
+	iteration++;
+
+	if (!enabled)
+		return false;
+
+	if (head - tail == LOOP_TRACE_RING_SIZE)
+	{
+		// full - the consumer sees the gap in the iterations.
+		return false;
+	}
+
+	LoopTraceEntry* entry = &ring[head & (LOOP_TRACE_RING_SIZE - 1)];
+	uint32_t execUs = (endCycles - startCycles) / CYCLES_PER_US;
+	entry->iteration = iteration;
+	entry->sample.jitterUs = ClampInt16(jitterCycles / CYCLES_PER_US);
+	entry->sample.execUs = execUs > UINT16_MAX ? UINT16_MAX : (uint16_t)execUs;
+	entry->sample.input = ClampInt16((int32_t)(input * 100));
+	entry->sample.output = ClampInt16((int32_t)(output * 100));
+	entry->sample.tofDistance[0] = tofFront;
+	entry->sample.tofDistance[1] = tofRear;
+
+	MemoryBarrier();
+	head++;
+
+	return (iteration % LOOP_TRACE_BATCH_SIZE) == 0;
+}
+
+bool LoopTrace_ReadBatch(struct LOOP_TRACE* batch)
+{
+	uint32_t available = head - tail;
+	MemoryBarrier();
+
+	uint32_t count = 0;
+	uint32_t first = ring[tail & (LOOP_TRACE_RING_SIZE - 1)].iteration;
+	while (count < available && count < LOOP_TRACE_BATCH_SIZE)
+	{
+		const LoopTraceEntry* entry = &ring[(tail + count) & (LOOP_TRACE_RING_SIZE - 1)];
+		if (entry->iteration != first + count)
+			break;	// iterations were dropped - end the batch here.
+		count++;
+	}
+
+	// wait for a full batch, unless it's cut short by dropped iterations.
+	if (count == 0 || (count < LOOP_TRACE_BATCH_SIZE && count == available))
+		return false;
+
+	batch->id = MSG_LOOP_TRACE;
+	batch->count = (uint8_t)count;
+	batch->periodUs = tracePeriodUs;
+	batch->firstIteration = first;
+	batch->dropped = resync ? 0 : first - nextIteration;
+	for (uint32_t x = 0; x < count; x++)
+	{
+		batch->samples[x] = ring[(tail + x) & (LOOP_TRACE_RING_SIZE - 1)].sample;
+	}
+
+	MemoryBarrier();
+	tail += count;
+
+	nextIteration = first + count;
+	resync = false;
+	return true;
+}
+
+size_t LoopTrace_BatchSize(const struct LOOP_TRACE* batch)
+{
+	return offsetof(struct LOOP_TRACE, samples) + batch->count * sizeof(struct LOOP_TRACE_SAMPLE);
+}
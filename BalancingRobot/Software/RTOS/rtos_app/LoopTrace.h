@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "intercore_messages.h"
+
+// Control loop trace: the hardware thread records each iteration in a lock-free ring (single
+// producer, single consumer), the intercore thread streams it to the HL app in MSG_LOOP_TRACE
+// batches. Recording never blocks or prints - when the ring is full the iteration is dropped.
+
+// enable the cycle counter used for timing, periodUs is the nominal control loop period.
+void LoopTrace_Init(uint16_t periodUs);
+
+// start/stop recording (intercore thread) - samples recorded before enabling are discarded.
+void LoopTrace_Enable(bool enable);
+
+// call at the start of the control loop, pass the result to LoopTrace_End.
+uint32_t LoopTrace_Start(void);
+
+// call at the end of the control loop (hardware thread).
+// returns true when a batch is ready, the intercore thread should then call LoopTrace_ReadBatch.
+bool LoopTrace_End(uint32_t startCycles, double input, double output, uint16_t tofFront, uint16_t tofRear);
+
+// fill batch with the next consecutive iterations (intercore thread).
+// returns false if less than a full batch is waiting.
+bool LoopTrace_ReadBatch(struct LOOP_TRACE* batch);
+
+// size of the used part of batch.
+size_t LoopTrace_BatchSize(const struct LOOP_TRACE* batch);
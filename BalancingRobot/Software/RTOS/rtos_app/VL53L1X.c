@@ -64,8 +64,9 @@ uint16_t fast_osc_frequency;
 uint16_t osc_calibrate_val;
 
 // bool calibrated;
-uint8_t saved_vhv_init;
-uint8_t saved_vhv_timeout;
+// per laser, restored by stopContinuous()
+uint8_t saved_vhv_init[2];
+uint8_t saved_vhv_timeout[2];
 
 enum DistanceMode distance_mode;
 
@@ -108,8 +109,8 @@ bool VL53L1X_init(bool io_2v8)
     io_timeout = 0; // no timeout
     did_timeout = false;
     // calibrated = false;
-    saved_vhv_init = 0;
-    saved_vhv_timeout = 0;
+    saved_vhv_init[activeLaser] = 0;
+    saved_vhv_timeout[activeLaser] = 0;
     distance_mode = Unknown;
 
     laserCalibrated[activeLaser] = false;
@@ -457,13 +458,13 @@ void VL53L1X_stopContinuous()
   // calibrated = false;
 
   // "restore vhv configs"
-  if (saved_vhv_init != 0)
+  if (saved_vhv_init[activeLaser] != 0)
   {
-    writeRegister(VHV_CONFIG__INIT, saved_vhv_init);
+    writeRegister(VHV_CONFIG__INIT, saved_vhv_init[activeLaser]);
   }
-  if (saved_vhv_timeout != 0)
+  if (saved_vhv_timeout[activeLaser] != 0)
   {
-     writeRegister(VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND, saved_vhv_timeout);
+     writeRegister(VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND, saved_vhv_timeout[activeLaser]);
   }
 
   // "remove phasecal override"
@@ -577,15 +578,15 @@ bool VL53L1X_timeoutOccurred()
 void VL53L1X_setupManualCalibration()
 {
   // "save original vhv configs"
-  saved_vhv_init = readRegister(VHV_CONFIG__INIT);
-  saved_vhv_timeout = readRegister(VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND);
+  saved_vhv_init[activeLaser] = readRegister(VHV_CONFIG__INIT);
+  saved_vhv_timeout[activeLaser] = readRegister(VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND);
 
   // "disable VHV init"
-  writeRegister(VHV_CONFIG__INIT, saved_vhv_init & 0x7F);
+  writeRegister(VHV_CONFIG__INIT, saved_vhv_init[activeLaser] & 0x7F);
 
   // "set loop bound to tuning param"
   writeRegister(VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND,
-    (saved_vhv_timeout & 0x03) + (3 << 2)); // tuning parm default (LOWPOWERAUTO_VHV_LOOP_BOUND_DEFAULT)
+    (saved_vhv_timeout[activeLaser] & 0x03) + (3 << 2)); // tuning parm default (LOWPOWERAUTO_VHV_LOOP_BOUND_DEFAULT)
 
   // "override phasecal"
   writeRegister(PHASECAL_CONFIG__OVERRIDE, 0x01);
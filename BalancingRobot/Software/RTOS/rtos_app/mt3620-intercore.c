@@ -5,10 +5,20 @@
 
 #include "mt3620-baremetal.h"
 #include "mt3620-intercore.h"
+#include "nvic.h"
 //#include "mt3620-uart-poll.h"
 
 static const uintptr_t MAILBOX_BASE = 0x21050000;
 
+// Software interrupt ports raised by the high-level application: it rings port 0 when it has
+// written a message to the inbound buffer, port 1 when it has read from the outbound buffer
+// (the mirror of the ports this core rings in EnqueueData and DequeueData).
+#define SW_INT_PORT_MESSAGE_SENT (1U << 0)
+#define SW_INT_PORT_MESSAGE_RECEIVED (1U << 1)
+#define INTERCORE_IRQ_PRIORITY 2
+
+static IntercoreInterruptCallback interruptCallback = NULL;
+
 static void ReceiveMessage(uint32_t *command, uint32_t *data);
 static uint32_t GetBufferSize(uint32_t bufferBase);
 static BufferHeader *GetBufferHeader(uint32_t bufferBase);
@@ -241,3 +251,27 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
 
     return 0;
 }
+
+void IntercoreSwInterruptHandler(void)
+{
+    // SW_RX_INT_STS: write 1 to clear the ports which rang.
+    uint32_t status = ReadReg32(MAILBOX_BASE, 0x1C) & ReadReg32(MAILBOX_BASE, 0x18);
+    WriteReg32(MAILBOX_BASE, 0x1C, status);
+
+    if (status != 0 && interruptCallback != NULL) {
+        interruptCallback();
+    }
+}
+
+void EnableIntercoreInterrupt(IntercoreInterruptCallback callback)
+{
+    interruptCallback = callback;
+
+    // Discard the doorbells rung before now: the caller drains the inbound buffer once enabled.
+    WriteReg32(MAILBOX_BASE, 0x1C, SW_INT_PORT_MESSAGE_SENT | SW_INT_PORT_MESSAGE_RECEIVED);
+    // SW_RX_INT_EN: only a new inbound message wakes the reader.
+    WriteReg32(MAILBOX_BASE, 0x18, SW_INT_PORT_MESSAGE_SENT);
+
+    CM4_Install_NVIC(INTERCORE_SW_INT_IRQ, INTERCORE_IRQ_PRIORITY, IRQ_LEVEL_TRIGGER,
+                     IntercoreSwInterruptHandler, true);
+}
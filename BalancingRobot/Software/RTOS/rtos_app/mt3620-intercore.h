@@ -76,4 +76,33 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
 int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
                 uint32_t *dataSize);
 
+/// <summary>
+/// IRQ number of the mailbox software interrupt which the high-level core raises to this core.
+/// </summary>
+#define INTERCORE_SW_INT_IRQ 11
+
+/// <summary>
+/// Called from the mailbox interrupt when the high-level application has written a message to
+/// the inbound buffer. It must be short and interrupt-safe, e.g. set an event flag.
+/// </summary>
+typedef void (*IntercoreInterruptCallback)(void);
+
+/// <summary>
+/// <para>Installs <see cref="IntercoreSwInterruptHandler" /> for <see cref="INTERCORE_SW_INT_IRQ" />
+/// and enables the mailbox software interrupt which the high-level application raises when it
+/// writes a message to the inbound buffer, so the reader can wait for messages instead of
+/// polling <see cref="DequeueData" />.</para>
+/// <para>Doorbells rung before this call are discarded: drain the inbound buffer once after
+/// calling it. One doorbell may announce several messages, so drain the buffer fully on each
+/// callback.</para>
+/// </summary>
+/// <param name="callback">Called from the interrupt handler.</param>
+void EnableIntercoreInterrupt(IntercoreInterruptCallback callback);
+
+/// <summary>
+/// Interrupt handler of the mailbox software interrupt: acknowledges it and calls the callback
+/// supplied to <see cref="EnableIntercoreInterrupt" />.
+/// </summary>
+void IntercoreSwInterruptHandler(void);
+
 #endif // #ifndef MT3620_INTERCORE_H
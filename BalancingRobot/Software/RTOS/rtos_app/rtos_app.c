@@ -19,6 +19,7 @@
 
 #include "FanOut.h"
 #include "VL53L1X.h"
+#include "LoopTrace.h"
 
 // Show Debug Log messages for Yaw/Pitch/Roll/Roll Delta
 // #define SHOW_LOG
@@ -48,6 +49,9 @@
 // these 'longer' readings are ignored.
 #define TOF_OBSTACLE_DISTANCE_MM 100	// 100mm == ~4 inches from ToF sensor.
 
+// the ToF thread checks for new measurements every TOF_TICK_MS (tofSensorConfig has the rates).
+#define TOF_TICK_MS 10
+
 // used to turn ToF off when robot is initially balanced
 // count for TOF_STABILIZE_PERIOD (value can be adjusted) before enabling ToF.
 static unsigned long ToF_Settle_Counter = 0;
@@ -72,8 +76,36 @@ bool highLevelReady = false;
 
 static bool haveHLApp = false;		// used to determine whether we've received a message from the HL app.
 
+// Intercore event flags: the mailbox interrupt wakes the intercore thread as soon as the HL app
+// sends a message, the timer tick is only a backstop in case a doorbell is missed.
+#define INTERCORE_EVENT_MAILBOX 0x1
+#define INTERCORE_EVENT_POLL 0x2
+#define INTERCORE_EVENT_REMOTE_CMD_ACTUATED 0x4
+#define INTERCORE_EVENT_LOOP_TRACE 0x8
+#define INTERCORE_EVENTS (INTERCORE_EVENT_MAILBOX | INTERCORE_EVENT_POLL | INTERCORE_EVENT_REMOTE_CMD_ACTUATED | INTERCORE_EVENT_LOOP_TRACE)
+// messages handled per wake: the rest are handled on the next pass, after the pending ack.
+#define INTERCORE_MAX_MESSAGES_PER_WAKE 16
+
+// remote command latency (ms ticks): mailbox interrupt -> dequeued -> motor outputs updated.
+static volatile ULONG mailboxInterruptTick = 0;
+static volatile bool remoteCmdPending = false;		// set by the intercore thread, cleared by loop() once actuated.
+static ULONG remoteCmdDequeuedTick = 0;
+static struct REMOTE_CMD_ACK remoteCmdAck;			// command waiting for loop() - only written while remoteCmdPending is false.
+static struct REMOTE_CMD_ACK remoteCmdActuated;		// copied by loop(), sent by the intercore thread.
+
 static const uint8_t HighLevelAppComponentId[16] = { 0x67, 0xc3, 0x5b, 0x88, 0x59, 0xb1, 0xa5, 0x44, 0x91, 0xfa, 0x3f, 0xeb, 0x53, 0xa8, 0x23, 0x17 };
 
+// control loop trace batches are larger than the other messages so have their own buffer (intercore thread only):
+// component id, 4 reserved bytes (payloadStart), then the batch.
+static uint8_t loopTraceBuf[sizeof(HighLevelAppComponentId) + 4 + sizeof(struct LOOP_TRACE)] __attribute__((aligned(4)));
+static void SendLoopTrace(void);
+
+// latest ToF readings (front, rear), for the control loop trace.
+static volatile uint16_t ToF_Distances[2] = { 0, 0 };
+
+// control loop period - the 5ms timer tick (hardware_init_thread).
+#define LOOP_PERIOD_US 5000
+
 // Define the ThreadX object control blocks...
 TX_THREAD				tx_hardware_init_thread;
 TX_THREAD				tx_timer_test_Thread;
@@ -99,6 +131,8 @@ void Intercore_thread(ULONG thread_input);
 void hardware_init_thread(ULONG thread_input);
 
 void EnqueueIntercoreMessage(void* payload, size_t payload_size);
+static void HandleIntercoreMessage(ULONG wakeTick);
+static void OnIntercoreInterrupt(void);
 int GetCompassDirection(float compassAngle);
 
 static bool TurnRobotFlag = false;
@@ -208,17 +242,27 @@ static volatile bool hardwareInitOK = false;
 
 bool InitHardware(void);
 unsigned long loop(void);
+bool ToF_Init(void);
+void ToF_Update(void);
+void ReadImuOrientation(float* roll, float* heading);
 
-unsigned long loop(void)
+// Roll is the lean angle (~90 when upright), heading is the compass heading.
+// The IMU code isn't included (see README), replace this default - the host simulation (../simulation) does.
+__attribute__((weak)) void ReadImuOrientation(float* roll, float* heading)
 {
-	unsigned long startPeriod = millis();
-
-
 	// TODO: Read IMU, calculate Yaw, Pitch, Roll
 	// ICM-20948 oritentation gives Roll as lean angle.
+	*roll = 0.0;
+	*heading = 0.0;
+}
+
+unsigned long loop(void)
+{
+	unsigned long startPeriod = millis();
 
 	float _Roll = 0.0;	// 
 	float g_heading = 0.0; //
+	ReadImuOrientation(&_Roll, &g_heading);
 	if (g_heading < 0)
 		g_heading += 360;
 
@@ -402,6 +446,15 @@ unsigned long loop(void)
 		mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL1, PWM_PERIOD, dutyRight);
 	}
 
+	// a remote command picked up by the setpoint above has now reached the motors.
+	if (remoteCmdPending)
+	{
+		remoteCmdActuated = remoteCmdAck;
+		remoteCmdActuated.actuationMs = millis() - remoteCmdDequeuedTick;
+		remoteCmdPending = false;
+		tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_REMOTE_CMD_ACTUATED, TX_OR);
+	}
+
 	unsigned long timePeriod = millis() - startPeriod;
 
 	return timePeriod;
@@ -464,223 +517,341 @@ bool InitHardware(void)
 	return true;
 }
 
-void ToF_thread(ULONG thread_input)
+// ToF ranging: both sensors range continuously, each with its own timing budget and
+// inter-measurement period. The ToF thread ticks every TOF_TICK_MS and reads each sensor once its
+// measurement is due and ready, so an obstacle is seen within one measurement period (plus a tick)
+// on either side, rather than every other 100ms tick.
+typedef struct {
+	uint8_t fanoutChannel;
+	uint32_t timingBudgetUs;	// 33ms minimum in Long distance mode.
+	uint32_t periodMs;			// inter-measurement period, at least the timing budget.
+} ToFSensorConfig;
+
+static const ToFSensorConfig tofSensorConfig[2] = {
+	{ 1, 33000, 40 },	// front.
+	{ 2, 33000, 40 },	// rear.
+};
+
+// ToF state, kept between ToF ticks.
+static int selectedToF = -1;			// sensor currently selected on the fan out.
+static unsigned long tofDueMs[2];		// next measurement expected.
+static uint16_t distances[2];	// front and rear lasers.
+// setup last distances to be 'far'.
+static uint16_t lastDistances[2] = { 2400,2400 };
+static bool obstacles[2] = { false, false };
+
+// select a sensor on the fan out (and its calibration state in the VL53L1X driver).
+static void SelectToF(int index)
 {
-	printf("Initialize ToF\r\n");
-	SelectFanoutChannel(1);
-	
-	VL53L1X_setActiveLaser(1);	// used to track which has been configued.
-
-	bool initOk = VL53L1X_init(true);
+	if (selectedToF != index)
+	{
+		SelectFanoutChannel(tofSensorConfig[index].fanoutChannel);
+		VL53L1X_setActiveLaser((uint8_t)index);
+		selectedToF = index;
+	}
+}
 
-	if (!initOk)
+bool ToF_Init(void)
+{
+	for (int index = 0; index < 2; index++)
 	{
-		printf("ToF Channel 1 failed\r\n");
-		return;
+		SelectToF(index);
+
+		if (!VL53L1X_init(true))
+		{
+			printf("ToF Channel %u failed\r\n", tofSensorConfig[index].fanoutChannel);
+			return false;
+		}
+
+		VL53L1X_setDistanceMode(Long);
+		VL53L1X_setMeasurementTimingBudget(tofSensorConfig[index].timingBudgetUs);
+		// Start continuous readings, one measurement every periodMs (the inter-measurement period).
+		// This period should be at least as long as the timing budget.
+		VL53L1X_startContinuous(tofSensorConfig[index].periodMs);
+
+		tofDueMs[index] = millis() + tofSensorConfig[index].timingBudgetUs / 1000;
 	}
 
-	VL53L1X_setDistanceMode(Long);
-	VL53L1X_setMeasurementTimingBudget(50000);
-	// Start continuous readings at a rate of one measurement every 50 ms (the
-	// inter-measurement period). This period should be at least as long as the
-	// timing budget.
-	VL53L1X_startContinuous(50);
+	return true;
+}
 
-	delay(2);
+// adjust the setpoint if an obstacle is found ahead (index 0) or behind (index 1).
+static void ProcessToFDistance(int index, uint16_t distance)
+{
+	distances[index] = distance;
 
-	SelectFanoutChannel(2);
+	if (distances[index] != 0)
+	{
+		// Log_Debug("ToF Distance %d\r\n", distance);
 
-	VL53L1X_setActiveLaser(1);	// used to track which has been configued.
+		if (distances[index] < TOF_OBSTACLE_DISTANCE_MM && distances[index] > 0 && !obstacles[index])
+		{
+			mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 1000);
+			// Log_Debug("Obstacle Found - adjusting setpoint\n");
+			obstacles[index] = true;
+			ObstacleDetected = true;
+			ToF_ObstacleCounter++;
 
-	initOk = VL53L1X_init(true);
+			if (index == 0)
+			{
+				ToFSetpointAdjust = -1.5;
+			}
+			else
+			{
+				ToFSetpointAdjust = 1.5;
+			}
+		}
+
+		// see if we're moving away, and if yes, cancel the movement.
+		if (obstacles[index] && lastDistances[index] < distances[index] && distances[index] > 0) //distances[index] > 100 && obstacles[index])
+		{
+			mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 0);
+			obstacles[index] = false;
+			ObstacleDetected = false;
+			ToFSetpointAdjust = 0.0;
+		}
+	}
+	lastDistances[index] = distances[index];
+	ToF_Distances[index] = distances[index];
+}
 
-	if (!initOk)
+// read the sensors whose measurement is due: a sensor that isn't ready yet is polled again on the
+// next tick, rather than waiting for it.
+void ToF_Update(void)
+{
+	if (!Tof_Active)
 	{
-		printf("ToF Channel 2 failed\r\n");
 		return;
 	}
 
-	VL53L1X_setDistanceMode(Long);
-	VL53L1X_setMeasurementTimingBudget(50000);
-	// Start continuous readings at a rate of one measurement every 50 ms (the
-	// inter-measurement period). This period should be at least as long as the
-	// timing budget.
-	VL53L1X_startContinuous(50);
+	unsigned long now = millis();
+	for (int index = 0; index < 2; index++)
+	{
+		if ((long)(now - tofDueMs[index]) < 0)
+		{
+			continue;
+		}
 
-	SelectFanoutChannel(1);
+		SelectToF(index);
+		if (!VL53L1X_dataReady())
+		{
+			continue;
+		}
 
-	bool useFrontToF = true;		// TODO: tick/tock on front/rear sensors.
+		ProcessToFDistance(index, VL53L1X_read(false));
 
-	ULONG   actual_flags = 0;
+		// the next measurement is one period after this one became ready (within the last tick).
+		tofDueMs[index] = now + tofSensorConfig[index].periodMs - TOF_TICK_MS;
+	}
+}
 
-	uint16_t distances[2];	// front and rear lasers.
-	// setup last distances to be 'far'.
-	uint16_t lastDistances[2] = { 2400,2400 };
+void ToF_thread(ULONG thread_input)
+{
+	printf("Initialize ToF\r\n");
+	if (!ToF_Init())
+	{
+		return;
+	}
 
-	bool obstacles[2] = { false, false };
+	ULONG   actual_flags = 0;
 
 	while (true)
 	{
 		// wait on timer tick.
 		tx_event_flags_get(&ToF_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		ToF_Update();
+	}
+
+	printf("ToF Thread exit\r\n");
+}
 
-		if (Tof_Active)
+void Intercore_thread(ULONG thread_input)
+{
+	ULONG   actual_flags = 0;
+
+	printf("Intercore Thread Starting\r\n");
+
+	// wake on the mailbox doorbell rather than the timer tick, and handle whatever the HL app sent before now.
+	EnableIntercoreInterrupt(OnIntercoreInterrupt);
+	tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_POLL, TX_OR);
+
+	while (true)
+	{
+		tx_event_flags_get(&Intercore_event_flags_0, INTERCORE_EVENTS, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+
+		if (actual_flags & INTERCORE_EVENT_REMOTE_CMD_ACTUATED)
 		{
-			int index = useFrontToF == true ? 0 : 1;
-			distances[index] = VL53L1X_read(true);
+			EnqueueIntercoreMessage(&remoteCmdActuated, sizeof(remoteCmdActuated));
+		}
 
-			if (distances[index] != 0)
-			{
-				// Log_Debug("ToF Distance %d\r\n", distance);
+		if (actual_flags & INTERCORE_EVENT_LOOP_TRACE)
+		{
+			SendLoopTrace();
+		}
 
-				if (distances[index] < TOF_OBSTACLE_DISTANCE_MM && distances[index] > 0 && !obstacles[index])
-				{
-					mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 1000);
-					// Log_Debug("Obstacle Found - adjusting setpoint\n");
-					obstacles[index] = true;
-					ObstacleDetected = true;
-					ToF_ObstacleCounter++;
+		if (actual_flags & (INTERCORE_EVENT_MAILBOX | INTERCORE_EVENT_POLL))
+		{
+			// time the queued messages from the doorbell, or from now if woken by the backstop tick.
+			ULONG wakeTick = (actual_flags & INTERCORE_EVENT_MAILBOX) ? mailboxInterruptTick : millis();
 
-					if (useFrontToF)
-					{
-						ToFSetpointAdjust = -1.5;
-					}
-					else
-					{
-						ToFSetpointAdjust = 1.5;
-					}
+			// one doorbell can announce several messages: drain the inbound buffer.
+			int count = 0;
+			while (count < INTERCORE_MAX_MESSAGES_PER_WAKE)
+			{
+				dataSize = sizeof(buf);
+				if (DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize) != 0)
+				{
+					break;
 				}
-
-				// see if we're moving away, and if yes, cancel the movement.
-				if (obstacles[index] && lastDistances[index] < distances[index] && distances[index] > 0) //distances[index] > 100 && obstacles[index])
+				count++;
+				if (dataSize > payloadStart)
 				{
-					mtk_os_hal_pwm_config_freq_duty_normal(OS_HAL_PWM_GROUP1, PWM_CHANNEL2, PWM_PERIOD, 0);
-					obstacles[index] = false;
-					ObstacleDetected = false;
-					ToFSetpointAdjust = 0.0;
+					HandleIntercoreMessage(wakeTick);
 				}
 			}
-			lastDistances[index] = distances[index];
-			useFrontToF = !useFrontToF;
-			SelectFanoutChannel(useFrontToF == true ? 1 : 2);
+
+			if (count == INTERCORE_MAX_MESSAGES_PER_WAKE)
+			{
+				// more may be waiting - come straight back once the other events are handled.
+				tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_POLL, TX_OR);
+			}
 		}
 	}
 
-	printf("ToF Thread exit\r\n");
+	printf("Intercore Thread exit\r\n");
 }
 
-void Intercore_thread(ULONG thread_input)
+// send every complete batch of the control loop trace.
+static void SendLoopTrace(void)
 {
-	ULONG   actual_flags = 0;
+	struct LOOP_TRACE* pTrace = (struct LOOP_TRACE*)&loopTraceBuf[payloadStart];
 
-	printf("Intercore Thread Starting\r\n");
+	memcpy(loopTraceBuf, HighLevelAppComponentId, sizeof(HighLevelAppComponentId));
+	while (LoopTrace_ReadBatch(pTrace))
+	{
+		if (EnqueueData(inbound, outbound, sharedBufSize, loopTraceBuf, payloadStart + LoopTrace_BatchSize(pTrace)) != 0)
+		{
+			// mailbox full - the HL app sees the gap in the iterations.
+			break;
+		}
+	}
+}
+
+// mailbox interrupt - runs in interrupt context.
+static void OnIntercoreInterrupt(void)
+{
+	mailboxInterruptTick = millis();
+	tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_MAILBOX, TX_OR);
+}
 
+// handle the message in buf (wakeTick: when the intercore thread was signalled for it).
+static void HandleIntercoreMessage(ULONG wakeTick)
+{
 	struct TURN_ROBOT* pTurn;
 	struct SETPOINT* pSetpoint;
 	struct REMOTE_CMD* pRemote;
 	struct UPDATE_ACTIVE* pUpdate;
+	struct LOOP_TRACE_CONTROL* pTraceControl;
 
-	while (true)
-	{
-		// wait on timer tick.
-		tx_event_flags_get(&Intercore_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
-		dataSize = sizeof(buf);
-		int r = DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize);
-		if (r == 0 && dataSize > payloadStart) {
-			size_t payloadBytes = dataSize - payloadStart;
-			if (payloadBytes > 0) {
-				switch (buf[payloadStart]) {
-				case MSG_UPDATE_ACTIVE:
-					pUpdate = (struct UPDATE_ACTIVE*)&buf[payloadStart];
-					if (pUpdate->updateActive)
-					{
-						updating = true;
-					}
-					else
-					{
-						updating = false;
-					}
-					break;
-				case MSG_REMOTE_CMD:
-					pRemote=(struct REMOTE_CMD*)&buf[payloadStart];
-					switch (pRemote->cmd)
-					{
-					case 4:	// stop.
-						RemoteFwdBackAdjust = 0.0;
-						RemoteRotateCommand = 0;
-						break;
-					case 1:	// foreward
-						RemoteFwdBackAdjust = 1.5;
-						RemoteRotateCommand = 0;
-						break;
-					case 3:	// back
-						RemoteFwdBackAdjust = -1.5;
-						RemoteRotateCommand = 0;
-						break;
-					case 2:		// right
-						RemoteFwdBackAdjust = 0.0;
-						RotateClockwise = false;
-						RemoteRotateCommand = 2;	// right
-							break;
-					case 0:		// left
-						RemoteFwdBackAdjust = 0.0;
-						RotateClockwise = true;
-						RemoteRotateCommand = 1;	// left.
-						break;
-					default:
-						break;
-					};
-					break;
-				case MSG_IMU_STABLE_REQUEST:
-					tImuStatusMsg.id = MSG_IMU_STABLE_RESULT;
-					tImuStatusMsg.imuStable = imuStable;
-					EnqueueIntercoreMessage(&tImuStatusMsg, sizeof(tImuStatusMsg));
-					break;
-				case MSG_TELEMETRY_REQUEST:
-					haveHLApp = true;		// have received at least one message from the HL App, can now start sending IMU telemetry.
-					tMsg.id = MSG_DEVICE_STATUS;
-					tMsg.timestamp = millis();
-					tMsg.numObstaclesDetected = ToF_ObstacleCounter;
-					tMsg.setpoint = CalibratedSetpoint;
-					tMsg.pitch = g_pitch;
-					tMsg.yaw = g_heading;
-					tMsg.roll = g_roll;
-					tMsg.turnNorth = TurnRobotFlag;
-					tMsg.avoidActive = ObstacleDetected;
-					EnqueueIntercoreMessage(&tMsg, sizeof(tMsg));
-					break;
-				case MSG_SETPOINT:
-					pSetpoint = (struct SETPOINT*)&buf[payloadStart];
-					if (pSetpoint->setpoint > 80 && pSetpoint->setpoint < 100)
-					{
-						CalibratedSetpoint = pSetpoint->setpoint;
-					}
-					break;
-				case MSG_TURN_ROBOT:
-					pTurn = (struct TURN_ROBOT*)&buf[payloadStart];
-					
-					// accept the turn if we're stood up.
-					if (g_roll > 80)
-					{
-						if (pTurn->enabled)
-						{
-							RotateClockwise = GetRotationDirection(g_heading, pTurn->heading);
-						}
-						turnHeading = pTurn->heading;
-						TurnRobotFlag = pTurn->enabled;
-						if (TurnRobotFlag)
-						{
-							// store current heading (used in telemetry).
-							turnStartHeading = g_heading;
-						}
-					}
-					break;
-				};
+	switch (buf[payloadStart]) {
+	case MSG_UPDATE_ACTIVE:
+		pUpdate = (struct UPDATE_ACTIVE*)&buf[payloadStart];
+		if (pUpdate->updateActive)
+		{
+			updating = true;
+		}
+		else
+		{
+			updating = false;
+		}
+		break;
+	case MSG_REMOTE_CMD:
+		pRemote=(struct REMOTE_CMD*)&buf[payloadStart];
+		switch (pRemote->cmd)
+		{
+		case 4:	// stop.
+			RemoteFwdBackAdjust = 0.0;
+			RemoteRotateCommand = 0;
+			break;
+		case 1:	// foreward
+			RemoteFwdBackAdjust = 1.5;
+			RemoteRotateCommand = 0;
+			break;
+		case 3:	// back
+			RemoteFwdBackAdjust = -1.5;
+			RemoteRotateCommand = 0;
+			break;
+		case 2:		// right
+			RemoteFwdBackAdjust = 0.0;
+			RotateClockwise = false;
+			RemoteRotateCommand = 2;	// right
+				break;
+		case 0:		// left
+			RemoteFwdBackAdjust = 0.0;
+			RotateClockwise = true;
+			RemoteRotateCommand = 1;	// left.
+			break;
+		default:
+			break;
+		};
+		// acknowledged by the intercore thread once loop() has applied it to the motors.
+		// loop() runs at a higher priority, so it sees either no command or all of it.
+		remoteCmdPending = false;
+		remoteCmdAck.id = MSG_REMOTE_CMD_ACK;
+		remoteCmdAck.sequence = pRemote->sequence;
+		remoteCmdAck.queuedMs = millis() - wakeTick;
+		remoteCmdDequeuedTick = millis();
+		remoteCmdPending = true;
+		break;
+	case MSG_IMU_STABLE_REQUEST:
+		tImuStatusMsg.id = MSG_IMU_STABLE_RESULT;
+		tImuStatusMsg.imuStable = imuStable;
+		EnqueueIntercoreMessage(&tImuStatusMsg, sizeof(tImuStatusMsg));
+		break;
+	case MSG_TELEMETRY_REQUEST:
+		haveHLApp = true;		// have received at least one message from the HL App, can now start sending IMU telemetry.
+		tMsg.id = MSG_DEVICE_STATUS;
+		tMsg.timestamp = millis();
+		tMsg.numObstaclesDetected = ToF_ObstacleCounter;
+		tMsg.setpoint = CalibratedSetpoint;
+		tMsg.pitch = g_pitch;
+		tMsg.yaw = g_heading;
+		tMsg.roll = g_roll;
+		tMsg.turnNorth = TurnRobotFlag;
+		tMsg.avoidActive = ObstacleDetected;
+		EnqueueIntercoreMessage(&tMsg, sizeof(tMsg));
+		break;
+	case MSG_LOOP_TRACE_CONTROL:
+		pTraceControl = (struct LOOP_TRACE_CONTROL*)&buf[payloadStart];
+		LoopTrace_Enable(pTraceControl->enabled);
+		break;
+	case MSG_SETPOINT:
+		pSetpoint = (struct SETPOINT*)&buf[payloadStart];
+		if (pSetpoint->setpoint > 80 && pSetpoint->setpoint < 100)
+		{
+			CalibratedSetpoint = pSetpoint->setpoint;
+		}
+		break;
+	case MSG_TURN_ROBOT:
+		pTurn = (struct TURN_ROBOT*)&buf[payloadStart];
+		
+		// accept the turn if we're stood up.
+		if (g_roll > 80)
+		{
+			if (pTurn->enabled)
+			{
+				RotateClockwise = GetRotationDirection(g_heading, pTurn->heading);
+			}
+			turnHeading = pTurn->heading;
+			TurnRobotFlag = pTurn->enabled;
+			if (TurnRobotFlag)
+			{
+				// store current heading (used in telemetry).
+				turnStartHeading = g_heading;
 			}
 		}
-	}
-
-	printf("Intercore Thread exit\r\n");
+		break;
+	};
 }
 
 static bool GetRotationDirection(float current, float desired)
@@ -742,20 +913,30 @@ void hardware_thread(ULONG thread_input)
 
 	printf("hardware thread starting...\r\n");
 
+	LoopTrace_Init(LOOP_PERIOD_US);
+
 	while (true)
 	{
 		tx_event_flags_get(&hardware_event_flags_0, 0x1, TX_OR_CLEAR, &actual_flags, TX_WAIT_FOREVER);
+		uint32_t traceStart = LoopTrace_Start();
 #ifdef SHOW_DEBUG_MSGS
 		loopTime = loop();
+#else
+		loop();
+#endif
+		if (LoopTrace_End(traceStart, input, output, ToF_Distances[0], ToF_Distances[1]))
+		{
+			tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_LOOP_TRACE, TX_OR);
+		}
+
+#ifdef SHOW_DEBUG_MSGS
+		// note: the printf delays the next iteration, use the loop trace (MSG_LOOP_TRACE) to profile the timing.
 		now = millis();
 		delta = now - last;
 		last = now;
 
 		printf("%u | %u | %s - Loop: %u\r\n",now, delta, delta > 5 ? "***"  : " ",loopTime);
-#else
-		loop();
 #endif
-
 	}
 }
 
@@ -774,7 +955,7 @@ void timerFn(ULONG input)
 		}
 
 		ToFTickCounter++;
-		if (ToFTickCounter == 20)	// 100ms
+		if (ToFTickCounter == TOF_TICK_MS * 1000 / LOOP_PERIOD_US)
 		{
 			ToFTickCounter=0;
 			status = tx_event_flags_set(&ToF_event_flags_0, 0x1, TX_OR);
@@ -787,10 +968,10 @@ void timerFn(ULONG input)
 		// Azure HL App 'Device Twin' check is every 5 seconds
 		// Request for Telemetry is every 20 seconds.
 		IntercoreTickCounter++;
-		if (IntercoreTickCounter == 100)	// 0.5 seconds.
+		if (IntercoreTickCounter == 100)	// 0.5 seconds - backstop, messages normally arrive via the mailbox interrupt.
 		{
 			IntercoreTickCounter = 0;
-			status = tx_event_flags_set(&Intercore_event_flags_0, 0x1, TX_OR);
+			status = tx_event_flags_set(&Intercore_event_flags_0, INTERCORE_EVENT_POLL, TX_OR);
 			if (status != TX_SUCCESS)
 			{
 				printf("failed to set Intercore event flags\r\n");
@@ -823,9 +1004,11 @@ void hardware_init_thread(ULONG thread_input)
 	printf("Hardware Init - %s\r\n", hardwareInitOK ? "OK" : "FAIL");
 }
 
+#ifndef CONTROL_SIMULATION	// the host simulation drives loop() itself.
 int main() {
 	tx_kernel_enter();	// Enter the Azure RTOS kernel.
 }
+#endif
 
 // Define what the initial system looks like.
 void tx_application_define(void* first_unused_memory) {
@@ -853,13 +1036,13 @@ void tx_application_define(void* first_unused_memory) {
 		printf("failed to create hardware_event_flags\r\n");
 	}
 
-	status = tx_event_flags_create(&ToF_event_flags_0, "ToF Event");					// ToF events fire every 100 ms
+	status = tx_event_flags_create(&ToF_event_flags_0, "ToF Event");					// ToF events fire every TOF_TICK_MS
 	if (status != TX_SUCCESS)
 	{
 		printf("failed to create ToF_event_flags\r\n");
 	}
 
-	status = tx_event_flags_create(&Intercore_event_flags_0, "Intercore Event");		// Intercore events fire every 10 ms
+	status = tx_event_flags_create(&Intercore_event_flags_0, "Intercore Event");		// Intercore events fire on the mailbox interrupt, and every 500 ms
 	if (status != TX_SUCCESS)
 	{
 		printf("failed to create Intercore_event_flags\r\n");
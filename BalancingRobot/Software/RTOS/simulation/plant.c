@@ -0,0 +1,90 @@
+#include <math.h>
+#include <stdlib.h>
+#include "plant.h"
+
+#define GRAVITY 9.81
+#define DEG_PER_RAD (180.0 / 3.14159265358979323846)
+#define TOF_MAX_RANGE_MM 4000
+#define FALLEN_ANGLE_DEG 60
+
+void Plant_Init(Plant* plant, double initialTiltDeg)
+{
+	plant->comHeight = 0.08;
+	plant->maxWheelSpeed = 1.0;
+	plant->motorTau = 0.05;
+	plant->balanceRoll = 90.54;
+	plant->imuNoise = 0.002;
+	plant->obstacleFront = 0.0;
+	plant->obstacleRear = 0.0;
+
+	plant->angle = initialTiltDeg / DEG_PER_RAD;
+	plant->angularVelocity = 0.0;
+	plant->position = 0.0;
+	plant->velocity = 0.0;
+	plant->wheelSpeed = 0.0;
+	plant->wheelAccel = 0.0;
+	plant->held = true;
+}
+
+void Plant_Step(Plant* plant, double dt, double motorCommand, double disturbance)
+{
+	if (motorCommand > 1.0)
+		motorCommand = 1.0;
+	if (motorCommand < -1.0)
+		motorCommand = -1.0;
+
+	if (plant->held)
+	{
+		plant->wheelSpeed = 0.0;
+		plant->wheelAccel = 0.0;
+		return;
+	}
+
+	plant->wheelAccel = (motorCommand * plant->maxWheelSpeed - plant->wheelSpeed) / plant->motorTau;
+	plant->wheelSpeed += plant->wheelAccel * dt;
+
+	if (Plant_Fallen(plant))
+	{
+		plant->angularVelocity = 0.0;
+		plant->velocity = 0.0;
+		return;
+	}
+
+	// the axle accelerating backward tips the body forward.
+	double angularAccel = (GRAVITY * sin(plant->angle) + (plant->wheelAccel + disturbance) * cos(plant->angle)) / plant->comHeight;
+
+	plant->angularVelocity += angularAccel * dt;
+	plant->angle += plant->angularVelocity * dt;
+	plant->velocity = -plant->wheelSpeed;
+	plant->position += plant->velocity * dt;
+}
+
+// standard normal (Box-Muller).
+static double Gaussian(void)
+{
+	double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+}
+
+float Plant_ImuRoll(const Plant* plant)
+{
+	return (float)(plant->balanceRoll + plant->angle * DEG_PER_RAD + plant->imuNoise * Gaussian());
+}
+
+uint16_t Plant_ToFDistance(const Plant* plant, bool front)
+{
+	double obstacle = front ? plant->obstacleFront : plant->obstacleRear;
+	if (obstacle == 0.0)
+		return 0;
+
+	double distanceMm = (front ? obstacle - plant->position : obstacle + plant->position) * 1000.0;
+	if (distanceMm < 1.0 || distanceMm > TOF_MAX_RANGE_MM)
+		return 0;
+	return (uint16_t)distanceMm;
+}
+
+bool Plant_Fallen(const Plant* plant)
+{
+	return fabs(plant->angle * DEG_PER_RAD) >= FALLEN_ANGLE_DEG;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Two-wheeled inverted pendulum: the body pivots on the wheel axle. The back EMF of the DC motors
+// makes the wheel speed follow the motor command, with a first-order lag.
+// Position is positive forward, the way the front ToF sensor faces. A positive motor command
+// (positive PID output) drives backward, which tips the body forward: the angle is positive when
+// leaning forward, which is when the IMU roll is above the balance point.
+typedef struct {
+	// parameters.
+	double comHeight;		// m, wheel axle to centre of mass.
+	double maxWheelSpeed;	// m/s at full duty.
+	double motorTau;		// s, motor response time constant.
+	double balanceRoll;		// IMU roll when balanced, degrees.
+	double imuNoise;		// IMU roll noise, standard deviation in degrees.
+	double obstacleFront;	// m, distance of an obstacle ahead of the start position, 0 == none.
+	double obstacleRear;	// m, distance of an obstacle behind the start position, 0 == none.
+
+	// state.
+	double angle;			// rad, from balanced.
+	double angularVelocity;	// rad/s.
+	double position;		// m.
+	double velocity;		// m/s.
+	double wheelSpeed;		// m/s, backward.
+	double wheelAccel;		// m/s^2, backward.
+	bool held;				// held still (by hand) until released.
+} Plant;
+
+// defaults, held upright at initialTiltDeg from balanced.
+void Plant_Init(Plant* plant, double initialTiltDeg);
+
+// advance by dt seconds, motorCommand -1 to 1, disturbance is a push (m/s^2, positive tips the body forward).
+void Plant_Step(Plant* plant, double dt, double motorCommand, double disturbance);
+
+// IMU roll (degrees, ~90 when upright) with noise.
+float Plant_ImuRoll(const Plant* plant);
+
+// VL53L1X distance (mm) to the obstacle ahead or behind, 0 when out of range.
+uint16_t Plant_ToFDistance(const Plant* plant, bool front);
+
+// lying on the floor.
+bool Plant_Fallen(const Plant* plant);
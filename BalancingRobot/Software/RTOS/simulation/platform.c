@@ -0,0 +1,204 @@
+// Host simulation of the hardware and RTOS services used by rtos_app.c: simulated time, motor
+// GPIO/PWM capture, simulated IMU and VL53L1X sensors, and no-op intercore/trace functions.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tx_api.h"
+#include "os_hal_gpio.h"
+#include "os_hal_pwm.h"
+#include "os_hal_i2c.h"
+#include "VL53L1X.h"
+#include "FanOut.h"
+#include "mt3620-intercore.h"
+#include "LoopTrace.h"
+#include "platform.h"
+
+SimSensors simSensors = { 90.0f, 0.0f, { 2400, 2400 } };
+
+static unsigned long simTimeMs = 0;
+static int gpioOutputs[OS_HAL_GPIO_MAX];
+static uint32_t motorDuty[2];		// PWM_CHANNEL0, PWM_CHANNEL1.
+static uint8_t fanoutChannel = 1;	// 1 == front, 2 == rear.
+
+void Sim_SetTime(unsigned long ms)
+{
+	simTimeMs = ms;
+}
+
+bool Sim_MotorsEnabled(void)
+{
+	return gpioOutputs[OS_HAL_GPIO_13] != 0;
+}
+
+double Sim_GetMotorCommand(void)
+{
+	if (!Sim_MotorsEnabled())
+		return 0.0;
+
+	// loop() sets GPIO 1 and 2 when the PID output is positive, GPIO 0 and 12 when it's negative.
+	double duty = (motorDuty[0] + motorDuty[1]) / 2000.0;
+	if (gpioOutputs[OS_HAL_GPIO_1] && gpioOutputs[OS_HAL_GPIO_2])
+		return duty;
+	if (gpioOutputs[OS_HAL_GPIO_0] && gpioOutputs[OS_HAL_GPIO_12])
+		return -duty;
+	return 0.0;
+}
+
+// IMU.
+void ReadImuOrientation(float* roll, float* heading)
+{
+	*roll = simSensors.roll;
+	*heading = simSensors.heading;
+}
+
+// VL53L1X and the I2C fan out selecting the front/rear sensor.
+bool SelectFanoutChannel(uint8_t channelNumber)
+{
+	fanoutChannel = channelNumber;
+	return true;
+}
+
+// each sensor ranges continuously: a new measurement is ready every period_ms.
+static uint32_t tofPeriodMs[2] = { 50, 50 };
+static unsigned long tofReadyMs[2];
+static unsigned long tofReads[2];
+
+static int FanoutIndex(void)
+{
+	return fanoutChannel == 1 ? 0 : 1;
+}
+
+void VL53L1X_setActiveLaser(uint8_t laserNum) { (void)laserNum; }
+bool VL53L1X_init(bool io_2v8) { (void)io_2v8; return true; }
+bool VL53L1X_setDistanceMode(enum DistanceMode mode) { (void)mode; return true; }
+bool VL53L1X_setMeasurementTimingBudget(uint32_t budget_us) { (void)budget_us; return true; }
+
+void VL53L1X_startContinuous(uint32_t period_ms)
+{
+	tofPeriodMs[FanoutIndex()] = period_ms;
+	tofReadyMs[FanoutIndex()] = simTimeMs + period_ms;
+}
+
+bool VL53L1X_dataReady(void)
+{
+	return simTimeMs >= tofReadyMs[FanoutIndex()];
+}
+
+uint16_t VL53L1X_read(bool blocking)
+{
+	int index = FanoutIndex();
+	(void)blocking;
+
+	// the next measurement completes one period after the last one.
+	uint32_t period = tofPeriodMs[index];
+	while (tofReadyMs[index] <= simTimeMs)
+		tofReadyMs[index] += period;
+	tofReads[index]++;
+	return simSensors.tofDistance[index];
+}
+
+unsigned long Sim_GetToFReadCount(bool front)
+{
+	return tofReads[front ? 0 : 1];
+}
+
+// ThreadX: time is simulated, the threads and timer are never started.
+ULONG tx_time_get(void) { return simTimeMs; }
+unsigned long millis(void) { return simTimeMs; }
+UINT tx_thread_sleep(ULONG timer_ticks) { (void)timer_ticks; return TX_SUCCESS; }
+void tx_kernel_enter(void) { }
+UINT tx_event_flags_create(TX_EVENT_FLAGS_GROUP* group_ptr, CHAR* name_ptr) { (void)name_ptr; group_ptr->flags = 0; return TX_SUCCESS; }
+UINT tx_event_flags_set(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG flags_to_set, UINT set_option) { (void)set_option; group_ptr->flags |= flags_to_set; return TX_SUCCESS; }
+UINT tx_event_flags_get(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG requested_flags, UINT get_option,
+	ULONG* actual_flags_ptr, ULONG wait_option)
+{
+	(void)wait_option;
+	*actual_flags_ptr = group_ptr->flags & requested_flags;
+	if (get_option == TX_OR_CLEAR)
+		group_ptr->flags &= ~requested_flags;
+	return TX_SUCCESS;
+}
+UINT tx_byte_pool_create(TX_BYTE_POOL* pool_ptr, CHAR* name_ptr, VOID* pool_start, ULONG pool_size) { (void)pool_ptr; (void)name_ptr; (void)pool_start; (void)pool_size; return TX_SUCCESS; }
+UINT tx_byte_allocate(TX_BYTE_POOL* pool_ptr, VOID** memory_ptr, ULONG memory_size, ULONG wait_option) { (void)pool_ptr; (void)memory_size; (void)wait_option; *memory_ptr = NULL; return TX_SUCCESS; }
+UINT tx_thread_create(TX_THREAD* thread_ptr, CHAR* name_ptr, VOID (*entry_function)(ULONG), ULONG entry_input,
+	VOID* stack_start, ULONG stack_size, UINT priority, UINT preempt_threshold, ULONG time_slice, UINT auto_start)
+{
+	(void)thread_ptr; (void)name_ptr; (void)entry_function; (void)entry_input; (void)stack_start;
+	(void)stack_size; (void)priority; (void)preempt_threshold; (void)time_slice; (void)auto_start;
+	return TX_SUCCESS;
+}
+UINT tx_timer_create(TX_TIMER* timer_ptr, CHAR* name_ptr, VOID (*expiration_function)(ULONG), ULONG expiration_input,
+	ULONG initial_ticks, ULONG reschedule_ticks, UINT auto_activate)
+{
+	(void)timer_ptr; (void)name_ptr; (void)expiration_function; (void)expiration_input;
+	(void)initial_ticks; (void)reschedule_ticks; (void)auto_activate;
+	return TX_SUCCESS;
+}
+
+// GPIO, PWM and I2C.
+int mtk_os_hal_gpio_set_direction(os_hal_gpio_pin pin, os_hal_gpio_direction dir) { (void)pin; (void)dir; return 0; }
+
+int mtk_os_hal_gpio_set_output(os_hal_gpio_pin pin, int out_val)
+{
+	if (pin < OS_HAL_GPIO_MAX)
+		gpioOutputs[pin] = out_val;
+	return 0;
+}
+
+int mtk_os_hal_pwm_ctlr_init(pwm_groups group_num, uint32_t channel_bit_map) { (void)group_num; (void)channel_bit_map; return 0; }
+int mtk_os_hal_pwm_feature_enable(pwm_groups group_num, uint32_t pwm_num, uint8_t global_kick_enable,
+	uint8_t io_ctrl_sel, uint8_t polarity_set)
+{
+	(void)group_num; (void)pwm_num; (void)global_kick_enable; (void)io_ctrl_sel; (void)polarity_set;
+	return 0;
+}
+
+int mtk_os_hal_pwm_config_freq_duty_normal(pwm_groups group_num, uint32_t pwm_num, uint32_t frequency,
+	uint32_t duty_cycle)
+{
+	(void)frequency;
+	if (group_num == OS_HAL_PWM_GROUP1 && pwm_num == PWM_CHANNEL0)
+		motorDuty[0] = duty_cycle;
+	if (group_num == OS_HAL_PWM_GROUP1 && pwm_num == PWM_CHANNEL1)
+		motorDuty[1] = duty_cycle;
+	return 0;
+}
+
+int mtk_os_hal_pwm_start_normal(pwm_groups group_num, uint32_t pwm_num) { (void)group_num; (void)pwm_num; return 0; }
+int mtk_os_hal_i2c_ctrl_init(i2c_num bus_num) { (void)bus_num; return 0; }
+int mtk_os_hal_i2c_speed_init(i2c_num bus_num, I2C_SPEED_KHZ speed) { (void)bus_num; (void)speed; return 0; }
+
+// Intercore messages and the loop trace go nowhere.
+int GetIntercoreBuffers(BufferHeader** outbound, BufferHeader** inbound, uint32_t* incomingBufferSize)
+{
+	*outbound = NULL;
+	*inbound = NULL;
+	*incomingBufferSize = 0;
+	return 0;
+}
+
+int EnqueueData(BufferHeader* inbound, BufferHeader* outbound, uint32_t bufSize, const void* src, uint32_t dataSize)
+{
+	(void)inbound; (void)outbound; (void)bufSize; (void)src; (void)dataSize;
+	return 0;
+}
+
+int DequeueData(BufferHeader* outbound, BufferHeader* inbound, uint32_t bufSize, void* dest, uint32_t* dataSize)
+{
+	(void)outbound; (void)inbound; (void)bufSize; (void)dest; (void)dataSize;
+	return -1;
+}
+
+void EnableIntercoreInterrupt(IntercoreInterruptCallback callback) { (void)callback; }
+void LoopTrace_Init(uint16_t periodUs) { (void)periodUs; }
+void LoopTrace_Enable(bool enable) { (void)enable; }
+uint32_t LoopTrace_Start(void) { return 0; }
+bool LoopTrace_End(uint32_t startCycles, double traceInput, double traceOutput, uint16_t tofFront, uint16_t tofRear)
+{
+	(void)startCycles; (void)traceInput; (void)traceOutput; (void)tofFront; (void)tofRear;
+	return false;
+}
+bool LoopTrace_ReadBatch(struct LOOP_TRACE* batch) { (void)batch; return false; }
+size_t LoopTrace_BatchSize(const struct LOOP_TRACE* batch) { (void)batch; return 0; }
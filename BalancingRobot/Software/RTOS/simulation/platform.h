@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// rtos_app.c functions driven by the simulation, in place of the ThreadX threads and timer.
+bool InitHardware(void);
+unsigned long loop(void);
+bool ToF_Init(void);
+void ToF_Update(void);
+extern double input, output;		// PID input (roll) and output.
+extern unsigned long ToF_ObstacleCounter;
+
+// sensor values returned to the control code by the simulated IMU and VL53L1X sensors.
+typedef struct {
+	float roll;
+	float heading;
+	uint16_t tofDistance[2];	// front, rear (mm).
+} SimSensors;
+
+extern SimSensors simSensors;
+
+// simulated millisecond tick (tx_time_get/millis).
+void Sim_SetTime(unsigned long ms);
+
+// motor drive from the GPIO/PWM outputs, -1 to 1: positive when the control loop sets the
+// direction pins for a positive PID output, 0 while the motor driver is disabled.
+double Sim_GetMotorCommand(void);
+bool Sim_MotorsEnabled(void);
+
+// number of VL53L1X measurements read from the front/rear sensor.
+unsigned long Sim_GetToFReadCount(bool front);
@@ -0,0 +1,2 @@
+// Host simulation: not used by the control code.
+#pragma once
@@ -0,0 +1,15 @@
+// Host simulation: GPIO outputs are captured by platform.c (motor direction and enable).
+#pragma once
+#include <stdint.h>
+
+typedef enum {
+	OS_HAL_GPIO_0 = 0, OS_HAL_GPIO_1, OS_HAL_GPIO_2, OS_HAL_GPIO_3, OS_HAL_GPIO_4, OS_HAL_GPIO_5,
+	OS_HAL_GPIO_6, OS_HAL_GPIO_7, OS_HAL_GPIO_8, OS_HAL_GPIO_9, OS_HAL_GPIO_10, OS_HAL_GPIO_11,
+	OS_HAL_GPIO_12, OS_HAL_GPIO_13, OS_HAL_GPIO_14, OS_HAL_GPIO_15, OS_HAL_GPIO_16,
+	OS_HAL_GPIO_MAX
+} os_hal_gpio_pin;
+
+typedef enum { OS_HAL_GPIO_DIR_INPUT = 0, OS_HAL_GPIO_DIR_OUTPUT = 1 } os_hal_gpio_direction;
+
+int mtk_os_hal_gpio_set_direction(os_hal_gpio_pin pin, os_hal_gpio_direction dir);
+int mtk_os_hal_gpio_set_output(os_hal_gpio_pin pin, int out_val);
@@ -0,0 +1,9 @@
+// Host simulation: I2C is not used, the sensors are simulated (platform.c).
+#pragma once
+#include <stdint.h>
+
+typedef enum { OS_HAL_I2C_ISU0 = 0, OS_HAL_I2C_ISU1, OS_HAL_I2C_ISU2, OS_HAL_I2C_ISU3, OS_HAL_I2C_ISU4 } i2c_num;
+typedef enum { I2C_SCL_50kHz = 0, I2C_SCL_100kHz, I2C_SCL_200kHz, I2C_SCL_400kHz, I2C_SCL_1000kHz } I2C_SPEED_KHZ;
+
+int mtk_os_hal_i2c_ctrl_init(i2c_num bus_num);
+int mtk_os_hal_i2c_speed_init(i2c_num bus_num, I2C_SPEED_KHZ speed);
@@ -0,0 +1,17 @@
+// Host simulation: PWM duty cycles are captured by platform.c (motor speed).
+#pragma once
+#include <stdint.h>
+
+typedef enum { OS_HAL_PWM_GROUP0 = 0, OS_HAL_PWM_GROUP1, OS_HAL_PWM_GROUP2 } pwm_groups;
+
+#define PWM_CHANNEL0 (1U << 0)
+#define PWM_CHANNEL1 (1U << 1)
+#define PWM_CHANNEL2 (1U << 2)
+#define PWM_CHANNEL3 (1U << 3)
+
+int mtk_os_hal_pwm_ctlr_init(pwm_groups group_num, uint32_t channel_bit_map);
+int mtk_os_hal_pwm_feature_enable(pwm_groups group_num, uint32_t pwm_num, uint8_t global_kick_enable,
+	uint8_t io_ctrl_sel, uint8_t polarity_set);
+int mtk_os_hal_pwm_config_freq_duty_normal(pwm_groups group_num, uint32_t pwm_num, uint32_t frequency,
+	uint32_t duty_cycle);
+int mtk_os_hal_pwm_start_normal(pwm_groups group_num, uint32_t pwm_num);
@@ -0,0 +1,3 @@
+// Host simulation: the BSP printf is the C library one.
+#pragma once
+#include <stdio.h>
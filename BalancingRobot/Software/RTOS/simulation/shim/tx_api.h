@@ -0,0 +1,39 @@
+// Host simulation: the parts of the Azure RTOS (ThreadX) API used by rtos_app.c.
+// Time is simulated (see platform.c), threads are never started.
+#pragma once
+#include <stdint.h>
+
+typedef unsigned long ULONG;
+typedef unsigned int UINT;
+typedef char CHAR;
+typedef unsigned char UCHAR;
+typedef void VOID;
+
+typedef struct { int unused; } TX_THREAD;
+typedef struct { int unused; } TX_TIMER;
+typedef struct { ULONG flags; } TX_EVENT_FLAGS_GROUP;
+typedef struct { int unused; } TX_BYTE_POOL;
+typedef struct { int unused; } TX_BLOCK_POOL;
+
+#define TX_SUCCESS 0
+#define TX_OR 0
+#define TX_OR_CLEAR 1
+#define TX_NO_WAIT 0
+#define TX_WAIT_FOREVER 0xFFFFFFFFUL
+#define TX_NO_TIME_SLICE 0
+#define TX_AUTO_START 1
+#define TX_AUTO_ACTIVATE 1
+
+ULONG tx_time_get(void);
+UINT tx_thread_sleep(ULONG timer_ticks);
+void tx_kernel_enter(void);
+UINT tx_event_flags_create(TX_EVENT_FLAGS_GROUP* group_ptr, CHAR* name_ptr);
+UINT tx_event_flags_set(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG flags_to_set, UINT set_option);
+UINT tx_event_flags_get(TX_EVENT_FLAGS_GROUP* group_ptr, ULONG requested_flags, UINT get_option,
+	ULONG* actual_flags_ptr, ULONG wait_option);
+UINT tx_byte_pool_create(TX_BYTE_POOL* pool_ptr, CHAR* name_ptr, VOID* pool_start, ULONG pool_size);
+UINT tx_byte_allocate(TX_BYTE_POOL* pool_ptr, VOID** memory_ptr, ULONG memory_size, ULONG wait_option);
+UINT tx_thread_create(TX_THREAD* thread_ptr, CHAR* name_ptr, VOID (*entry_function)(ULONG), ULONG entry_input,
+	VOID* stack_start, ULONG stack_size, UINT priority, UINT preempt_threshold, ULONG time_slice, UINT auto_start);
+UINT tx_timer_create(TX_TIMER* timer_ptr, CHAR* name_ptr, VOID (*expiration_function)(ULONG), ULONG expiration_input,
+	ULONG initial_ticks, ULONG reschedule_ticks, UINT auto_activate);
@@ -0,0 +1,479 @@
+// Host simulation of the balancing robot control loop: runs loop() from rtos_app.c, with the PID
+// controllers from PID_v1.c and PID.c, against a simulated plant or recorded sensor values.
+//
+//   balance_sim run [options]      closed loop against the inverted pendulum (plant.c)
+//   balance_sim bench [options]    controller execution time per step
+//   balance_sim replay FILE [options]  feed recorded sensor values through the controller
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "PID.h"
+#include "PID_v1.h"
+#include "plant.h"
+#include "platform.h"
+
+#define LOOP_PERIOD_MS 5
+#define TOF_PERIOD_LOOPS 2		// the ToF thread runs every 10ms.
+#define PLANT_STEPS_PER_LOOP 5	// 1ms plant steps.
+#define DEG_PER_RAD (180.0 / 3.14159265358979323846)
+
+typedef struct {
+	double seconds;
+	double tiltDeg;
+	double pushAt;		// s, 0 == no push.
+	double push;		// m/s^2 for 100ms.
+	double obstacleFront;
+	double obstacleRear;
+	double imuNoise;
+	double comHeight;
+	double maxWheelSpeed;
+	unsigned long steps;	// bench.
+	const char* csvPath;
+	unsigned int seed;
+} Options;
+
+static void Usage(void)
+{
+	fprintf(stderr,
+		"usage: balance_sim run [options]\n"
+		"       balance_sim bench [--steps N]\n"
+		"       balance_sim replay FILE [--csv OUT]\n"
+		"options:\n"
+		"  --seconds S          simulated time (default 20)\n"
+		"  --tilt DEG           tilt from balanced when released (default 1)\n"
+		"  --push T:ACCEL       push of ACCEL m/s^2 for 100ms at T seconds\n"
+		"  --obstacle-front M   obstacle M metres ahead\n"
+		"  --obstacle-rear M    obstacle M metres behind\n"
+		"  --noise DEG          IMU roll noise (default 0.002)\n"
+		"  --com-height M       wheel axle to centre of mass (default 0.08)\n"
+		"  --max-speed V        wheel speed at full duty, m/s (default 1)\n"
+		"  --steps N            bench: control loop iterations (default 200000)\n"
+		"  --seed N             random seed (default 1)\n"
+		"  --csv FILE           run: write every control loop iteration from the release to FILE, in the\n"
+		"                       replay format; replay: write the replayed output to FILE\n");
+}
+
+static bool ParseOptions(int argc, char** argv, int first, Options* options)
+{
+	for (int i = first; i < argc; i++)
+	{
+		const char* name = argv[i];
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "missing value for %s\n", name);
+			return false;
+		}
+		const char* value = argv[++i];
+
+		if (strcmp(name, "--seconds") == 0)
+			options->seconds = atof(value);
+		else if (strcmp(name, "--tilt") == 0)
+			options->tiltDeg = atof(value);
+		else if (strcmp(name, "--push") == 0)
+		{
+			if (sscanf(value, "%lf:%lf", &options->pushAt, &options->push) != 2)
+			{
+				fprintf(stderr, "--push expects T:ACCEL\n");
+				return false;
+			}
+		}
+		else if (strcmp(name, "--obstacle-front") == 0)
+			options->obstacleFront = atof(value);
+		else if (strcmp(name, "--obstacle-rear") == 0)
+			options->obstacleRear = atof(value);
+		else if (strcmp(name, "--noise") == 0)
+			options->imuNoise = atof(value);
+		else if (strcmp(name, "--com-height") == 0)
+			options->comHeight = atof(value);
+		else if (strcmp(name, "--max-speed") == 0)
+			options->maxWheelSpeed = atof(value);
+		else if (strcmp(name, "--steps") == 0)
+			options->steps = strtoul(value, NULL, 10);
+		else if (strcmp(name, "--seed") == 0)
+			options->seed = (unsigned int)strtoul(value, NULL, 10);
+		else if (strcmp(name, "--csv") == 0)
+			options->csvPath = value;
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", name);
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint64_t NowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int CompareUint32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// sorts the samples. 'unit' names what was timed per sample ("steps", or "batches" of steps timed together).
+static void PrintTimings(const char* name, uint32_t* samples, size_t count, const char* unit)
+{
+	if (count == 0)
+	{
+		printf("%-28s no samples\n", name);
+		return;
+	}
+	qsort(samples, count, sizeof(samples[0]), CompareUint32);
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; i++)
+		total += samples[i];
+	printf("%-28s %8zu %-7s  min %6u  median %6u  p99 %6u  max %7u  mean %8.1f ns\n", name, count, unit,
+		samples[0], samples[count / 2], samples[(count * 99) / 100], samples[count - 1], (double)total / count);
+}
+
+// the control loop and ToF thread, at the time of the given iteration.
+static uint32_t RunControlStep(unsigned long iteration)
+{
+	Sim_SetTime(iteration * LOOP_PERIOD_MS);
+
+	uint64_t start = NowNs();
+	loop();
+	uint32_t elapsed = (uint32_t)(NowNs() - start);
+
+	if (iteration % TOF_PERIOD_LOOPS == 0)
+		ToF_Update();
+	return elapsed;
+}
+
+static void InitController(void)
+{
+	Sim_SetTime(0);
+	InitHardware();
+	ToF_Init();
+}
+
+static void InitPlant(Plant* plant, const Options* options)
+{
+	Plant_Init(plant, options->tiltDeg);
+	plant->imuNoise = options->imuNoise;
+	if (options->comHeight > 0)
+		plant->comHeight = options->comHeight;
+	if (options->maxWheelSpeed > 0)
+		plant->maxWheelSpeed = options->maxWheelSpeed;
+	plant->obstacleFront = options->obstacleFront;
+	plant->obstacleRear = options->obstacleRear;
+}
+
+// read the sensors, run the controller, then the plant until the next iteration.
+static uint32_t ClosedLoopStep(Plant* plant, unsigned long iteration, const Options* options)
+{
+	simSensors.roll = Plant_ImuRoll(plant);
+	simSensors.heading = 0.0f;
+	simSensors.tofDistance[0] = Plant_ToFDistance(plant, true);
+	simSensors.tofDistance[1] = Plant_ToFDistance(plant, false);
+
+	uint32_t elapsed = RunControlStep(iteration);
+
+	// held upright until the control loop enables the motors.
+	if (plant->held && Sim_MotorsEnabled())
+		plant->held = false;
+
+	double command = Sim_GetMotorCommand();
+	for (int i = 0; i < PLANT_STEPS_PER_LOOP; i++)
+	{
+		double t = (iteration * LOOP_PERIOD_MS + i) / 1000.0;
+		double disturbance = (options->pushAt > 0 && t >= options->pushAt && t < options->pushAt + 0.1) ? options->push : 0.0;
+		Plant_Step(plant, 0.001, command, disturbance);
+	}
+	return elapsed;
+}
+
+static int Run(const Options* options)
+{
+	FILE* csv = NULL;
+	if (options->csvPath)
+	{
+		csv = fopen(options->csvPath, "w");
+		if (!csv)
+		{
+			perror(options->csvPath);
+			return 1;
+		}
+		// the replay columns first, so that the file can be replayed.
+		fprintf(csv, "roll,heading,tof_front,tof_rear,output,time_ms,motor_command,angle_deg,position_m\n");
+	}
+
+	Plant plant;
+	InitPlant(&plant, options);
+	InitController();
+
+	unsigned long iterations = (unsigned long)(options->seconds * 1000 / LOOP_PERIOD_MS);
+	long releasedAt = -1;
+	long fellAt = -1;
+	double maxAngle = 0, sumSquares = 0, maxPosition = 0, minTofDistance = 0;
+	unsigned long settledSamples = 0, saturated = 0;
+
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		ClosedLoopStep(&plant, i, options);
+		double angleDeg = plant.angle * DEG_PER_RAD;
+
+		if (plant.held)
+			continue;
+		// from the release, like a recording on the robot once it balances.
+		if (csv)
+		{
+			fprintf(csv, "%.9g,%.9g,%u,%u,%.9g,%lu,%.3f,%.3f,%.4f\n", simSensors.roll, simSensors.heading,
+				simSensors.tofDistance[0], simSensors.tofDistance[1], output, i * LOOP_PERIOD_MS, Sim_GetMotorCommand(),
+				angleDeg, plant.position);
+		}
+		if (releasedAt < 0)
+			releasedAt = (long)i;
+		if (fellAt < 0 && Plant_Fallen(&plant))
+			fellAt = (long)i;
+		if (fellAt >= 0)
+			continue;
+
+		if (fabs(angleDeg) > maxAngle)
+			maxAngle = fabs(angleDeg);
+		if (fabs(plant.position) > fabs(maxPosition))
+			maxPosition = plant.position;
+		if (fabs(Sim_GetMotorCommand()) >= 1.0)
+			saturated++;
+		for (int s = 0; s < 2; s++)
+		{
+			if (simSensors.tofDistance[s] != 0 && (minTofDistance == 0 || simSensors.tofDistance[s] < minTofDistance))
+				minTofDistance = simSensors.tofDistance[s];
+		}
+		// RMS once the release transient (1s) is over.
+		if ((long)i - releasedAt >= 1000 / LOOP_PERIOD_MS)
+		{
+			sumSquares += angleDeg * angleDeg;
+			settledSamples++;
+		}
+	}
+
+	if (csv)
+		fclose(csv);
+
+	if (releasedAt < 0)
+	{
+		printf("never released: the IMU didn't settle or the motors were never enabled\n");
+		return 1;
+	}
+	printf("released at     %.3f s\n", releasedAt * LOOP_PERIOD_MS / 1000.0);
+	if (fellAt >= 0)
+		printf("FELL at         %.3f s\n", fellAt * LOOP_PERIOD_MS / 1000.0);
+	printf("max angle       %.3f deg\n", maxAngle);
+	printf("rms angle       %.3f deg (after the first second)\n", settledSamples ? sqrt(sumSquares / settledSamples) : 0.0);
+	printf("max position    %.3f m, final %.3f m\n", maxPosition, plant.position);
+	printf("saturated       %.1f %% of steps\n", 100.0 * saturated / (iterations - releasedAt));
+	if (minTofDistance > 0)
+		printf("closest ToF     %.0f mm, %lu obstacle(s) detected\n", minTofDistance, ToF_ObstacleCounter);
+	printf("ToF reads       front %.1f/s, rear %.1f/s\n", Sim_GetToFReadCount(true) / options->seconds, Sim_GetToFReadCount(false) / options->seconds);
+	return fellAt >= 0 ? 2 : 0;
+}
+
+static int Bench(const Options* options)
+{
+	uint32_t* loopNs = malloc(options->steps * sizeof(uint32_t));
+	if (!loopNs)
+		return 1;
+
+	// loop() in closed loop, once the motors are running.
+	Plant plant;
+	InitPlant(&plant, options);
+	InitController();
+	size_t count = 0;
+	for (unsigned long i = 0; i < options->steps; i++)
+	{
+		uint32_t elapsed = ClosedLoopStep(&plant, i, options);
+		if (!plant.held && !Plant_Fallen(&plant))
+			loopNs[count++] = elapsed;
+	}
+	PrintTimings("loop()", loopNs, count, "steps");
+
+	// the PID updates alone, in batches to amortise the clock reads: each sample is the mean time per update of a batch.
+	const size_t batch = 100;
+	size_t batches = options->steps / batch;
+	double value = 90.0;
+
+	// Compute() only runs once per sample time: advance the clock between the calls.
+	unsigned long now = options->steps * LOOP_PERIOD_MS;
+	for (size_t b = 0; b < batches; b++)
+	{
+		uint64_t start = NowNs();
+		for (size_t i = 0; i < batch; i++)
+		{
+			now += LOOP_PERIOD_MS;
+			Sim_SetTime(now);
+			input = value + 0.01 * (double)((b * batch + i) % 50);
+			Compute();
+		}
+		loopNs[b] = (uint32_t)((NowNs() - start) / batch);
+	}
+	PrintTimings("Compute() (PID_v1)", loopNs, batches, "batches");
+
+	PIDController pid = { 2.2f, 0.5f, -0.25f, 0.05f, -1.5f, 1.5f, 0.05f };
+	PIDController_Init(&pid);
+	volatile float sink = 0;
+	for (size_t b = 0; b < batches; b++)
+	{
+		uint64_t start = NowNs();
+		for (size_t i = 0; i < batch; i++)
+		{
+			sink += PIDController_Update(&pid, 0.0f, (float)((b * batch + i) % 50) * 0.1f);
+		}
+		loopNs[b] = (uint32_t)((NowNs() - start) / batch);
+	}
+	PrintTimings("PIDController_Update (PID)", loopNs, batches, "batches");
+
+	free(loopNs);
+	return 0;
+}
+
+// CSV: roll,heading,tof_front,tof_rear[,output] - one control loop iteration per line.
+static int Replay(const char* path, const Options* options)
+{
+	FILE* in = fopen(path, "r");
+	if (!in)
+	{
+		perror(path);
+		return 1;
+	}
+	FILE* csv = NULL;
+	if (options->csvPath)
+	{
+		csv = fopen(options->csvPath, "w");
+		if (!csv)
+		{
+			perror(options->csvPath);
+			fclose(in);
+			return 1;
+		}
+		fprintf(csv, "time_ms,roll,output,recorded_output\n");
+	}
+
+	InitController();
+
+	char line[256];
+	unsigned long iteration = 0;
+	unsigned long compared = 0;
+	double maxDiff = 0, sumSquares = 0;
+	bool primed = false;
+	size_t capacity = 4096, count = 0;
+	uint32_t* loopNs = malloc(capacity * sizeof(uint32_t));
+
+	while (loopNs && fgets(line, sizeof(line), in))
+	{
+		float roll, heading;
+		unsigned int tofFront, tofRear;
+		double recorded;
+		int fields = sscanf(line, "%f,%f,%u,%u,%lf", &roll, &heading, &tofFront, &tofRear, &recorded);
+		if (fields < 4)
+			continue;	// header or blank line.
+
+		simSensors.roll = roll;
+		simSensors.heading = heading;
+		simSensors.tofDistance[0] = (uint16_t)tofFront;
+		simSensors.tofDistance[1] = (uint16_t)tofRear;
+
+		// the recording starts mid-run: fill the roll history loop() checks for a stable IMU with the
+		// first sample, so that the controller runs from the first recorded iteration.
+		if (!primed)
+		{
+			for (int i = 0; i < 199; i++)
+				RunControlStep(iteration++);
+			primed = true;
+		}
+
+		uint32_t elapsed = RunControlStep(iteration++);
+		if (count == capacity)
+		{
+			capacity *= 2;
+			uint32_t* grown = realloc(loopNs, capacity * sizeof(uint32_t));
+			if (!grown)
+				break;
+			loopNs = grown;
+		}
+		loopNs[count++] = elapsed;
+
+		if (fields == 5)
+		{
+			double diff = fabs(output - recorded);
+			if (diff > maxDiff)
+				maxDiff = diff;
+			sumSquares += diff * diff;
+			compared++;
+		}
+		if (csv)
+		{
+			if (fields == 5)
+				fprintf(csv, "%lu,%.3f,%.3f,%.3f\n", iteration * LOOP_PERIOD_MS, roll, output, recorded);
+			else
+				fprintf(csv, "%lu,%.3f,%.3f,\n", iteration * LOOP_PERIOD_MS, roll, output);
+		}
+	}
+
+	fclose(in);
+	if (csv)
+		fclose(csv);
+
+	printf("replayed        %zu iterations\n", count);
+	if (compared > 0)
+		printf("output vs recorded  max diff %.3f, rms diff %.3f (%lu iterations)\n", maxDiff, sqrt(sumSquares / compared), compared);
+	PrintTimings("loop()", loopNs, count, "steps");
+	free(loopNs);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	Options options = {
+		.seconds = 20, .tiltDeg = 1, .imuNoise = 0.002, .steps = 200000, .seed = 1
+	};
+
+	if (argc < 2)
+	{
+		Usage();
+		return 1;
+	}
+
+	const char* command = argv[1];
+	const char* replayPath = NULL;
+	int first = 2;
+	if (strcmp(command, "replay") == 0)
+	{
+		if (argc < 3)
+		{
+			Usage();
+			return 1;
+		}
+		replayPath = argv[2];
+		first = 3;
+	}
+
+	if (!ParseOptions(argc, argv, first, &options))
+	{
+		Usage();
+		return 1;
+	}
+	srand(options.seed);
+
+	if (strcmp(command, "run") == 0)
+		return Run(&options);
+	if (strcmp(command, "bench") == 0)
+		return Bench(&options);
+	if (replayPath)
+		return Replay(replayPath, &options);
+
+	Usage();
+	return 1;
+}
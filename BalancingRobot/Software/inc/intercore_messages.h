@@ -141,6 +141,7 @@ struct REMOTE_CMD
 {
     uint8_t id; // MSG_REMOTE_CMD
     uint8_t cmd;    // 0-4 (left, right, foreward, back, stop).
+    uint16_t sequence;  // echoed in MSG_REMOTE_CMD_ACK.
 };
 
 #define MSG_UPDATE_ACTIVE 0x10
@@ -149,3 +150,46 @@ struct UPDATE_ACTIVE
     uint8_t id; // MSG_UPDATE_ACTIVE
     bool updateActive;
 };
+
+// M4 to A7, once the motor outputs have been updated with a remote command.
+// The A7 measures the command-to-actuation latency from when it queued the command,
+// the M4 timings (ms ticks) split it into mailbox and control loop delays.
+#define MSG_REMOTE_CMD_ACK 0x11
+struct REMOTE_CMD_ACK
+{
+    uint8_t id; // MSG_REMOTE_CMD_ACK
+    uint16_t sequence;  // of the MSG_REMOTE_CMD.
+    uint32_t queuedMs;  // mailbox interrupt to dequeued by the intercore thread.
+    uint32_t actuationMs;   // dequeued to motor outputs updated by the control loop.
+};
+
+// A7 to M4, start/stop streaming the control loop trace (MSG_LOOP_TRACE).
+#define MSG_LOOP_TRACE_CONTROL 0x12
+struct LOOP_TRACE_CONTROL
+{
+    uint8_t id; // MSG_LOOP_TRACE_CONTROL
+    bool enabled;
+};
+
+// M4 to A7, a batch of consecutive control loop iterations.
+// The A7 forwards the message as is over UDP.
+#define MSG_LOOP_TRACE 0x13
+#define LOOP_TRACE_BATCH_SIZE 16
+struct LOOP_TRACE_SAMPLE
+{
+    int16_t jitterUs;   // start time minus the nominal start time (previous start + periodUs).
+    uint16_t execUs;    // time spent in the control loop.
+    int16_t input;      // PID input (roll), 1/100 degree.
+    int16_t output;     // PID output, 1/100.
+    uint16_t tofDistance[2];    // front and rear ToF sensors, mm.
+};
+
+struct LOOP_TRACE
+{
+    uint8_t id; // MSG_LOOP_TRACE
+    uint8_t count;  // samples used.
+    uint16_t periodUs;  // nominal control loop period.
+    uint32_t firstIteration;    // iteration of samples[0], the others follow on.
+    uint32_t dropped;   // iterations missing before samples[0] (trace buffer full).
+    struct LOOP_TRACE_SAMPLE samples[LOOP_TRACE_BATCH_SIZE];
+};
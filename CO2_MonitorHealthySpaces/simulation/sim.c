@@ -0,0 +1,415 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Runs the telemetry aggregator against synthetic sensor series, the way main.c drives it: a sample at the interval
+// the aggregator asks for, and a message every 20 seconds. The batches are decoded and checked against the samples,
+// the window statistics against a direct computation. Exit code 0 if everything matches.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry_aggregator.h"
+
+#define PUBLISH_INTERVAL 20
+#define JSON_MESSAGE_BYTES 2048
+#define START_UTC 1700000000
+
+// Same settings as main.h
+static AGGREGATOR_CONFIG aggregator_config = {
+    .windows = {60, 300, 900},
+    .window_count = 3,
+    .sample_interval = 20,
+    .fast_sample_interval = 5,
+    .fast_threshold = {[AGGREGATOR_CO2PPM] = 50, [AGGREGATOR_TEMPERATURE] = 1, [AGGREGATOR_HUMIDITY] = 5},
+    .fast_hold_samples = 12,
+    .max_batch_samples = 64};
+
+static const char *metric_names[AGGREGATOR_METRIC_COUNT] = {"co2ppm", "temperature", "humidity", "pressure"};
+
+typedef struct
+{
+    uint32_t timestamp;
+    int values[AGGREGATOR_METRIC_COUNT];
+} SAMPLE;
+
+// Every sample added, and every sample received by the "cloud" after decoding the batches
+#define MAX_RECORDED 20000
+static SAMPLE added[MAX_RECORDED];
+static size_t added_count;
+static SAMPLE received[MAX_RECORDED];
+static size_t received_count;
+static unsigned long lost_reported;
+
+static int failures;
+
+#define CHECK(condition, ...)          \
+    do                                 \
+    {                                  \
+        if (!(condition))              \
+        {                              \
+            printf("FAIL: ");          \
+            printf(__VA_ARGS__);       \
+            printf("\n");              \
+            failures++;                \
+        }                              \
+    } while (0)
+
+/***********************************************************************************************************
+ * Synthetic sensor series
+ **********************************************************************************************************/
+
+typedef enum
+{
+    SERIES_STEADY, // Occupied room at a steady level, with sensor noise
+    SERIES_RAMP,   // CO2 rising slowly as people come in, then falling quickly as the room is ventilated
+    SERIES_SPIKE,  // A short CO2 spike, e.g. someone breathing on the sensor
+    SERIES_STEP,   // Temperature and humidity step, e.g. a window opened
+    SERIES_COUNT
+} SERIES;
+
+static const char *series_names[SERIES_COUNT] = {"steady", "ramp", "spike", "step"};
+
+static int noise(int amplitude)
+{
+    return amplitude == 0 ? 0 : (rand() % (2 * amplitude + 1)) - amplitude;
+}
+
+static void series_read(SERIES series, uint32_t t, int values[AGGREGATOR_METRIC_COUNT])
+{
+    int co2 = 650;
+    int temperature = 22;
+    int humidity = 45;
+
+    switch (series)
+    {
+    case SERIES_STEADY:
+        break;
+    case SERIES_RAMP:
+        // Up 900 ppm in 30 minutes, under the fast sampling threshold, then down in 3 minutes
+        co2 += t < 1800 ? (int)(t * 900 / 1800) : t < 1980 ? (int)(900 - (t - 1800) * 900 / 180) : 0;
+        break;
+    case SERIES_SPIKE:
+        co2 += t >= 1800 && t < 1830 ? 900 : 0;
+        break;
+    case SERIES_STEP:
+        temperature -= t >= 1800 ? 4 : 0;
+        humidity += t >= 1800 ? 15 : 0;
+        break;
+    default:
+        break;
+    }
+
+    values[AGGREGATOR_CO2PPM] = co2 + noise(8);
+    // Temperature is reported in whole degrees, steady enough not to flicker
+    values[AGGREGATOR_TEMPERATURE] = temperature;
+    values[AGGREGATOR_HUMIDITY] = humidity + noise(1);
+    values[AGGREGATOR_PRESSURE] = 1013 + noise(1);
+}
+
+/***********************************************************************************************************
+ * Batch decoding, as the cloud side would do it
+ **********************************************************************************************************/
+
+static bool decode_array(const char *batch, const char *name, long *values, size_t max_values, size_t *count)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\":[", name);
+
+    const char *p = strstr(batch, key);
+    if (p == NULL)
+    {
+        return false;
+    }
+    p += strlen(key);
+
+    *count = 0;
+    while (*p != ']')
+    {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || *count == max_values)
+        {
+            return false;
+        }
+        values[(*count)++] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+/// <summary>
+/// Decode the batch of a message into received[], undoing the delta encoding
+/// </summary>
+/// <returns>Number of samples in the batch, or -1 if it doesn't decode</returns>
+static int decode_batch(const char *message)
+{
+    static long dt[AGGREGATOR_MAX_SAMPLES];
+    static long deltas[AGGREGATOR_MAX_SAMPLES];
+
+    const char *batch = strstr(message, "\"batch\":{");
+    if (batch == NULL)
+    {
+        return -1;
+    }
+
+    const char *lost = strstr(batch, "\"lost\":");
+    if (lost == NULL)
+    {
+        return -1;
+    }
+    lost_reported += strtoul(lost + 7, NULL, 10);
+
+    const char *t0 = strstr(batch, "\"t0\":");
+    if (t0 == NULL)
+    {
+        return 0;
+    }
+
+    size_t count;
+    if (!decode_array(batch, "dt", dt, AGGREGATOR_MAX_SAMPLES, &count))
+    {
+        return -1;
+    }
+
+    long long timestamp = strtoll(t0 + 5, NULL, 10) - START_UTC;
+    for (size_t i = 0; i < count; i++)
+    {
+        timestamp += dt[i];
+        received[received_count + i].timestamp = (uint32_t)timestamp;
+    }
+
+    for (int metric = 0; metric < AGGREGATOR_METRIC_COUNT; metric++)
+    {
+        size_t metric_count;
+        if (!decode_array(batch, metric_names[metric], deltas, AGGREGATOR_MAX_SAMPLES, &metric_count) || metric_count != count)
+        {
+            return -1;
+        }
+
+        long value = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            value += deltas[i];
+            received[received_count + i].values[metric] = (int)value;
+        }
+    }
+
+    received_count += count;
+    return (int)count;
+}
+
+/// <summary>
+/// Check the window statistics of a message against a direct computation over the samples added
+/// </summary>
+static void check_stats(const char *message, uint32_t now)
+{
+    for (size_t w = 0; w < aggregator_config.window_count; w++)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "\"%u\":{", aggregator_config.windows[w]);
+        const char *window = strstr(message, key);
+
+        for (int metric = 0; metric < AGGREGATOR_METRIC_COUNT; metric++)
+        {
+            static int values[AGGREGATOR_MAX_SAMPLES];
+            size_t n = 0;
+            long long sum = 0;
+
+            // The aggregator only keeps the last AGGREGATOR_MAX_SAMPLES samples
+            size_t oldest = added_count > AGGREGATOR_MAX_SAMPLES ? added_count - AGGREGATOR_MAX_SAMPLES : 0;
+            for (size_t i = oldest; i < added_count; i++)
+            {
+                if (now - added[i].timestamp < aggregator_config.windows[w])
+                {
+                    values[n++] = added[i].values[metric];
+                    sum += added[i].values[metric];
+                }
+            }
+
+            if (n == 0)
+            {
+                CHECK(window == NULL, "t=%u window %u reported without samples", now, aggregator_config.windows[w]);
+                continue;
+            }
+
+            long stats[4];
+            size_t count;
+            CHECK(window != NULL && decode_array(window, metric_names[metric], stats, 4, &count) && count == 4,
+                  "t=%u window %u %s missing", now, aggregator_config.windows[w], metric_names[metric]);
+            if (window == NULL)
+            {
+                continue;
+            }
+
+            // Insertion sort: a different algorithm from the aggregator's
+            for (size_t i = 1; i < n; i++)
+            {
+                int v = values[i];
+                size_t j = i;
+                for (; j > 0 && values[j - 1] > v; j--)
+                {
+                    values[j] = values[j - 1];
+                }
+                values[j] = v;
+            }
+
+            size_t rank = (size_t)((n * 95 + 99) / 100);
+            long expected[4] = {values[0], values[n - 1], (long)((sum + (sum < 0 ? -(long long)n : (long long)n) / 2) / (long long)n),
+                                values[rank - 1]};
+
+            for (int i = 0; i < 4; i++)
+            {
+                CHECK(stats[i] == expected[i], "t=%u window %u %s stat %d: %ld, expected %ld", now, aggregator_config.windows[w],
+                      metric_names[metric], i, stats[i], expected[i]);
+            }
+        }
+    }
+}
+
+/***********************************************************************************************************
+ * Simulation
+ **********************************************************************************************************/
+
+/// <summary>
+/// Run a series for a duration, publishing every 20 seconds except between offline_from and offline_to
+/// </summary>
+static void run(SERIES series, uint32_t duration, uint32_t offline_from, uint32_t offline_to)
+{
+    char message[JSON_MESSAGE_BYTES];
+    uint32_t next_sample = 0;
+    uint32_t next_publish = PUBLISH_INTERVAL;
+    unsigned long messages = 0, message_bytes = 0, batch_bytes = 0, batch_samples = 0, fast_samples = 0;
+    size_t max_message = 0;
+    uint32_t spike_seen_max = 0;
+
+    aggregator_init(&aggregator_config);
+    added_count = received_count = 0;
+    lost_reported = 0;
+    srand(1);
+
+    for (uint32_t t = 0; t <= duration; t++)
+    {
+        if (t == next_sample)
+        {
+            SAMPLE *sample = &added[added_count++];
+            sample->timestamp = t;
+            series_read(series, t, sample->values);
+            aggregator_add_sample(t, sample->values);
+
+            uint32_t interval = aggregator_next_sample_interval();
+            if (interval < aggregator_config.sample_interval)
+            {
+                fast_samples++;
+            }
+            next_sample = t + interval;
+        }
+
+        if (t == next_publish)
+        {
+            next_publish += PUBLISH_INTERVAL;
+
+            // What dx_jsonSerialize writes in main.c
+            snprintf(message, sizeof(message),
+                     "{\"msgId\":%lu,\"co2ppm\":%d,\"humidity\":%d,\"pressure\":%d,\"temperature\":%d,\"peakUserMemoryKiB\":%d,"
+                     "\"totalMemoryKiB\":%d}",
+                     messages, added[added_count - 1].values[AGGREGATOR_CO2PPM], added[added_count - 1].values[AGGREGATOR_HUMIDITY],
+                     added[added_count - 1].values[AGGREGATOR_PRESSURE], added[added_count - 1].values[AGGREGATOR_TEMPERATURE], 812,
+                     1904);
+
+            int samples_in_batch = aggregator_append_json(message, sizeof(message), t, START_UTC + t);
+            CHECK(samples_in_batch >= 0, "t=%u message doesn't fit", t);
+            if (samples_in_batch < 0)
+            {
+                continue;
+            }
+
+            check_stats(message, t);
+
+            AGGREGATOR_STATS stats;
+            if (aggregator_get_stats(AGGREGATOR_CO2PPM, 60, t, &stats) && (uint32_t)stats.max > spike_seen_max)
+            {
+                spike_seen_max = (uint32_t)stats.max;
+            }
+
+            if (t >= offline_from && t < offline_to)
+            {
+                continue;
+            }
+
+            size_t before = received_count;
+            int decoded = decode_batch(message);
+            CHECK(decoded == samples_in_batch, "t=%u decoded %d samples, batch has %d", t, decoded, samples_in_batch);
+            if (decoded != samples_in_batch)
+            {
+                received_count = before;
+                continue;
+            }
+
+            aggregator_batch_published((size_t)samples_in_batch);
+            messages++;
+            message_bytes += strlen(message);
+            batch_bytes += strlen(strstr(message, "\"batch\":{"));
+            batch_samples += (unsigned long)samples_in_batch;
+            if (strlen(message) > max_message)
+            {
+                max_message = strlen(message);
+            }
+        }
+    }
+
+    // Every sample the aggregator kept is received once, in order: the others are reported lost
+    CHECK(received_count + lost_reported + aggregator_pending_samples() == added_count,
+          "%s: %zu received + %lu lost + %zu pending, %zu added", series_names[series], received_count, lost_reported,
+          aggregator_pending_samples(), added_count);
+
+    size_t a = 0;
+    for (size_t r = 0; r < received_count; r++)
+    {
+        while (a < added_count && added[a].timestamp != received[r].timestamp)
+        {
+            a++;
+        }
+        CHECK(a < added_count && memcmp(added[a].values, received[r].values, sizeof(received[r].values)) == 0,
+              "%s: sample at t=%u doesn't match", series_names[series], received[r].timestamp);
+    }
+
+    if (series == SERIES_SPIKE)
+    {
+        CHECK(spike_seen_max >= 650 + 900 - 8, "%s: 1 minute maximum %u misses the spike", series_names[series], spike_seen_max);
+    }
+    if (series == SERIES_STEADY)
+    {
+        CHECK(fast_samples == 0, "%s: %lu fast samples on a steady series", series_names[series], fast_samples);
+    }
+    else
+    {
+        CHECK(fast_samples > 0, "%s: readings changing quickly didn't raise the sampling rate", series_names[series]);
+    }
+
+    printf("%-7s %5zu samples (%3lu fast), %3lu messages: %4.1f samples/message, %5.1f bytes/message (max %4zu), "
+           "batch %4.1f bytes/sample, %lu lost\n",
+           series_names[series], added_count, fast_samples, messages, messages ? (double)batch_samples / messages : 0.0,
+           messages ? (double)message_bytes / messages : 0.0, max_message, batch_samples ? (double)batch_bytes / batch_samples : 0.0,
+           lost_reported);
+}
+
+int main(void)
+{
+    for (SERIES series = 0; series < SERIES_COUNT; series++)
+    {
+        run(series, 3600, 0, 0);
+    }
+
+    // Offline for 30 minutes: the backlog is sent in batches of up to max_batch_samples once back online
+    printf("offline 30 minutes:\n");
+    run(SERIES_RAMP, 3600, 600, 2400);
+
+    // Offline for 2 hours: more samples than the aggregator keeps, the oldest are reported lost
+    printf("offline 2 hours:\n");
+    run(SERIES_STEADY, 3 * 3600, 600, 600 + 7200);
+
+    printf(failures == 0 ? "PASS\n" : "%d FAILURES\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -142,6 +142,19 @@ bool co2_read(ENVIRONMENT *telemetry)
 #endif
 }
 
+bool co2_data_ready(void)
+{
+#ifdef SCD30
+    uint16_t data_ready = 0;
+
+    return scd30_get_data_ready(&data_ready) == STATUS_OK && data_ready != 0;
+#else
+    bool data_ready = false;
+
+    return scd4x_get_data_ready_flag(&data_ready) == NO_ERROR && data_ready;
+#endif
+}
+
 bool co2_set_altitude(int altitude_in_meters)
 {
     bool result = false;
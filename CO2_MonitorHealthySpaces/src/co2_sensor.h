@@ -30,6 +30,13 @@ bool co2_initialize(void);
 /// <returns></returns>
 bool co2_read(ENVIRONMENT *telemetry);
 
+/// <summary>
+/// Check whether the CO2 sensor has a measurement that hasn't been read yet
+/// </summary>
+/// <param name=""></param>
+/// <returns></returns>
+bool co2_data_ready(void);
+
 /// <summary>
 /// Set the CO2 sensor altitude
 /// </summary>
@@ -37,6 +37,16 @@
  * Publish data to Azure IoT Hub/Central
  **********************************************************************************************************/
 
+/// <summary>
+/// Seconds since boot, to timestamp the samples passed to the aggregator
+/// </summary>
+static uint32_t monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec;
+}
+
 /// <summary>
 /// Publish HVAC telemetry
 /// </summary>
@@ -44,6 +54,7 @@
 static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
 {
     static int msgId = 0;
+    ACQUISITION_STATS acquisition_stats;
 
     if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
     {
@@ -53,22 +64,36 @@ static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer)
 
     if (telemetry.valid && azure_connected)
     {
+        acquisition_get_stats(&acquisition_stats, true);
+
         // clang-format off
         // Serialize telemetry as JSON
-        if (dx_jsonSerialize(msgBuffer, sizeof(msgBuffer), 7,
+        if (dx_jsonSerialize(msgBuffer, sizeof(msgBuffer), 10,
             DX_JSON_INT, "msgId", msgId++,
             DX_JSON_INT, "co2ppm", telemetry.latest.co2ppm,
             DX_JSON_INT, "humidity", telemetry.latest.humidity,
             DX_JSON_INT, "pressure", telemetry.latest.pressure,
             DX_JSON_INT, "temperature", telemetry.latest.temperature,
             DX_JSON_INT, "peakUserMemoryKiB", (int)Applications_GetPeakUserModeMemoryUsageInKB(),
-            DX_JSON_INT, "totalMemoryKiB", (int)Applications_GetTotalMemoryUsageInKB()))
+            DX_JSON_INT, "totalMemoryKiB", (int)Applications_GetTotalMemoryUsageInKB(),
+            DX_JSON_INT, "readLatencyUs", (int)acquisition_stats.latency_average_us,
+            DX_JSON_INT, "readLatencyMaxUs", (int)acquisition_stats.latency_max_us,
+            DX_JSON_INT, "missedSamples", (int)(acquisition_stats.missed_not_ready + acquisition_stats.missed_queue_full +
+                                                acquisition_stats.missed_overrun)))
         // clang-format on
         {
+            // Add the window statistics and the samples read since the last published message
+            int samples_in_batch = aggregator_append_json(msgBuffer, sizeof(msgBuffer), monotonic_seconds(), time(NULL));
+
             dx_Log_Debug("%s\n", msgBuffer);
 
-            // Publish telemetry message to IoT Hub/Central
-            dx_azurePublish(msgBuffer, strlen(msgBuffer), messageProperties, NELEMS(messageProperties), &contentProperties);
+            // Publish telemetry message to IoT Hub/Central. An empty batch is marked published too, as it reported the lost
+            // samples; a message without a batch (-1) reported nothing.
+            if (dx_azurePublish(msgBuffer, strlen(msgBuffer), messageProperties, NELEMS(messageProperties), &contentProperties) &&
+                samples_in_batch >= 0)
+            {
+                aggregator_batch_published((size_t)samples_in_batch);
+            }
         }
         else
         {
@@ -116,37 +141,44 @@ static void update_device_twins(EventLoopTimer *eventLoopTimer)
 }
 
 /// <summary>
-/// Handler called every 20 seconds
-/// The CO2 sensor and Avnet Onboard sensors are read
-/// Then reload 20 second oneshot timer
+/// Called on the event loop for each sample read by the acquisition thread, every 20 seconds, or every 5 seconds while
+/// readings change quickly. The readings are validated, then passed to the alerting and telemetry stages
 /// </summary>
-/// <param name="eventLoopTimer"></param>
-static void read_telemetry_handler(EventLoopTimer *eventLoopTimer)
+/// <param name="sample"></param>
+static void sensor_sample_handler(const ACQUISITION_SAMPLE *sample)
 {
-    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0)
-    {
-        dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
-        return;
-    }
+    // From the last valid sample, so that an invalid sample in between doesn't repeat the alert
+    static bool over_alert_level = false;
+
+    telemetry.latest = sample->reading;
 
-    onboard_sensors_read(&telemetry.latest);
+    // clang-format off
+    telemetry.valid =
+        sample->valid &&
+        IN_RANGE(telemetry.latest.temperature, -20, 50) &&
+        IN_RANGE(telemetry.latest.pressure, 800, 1200) &&
+        IN_RANGE(telemetry.latest.humidity, 0, 100) &&
+        IN_RANGE(telemetry.latest.co2ppm, 0, 20000);
+    // clang-format on
 
-    if (co2_read(&telemetry))
+    if (!telemetry.valid)
     {
-        // clang-format off
-        telemetry.valid =
-            IN_RANGE(telemetry.latest.temperature, -20, 50) &&
-            IN_RANGE(telemetry.latest.pressure, 800, 1200) &&
-            IN_RANGE(telemetry.latest.humidity, 0, 100) &&
-            IN_RANGE(telemetry.latest.co2ppm, 0, 20000);
-        // clang-format on
+        return;
     }
-    else
+
+    // Alert as soon as the CO2 level crosses the alert level, tmr_co2_alert_timer then repeats the alert
+    if ((telemetry.latest.co2ppm > co2_alert_level) != over_alert_level)
     {
-        telemetry.valid = false;
+        over_alert_level = !over_alert_level;
+        update_co2_alert_status();
     }
 
-    dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){20, 0});
+    int values[AGGREGATOR_METRIC_COUNT] = {[AGGREGATOR_CO2PPM] = telemetry.latest.co2ppm,
+                                           [AGGREGATOR_TEMPERATURE] = telemetry.latest.temperature,
+                                           [AGGREGATOR_HUMIDITY] = telemetry.latest.humidity,
+                                           [AGGREGATOR_PRESSURE] = telemetry.latest.pressure};
+    aggregator_add_sample(sample->timestamp, values);
+    acquisition_set_interval(aggregator_next_sample_interval());
 }
 
 /***********************************************************************************************************
@@ -259,7 +291,9 @@ static void set_device_altitude(DX_DEVICE_TWIN_BINDING *deviceTwinBinding)
 {
     if (IN_RANGE(*(int *)deviceTwinBinding->propertyValue, 0, 10000))
     {
+        acquisition_bus_lock();
         co2_set_altitude(*(int *)deviceTwinBinding->propertyValue);
+        acquisition_bus_unlock();
         dx_deviceTwinAckDesiredValue(deviceTwinBinding, deviceTwinBinding->propertyValue, DX_DEVICE_TWIN_RESPONSE_COMPLETED);
     }
     else
@@ -456,7 +490,14 @@ static void InitPeripheralsAndHandlers(void)
     dx_azureRegisterConnectionChangedNotification(azure_connection_state);
     dx_azureRegisterConnectionChangedNotification(hvac_startup_report);
 
-    dx_timerOneShotSet(&tmr_read_telemetry, &(struct timespec){0, 250 * ONE_MS});
+    aggregator_init(&aggregator_config);
+
+    // Read the sensors off the event loop, samples are passed to sensor_sample_handler
+    acquisition_config.interval = aggregator_next_sample_interval();
+    if (!acquisition_start(&acquisition_config, dx_timerGetEventLoop(), sensor_sample_handler))
+    {
+        dx_terminate(APP_ExitCode_Acquisition_Start_Failed);
+    }
 
     telemetry.previous.temperature = telemetry.previous.pressure = telemetry.previous.humidity = telemetry.previous.co2ppm = INT32_MAX;
 
@@ -470,6 +511,7 @@ static void InitPeripheralsAndHandlers(void)
 static void ClosePeripheralsAndHandlers(void)
 {
     dx_timerSetStop(timer_bindings, NELEMS(timer_bindings));
+    acquisition_stop();
     dx_deviceTwinUnsubscribe();
     dx_gpioSetClose(gpio_bindings, NELEMS(gpio_bindings));
     dx_i2cSetClose(i2c_bindings, NELEMS(i2c_bindings));
@@ -18,6 +18,8 @@
 #include "Onboard/onboard_sensors.h"
 #include "Onboard/azure_status.h"
 #include "co2_sensor.h"
+#include "sensor_acquisition.h"
+#include "telemetry_aggregator.h"
 
 #include <applibs/applications.h>
 #include <applibs/log.h>
@@ -39,9 +41,10 @@ static void co2_alert_handler(EventLoopTimer *eventLoopTimer);
 static void delayed_restart_device_handler(EventLoopTimer *eventLoopTimer);
 static void publish_telemetry_handler(EventLoopTimer *eventLoopTimer);
 static void read_buttons_handler(EventLoopTimer *eventLoopTimer);
-static void read_telemetry_handler(EventLoopTimer *eventLoopTimer);
 static void set_co2_alert_level(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
+static void sensor_sample_handler(const ACQUISITION_SAMPLE *sample);
 static void set_device_altitude(DX_DEVICE_TWIN_BINDING *deviceTwinBinding);
+static void update_co2_alert_status(void);
 static void update_device_twins(EventLoopTimer *eventLoopTimer);
 static void watchdog_handler(EventLoopTimer *eventLoopTimer);
 void azure_status_led_off_handler(EventLoopTimer *eventLoopTimer);
@@ -54,7 +57,7 @@ void azure_status_led_on_handler(EventLoopTimer *eventLoopTimer);
 #define Log_Debug(f_, ...) dx_Log_Debug((f_), ##__VA_ARGS__)
 static char Log_Debug_Time_buffer[128];
 
-#define JSON_MESSAGE_BYTES 256
+#define JSON_MESSAGE_BYTES 2048
 static char msgBuffer[JSON_MESSAGE_BYTES] = {0};
 
 // Set alert level to a reasonable default. This is updated by CO2PPMAlertLevel device twin
@@ -62,6 +65,23 @@ static int32_t co2_alert_level = 1000;
 
 static bool be_quiet = false;
 
+// Statistics over the last 1, 5 and 15 minutes, and a batch of the samples read since the last message, are added to the
+// telemetry. Sampling goes from every 20 seconds to every 5 seconds while CO2 changes by 50 ppm, temperature by 1 degree or
+// humidity by 5% within 20 seconds, until a minute after it settles.
+static AGGREGATOR_CONFIG aggregator_config = {
+    .windows = {60, 300, 900},
+    .window_count = 3,
+    .sample_interval = 20,
+    .fast_sample_interval = 5,
+    .fast_threshold = {[AGGREGATOR_CO2PPM] = 50, [AGGREGATOR_TEMPERATURE] = 1, [AGGREGATOR_HUMIDITY] = 5},
+    .fast_hold_samples = 12,
+    .max_batch_samples = 64};
+
+// The sensors are read on the acquisition thread, when the sampling interval is due and the CO2 sensor has a new measurement.
+// The SCD30 measures every 2 seconds and the SCD4x every 5 seconds.
+static ACQUISITION_CONFIG acquisition_config = {
+    .trigger = ACQUISITION_TRIGGER_DATA_READY, .interval = 20, .data_ready_poll_ms = 250, .data_ready_timeout_ms = 6000};
+
 ENVIRONMENT telemetry;
 
 static DX_USER_CONFIG dx_config;
@@ -130,7 +150,6 @@ static DX_TIMER_BINDING tmr_co2_alert_timer = {.period = {8, 0}, .name = "tmr_co
 static DX_TIMER_BINDING tmr_delayed_restart_device = {.name = "tmr_delayed_restart_device", .handler = delayed_restart_device_handler};
 static DX_TIMER_BINDING tmr_publish_telemetry = {.period = {20, 0}, .name = "tmr_publish_telemetry", .handler = publish_telemetry_handler};
 static DX_TIMER_BINDING tmr_read_buttons = {.period = {0, 100 * ONE_MS}, .name = "tmr_read_buttons", .handler = read_buttons_handler};
-static DX_TIMER_BINDING tmr_read_telemetry = {.name = "tmr_read_telemetry", .handler = read_telemetry_handler};
 static DX_TIMER_BINDING tmr_update_device_twins = {.period = {15, 0}, .name = "tmr_update_device_twins", .handler = update_device_twins};
 static DX_TIMER_BINDING tmr_watchdog = {.period = {30, 0}, .name = "tmr_publish_telemetry", .handler = watchdog_handler};
 
@@ -169,8 +188,7 @@ DX_I2C_BINDING *i2c_bindings[] = {&i2c_co2_sensor, &i2c_onboard_sensors};
 static DX_GPIO_BINDING *gpio_bindings[] = {&gpio_network_led, &gpio_button_b};
 static DX_DIRECT_METHOD_BINDING *direct_method_bindings[] = {&dm_restart_device};
 
-static DX_TIMER_BINDING *timer_bindings[] = {&tmr_read_telemetry,
-                                             &tmr_co2_alert_buzzer_off_oneshot,
+static DX_TIMER_BINDING *timer_bindings[] = {&tmr_co2_alert_buzzer_off_oneshot,
                                              &tmr_co2_alert_timer,
                                              &tmr_azure_status_led_on,
                                              &tmr_azure_status_led_off,
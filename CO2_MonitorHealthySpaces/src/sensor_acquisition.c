@@ -0,0 +1,370 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "sensor_acquisition.h"
+#include "co2_sensor.h"
+
+#include <applibs/log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static ACQUISITION_CONFIG config;
+static ACQUISITION_SAMPLE_HANDLER sample_handler;
+
+// Single producer, single consumer queue: the acquisition thread only writes queue_head, the event loop only writes queue_tail.
+// The indexes run freely and wrap at ACQUISITION_QUEUE_SIZE when accessing the queue.
+static ACQUISITION_SAMPLE queue[ACQUISITION_QUEUE_SIZE];
+static atomic_uint queue_head;
+static atomic_uint queue_tail;
+
+// Signalled by the acquisition thread when samples are queued
+static int sample_event_fd = -1;
+static EventLoop *sample_event_loop;
+static EventRegistration *sample_event_registration;
+
+static pthread_t acquisition_thread;
+static bool acquisition_running;
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Wakes the acquisition thread when the interval changes or acquisition stops
+static pthread_mutex_t wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_condition;
+static atomic_uint interval;
+static atomic_bool stop_requested;
+
+static atomic_uint stat_samples;
+static atomic_uint stat_read_errors;
+static atomic_uint stat_missed_not_ready;
+static atomic_uint stat_missed_queue_full;
+static atomic_uint stat_missed_overrun;
+static atomic_ullong latency_sum_us;
+static atomic_uint latency_count;
+static atomic_uint latency_max_us;
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+static uint64_t monotonic_ms(void)
+{
+    return monotonic_us() / 1000u;
+}
+
+static uint64_t interval_ms(void)
+{
+    return (uint64_t)atomic_load(&interval) * 1000u;
+}
+
+static bool queue_push(const ACQUISITION_SAMPLE *sample)
+{
+    unsigned int head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+
+    if (head - tail == ACQUISITION_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    queue[head % ACQUISITION_QUEUE_SIZE] = *sample;
+    // Publish the sample before the new head
+    atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+    return true;
+}
+
+static bool queue_pop(ACQUISITION_SAMPLE *sample)
+{
+    unsigned int tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue_head, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return false;
+    }
+
+    *sample = queue[tail % ACQUISITION_QUEUE_SIZE];
+    // Release the slot only once the sample is copied
+    atomic_store_explicit(&queue_tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/// <summary>
+/// Wait until deadline_ms with wait_lock held, unless acquisition is stopping or the deadline has passed
+/// </summary>
+static void wait_locked(uint64_t deadline_ms)
+{
+    if (!atomic_load(&stop_requested) && monotonic_ms() < deadline_ms)
+    {
+        struct timespec deadline = {.tv_sec = (time_t)(deadline_ms / 1000u), .tv_nsec = (long)(deadline_ms % 1000u) * 1000000L};
+        pthread_cond_timedwait(&wait_condition, &wait_lock, &deadline);
+    }
+}
+
+/// <summary>
+/// Wait until deadline_ms, or until woken by acquisition_set_interval or acquisition_stop
+/// </summary>
+static void wait_until(uint64_t deadline_ms)
+{
+    pthread_mutex_lock(&wait_lock);
+    wait_locked(deadline_ms);
+    pthread_mutex_unlock(&wait_lock);
+}
+
+/// <summary>
+/// Wait until the sampling interval started at interval_start_ms is over, or until woken by acquisition_set_interval or
+/// acquisition_stop. The deadline is computed under wait_lock, which acquisition_set_interval changes the interval under,
+/// so that a change can't be missed between reading the interval and waiting.
+/// </summary>
+static void wait_for_interval(uint64_t interval_start_ms)
+{
+    pthread_mutex_lock(&wait_lock);
+    wait_locked(interval_start_ms + interval_ms());
+    pthread_mutex_unlock(&wait_lock);
+}
+
+/// <summary>
+/// Poll the CO2 sensor until it has a new measurement
+/// </summary>
+/// <returns>false if there was none within data_ready_timeout_ms, or acquisition is stopping</returns>
+static bool wait_for_data_ready(void)
+{
+    uint64_t timeout_ms = monotonic_ms() + config.data_ready_timeout_ms;
+
+    for (;;)
+    {
+        acquisition_bus_lock();
+        bool ready = co2_data_ready();
+        acquisition_bus_unlock();
+
+        uint64_t now_ms = monotonic_ms();
+        if (ready)
+        {
+            return true;
+        }
+        if (now_ms >= timeout_ms || atomic_load(&stop_requested))
+        {
+            return false;
+        }
+
+        uint64_t poll_ms = now_ms + config.data_ready_poll_ms;
+        wait_until(poll_ms < timeout_ms ? poll_ms : timeout_ms);
+    }
+}
+
+static void record_latency(uint32_t latency_us)
+{
+    atomic_fetch_add(&latency_sum_us, latency_us);
+    atomic_fetch_add(&latency_count, 1);
+
+    unsigned int max_us = atomic_load(&latency_max_us);
+    while (latency_us > max_us && !atomic_compare_exchange_weak(&latency_max_us, &max_us, latency_us))
+    {
+    }
+}
+
+static void *acquisition_thread_main(void *arg)
+{
+    uint32_t sequence = 0;
+    // Start of the current sampling interval: the first sample is taken straight away
+    uint64_t interval_start_ms = monotonic_ms() - interval_ms();
+
+    while (!atomic_load(&stop_requested))
+    {
+        uint64_t due_ms = interval_start_ms + interval_ms();
+        if (monotonic_ms() < due_ms)
+        {
+            // Recompute the deadline when woken, the interval may have changed
+            wait_for_interval(interval_start_ms);
+            continue;
+        }
+
+        if (config.trigger == ACQUISITION_TRIGGER_DATA_READY)
+        {
+            if (!wait_for_data_ready())
+            {
+                if (!atomic_load(&stop_requested))
+                {
+                    atomic_fetch_add(&stat_missed_not_ready, 1);
+                }
+                interval_start_ms = monotonic_ms();
+                continue;
+            }
+            // Follow the sensor measurement period rather than drift against it
+            due_ms = monotonic_ms();
+        }
+
+        ACQUISITION_SAMPLE sample = {.sequence = sequence++};
+        ENVIRONMENT environment = {0};
+
+        uint64_t start_us = monotonic_us();
+        acquisition_bus_lock();
+        bool onboard_read = onboard_sensors_read(&environment.latest);
+        bool co2_read_ok = co2_read(&environment);
+        acquisition_bus_unlock();
+        uint64_t end_us = monotonic_us();
+
+        sample.reading = environment.latest;
+        sample.valid = onboard_read && co2_read_ok;
+        sample.timestamp = (uint32_t)(end_us / 1000000u);
+        sample.read_latency_us = (uint32_t)(end_us - start_us);
+
+        atomic_fetch_add(&stat_samples, 1);
+        if (!sample.valid)
+        {
+            atomic_fetch_add(&stat_read_errors, 1);
+        }
+        record_latency(sample.read_latency_us);
+
+        if (queue_push(&sample))
+        {
+            if (eventfd_write(sample_event_fd, 1) != 0)
+            {
+                Log_Debug("ERROR: eventfd_write (sensor acquisition): errno=%d (%s)\n", errno, strerror(errno));
+            }
+        }
+        else
+        {
+            atomic_fetch_add(&stat_missed_queue_full, 1);
+        }
+
+        // Count the sampling intervals that went by while reading, and start from the last one
+        interval_start_ms = due_ms;
+        uint64_t period_ms = interval_ms();
+        uint64_t elapsed_ms = end_us / 1000u - due_ms;
+        if (period_ms > 0 && elapsed_ms >= period_ms)
+        {
+            atomic_fetch_add(&stat_missed_overrun, (unsigned int)(elapsed_ms / period_ms));
+            interval_start_ms += elapsed_ms / period_ms * period_ms;
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Pass the queued samples to the sample handler, on the event loop
+/// </summary>
+static void sample_event_handler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    eventfd_t count;
+    ACQUISITION_SAMPLE sample;
+
+    if (eventfd_read(fd, &count) != 0 && errno != EAGAIN)
+    {
+        Log_Debug("ERROR: eventfd_read (sensor acquisition): errno=%d (%s)\n", errno, strerror(errno));
+    }
+
+    while (queue_pop(&sample))
+    {
+        sample_handler(&sample);
+    }
+}
+
+bool acquisition_start(const ACQUISITION_CONFIG *acquisition_config, EventLoop *eventLoop, ACQUISITION_SAMPLE_HANDLER handler)
+{
+    config = *acquisition_config;
+    sample_handler = handler;
+    atomic_store(&interval, config.interval);
+    atomic_store(&stop_requested, false);
+    atomic_store(&queue_head, 0);
+    atomic_store(&queue_tail, 0);
+
+    // Deadlines are on the monotonic clock, like the sampling intervals
+    pthread_condattr_t condition_attributes;
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&wait_condition, &condition_attributes);
+    pthread_condattr_destroy(&condition_attributes);
+
+    sample_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (sample_event_fd == -1)
+    {
+        Log_Debug("ERROR: eventfd (sensor acquisition): errno=%d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+
+    sample_event_loop = eventLoop;
+    sample_event_registration = EventLoop_RegisterIo(eventLoop, sample_event_fd, EventLoop_Input, sample_event_handler, NULL);
+    if (sample_event_registration == NULL)
+    {
+        Log_Debug("ERROR: EventLoop_RegisterIo (sensor acquisition): errno=%d (%s)\n", errno, strerror(errno));
+        close(sample_event_fd);
+        sample_event_fd = -1;
+        return false;
+    }
+
+    int result = pthread_create(&acquisition_thread, NULL, acquisition_thread_main, NULL);
+    if (result != 0)
+    {
+        Log_Debug("ERROR: pthread_create (sensor acquisition): %d (%s)\n", result, strerror(result));
+        EventLoop_UnregisterIo(sample_event_loop, sample_event_registration);
+        close(sample_event_fd);
+        sample_event_fd = -1;
+        return false;
+    }
+
+    acquisition_running = true;
+    return true;
+}
+
+void acquisition_set_interval(uint32_t new_interval)
+{
+    pthread_mutex_lock(&wait_lock);
+    if (atomic_exchange(&interval, new_interval) != new_interval)
+    {
+        pthread_cond_signal(&wait_condition);
+    }
+    pthread_mutex_unlock(&wait_lock);
+}
+
+void acquisition_get_stats(ACQUISITION_STATS *stats, bool reset_latency)
+{
+    stats->samples = atomic_load(&stat_samples);
+    stats->read_errors = atomic_load(&stat_read_errors);
+    stats->missed_not_ready = atomic_load(&stat_missed_not_ready);
+    stats->missed_queue_full = atomic_load(&stat_missed_queue_full);
+    stats->missed_overrun = atomic_load(&stat_missed_overrun);
+
+    unsigned long long sum_us = reset_latency ? atomic_exchange(&latency_sum_us, 0) : atomic_load(&latency_sum_us);
+    unsigned int count = reset_latency ? atomic_exchange(&latency_count, 0) : atomic_load(&latency_count);
+    stats->latency_max_us = reset_latency ? atomic_exchange(&latency_max_us, 0) : atomic_load(&latency_max_us);
+    stats->latency_average_us = count > 0 ? (uint32_t)(sum_us / count) : 0;
+}
+
+void acquisition_bus_lock(void)
+{
+    pthread_mutex_lock(&bus_lock);
+}
+
+void acquisition_bus_unlock(void)
+{
+    pthread_mutex_unlock(&bus_lock);
+}
+
+void acquisition_stop(void)
+{
+    if (!acquisition_running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&wait_lock);
+    atomic_store(&stop_requested, true);
+    pthread_cond_signal(&wait_condition);
+    pthread_mutex_unlock(&wait_lock);
+
+    pthread_join(acquisition_thread, NULL);
+    acquisition_running = false;
+
+    EventLoop_UnregisterIo(sample_event_loop, sample_event_registration);
+    close(sample_event_fd);
+    sample_event_fd = -1;
+    pthread_cond_destroy(&wait_condition);
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "Onboard/onboard_sensors.h"
+
+#include <applibs/eventloop.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Capacity of the queue between the acquisition thread and the event loop, a power of 2
+#define ACQUISITION_QUEUE_SIZE 16
+
+typedef enum
+{
+    // Read when the sampling interval is due and the CO2 sensor has a new measurement
+    ACQUISITION_TRIGGER_DATA_READY,
+    // Read when the sampling interval is due
+    ACQUISITION_TRIGGER_CADENCE
+} ACQUISITION_TRIGGER;
+
+typedef struct
+{
+    ACQUISITION_TRIGGER trigger;
+    // Sampling interval in seconds, changed with acquisition_set_interval
+    uint32_t interval;
+    // How often the CO2 sensor data ready status is polled, and how long to wait for it before missing the sample
+    uint32_t data_ready_poll_ms;
+    uint32_t data_ready_timeout_ms;
+} ACQUISITION_CONFIG;
+
+typedef struct
+{
+    SENSOR reading;
+    // false if a sensor read failed
+    bool valid;
+    // Monotonic time of the read in seconds
+    uint32_t timestamp;
+    // Time spent reading the sensors
+    uint32_t read_latency_us;
+    uint32_t sequence;
+} ACQUISITION_SAMPLE;
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t read_errors;
+    // Samples missed because the CO2 sensor had no new measurement within data_ready_timeout_ms
+    uint32_t missed_not_ready;
+    // Samples missed because the event loop didn't empty the queue in time
+    uint32_t missed_queue_full;
+    // Sampling intervals skipped because reading took longer than the interval
+    uint32_t missed_overrun;
+    // Read latency since the last call to acquisition_get_stats with reset_latency set
+    uint32_t latency_average_us;
+    uint32_t latency_max_us;
+} ACQUISITION_STATS;
+
+/// <summary>
+/// Called on the event loop for each sample, in order
+/// </summary>
+typedef void (*ACQUISITION_SAMPLE_HANDLER)(const ACQUISITION_SAMPLE *sample);
+
+/// <summary>
+/// Start the acquisition thread, which reads the onboard and CO2 sensors off the event loop and queues the samples
+/// </summary>
+/// <param name="acquisition_config">Copied</param>
+/// <param name="eventLoop">Event loop the sample handler is called on</param>
+/// <param name="handler">Consumer of the samples</param>
+/// <returns>false if the thread or the event loop registration couldn't be created</returns>
+bool acquisition_start(const ACQUISITION_CONFIG *acquisition_config, EventLoop *eventLoop, ACQUISITION_SAMPLE_HANDLER handler);
+
+/// <summary>
+/// Change the sampling interval, from the previous sample
+/// </summary>
+void acquisition_set_interval(uint32_t interval);
+
+/// <summary>
+/// Get the acquisition statistics
+/// </summary>
+/// <param name="reset_latency">Start a new latency measurement period</param>
+void acquisition_get_stats(ACQUISITION_STATS *stats, bool reset_latency);
+
+/// <summary>
+/// Serialize other I2C accesses, e.g. sensor configuration from the event loop, with the acquisition thread
+/// </summary>
+void acquisition_bus_lock(void);
+void acquisition_bus_unlock(void);
+
+/// <summary>
+/// Stop the acquisition thread and discard the queued samples
+/// </summary>
+void acquisition_stop(void);
@@ -0,0 +1,318 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "telemetry_aggregator.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    uint32_t timestamp;
+    int values[AGGREGATOR_METRIC_COUNT];
+} AGGREGATOR_SAMPLE;
+
+static const char *metric_names[AGGREGATOR_METRIC_COUNT] = {"co2ppm", "temperature", "humidity", "pressure"};
+
+static AGGREGATOR_CONFIG config;
+
+// Ring of samples, oldest first from samples[first]. The last unpublished samples are not published yet.
+static AGGREGATOR_SAMPLE samples[AGGREGATOR_MAX_SAMPLES];
+static size_t first;
+static size_t count;
+static size_t unpublished;
+
+// Samples dropped before they were published, and how many of them the last batch reported
+static uint32_t lost;
+static uint32_t lost_in_batch;
+
+// Samples left to take at the fast sampling interval
+static uint32_t fast_samples_remaining;
+
+// Scratch buffer for sorting the values of a window
+static int sorted_values[AGGREGATOR_MAX_SAMPLES];
+
+static AGGREGATOR_SAMPLE *sample_at(size_t index)
+{
+    return &samples[(first + index) % AGGREGATOR_MAX_SAMPLES];
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/// <summary>
+/// Append formatted text at buffer + *length, without writing past size
+/// </summary>
+/// <returns>false if the text doesn't fit</returns>
+static bool append(char *buffer, size_t size, size_t *length, const char *format, ...)
+{
+    if (*length >= size)
+    {
+        return false;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + *length, size - *length, format, args);
+    va_end(args);
+
+    if (written < 0 || (size_t)written >= size - *length)
+    {
+        return false;
+    }
+
+    *length += (size_t)written;
+    return true;
+}
+
+void aggregator_init(const AGGREGATOR_CONFIG *aggregator_config)
+{
+    config = *aggregator_config;
+    if (config.window_count > AGGREGATOR_MAX_WINDOWS)
+    {
+        config.window_count = AGGREGATOR_MAX_WINDOWS;
+    }
+    if (config.max_batch_samples == 0 || config.max_batch_samples > AGGREGATOR_MAX_SAMPLES)
+    {
+        config.max_batch_samples = AGGREGATOR_MAX_SAMPLES;
+    }
+
+    first = count = unpublished = 0;
+    lost = lost_in_batch = 0;
+    fast_samples_remaining = 0;
+}
+
+void aggregator_add_sample(uint32_t timestamp, const int values[AGGREGATOR_METRIC_COUNT])
+{
+    if (count > 0 && config.fast_sample_interval > 0)
+    {
+        // Readings change quickly when a metric moves by its threshold or more since the sample taken a sampling interval ago,
+        // so that sensor noise between samples taken at the fast sampling interval doesn't count
+        size_t reference = count - 1;
+        while (reference > 0 && sample_at(reference)->timestamp + config.sample_interval > timestamp)
+        {
+            reference--;
+        }
+
+        AGGREGATOR_SAMPLE *previous = sample_at(reference);
+        bool fast = false;
+
+        for (int metric = 0; metric < AGGREGATOR_METRIC_COUNT; metric++)
+        {
+            if (config.fast_threshold[metric] > 0 && abs(values[metric] - previous->values[metric]) >= config.fast_threshold[metric])
+            {
+                fast = true;
+            }
+        }
+
+        if (fast)
+        {
+            fast_samples_remaining = config.fast_hold_samples > 0 ? config.fast_hold_samples : 1;
+        }
+        else if (fast_samples_remaining > 0)
+        {
+            fast_samples_remaining--;
+        }
+    }
+
+    if (count == AGGREGATOR_MAX_SAMPLES)
+    {
+        if (unpublished == count)
+        {
+            lost++;
+            unpublished--;
+        }
+        first = (first + 1) % AGGREGATOR_MAX_SAMPLES;
+        count--;
+    }
+
+    AGGREGATOR_SAMPLE *sample = sample_at(count);
+    sample->timestamp = timestamp;
+    memcpy(sample->values, values, sizeof(sample->values));
+    count++;
+    unpublished++;
+}
+
+bool aggregator_get_stats(AGGREGATOR_METRIC metric, uint32_t window, uint32_t now, AGGREGATOR_STATS *stats)
+{
+    size_t n = 0;
+    int64_t sum = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        AGGREGATOR_SAMPLE *sample = sample_at(i);
+        if (now - sample->timestamp < window)
+        {
+            sorted_values[n++] = sample->values[metric];
+            sum += sample->values[metric];
+        }
+    }
+
+    if (n == 0)
+    {
+        return false;
+    }
+
+    qsort(sorted_values, n, sizeof(sorted_values[0]), compare_int);
+
+    stats->min = sorted_values[0];
+    stats->max = sorted_values[n - 1];
+    stats->mean = (int)((sum + (sum < 0 ? -(int64_t)n : (int64_t)n) / 2) / (int64_t)n);
+    // Nearest rank: the smallest value greater than or equal to 95% of the values
+    stats->p95 = sorted_values[(95 * n + 99) / 100 - 1];
+    stats->count = n;
+
+    return true;
+}
+
+uint32_t aggregator_next_sample_interval(void)
+{
+    return fast_samples_remaining > 0 ? config.fast_sample_interval : config.sample_interval;
+}
+
+size_t aggregator_pending_samples(void)
+{
+    return unpublished;
+}
+
+static bool append_stats(char *buffer, size_t size, size_t *length, uint32_t now)
+{
+    bool first_window = true;
+
+    if (!append(buffer, size, length, ",\"stats\":{"))
+    {
+        return false;
+    }
+
+    for (size_t w = 0; w < config.window_count; w++)
+    {
+        AGGREGATOR_STATS stats;
+
+        if (!aggregator_get_stats(AGGREGATOR_CO2PPM, config.windows[w], now, &stats))
+        {
+            continue;
+        }
+
+        if (!append(buffer, size, length, "%s\"%u\":{", first_window ? "" : ",", config.windows[w]))
+        {
+            return false;
+        }
+        first_window = false;
+
+        for (int metric = 0; metric < AGGREGATOR_METRIC_COUNT; metric++)
+        {
+            aggregator_get_stats(metric, config.windows[w], now, &stats);
+            if (!append(buffer, size, length, "%s\"%s\":[%d,%d,%d,%d]", metric == 0 ? "" : ",", metric_names[metric], stats.min,
+                        stats.max, stats.mean, stats.p95))
+            {
+                return false;
+            }
+        }
+
+        if (!append(buffer, size, length, "}"))
+        {
+            return false;
+        }
+    }
+
+    return append(buffer, size, length, "}");
+}
+
+static bool append_batch(char *buffer, size_t size, size_t *length, size_t samples_in_batch, uint32_t now, time_t now_utc)
+{
+    size_t start = count - unpublished;
+
+    if (samples_in_batch == 0)
+    {
+        return append(buffer, size, length, ",\"batch\":{\"lost\":%u}", lost);
+    }
+
+    AGGREGATOR_SAMPLE *sample = sample_at(start);
+    long long t0 = (long long)now_utc - (long long)(now - sample->timestamp);
+
+    if (!append(buffer, size, length, ",\"batch\":{\"t0\":%lld,\"dt\":[", t0))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < samples_in_batch; i++)
+    {
+        uint32_t dt = i == 0 ? 0 : sample_at(start + i)->timestamp - sample_at(start + i - 1)->timestamp;
+        if (!append(buffer, size, length, i == 0 ? "%u" : ",%u", dt))
+        {
+            return false;
+        }
+    }
+
+    for (int metric = 0; metric < AGGREGATOR_METRIC_COUNT; metric++)
+    {
+        if (!append(buffer, size, length, "],\"%s\":[", metric_names[metric]))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < samples_in_batch; i++)
+        {
+            int value = sample_at(start + i)->values[metric];
+            if (i > 0)
+            {
+                value -= sample_at(start + i - 1)->values[metric];
+            }
+            if (!append(buffer, size, length, i == 0 ? "%d" : ",%d", value))
+            {
+                return false;
+            }
+        }
+    }
+
+    return append(buffer, size, length, "],\"lost\":%u}", lost);
+}
+
+int aggregator_append_json(char *buffer, size_t size, uint32_t now, time_t now_utc)
+{
+    char *closing_brace = strrchr(buffer, '}');
+    if (closing_brace == NULL)
+    {
+        return -1;
+    }
+
+    size_t object_length = (size_t)(closing_brace - buffer);
+    size_t samples_in_batch = unpublished < config.max_batch_samples ? unpublished : config.max_batch_samples;
+
+    // Drop the newest samples from the batch until the message fits: they are sent with the next one
+    for (;;)
+    {
+        size_t length = object_length;
+
+        if (append_stats(buffer, size, &length, now) && append_batch(buffer, size, &length, samples_in_batch, now, now_utc) &&
+            append(buffer, size, &length, "}"))
+        {
+            lost_in_batch = lost;
+            return (int)samples_in_batch;
+        }
+
+        if (samples_in_batch == 0)
+        {
+            break;
+        }
+        samples_in_batch = samples_in_batch > 8 ? samples_in_batch * 3 / 4 : samples_in_batch - 1;
+    }
+
+    // Restore the original object
+    buffer[object_length] = '}';
+    buffer[object_length + 1] = '\0';
+    return -1;
+}
+
+void aggregator_batch_published(size_t samples_in_batch)
+{
+    unpublished -= samples_in_batch < unpublished ? samples_in_batch : unpublished;
+    lost -= lost_in_batch;
+    lost_in_batch = 0;
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Fixed memory: the last AGGREGATOR_MAX_SAMPLES samples are kept, whatever the windows and the sampling rate
+#define AGGREGATOR_MAX_SAMPLES 256
+#define AGGREGATOR_MAX_WINDOWS 4
+
+typedef enum
+{
+    AGGREGATOR_CO2PPM,
+    AGGREGATOR_TEMPERATURE,
+    AGGREGATOR_HUMIDITY,
+    AGGREGATOR_PRESSURE,
+    AGGREGATOR_METRIC_COUNT
+} AGGREGATOR_METRIC;
+
+typedef struct
+{
+    int min;
+    int max;
+    int mean;
+    int p95;
+    size_t count;
+} AGGREGATOR_STATS;
+
+typedef struct
+{
+    // Durations in seconds of the windows statistics are reported for, up to AGGREGATOR_MAX_WINDOWS
+    uint32_t windows[AGGREGATOR_MAX_WINDOWS];
+    size_t window_count;
+    // Sampling interval in seconds
+    uint32_t sample_interval;
+    // Sampling interval in seconds while readings change quickly, 0 to always use sample_interval
+    uint32_t fast_sample_interval;
+    // Change over sample_interval seconds, per metric, from which readings change quickly (0 to ignore the metric)
+    int fast_threshold[AGGREGATOR_METRIC_COUNT];
+    // Number of consecutive samples under the thresholds before returning to sample_interval
+    uint32_t fast_hold_samples;
+    // Maximum number of samples in a batch
+    size_t max_batch_samples;
+} AGGREGATOR_CONFIG;
+
+/// <summary>
+/// Initialize the aggregator, discarding all samples
+/// </summary>
+/// <param name="aggregator_config">Copied</param>
+void aggregator_init(const AGGREGATOR_CONFIG *aggregator_config);
+
+/// <summary>
+/// Add a sample. When the aggregator is full, the oldest sample is dropped, and counted as lost if it wasn't published.
+/// </summary>
+/// <param name="timestamp">Monotonic time of the sample in seconds</param>
+/// <param name="values">Value of each metric, indexed by AGGREGATOR_METRIC</param>
+void aggregator_add_sample(uint32_t timestamp, const int values[AGGREGATOR_METRIC_COUNT]);
+
+/// <summary>
+/// Get the minimum, maximum, mean and 95th percentile (nearest rank) of a metric over the samples of the last window seconds
+/// </summary>
+/// <returns>false if there is no sample in the window</returns>
+bool aggregator_get_stats(AGGREGATOR_METRIC metric, uint32_t window, uint32_t now, AGGREGATOR_STATS *stats);
+
+/// <summary>
+/// Delay in seconds until the next sample: the fast sampling interval while readings change quickly, else the sampling interval
+/// </summary>
+uint32_t aggregator_next_sample_interval(void);
+
+/// <summary>
+/// Number of samples not published yet
+/// </summary>
+size_t aggregator_pending_samples(void);
+
+/// <summary>
+/// Append the window statistics and a batch of the samples not published yet to a JSON object, e.g. one written by
+/// dx_jsonSerialize. The batch is delta encoded: "t0" is the UTC time of its first sample, then "dt" and each metric
+/// hold the first value followed by the difference of each sample with the previous one.
+/// {..., "stats":{"60":{"co2ppm":[min,max,mean,p95],...},...},
+///       "batch":{"t0":1700000000,"dt":[0,20,5],"co2ppm":[612,3,250],...,"lost":0}}
+/// As many samples are included as fit in the buffer, up to max_batch_samples.
+/// </summary>
+/// <param name="buffer">Null terminated JSON object</param>
+/// <param name="size">Size of buffer</param>
+/// <param name="now">Monotonic time in seconds</param>
+/// <param name="now_utc">UTC time at now</param>
+/// <returns>Number of samples in the batch, to pass to aggregator_batch_published once sent, or -1 if the buffer is too
+/// small, in which case buffer is unchanged</returns>
+int aggregator_append_json(char *buffer, size_t size, uint32_t now, time_t now_utc);
+
+/// <summary>
+/// Mark the oldest samples not published yet as published
+/// </summary>
+/// <param name="count">Value returned by aggregator_append_json</param>
+void aggregator_batch_published(size_t count);
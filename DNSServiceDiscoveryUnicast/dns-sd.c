@@ -8,184 +8,856 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 
+#include "eventloop_timer_utilities.h"
+
+// The host test serves the records on another port.
+#ifndef DNS_SERVER_PORT
 #define DNS_SERVER_PORT 53
-#define QUERY_BUF_SIZE 2048u
-#define DISPLAY_BUF_SIZE 256u
+#endif
+#define QUERY_BUF_SIZE 512u
+#define ANSWER_BUF_SIZE 2048u
+#define DNS_NAME_SIZE 256u
+#define TXT_DATA_SIZE 256u
+#define MAX_SERVICE_INSTANCES 8
+// For each instance: its PTR, SRV, TXT and A records; a query for each SRV, TXT and A RRset.
+#define DNS_CACHE_SIZE (4 * MAX_SERVICE_INSTANCES)
+#define DNS_QUERY_COUNT (1 + 3 * MAX_SERVICE_INSTANCES)
+
+// A record is queried again once REFRESH_PERCENT of its TTL has elapsed, so it's refreshed before
+// it expires; but not more than once every MIN_REFRESH_MS, e.g. for a TTL of 0.
+#define REFRESH_PERCENT 80
+#define MIN_REFRESH_MS 1000
+#define QUERY_TIMEOUT_MS 2000
+#define QUERY_MAX_ATTEMPTS 3
+// Delay before querying again a record which wasn't found, or whose queries weren't answered.
+#define QUERY_RETRY_DELAY_MS 10000
+#define RESOLVER_TICK_MS 250
+
+// An instance which failed is avoided for INSTANCE_RETRY_MS, doubled with each consecutive
+// failure up to INSTANCE_RETRY_MAX_MS.
+#define INSTANCE_RETRY_MS 1000
+#define INSTANCE_RETRY_MAX_MS 60000
+// Weight of the latency of the last connection in the moving average (1/8, like TCP's SRTT).
+#define LATENCY_SMOOTHING 8
+// SRV weights are scaled up so that a weight of 0 (scaled to 1) keeps a very small chance of
+// being selected (RFC 2782), and so that the latency bias keeps some precision.
+#define WEIGHT_SCALE 100u
+
+/// <summary>
+/// A cached resource record.
+/// </summary>
+typedef struct {
+    char name[DNS_NAME_SIZE];
+    uint16_t type;
+    /// <summary>Serial of the response it came from, to replace the whole RRset</summary>
+    unsigned int response;
+    union {
+        // PTR
+        char target[DNS_NAME_SIZE];
+        // SRV
+        struct {
+            uint16_t priority;
+            uint16_t weight;
+            uint16_t port;
+            char target[DNS_NAME_SIZE];
+        } srv;
+        // TXT
+        struct {
+            uint16_t length;
+            char data[TXT_DATA_SIZE];
+        } txt;
+        // A
+        struct in_addr address;
+    } data;
+    struct timespec expiresAt;
+    struct timespec refreshAt;
+} DnsRecord;
+
+/// <summary>
+/// Query state of an RRset (all the records with the same name and type).
+/// </summary>
+typedef struct {
+    char name[DNS_NAME_SIZE];
+    uint16_t type;
+    /// <summary>Whether the RRset is still needed to resolve the instances</summary>
+    bool wanted;
+    struct timespec refreshAt;
+    /// <summary>ID of the query in flight, 0 if none</summary>
+    uint16_t queryId;
+    struct timespec sentAt;
+    unsigned int attempts;
+} DnsQuery;
+
+/// <summary>
+/// A resolved service instance.
+/// </summary>
+typedef struct {
+    ServiceInstanceDetails *details;
+    ServiceInstanceHealth health;
+    /// <summary>End of the delay during which the instance is avoided after a failure</summary>
+    struct timespec retryAt;
+    /// <summary>Whether it's still resolved, while updating the instances</summary>
+    bool resolved;
+} ServiceInstance;
+
+static DnsRecord cache[DNS_CACHE_SIZE];
+static DnsQuery queries[DNS_QUERY_COUNT];
+static ServiceInstance instances[MAX_SERVICE_INSTANCES];
+static size_t instanceCount = 0;
+// Instances resolved but ignored as there were already MAX_SERVICE_INSTANCES, logged when it changes
+static size_t ignoredInstanceCount = 0;
+static const char *discoveredServiceType = NULL;
+static ServiceInstanceChangedHandler instanceChangedHandler = NULL;
+static uint16_t nextQueryId = 0;
+static unsigned int responseSerial = 0;
 
-int SendDnsQuery(const char *dName, int class, int type, char* answerBuf, int answerBufSize)
+static EventLoop *resolverEventLoop = NULL;
+static EventLoopTimer *resolverTimer = NULL;
+static EventRegistration *resolverEventReg = NULL;
+static int resolverFd = -1;
+
+static void AddMilliseconds(struct timespec *result, const struct timespec *from, long ms)
 {
-    static char queryBuf[QUERY_BUF_SIZE];
-    if (!dName) {
-        Log_Debug("ERROR: Can't send DNS query as the domain name is null.\n");
-        errno = EINVAL;
-        return -1;
+    result->tv_sec = from->tv_sec + ms / 1000;
+    result->tv_nsec = from->tv_nsec + (ms % 1000) * 1000000;
+    if (result->tv_nsec >= 1000000000) {
+        result->tv_sec++;
+        result->tv_nsec -= 1000000000;
     }
+}
 
-    // Construct the DNS query to send
-    Log_Debug("INFO: Sending DNS query to resolve domain name [%s]...\n", dName);
-    int ret = res_init();
-    if (ret) {
-        Log_Debug("ERROR: res_init: %d (%s)\n", errno, strerror(errno));
-        return -1;
+static bool IsReached(const struct timespec *deadline, const struct timespec *now)
+{
+    return now->tv_sec > deadline->tv_sec ||
+           (now->tv_sec == deadline->tv_sec && now->tv_nsec >= deadline->tv_nsec);
+}
+
+static const char *RecordTypeName(uint16_t type)
+{
+    switch (type) {
+    case ns_t_ptr:
+        return "PTR";
+    case ns_t_srv:
+        return "SRV";
+    case ns_t_txt:
+        return "TXT";
+    case ns_t_a:
+        return "A";
+    default:
+        return "?";
+    }
+}
+
+/// <summary>
+///     Returns the next cached record of an RRset after 'previous' (NULL for the first one), or
+///     NULL.
+/// </summary>
+static const DnsRecord *NextRecord(const char *name, uint16_t type, const DnsRecord *previous)
+{
+    for (int i = previous ? (int)(previous - cache) + 1 : 0; i < DNS_CACHE_SIZE; ++i) {
+        if (cache[i].name[0] != '\0' && cache[i].type == type &&
+            strcasecmp(cache[i].name, name) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static DnsQuery *FindQuery(const char *name, uint16_t type)
+{
+    for (int i = 0; i < DNS_QUERY_COUNT; ++i) {
+        if (queries[i].name[0] != '\0' && queries[i].type == type &&
+            strcasecmp(queries[i].name, name) == 0) {
+            return &queries[i];
+        }
+    }
+    return NULL;
+}
+
+static DnsQuery *FindOrAddQuery(const char *name, uint16_t type, const struct timespec *now)
+{
+    DnsQuery *query = FindQuery(name, type);
+    if (query) {
+        return query;
     }
-    int messageSize =
-        res_mkquery(ns_o_query, dName, class, type, NULL, 0, NULL, queryBuf, QUERY_BUF_SIZE);
+
+    for (int i = 0; i < DNS_QUERY_COUNT; ++i) {
+        if (queries[i].name[0] == '\0') {
+            query = &queries[i];
+            memset(query, 0, sizeof(*query));
+            strncpy(query->name, name, sizeof(query->name) - 1);
+            query->type = type;
+            // The RRset may already be cached, e.g. from the additional section of an answer.
+            const DnsRecord *record = NextRecord(name, type, NULL);
+            query->refreshAt = record ? record->refreshAt : *now;
+            return query;
+        }
+    }
+    Log_Debug("ERROR: Too many DNS queries, can't resolve [%s].\n", name);
+    return NULL;
+}
+
+static void SendQuery(DnsQuery *query, const struct timespec *now)
+{
+    static unsigned char queryBuf[QUERY_BUF_SIZE];
+
+    int messageSize = res_mkquery(ns_o_query, query->name, ns_c_in, query->type, NULL, 0, NULL,
+                                  queryBuf, QUERY_BUF_SIZE);
     if (messageSize <= 0) {
         Log_Debug("ERROR: res_mkquery: %d (%s)\n", errno, strerror(errno));
-        return -1;
+        AddMilliseconds(&query->refreshAt, now, QUERY_RETRY_DELAY_MS);
+        return;
     }
 
-    int answer = res_send(queryBuf, messageSize, answerBuf, answerBufSize);
-    if (answer < 0) {
-        Log_Debug("ERROR: res_send: %d (%s)\n", errno, strerror(errno));
-        return -1;
+    // Each query in flight gets its own ID, to match the answer.
+    if (++nextQueryId == 0) {
+        nextQueryId = 1;
     }
+    queryBuf[0] = (unsigned char)(nextQueryId >> 8);
+    queryBuf[1] = (unsigned char)(nextQueryId & 0xFF);
 
-    return answer;
+    Log_Debug("INFO: Sending DNS query to resolve domain name [%s] (%s)...\n", query->name,
+              RecordTypeName(query->type));
+    query->queryId = nextQueryId;
+    query->sentAt = *now;
+    query->attempts++;
+    if (send(resolverFd, queryBuf, (size_t)messageSize, 0) == -1) {
+        // Handled like a timeout.
+        Log_Debug("ERROR: send: %d (%s)\n", errno, strerror(errno));
+    }
 }
 
-int SendServiceDiscoveryQuery(const char *dName, char* answerBuf, int answerBufSize)
+/// <summary>
+///     Removes the cached records of an RRset, except those of the current response.
+/// </summary>
+static void RemoveRecords(const char *name, uint16_t type)
 {
-    return SendDnsQuery(dName, ns_c_in, ns_t_ptr, answerBuf, answerBufSize);
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if (cache[i].name[0] != '\0' && cache[i].type == type &&
+            cache[i].response != responseSerial && strcasecmp(cache[i].name, name) == 0) {
+            memset(&cache[i], 0, sizeof(cache[i]));
+        }
+    }
 }
 
-int SendServiceInstanceDetailsQuery(const char *instanceName, char* answerBuf, int answerBufSize)
+/// <summary>
+///     Adds a resource record of an answer to the cache.
+/// </summary>
+static void StoreRecord(const char *buf, int len, ns_rr *rr, const struct timespec *now)
 {
-    return SendDnsQuery(instanceName, ns_c_in, ns_t_any, answerBuf, answerBufSize);
+    static char nameBuf[DNS_NAME_SIZE];
+    uint16_t type = ns_rr_type(*rr);
+    if (type != ns_t_ptr && type != ns_t_srv && type != ns_t_txt && type != ns_t_a) {
+        return;
+    }
+
+    // The response holds the whole RRset: it replaces the records cached from former responses.
+    RemoveRecords(ns_rr_name(*rr), type);
+    DnsRecord *record = NULL;
+    for (int i = 0; i < DNS_CACHE_SIZE && !record; ++i) {
+        if (cache[i].name[0] == '\0') {
+            record = &cache[i];
+        }
+    }
+    if (!record) {
+        Log_Debug("ERROR: DNS cache full, can't add [%s].\n", ns_rr_name(*rr));
+        return;
+    }
+
+    const unsigned char *rdata = ns_rr_rdata(*rr);
+    switch (type) {
+    case ns_t_ptr:
+        if (dn_expand((const unsigned char *)buf, (const unsigned char *)buf + len, rdata, nameBuf,
+                      sizeof(nameBuf)) < 0) {
+            return;
+        }
+        strcpy(record->data.target, nameBuf);
+        break;
+    case ns_t_srv:
+        // Parse the SRV record as per DNS SRV record specification:
+        // https://tools.ietf.org/rfc/rfc2782.txt
+        // SRV record format: Priority|  Weight |   Port  |     Target
+        //                   (2 Bytes)|(2 Bytes)|(2 Bytes)|(Remaining Bytes)
+        if (ns_rr_rdlen(*rr) < 3 * sizeof(uint16_t) ||
+            dn_expand((const unsigned char *)buf, (const unsigned char *)buf + len,
+                      rdata + 3 * sizeof(uint16_t), nameBuf, sizeof(nameBuf)) < 0) {
+            return;
+        }
+        record->data.srv.priority = (uint16_t)ns_get16(rdata);
+        record->data.srv.weight = (uint16_t)ns_get16(rdata + sizeof(uint16_t));
+        record->data.srv.port = (uint16_t)ns_get16(rdata + 2 * sizeof(uint16_t));
+        strcpy(record->data.srv.target, nameBuf);
+        break;
+    case ns_t_txt:
+        record->data.txt.length =
+            ns_rr_rdlen(*rr) < TXT_DATA_SIZE ? ns_rr_rdlen(*rr) : (uint16_t)TXT_DATA_SIZE;
+        memcpy(record->data.txt.data, rdata, record->data.txt.length);
+        break;
+    case ns_t_a:
+        if (ns_rr_rdlen(*rr) != sizeof(record->data.address)) {
+            Log_Debug("ERROR: Invalid DNS A record length: %d\n", ns_rr_rdlen(*rr));
+            return;
+        }
+        memcpy(&record->data.address.s_addr, rdata, sizeof(record->data.address));
+        break;
+    }
+    strncpy(record->name, ns_rr_name(*rr), sizeof(record->name) - 1);
+    record->type = type;
+    record->response = responseSerial;
+
+    // Cache it for its TTL, and query it again before it expires.
+    long ttlMs = (long)ns_rr_ttl(*rr) * 1000;
+    long refreshMs = ttlMs / 100 * REFRESH_PERCENT;
+    AddMilliseconds(&record->expiresAt, now, ttlMs);
+    AddMilliseconds(&record->refreshAt, now, refreshMs > MIN_REFRESH_MS ? refreshMs : MIN_REFRESH_MS);
+
+    DnsQuery *query = FindQuery(record->name, type);
+    if (query) {
+        query->queryId = 0;
+        query->attempts = 0;
+        query->refreshAt = record->refreshAt;
+    }
 }
 
-int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
-                            ServiceInstanceDetails **instanceDetails)
+/// <summary>
+///     Caches the records of the answer and the additional sections of a DNS response.
+/// </summary>
+static void ProcessDnsResponse(const char *answerBuf, int len, const struct timespec *now)
 {
-    static char displayBuf[DISPLAY_BUF_SIZE];
-    ns_rr rr;
-    int messageCount = ns_msg_count(msg, section);
+    ns_msg msg;
+    if (ns_initparse((const unsigned char *)answerBuf, len, &msg) != 0) {
+        Log_Debug("ERROR: ns_initparse: %d (%s)\n", errno, strerror(errno));
+        return;
+    }
 
-    if (!(*instanceDetails)) {
-        // Allocate for ServiceInstanceDetails and initialize its members.
-        *instanceDetails = malloc(sizeof(ServiceInstanceDetails));
-        if (!(*instanceDetails)) {
-            Log_Debug("ERROR: recvfrom: %d (%s)\n", errno, strerror(errno));
-            return -1;
+    // Find the RRset the response answers.
+    uint16_t id = ns_msg_id(msg);
+    DnsQuery *queried = NULL;
+    for (int i = 0; i < DNS_QUERY_COUNT && id != 0; ++i) {
+        if (queries[i].name[0] != '\0' && queries[i].queryId == id) {
+            queried = &queries[i];
         }
-        (*instanceDetails)->name = NULL;
-        (*instanceDetails)->host = NULL;
-        (*instanceDetails)->ipv4Address.s_addr = INADDR_NONE;
-        (*instanceDetails)->port = 0;
-        (*instanceDetails)->txtData = NULL;
-        (*instanceDetails)->txtDataLength = 0;
+    }
+    if (!queried) {
+        // Late answer to a query which timed out, or to an RRset no longer needed.
+        return;
     }
 
-    // Parse each message
-    for (int i = 0; i < messageCount; ++i) {
-        if (ns_parserr(&msg, section, i, &rr)) {
-            Log_Debug("ERROR: ns_parserr: %d (%s)\n", errno, strerror(errno));
-            return -1;
-        }
-        switch (ns_rr_type(rr)) {
-        case ns_t_ptr: {
-            int compressedNameLength =
-                dn_expand(buf, buf + len, ns_rr_rdata(rr), displayBuf, sizeof(displayBuf));
-            if (compressedNameLength > 0 && !(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(displayBuf);
-                if (!(*instanceDetails)->name) {
-                    Log_Debug("ERROR: strdup for instance name failed: %d (%s)\n", errno,
-                              strerror(errno));
-                    return -1;
+    responseSerial++;
+    int rcode = ns_msg_getflag(msg, ns_f_rcode);
+    if (rcode == ns_r_noerror) {
+        static const ns_sect sections[] = {ns_s_an, ns_s_ar};
+        for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); ++s) {
+            for (int i = 0; i < ns_msg_count(msg, sections[s]); ++i) {
+                ns_rr rr;
+                if (ns_parserr(&msg, sections[s], i, &rr)) {
+                    Log_Debug("ERROR: ns_parserr: %d (%s)\n", errno, strerror(errno));
+                    break;
                 }
+                StoreRecord(answerBuf, len, &rr, now);
             }
-            break;
         }
-        case ns_t_srv: {
-            // Parse the SRV record and populate the port and host fields in instance details as per
-            // DNS SRV record specification: https://tools.ietf.org/rfc/rfc2782.txt
-            // SRV record format: Priority|  Weight |   Port  |     Target
-            //                   (2 Bytes)|(2 Bytes)|(2 Bytes)|(Remaining Bytes)
-            const char *data = ns_rr_rdata(rr);
-            int compressedTargetDomainNameLength = dn_expand(
-                buf, buf + len, data + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t),
-                displayBuf, sizeof(displayBuf));
-            if ((*instanceDetails)->port == 0 && compressedTargetDomainNameLength > 0 &&
-                !(*instanceDetails)->host) {
-                (*instanceDetails)->port =
-                    (uint16_t)ns_get16(data + sizeof(uint16_t) + sizeof(uint16_t));
-                (*instanceDetails)->host = strdup(displayBuf);
-                if (!(*instanceDetails)->host) {
-                    Log_Debug("ERROR: strdup: %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
-                Log_Debug("%s\n", (*instanceDetails)->host);
+    }
+
+    if (queried->queryId == id) {
+        // The answer didn't contain the RRset. If the server says it doesn't exist (any more),
+        // e.g. an instance was removed, drop it; if the server failed, keep the cached records
+        // until they expire.
+        Log_Debug("INFO: No %s record for [%s].\n", RecordTypeName(queried->type), queried->name);
+        if (rcode == ns_r_noerror || rcode == ns_r_nxdomain) {
+            RemoveRecords(queried->name, queried->type);
+        }
+        queried->queryId = 0;
+        queried->attempts = 0;
+        AddMilliseconds(&queried->refreshAt, now, QUERY_RETRY_DELAY_MS);
+    }
+}
+
+static void ResolverSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events,
+                                       void *context)
+{
+    static char answerBuf[ANSWER_BUF_SIZE];
+
+    ssize_t len = recv(fd, answerBuf, sizeof(answerBuf), 0);
+    if (len == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log_Debug("ERROR: recv: %d (%s)\n", errno, strerror(errno));
+        }
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ProcessDnsResponse(answerBuf, (int)len, &now);
+}
+
+/// <summary>
+///     Marks an RRset as needed, and queries it if it's missing, about to expire, or its query
+///     timed out.
+/// </summary>
+/// <returns>The first cached record of the RRset, or NULL if there's none.</returns>
+static const DnsRecord *WantRecords(const char *name, uint16_t type, const struct timespec *now)
+{
+    DnsQuery *query = FindOrAddQuery(name, type, now);
+    if (!query) {
+        return NULL;
+    }
+    query->wanted = true;
+
+    if (query->queryId != 0) {
+        struct timespec deadline;
+        AddMilliseconds(&deadline, &query->sentAt, QUERY_TIMEOUT_MS);
+        if (IsReached(&deadline, now)) {
+            query->queryId = 0;
+            if (query->attempts < QUERY_MAX_ATTEMPTS) {
+                SendQuery(query, now);
+            } else {
+                Log_Debug("ERROR: No answer for [%s] (%s).\n", name, RecordTypeName(type));
+                query->attempts = 0;
+                AddMilliseconds(&query->refreshAt, now, QUERY_RETRY_DELAY_MS);
             }
-            break;
         }
-        case ns_t_txt: {
-            // Populate name field in instance details if it hasn't been set
-            if (!(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(ns_rr_name(rr));
-                if (!(*instanceDetails)->name) {
-                    Log_Debug("ERROR: strdup(ns_rr_name(rr)): %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
+    } else if (IsReached(&query->refreshAt, now)) {
+        SendQuery(query, now);
+    }
+
+    return NextRecord(name, type, NULL);
+}
+
+static bool IsSameString(const char *a, const char *b)
+{
+    return (a == NULL && b == NULL) || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static bool IsSameInstance(const ServiceInstanceDetails *a, const ServiceInstanceDetails *b)
+{
+    return IsSameString(a->name, b->name) && IsSameString(a->host, b->host) &&
+           a->ipv4Address.s_addr == b->ipv4Address.s_addr && a->port == b->port &&
+           a->priority == b->priority && a->weight == b->weight &&
+           a->txtDataLength == b->txtDataLength &&
+           (a->txtDataLength == 0 || memcmp(a->txtData, b->txtData, a->txtDataLength) == 0);
+}
+
+static ServiceInstance *FindInstance(const char *name)
+{
+    for (size_t i = 0; i < instanceCount; ++i) {
+        if (strcasecmp(instances[i].details->name, name) == 0) {
+            return &instances[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Finds the instance of details returned by the resolver, or of a copy of them.
+/// </summary>
+static ServiceInstance *FindInstanceByDetails(const ServiceInstanceDetails *details)
+{
+    for (size_t i = 0; i < instanceCount; ++i) {
+        if (instances[i].details == details) {
+            return &instances[i];
+        }
+    }
+    return FindInstance(details->name);
+}
+
+/// <summary>
+///     Adds or updates an instance resolved from the cache, and calls the handler if it changed.
+///     Its health is kept across updates.
+/// </summary>
+/// <returns>false if the instance is ignored, as there are already MAX_SERVICE_INSTANCES.</returns>
+static bool UpdateServiceInstance(const ServiceInstanceDetails *resolved)
+{
+    ServiceInstance *instance = FindInstance(resolved->name);
+    if (instance) {
+        instance->resolved = true;
+        if (IsSameInstance(resolved, instance->details)) {
+            return true;
+        }
+    } else if (instanceCount >= MAX_SERVICE_INSTANCES) {
+        return false;
+    }
+
+    ServiceInstanceDetails *details = CopyServiceInstanceDetails(resolved);
+    if (!details) {
+        Log_Debug("ERROR: Out of memory for the service instance.\n");
+        return true;
+    }
+
+    ServiceInstanceChange change = ServiceInstanceChange_Updated;
+    if (instance) {
+        FreeServiceInstanceDetails(instance->details);
+    } else {
+        instance = &instances[instanceCount++];
+        memset(instance, 0, sizeof(*instance));
+        instance->resolved = true;
+        change = ServiceInstanceChange_Added;
+    }
+    instance->details = details;
+    if (instanceChangedHandler) {
+        instanceChangedHandler(details, change);
+    }
+    return true;
+}
+
+/// <summary>
+///     Updates the resolved instances from the cache: an instance is resolved once its SRV record
+///     and the A record of its host are cached.
+/// </summary>
+static void UpdateServiceInstances(void)
+{
+    for (size_t i = 0; i < instanceCount; ++i) {
+        instances[i].resolved = false;
+    }
+
+    size_t ignored = 0;
+    for (const DnsRecord *ptr = NextRecord(discoveredServiceType, ns_t_ptr, NULL); ptr;
+         ptr = NextRecord(discoveredServiceType, ns_t_ptr, ptr)) {
+        const DnsRecord *srv = NextRecord(ptr->data.target, ns_t_srv, NULL);
+        const DnsRecord *a = srv ? NextRecord(srv->data.srv.target, ns_t_a, NULL) : NULL;
+        if (!a) {
+            continue;
+        }
+        const DnsRecord *txt = NextRecord(ptr->data.target, ns_t_txt, NULL);
+        ServiceInstanceDetails resolved = {.name = (char *)ptr->data.target,
+                                           .host = (char *)srv->data.srv.target,
+                                           .ipv4Address = a->data.address,
+                                           .port = srv->data.srv.port,
+                                           .priority = srv->data.srv.priority,
+                                           .weight = srv->data.srv.weight,
+                                           .txtData = txt ? (char *)txt->data.txt.data : NULL,
+                                           .txtDataLength = txt ? txt->data.txt.length : 0};
+        if (!UpdateServiceInstance(&resolved)) {
+            ignored++;
+        }
+    }
+    if (ignored != ignoredInstanceCount) {
+        if (ignored > 0) {
+            Log_Debug("WARNING: More than %d service instances, %zu ignored.\n",
+                      MAX_SERVICE_INSTANCES, ignored);
+        }
+        ignoredInstanceCount = ignored;
+    }
+
+    // Remove the instances no longer resolved, keeping the array compact.
+    for (size_t i = instanceCount; i-- > 0;) {
+        if (!instances[i].resolved) {
+            if (instanceChangedHandler) {
+                instanceChangedHandler(instances[i].details, ServiceInstanceChange_Removed);
             }
+            FreeServiceInstanceDetails(instances[i].details);
+            instances[i] = instances[--instanceCount];
+        }
+    }
+}
 
-            // Get TXT record, populate txtData and txtDataLength fields in instance details
-            if (!(*instanceDetails)->txtData) {
-                (*instanceDetails)->txtData =
-                    malloc(sizeof(unsigned char) * (size_t)(ns_rr_rdlen(rr)));
-                if (!(*instanceDetails)->txtData) {
-                    Log_Debug("ERROR: malloc: %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
-                memcpy((*instanceDetails)->txtData, ns_rr_rdata(rr), ns_rr_rdlen(rr));
-                (*instanceDetails)->txtDataLength = ns_rr_rdlen(rr);
+/// <summary>
+///     Expires the records past their TTL, sends the queries needed to resolve the instances and
+///     to refresh the records about to expire, and drops the records no longer needed.
+/// </summary>
+static void ResolverTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if (cache[i].name[0] != '\0' && IsReached(&cache[i].expiresAt, &now)) {
+            Log_Debug("INFO: %s record for [%s] expired.\n", RecordTypeName(cache[i].type),
+                      cache[i].name);
+            memset(&cache[i], 0, sizeof(cache[i]));
+        }
+    }
+    for (int i = 0; i < DNS_QUERY_COUNT; ++i) {
+        queries[i].wanted = false;
+    }
+
+    // Follow the records from the service type to the address of each instance.
+    WantRecords(discoveredServiceType, ns_t_ptr, &now);
+    for (const DnsRecord *ptr = NextRecord(discoveredServiceType, ns_t_ptr, NULL); ptr;
+         ptr = NextRecord(discoveredServiceType, ns_t_ptr, ptr)) {
+        const DnsRecord *srv = WantRecords(ptr->data.target, ns_t_srv, &now);
+        WantRecords(ptr->data.target, ns_t_txt, &now);
+        if (srv) {
+            WantRecords(srv->data.srv.target, ns_t_a, &now);
+        }
+    }
+
+    for (int i = 0; i < DNS_QUERY_COUNT; ++i) {
+        if (!queries[i].wanted) {
+            memset(&queries[i], 0, sizeof(queries[i]));
+        }
+    }
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i) {
+        if (cache[i].name[0] != '\0' && !FindQuery(cache[i].name, cache[i].type)) {
+            memset(&cache[i], 0, sizeof(cache[i]));
+        }
+    }
+
+    UpdateServiceInstances();
+}
+
+int StartServiceDiscovery(EventLoop *eventLoop, const char *serviceType,
+                          ServiceInstanceChangedHandler handler)
+{
+    if (res_init()) {
+        Log_Debug("ERROR: res_init: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    // Queries go to the OS resolver, which forwards them to the configured DNS servers and opens
+    // the firewall for the discovered hosts.
+    resolverFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (resolverFd == -1) {
+        Log_Debug("ERROR: socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+    struct sockaddr_in resolver;
+    memset(&resolver, 0, sizeof(resolver));
+    resolver.sin_family = AF_INET;
+    resolver.sin_port = htons(DNS_SERVER_PORT);
+    resolver.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(resolverFd, (struct sockaddr *)&resolver, sizeof(resolver)) == -1) {
+        Log_Debug("ERROR: connect: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    resolverEventLoop = eventLoop;
+    resolverEventReg = EventLoop_RegisterIo(eventLoop, resolverFd, EventLoop_Input,
+                                            ResolverSocketEventHandler, NULL);
+    if (resolverEventReg == NULL) {
+        Log_Debug("ERROR: EventLoop_RegisterIo: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    static const struct timespec tickInterval = {.tv_sec = 0,
+                                                 .tv_nsec = RESOLVER_TICK_MS * 1000000};
+    resolverTimer = CreateEventLoopPeriodicTimer(eventLoop, ResolverTimerEventHandler, &tickInterval);
+    if (resolverTimer == NULL) {
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(cache));
+    memset(queries, 0, sizeof(queries));
+    instanceCount = 0;
+    ignoredInstanceCount = 0;
+    nextQueryId = (uint16_t)time(NULL);
+    srand((unsigned int)time(NULL));
+    discoveredServiceType = serviceType;
+    instanceChangedHandler = handler;
+    return 0;
+}
+
+size_t GetServiceInstanceCount(void)
+{
+    return instanceCount;
+}
+
+const ServiceInstanceDetails *GetServiceInstance(size_t index)
+{
+    return index < instanceCount ? instances[index].details : NULL;
+}
+
+const ServiceInstanceHealth *GetServiceInstanceHealth(const ServiceInstanceDetails *instance)
+{
+    ServiceInstance *found = FindInstanceByDetails(instance);
+    return found ? &found->health : NULL;
+}
+
+const ServiceInstanceDetails *SelectServiceInstance(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Skip the instances which failed recently; if they all did, retry the one whose delay ends
+    // first.
+    bool available[MAX_SERVICE_INSTANCES];
+    const ServiceInstance *firstRetry = NULL;
+    bool anyAvailable = false;
+    uint16_t priority = UINT16_MAX;
+    for (size_t i = 0; i < instanceCount; ++i) {
+        const ServiceInstance *instance = &instances[i];
+        available[i] =
+            instance->health.consecutiveFailures == 0 || IsReached(&instance->retryAt, &now);
+        if (available[i]) {
+            anyAvailable = true;
+            if (instance->details->priority < priority) {
+                priority = instance->details->priority;
             }
-            break;
+        } else if (!firstRetry || !IsReached(&firstRetry->retryAt, &instance->retryAt)) {
+            firstRetry = instance;
         }
-        case ns_t_a: {
-            // Get A record (host address), populate ipv4Address field in instance details
-            if (ns_rr_rdlen(rr) == sizeof((*instanceDetails)->ipv4Address)) {
-                memcpy(&(*instanceDetails)->ipv4Address.s_addr, ns_rr_rdata(rr), ns_rr_rdlen(rr));
-            } else {
-                Log_Debug("ERROR: Invalid DNS A record length: %d\n", ns_rr_rdlen(rr));
+    }
+    if (!anyAvailable) {
+        return firstRetry ? firstRetry->details : NULL;
+    }
+
+    // Among the instances with the lowest priority, the latency of the fastest one scales the
+    // weights of the others down, so that slower instances get a smaller share.
+    uint32_t fastestUs = 0;
+    for (size_t i = 0; i < instanceCount; ++i) {
+        uint32_t latencyUs = instances[i].health.latencyUs;
+        if (available[i] && instances[i].details->priority == priority && latencyUs != 0 &&
+            (fastestUs == 0 || latencyUs < fastestUs)) {
+            fastestUs = latencyUs;
+        }
+    }
+
+    uint32_t weights[MAX_SERVICE_INSTANCES];
+    uint32_t totalWeight = 0;
+    for (size_t i = 0; i < instanceCount; ++i) {
+        weights[i] = 0;
+        if (!available[i] || instances[i].details->priority != priority) {
+            continue;
+        }
+        uint16_t weight = instances[i].details->weight;
+        weights[i] = weight == 0 ? 1 : weight * WEIGHT_SCALE;
+        uint32_t latencyUs = instances[i].health.latencyUs;
+        if (fastestUs != 0 && latencyUs > fastestUs) {
+            weights[i] = (uint32_t)((uint64_t)weights[i] * fastestUs / latencyUs);
+            if (weights[i] == 0) {
+                weights[i] = 1;
             }
-            break;
         }
-        default:
-            break;
+        totalWeight += weights[i];
+    }
+
+    // Weighted random selection, as per RFC 2782.
+    uint32_t pick = (uint32_t)rand() % totalWeight;
+    for (size_t i = 0; i < instanceCount; ++i) {
+        if (pick < weights[i]) {
+            return instances[i].details;
         }
+        pick -= weights[i];
     }
-    return 0;
+    return NULL;
 }
 
-int ProcessDnsResponse(ServiceInstanceDetails **instanceDetails, char* answerBuf, int len)
+void ReportServiceInstanceResult(const ServiceInstanceDetails *instance, bool success,
+                                 uint32_t latencyUs)
 {
-    ns_msg msg;
-    // Decode received response
-    if (ns_initparse(answerBuf, len, &msg) != 0) {
-        Log_Debug("ERROR: ns_initparse: %d (%s)\n", errno, strerror(errno));
-        goto fail;
+    ServiceInstance *found = FindInstanceByDetails(instance);
+    if (!found) {
+        return;
     }
-    if (ProcessMessageBySection(answerBuf, len, msg, ns_s_an, instanceDetails) != 0) {
-        goto fail;
+
+    ServiceInstanceHealth *health = &found->health;
+    if (success) {
+        health->successCount++;
+        health->consecutiveFailures = 0;
+        if (health->latencyUs == 0) {
+            health->latencyUs = latencyUs;
+        } else {
+            health->latencyUs = (uint32_t)(((uint64_t)health->latencyUs * (LATENCY_SMOOTHING - 1) +
+                                            latencyUs) /
+                                           LATENCY_SMOOTHING);
+        }
+        return;
     }
-    if (ProcessMessageBySection(answerBuf, len, msg, ns_s_ar, instanceDetails) != 0) {
-        goto fail;
+
+    health->failureCount++;
+    health->consecutiveFailures++;
+    long delayMs = INSTANCE_RETRY_MAX_MS;
+    if (health->consecutiveFailures <= 16) {
+        delayMs = (long)INSTANCE_RETRY_MS << (health->consecutiveFailures - 1);
+        if (delayMs > INSTANCE_RETRY_MAX_MS) {
+            delayMs = INSTANCE_RETRY_MAX_MS;
+        }
     }
-    return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    AddMilliseconds(&found->retryAt, &now, delayMs);
+}
+
+void StopServiceDiscovery(void)
+{
+    DisposeEventLoopTimer(resolverTimer);
+    resolverTimer = NULL;
+    if (resolverEventLoop) {
+        EventLoop_UnregisterIo(resolverEventLoop, resolverEventReg);
+        resolverEventReg = NULL;
+    }
+    if (resolverFd >= 0) {
+        close(resolverFd);
+        resolverFd = -1;
+    }
+    for (size_t i = 0; i < instanceCount; ++i) {
+        FreeServiceInstanceDetails(instances[i].details);
+    }
+    instanceCount = 0;
+    memset(cache, 0, sizeof(cache));
+    memset(queries, 0, sizeof(queries));
+}
+
+bool GetTxtValue(const ServiceInstanceDetails *details, const char *key, char *value,
+                 size_t valueSize)
+{
+    // TXT data is a sequence of strings, each prefixed by its length (one byte).
+    size_t keyLength = strlen(key);
+    uint16_t offset = 0;
+    while (offset < details->txtDataLength) {
+        uint8_t length = (uint8_t)details->txtData[offset++];
+        if (length > details->txtDataLength - offset) {
+            break;
+        }
+        const char *entry = details->txtData + offset;
+        if (length > keyLength && entry[keyLength] == '=' &&
+            strncasecmp(entry, key, keyLength) == 0) {
+            size_t valueLength = length - keyLength - 1;
+            if (valueLength >= valueSize) {
+                return false;
+            }
+            memcpy(value, entry + keyLength + 1, valueLength);
+            value[valueLength] = '\0';
+            return true;
+        }
+        offset += length;
+    }
+    return false;
+}
 
-fail:
-    FreeServiceInstanceDetails(*instanceDetails);
-    *instanceDetails = NULL;
-    return -1;
+ServiceInstanceDetails *CopyServiceInstanceDetails(const ServiceInstanceDetails *instance)
+{
+    ServiceInstanceDetails *copy = calloc(1, sizeof(ServiceInstanceDetails));
+    if (!copy) {
+        return NULL;
+    }
+    copy->ipv4Address = instance->ipv4Address;
+    copy->port = instance->port;
+    copy->priority = instance->priority;
+    copy->weight = instance->weight;
+    copy->name = instance->name ? strdup(instance->name) : NULL;
+    copy->host = instance->host ? strdup(instance->host) : NULL;
+    if (instance->txtDataLength > 0) {
+        copy->txtData = malloc(instance->txtDataLength);
+        if (copy->txtData) {
+            memcpy(copy->txtData, instance->txtData, instance->txtDataLength);
+            copy->txtDataLength = instance->txtDataLength;
+        }
+    }
+    if ((instance->name && !copy->name) || (instance->host && !copy->host) ||
+        (instance->txtDataLength > 0 && !copy->txtData)) {
+        FreeServiceInstanceDetails(copy);
+        return NULL;
+    }
+    return copy;
 }
 
-void FreeServiceInstanceDetails(const ServiceInstanceDetails *details)
+void FreeServiceInstanceDetails(ServiceInstanceDetails *details)
 {
     if (details) {
         free(details->name);
         free(details->host);
         free(details->txtData);
-        free((void *)details);
+        free(details);
     }
-}
\ No newline at end of file
+}
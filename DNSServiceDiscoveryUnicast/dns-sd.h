@@ -2,13 +2,16 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <netinet/in.h>
 
+#include <applibs/eventloop.h>
+
 /// <summary>
 /// Data structure for a DNS instance details.
-/// This should be created with <see cref="ProcessServiceInstanceDetailsResponse"/> and freed with
+/// This should be created with <see cref="CopyServiceInstanceDetails"/> and freed with
 /// <see cref="FreeServiceInstanceDetails"/>.
 /// </summary>
 typedef struct {
@@ -20,6 +23,10 @@ typedef struct {
     struct in_addr ipv4Address;
     /// <summary>Network port</summary>
     uint16_t port;
+    /// <summary>SRV priority: the instances with the lowest priority are used first</summary>
+    uint16_t priority;
+    /// <summary>SRV weight: relative share of the instances with the same priority</summary>
+    uint16_t weight;
     /// <summary>DNS TXT data</summary>
     char *txtData;
     /// <summary>DNS TXT data length</summary>
@@ -27,34 +34,115 @@ typedef struct {
 } ServiceInstanceDetails;
 
 /// <summary>
-/// Send a service discovery query
+/// Health of a service instance, from the results reported with
+/// <see cref="ReportServiceInstanceResult"/>.
 /// </summary>
-/// <param name="dName">Domain to query</param>
-/// <param name="answerBuf">Pointer to a buffer to receive the response</param>
-/// <param name="answerBufSize">Size of answerBuf</param>
-/// <returns>The number of bytes in the response if succeeded, -1 if an error occurred.</returns>
-int SendServiceDiscoveryQuery(const char *dName, char* answerBuf, int answerBufSize);
+typedef struct {
+    unsigned int successCount;
+    unsigned int failureCount;
+    /// <summary>Failures since the last success; the instance is avoided while it's non-zero,
+    /// for a delay doubling with each failure</summary>
+    unsigned int consecutiveFailures;
+    /// <summary>Moving average of the latency of the successes, 0 if none yet</summary>
+    uint32_t latencyUs;
+} ServiceInstanceHealth;
+
+typedef enum {
+    ServiceInstanceChange_Added,
+    /// <summary>Its host, address, port, priority, weight or TXT data changed</summary>
+    ServiceInstanceChange_Updated,
+    /// <summary>Its records expired, or it's no longer listed by the PTR records</summary>
+    ServiceInstanceChange_Removed
+} ServiceInstanceChange;
 
 /// <summary>
-/// Send a service instance details query
+/// Called when a service instance is resolved, changes, or is removed. The instance is only valid
+/// during the call.
 /// </summary>
-/// <param name="instanceName">The instance name to query details for</param>
-/// <param name="answerBuf">Pointer to a buffer to receive the response</param>
-/// <param name="answerBufSize">Size of answerBuf</param>
-/// <returns>The number of bytes in the response if succeeded, -1 if an error occurred.</returns>
-int SendServiceInstanceDetailsQuery(const char *instanceName, char* answerBuf, int answerBufSize);
+typedef void (*ServiceInstanceChangedHandler)(const ServiceInstanceDetails *instance,
+                                              ServiceInstanceChange change);
 
 /// <summary>
-/// Process data from a service discovery response
+/// Starts resolving a service type asynchronously on the event loop: the PTR records of the
+/// service type, then the SRV and TXT records of each instance, then the A records of their
+/// hosts. The records are cached for their TTL and queried again before they expire, so that the
+/// resolved instances stay available without blocking the event loop. Up to 8 instances are
+/// resolved: the others are ignored, which is logged.
 /// </summary>
-/// <param name="instanceDetails">The instance details if it is available in the response</param>
-/// <param name="answerBuf">Pointer to a buffer containing the response</param>
-/// <param name="answerBufSize">Size of answerBuf</param>
+/// <param name="eventLoop">Event loop to run the queries on</param>
+/// <param name="serviceType">Service type to discover, e.g. "_http._tcp.home"; must stay
+/// valid</param>
+/// <param name="handler">Called when an instance is added, updated or removed</param>
 /// <returns>0 if succeeded, -1 if an error occurred.</returns>
-int ProcessDnsResponse(ServiceInstanceDetails **instanceDetails, char* answerBuf, int answerBufSize);
+int StartServiceDiscovery(EventLoop *eventLoop, const char *serviceType,
+                          ServiceInstanceChangedHandler handler);
+
+/// <summary>
+/// Returns the number of resolved service instances.
+/// </summary>
+size_t GetServiceInstanceCount(void);
+
+/// <summary>
+/// Returns a resolved service instance, or NULL if index is out of range. The instance stays valid
+/// until the next event loop iteration.
+/// </summary>
+const ServiceInstanceDetails *GetServiceInstance(size_t index);
+
+/// <summary>
+/// Returns the health of a resolved service instance, or NULL if it's no longer resolved.
+/// </summary>
+/// <param name="instance">The instance, or a copy of it made with
+/// <see cref="CopyServiceInstanceDetails"/></param>
+const ServiceInstanceHealth *GetServiceInstanceHealth(const ServiceInstanceDetails *instance);
+
+/// <summary>
+/// Selects the instance to connect to as per RFC 2782: among the instances with the lowest SRV
+/// priority, one at random in proportion to its SRV weight, scaled down by its latency relative to
+/// the fastest one. Instances which failed recently are skipped, so that calling this again after
+/// reporting a failure fails over to another instance; if they all failed, the one to be retried
+/// first is returned.
+/// </summary>
+/// <returns>The instance, valid until the next event loop iteration, or NULL if none is
+/// resolved.</returns>
+const ServiceInstanceDetails *SelectServiceInstance(void);
+
+/// <summary>
+/// Reports the result of a connection to an instance returned by
+/// <see cref="SelectServiceInstance"/>, to bias the next selections.
+/// </summary>
+/// <param name="instance">The instance, or a copy of it made with
+/// <see cref="CopyServiceInstanceDetails"/>, e.g. to report the result of a connection which
+/// completes on a later event loop iteration</param>
+/// <param name="success">Whether the connection succeeded</param>
+/// <param name="latencyUs">Latency of the connection if it succeeded</param>
+void ReportServiceInstanceResult(const ServiceInstanceDetails *instance, bool success,
+                                 uint32_t latencyUs);
+
+/// <summary>
+/// Stops the queries and frees the cache.
+/// </summary>
+void StopServiceDiscovery(void);
+
+/// <summary>
+/// Looks for a "key=value" string in the TXT data of an instance (RFC 6763, section 6).
+/// </summary>
+/// <param name="details">The service instance</param>
+/// <param name="key">The key to look for</param>
+/// <param name="value">Receives the null-terminated value</param>
+/// <param name="valueSize">Size of value</param>
+/// <returns>true if the key was found.</returns>
+bool GetTxtValue(const ServiceInstanceDetails *details, const char *key, char *value,
+                 size_t valueSize);
+
+/// <summary>
+/// Copies a ServiceInstanceDetails
+/// </summary>
+/// <param name="instance">The ServiceInstanceDetails struct to copy</param>
+/// <returns>The copy, or NULL if out of memory.</returns>
+ServiceInstanceDetails *CopyServiceInstanceDetails(const ServiceInstanceDetails *instance);
 
 /// <summary>
 /// Free memory used by a ServiceInstanceDetails
 /// </summary>
 /// <param name="instance">The ServiceInstanceDetails struct to free</param>
-void FreeServiceInstanceDetails(const ServiceInstanceDetails *instance);
\ No newline at end of file
+void FreeServiceInstanceDetails(ServiceInstanceDetails *instance);
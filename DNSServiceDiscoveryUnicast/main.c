@@ -7,11 +7,16 @@
 // It uses the API for the following Azure Sphere application libraries:
 // - log (displays messages in the Device Output window during debugging)
 // - networking (get network interface connection status)
-// - eventloop (system invokes handlers for timer events)
+// - eventloop (system invokes handlers for timer and socket events)
+//
+// The fetches use the curl multi interface on the same event loop, so that a slow or unresponsive
+// instance doesn't block the DNS-SD queries or the other events.
 
 #include <errno.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include <applibs/log.h>
@@ -35,21 +40,27 @@ typedef enum {
     ExitCode_ConnectionTimer_Consume = 2,
     ExitCode_ConnectionTimer_ConnectionReady = 3,
     ExitCode_ConnectionTimer_Disarm = 4,
+    ExitCode_ConnectionTimer_StartDiscovery = 6,
 
     ExitCode_Init_EventLoop = 5,
 
     ExitCode_Init_ConnectionTimer = 7,
     ExitCode_Init_ConfigureDnsServers = 8,
+    ExitCode_Init_Curl = 10,
+    ExitCode_Init_CurlTimer = 11,
+
+    ExitCode_CurlTimer_Consume = 12,
+    ExitCode_CurlSocket_Register = 13,
 
     ExitCode_Main_EventLoopFail = 9
 } ExitCode;
 
 // File descriptors - initialized to invalid value
 static bool isNetworkStackReady = false;
+static bool isDiscoveryStarted = false;
 
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *connectionTimer = NULL;
-static EventRegistration *dnsEventReg = NULL;
 
 static const Networking_InterfaceConnectionStatus RequiredNetworkStatus =
     Networking_InterfaceConnectionStatus_IpAvailable;
@@ -58,12 +69,47 @@ static const char DnsSDServiceType[] = "_http._tcp.home";
 static const char DnsSDServerIp[] = "w.x.y.z"; // Replace this with your DNS server for service discovery
 static const char OtherDnsServerIp[] = "w.x.y.z"; // Replace this with a second DNS server for normal resolution
 
+#define URL_SIZE 512u
+#define RESOLVE_ENTRY_SIZE 320u
+
+// Time allowed for a fetch, including the failovers to other instances. It is shorter than the
+// fetch period, so that a fetch is complete before the next one starts. Each attempt is limited
+// too, so that an unresponsive instance leaves time to fail over.
+#define FETCH_TIMEOUT_MS 8000L
+#define FETCH_ATTEMPT_TIMEOUT_MS 3000L
+
+// A single curl handle, kept across fetches so that the connections to the instances are reused.
+// It is run by curlMulti, whose sockets and timeout are handled by the event loop.
+static CURL *curlHandle = NULL;
+static CURLM *curlMulti = NULL;
+static EventLoopTimer *curlTimer = NULL;
+static struct curl_slist *curlResolve = NULL;
+static bool isCurlGlobalInitialized = false;
+// "host:port" of the instance in curlResolve, to remove it when fetching from another instance
+static char resolvedHostPort[RESOLVE_ENTRY_SIZE] = "";
+
+// Fetch in progress: a copy of the instance it's from, as the resolver may update or remove the
+// instance meanwhile, the instances tried so far, and when the fetch must be complete.
+static ServiceInstanceDetails *fetchInstance = NULL;
+static size_t fetchAttempts = 0;
+static struct timespec fetchDeadline;
 
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
-static void DoFetch(const char* url);
-static void DoQuery(void);
+static bool FetchFromInstance(const ServiceInstanceDetails *instance);
+static void FetchFromNextInstance(void);
+static void CompleteFetch(CURLcode result);
+static void DoFetch(void);
+static int CurlSocketCallback(CURL *easy, curl_socket_t fd, int what, void *userData,
+                              void *socketData);
+static int CurlTimerCallback(CURLM *multi, long timeoutMs, void *userData);
+static void CurlSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events,
+                                   void *context);
+static void CurlTimerEventHandler(EventLoopTimer *timer);
+static void ProcessCurlMessages(void);
+static void OnServiceInstanceChanged(const ServiceInstanceDetails *instance,
+                                     ServiceInstanceChange change);
 static void TerminationHandler(int signalNumber);
 static void ConnectionTimerEventHandler(EventLoopTimer *timer);
 static ExitCode InitializeAndStartDnsServiceDiscovery(void);
@@ -78,61 +124,277 @@ static void TerminationHandler(int signalNumber)
     exitCode = ExitCode_TermHandler_SigTerm;
 }
 
-static void DoFetch(const char* url)
+/// <summary>
+///     Returns the milliseconds left before the deadline of the fetch, or 0 if it has passed.
+/// </summary>
+static long GetFetchTimeLeftMs(void)
 {
-    CURL* curl;
-    CURLcode res;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long leftMs = (fetchDeadline.tv_sec - now.tv_sec) * 1000L +
+                  (fetchDeadline.tv_nsec - now.tv_nsec) / 1000000L;
+    return leftMs > 0 ? leftMs : 0;
+}
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
+/// <summary>
+///     Starts fetching the URL of a service instance, using its cached address so that curl
+///     doesn't resolve the host again. The transfer runs on the event loop, and
+///     <see cref="CompleteFetch"/> is called when it ends.
+/// </summary>
+/// <returns>true if the fetch was started.</returns>
+static bool FetchFromInstance(const ServiceInstanceDetails *instance)
+{
+    // NOTE: Only the "path" key of the TXT data is used here. You should replace this with
+    // your own production logic.
+    char path[URL_SIZE / 2];
+    if (!GetTxtValue(instance, "path", path, sizeof(path))) {
+        strcpy(path, "/");
+    }
+    static char url[URL_SIZE];
+    snprintf(url, sizeof(url), "http://%s:%hu%s", instance->host, instance->port, path);
+
+    // Replace the address of the previous instance (if any) in the curl resolve list.
+    static char entry[RESOLVE_ENTRY_SIZE];
+    curl_slist_free_all(curlResolve);
+    curlResolve = NULL;
+    if (resolvedHostPort[0] != '\0') {
+        snprintf(entry, sizeof(entry), "-%s", resolvedHostPort);
+        curlResolve = curl_slist_append(curlResolve, entry);
+    }
+    snprintf(resolvedHostPort, sizeof(resolvedHostPort), "%s:%hu", instance->host, instance->port);
+    snprintf(entry, sizeof(entry), "%s:%s", resolvedHostPort, inet_ntoa(instance->ipv4Address));
+    curlResolve = curl_slist_append(curlResolve, entry);
+    curl_easy_setopt(curlHandle, CURLOPT_RESOLVE, curlResolve);
+    curl_easy_setopt(curlHandle, CURLOPT_URL, url);
+    // The attempt only gets the time left for the whole fetch.
+    long timeoutMs = GetFetchTimeLeftMs();
+    if (timeoutMs > FETCH_ATTEMPT_TIMEOUT_MS) {
+        timeoutMs = FETCH_ATTEMPT_TIMEOUT_MS;
+    }
+    curl_easy_setopt(curlHandle, CURLOPT_TIMEOUT_MS, timeoutMs);
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
+    fetchInstance = CopyServiceInstanceDetails(instance);
+    if (fetchInstance == NULL) {
+        Log_Debug("ERROR: Could not copy the service instance details.\n");
+        return false;
+    }
 
-    res = curl_easy_perform(curl);
-    if(res != CURLE_OK)
-      Log_Debug("curl_easy_perform() failed: %s\n",
-              curl_easy_strerror(res));
-    curl_easy_cleanup(curl);
+    Log_Debug("INFO: Fetching %s from %s\n", url, instance->name);
+    CURLMcode res = curl_multi_add_handle(curlMulti, curlHandle);
+    if (res != CURLM_OK) {
+        Log_Debug("ERROR: curl_multi_add_handle() failed: %s\n", curl_multi_strerror(res));
+        FreeServiceInstanceDetails(fetchInstance);
+        fetchInstance = NULL;
+        return false;
+    }
+    return true;
 }
 
-#define ANSWER_BUF_SIZE 2048u
-static void DoQuery(void)
+/// <summary>
+///     Starts fetching from an instance of the service selected by SRV priority and weight, unless
+///     each instance was tried or the fetch is out of time. An instance the fetch can't be started
+///     for is reported as failed, and the next one is tried.
+/// </summary>
+static void FetchFromNextInstance(void)
 {
-    static char answerBuf[ANSWER_BUF_SIZE];
-    ServiceInstanceDetails *details = NULL;
+    while (fetchAttempts < GetServiceInstanceCount()) {
+        if (GetFetchTimeLeftMs() == 0) {
+            Log_Debug("INFO: Fetch abandoned after %zu attempts, out of time.\n", fetchAttempts);
+            return;
+        }
 
-    int answerSize = SendServiceDiscoveryQuery(DnsSDServiceType, answerBuf, ANSWER_BUF_SIZE);
-    if (answerSize <= 0) {
-        goto fail;
+        const ServiceInstanceDetails *instance = SelectServiceInstance();
+        if (!instance) {
+            return;
+        }
+        fetchAttempts++;
+        if (FetchFromInstance(instance)) {
+            return;
+        }
+        ReportServiceInstanceResult(instance, false, 0);
     }
-    
-    int result = ProcessDnsResponse(&details, answerBuf, answerSize);
-    if (result != 0) {
-        goto fail;
+}
+
+/// <summary>
+///     Reports the result of the fetch to the DNS-SD resolver, and on failure fails over at once
+///     to another instance.
+/// </summary>
+static void CompleteFetch(CURLcode result)
+{
+    curl_multi_remove_handle(curlMulti, curlHandle);
+
+    if (result != CURLE_OK) {
+        Log_Debug("Fetch failed: %s\n", curl_easy_strerror(result));
+        ReportServiceInstanceResult(fetchInstance, false, 0);
+    } else {
+        curl_off_t totalTimeUs = 0;
+        curl_easy_getinfo(curlHandle, CURLINFO_TOTAL_TIME_T, &totalTimeUs);
+        ReportServiceInstanceResult(fetchInstance, true, (uint32_t)totalTimeUs);
+        const ServiceInstanceHealth *health = GetServiceInstanceHealth(fetchInstance);
+        if (health) {
+            Log_Debug("INFO: Fetched in %u ms (average %u ms, %u/%u succeeded).\n",
+                      (unsigned int)(totalTimeUs / 1000), health->latencyUs / 1000,
+                      health->successCount, health->successCount + health->failureCount);
+        }
     }
 
-    if (details && details->name) {
-        Log_Debug("INFO: DNS Service Discovery has found an instance: %s.\n", details->name);
-        if (!details->host) {
-            Log_Debug("INFO: Requesting SRV and TXT details for the instance.\n");
-            answerSize = SendServiceInstanceDetailsQuery(details->name, answerBuf, ANSWER_BUF_SIZE);
-            result = ProcessDnsResponse(&details, answerBuf, answerSize);
-            if (result != 0) {
-                goto fail;
-            }
+    FreeServiceInstanceDetails(fetchInstance);
+    fetchInstance = NULL;
+
+    if (result != CURLE_OK) {
+        FetchFromNextInstance();
+    }
+}
+
+/// <summary>
+///     Starts a fetch, unless the previous one is still in progress.
+/// </summary>
+static void DoFetch(void)
+{
+    if (fetchInstance != NULL) {
+        Log_Debug("INFO: The previous fetch is still in progress.\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &fetchDeadline);
+    fetchDeadline.tv_sec += FETCH_TIMEOUT_MS / 1000;
+    fetchDeadline.tv_nsec += (FETCH_TIMEOUT_MS % 1000) * 1000000L;
+    if (fetchDeadline.tv_nsec >= 1000000000L) {
+        fetchDeadline.tv_sec++;
+        fetchDeadline.tv_nsec -= 1000000000L;
+    }
+    fetchAttempts = 0;
+    FetchFromNextInstance();
+}
+
+/// <summary>
+///     Passes the completed transfers of curlMulti to <see cref="CompleteFetch"/>.
+/// </summary>
+static void ProcessCurlMessages(void)
+{
+    CURLMsg *message;
+    int messagesLeft;
+    while ((message = curl_multi_info_read(curlMulti, &messagesLeft)) != NULL) {
+        if (message->msg == CURLMSG_DONE && message->easy_handle == curlHandle) {
+            CompleteFetch(message->data.result);
+        }
+    }
+}
+
+/// <summary>
+///     Called by curl to say which events to wait for on a socket: registers the socket with the
+///     event loop, updates its events, or unregisters it.
+/// </summary>
+static int CurlSocketCallback(CURL *easy, curl_socket_t fd, int what, void *userData,
+                              void *socketData)
+{
+    EventRegistration *registration = socketData;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (registration) {
+            EventLoop_UnregisterIo(eventLoop, registration);
+            curl_multi_assign(curlMulti, fd, NULL);
+        }
+        return 0;
+    }
 
-            // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
-            // replace this with your own production logic.
-            Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hd\n\tTXT Data: %.*s\n",
-                      details->name, details->host, inet_ntoa(details->ipv4Address), details->port,
-                      details->txtDataLength, details->txtData);
+    EventLoop_IoEvents events = 0;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+        events |= EventLoop_Input;
+    }
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+        events |= EventLoop_Output;
+    }
 
-            DoFetch(details->host);
+    if (!registration) {
+        registration = EventLoop_RegisterIo(eventLoop, fd, events, CurlSocketEventHandler, NULL);
+        if (!registration) {
+            Log_Debug("ERROR: EventLoop_RegisterIo: %d (%s)\n", errno, strerror(errno));
+            exitCode = ExitCode_CurlSocket_Register;
+            return -1;
         }
+        curl_multi_assign(curlMulti, fd, registration);
+    } else if (EventLoop_ModifyIoEvents(eventLoop, registration, events) != 0) {
+        Log_Debug("ERROR: EventLoop_ModifyIoEvents: %d (%s)\n", errno, strerror(errno));
+        exitCode = ExitCode_CurlSocket_Register;
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Called by curl to set when it must be called back, with -1 to cancel.
+/// </summary>
+static int CurlTimerCallback(CURLM *multi, long timeoutMs, void *userData)
+{
+    if (timeoutMs < 0) {
+        return DisarmEventLoopTimer(curlTimer);
+    }
+
+    // A zero delay would disarm the timer, so wait at least 1 ms.
+    if (timeoutMs == 0) {
+        timeoutMs = 1;
+    }
+    struct timespec delay = {.tv_sec = timeoutMs / 1000, .tv_nsec = (timeoutMs % 1000) * 1000000L};
+    return SetEventLoopTimerOneShot(curlTimer, &delay);
+}
+
+/// <summary>
+///     Handles the events of the curl sockets.
+/// </summary>
+static void CurlSocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events,
+                                   void *context)
+{
+    int action = 0;
+    if (events & EventLoop_Input) {
+        action |= CURL_CSELECT_IN;
+    }
+    if (events & EventLoop_Output) {
+        action |= CURL_CSELECT_OUT;
+    }
+    if (events & EventLoop_Error) {
+        action |= CURL_CSELECT_ERR;
+    }
+
+    int runningHandles;
+    curl_multi_socket_action(curlMulti, fd, action, &runningHandles);
+    ProcessCurlMessages();
+}
+
+/// <summary>
+///     Lets curl handle its timeouts.
+/// </summary>
+static void CurlTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_CurlTimer_Consume;
+        return;
+    }
+
+    int runningHandles;
+    curl_multi_socket_action(curlMulti, CURL_SOCKET_TIMEOUT, 0, &runningHandles);
+    ProcessCurlMessages();
+}
+
+/// <summary>
+///     Called by the DNS-SD resolver when an instance is resolved, changes or is removed.
+/// </summary>
+static void OnServiceInstanceChanged(const ServiceInstanceDetails *instance,
+                                     ServiceInstanceChange change)
+{
+    if (change == ServiceInstanceChange_Removed) {
+        Log_Debug("INFO: The service instance %s was removed.\n", instance->name);
+        return;
     }
 
-fail:
-    FreeServiceInstanceDetails(details);
+    Log_Debug("INFO: DNS Service Discovery has %s an instance: %s.\n",
+              change == ServiceInstanceChange_Added ? "found" : "updated", instance->name);
+    // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
+    // replace this with your own production logic.
+    Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hu\n\tPriority: %hu\n"
+              "\tWeight: %hu\n\tTXT Data: %.*s\n",
+              instance->name, instance->host, inet_ntoa(instance->ipv4Address), instance->port,
+              instance->priority, instance->weight, instance->txtDataLength, instance->txtData);
 }
 
 /// <summary>
@@ -177,8 +439,17 @@ static void ConnectionTimerEventHandler(EventLoopTimer *timer)
     if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
         exitCode = ExitCode_ConnectionTimer_ConnectionReady;
     } else if (isConnectionReady) {
-        // Connection is ready, send a DNS service discovery query.
-        DoQuery();
+        if (!isDiscoveryStarted) {
+            // Connection is ready, start resolving the service. The resolver caches the records
+            // and refreshes them in the background, so the fetches below don't wait for DNS.
+            if (StartServiceDiscovery(eventLoop, DnsSDServiceType, OnServiceInstanceChanged) !=
+                0) {
+                exitCode = ExitCode_ConnectionTimer_StartDiscovery;
+                return;
+            }
+            isDiscoveryStarted = true;
+        }
+        DoFetch();
     }
 }
 
@@ -237,8 +508,35 @@ static ExitCode InitializeAndStartDnsServiceDiscovery(void)
         return ExitCode_Init_EventLoop;
     }
 
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        Log_Debug("ERROR: curl_global_init failed.\n");
+        return ExitCode_Init_Curl;
+    }
+    isCurlGlobalInitialized = true;
+    curlHandle = curl_easy_init();
+    if (curlHandle == NULL) {
+        Log_Debug("ERROR: curl_easy_init failed.\n");
+        return ExitCode_Init_Curl;
+    }
+    // Fail over quickly from an instance which doesn't accept connections, or returns an error.
+    curl_easy_setopt(curlHandle, CURLOPT_CONNECTTIMEOUT, 3L);
+    curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1L);
+
+    curlMulti = curl_multi_init();
+    if (curlMulti == NULL) {
+        Log_Debug("ERROR: curl_multi_init failed.\n");
+        return ExitCode_Init_Curl;
+    }
+    curlTimer = CreateEventLoopDisarmedTimer(eventLoop, &CurlTimerEventHandler);
+    if (curlTimer == NULL) {
+        return ExitCode_Init_CurlTimer;
+    }
+    curl_multi_setopt(curlMulti, CURLMOPT_SOCKETFUNCTION, CurlSocketCallback);
+    curl_multi_setopt(curlMulti, CURLMOPT_TIMERFUNCTION, CurlTimerCallback);
+
     // Check network interface status at the specified period until it is ready.
-    // This also defines the frequency at which the sample sends out DNS-SD queries.
+    // This also defines the frequency at which the sample fetches from the service; DNS-SD
+    // queries are only sent when the cached records are about to expire.
     static const struct timespec checkInterval = {.tv_sec = 10, .tv_nsec = 0};
     connectionTimer =
         CreateEventLoopPeriodicTimer(eventLoop, &ConnectionTimerEventHandler, &checkInterval);
@@ -255,9 +553,30 @@ static ExitCode InitializeAndStartDnsServiceDiscovery(void)
 static void Cleanup(void)
 {
     DisposeEventLoopTimer(connectionTimer);
-    EventLoop_UnregisterIo(eventLoop, dnsEventReg);
+    if (isDiscoveryStarted) {
+        StopServiceDiscovery();
+    }
+
+    // Removing the handle from curlMulti unregisters its sockets, so do it before closing the
+    // event loop.
+    if (fetchInstance) {
+        curl_multi_remove_handle(curlMulti, curlHandle);
+        FreeServiceInstanceDetails(fetchInstance);
+        fetchInstance = NULL;
+    }
+    if (curlMulti) {
+        curl_multi_cleanup(curlMulti);
+    }
+    DisposeEventLoopTimer(curlTimer);
     EventLoop_Close(eventLoop);
 
+    if (curlHandle) {
+        curl_easy_cleanup(curlHandle);
+    }
+    curl_slist_free_all(curlResolve);
+    if (isCurlGlobalInitialized) {
+        curl_global_cleanup();
+    }
 }
 
 int main(void)
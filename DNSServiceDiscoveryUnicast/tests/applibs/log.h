@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host stand-in for the Azure Sphere log API: prints to stdout, and lets the test check what was
+// logged.
+
+#pragma once
+
+void Log_Debug(const char *format, ...);
@@ -0,0 +1,525 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test of the DNS-SD resolver: serves the records of a zone file (container/db.home) over
+// UDP on the event loop, and checks the resolved instances, their selection and the failover, and
+// the updates when the records change.
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <resolv.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "../dns-sd.h"
+
+#define ZONE_ORIGIN "home"
+#define SERVICE_TYPE "_http._tcp." ZONE_ORIGIN
+#define MAX_ZONE_RECORDS 64
+#define NAME_SIZE 256
+#define SELECTION_COUNT 4000
+// Longer than the TTL of the zone, so that the changed records are queried again
+#define UPDATE_TIMEOUT_MS 15000
+
+typedef struct {
+    char name[NAME_SIZE];
+    uint16_t type;
+    uint32_t ttl;
+    // PTR, SRV target; TXT string
+    char text[NAME_SIZE];
+    uint16_t priority;
+    uint16_t weight;
+    uint16_t port;
+    struct in_addr address;
+} ZoneRecord;
+
+static ZoneRecord zone[MAX_ZONE_RECORDS];
+static size_t zoneCount = 0;
+
+static unsigned int warningCount = 0;
+static unsigned int addedCount = 0;
+static unsigned int removedCount = 0;
+
+void Log_Debug(const char *format, ...)
+{
+    if (strncmp(format, "WARNING: More than", strlen("WARNING: More than")) == 0) {
+        warningCount++;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/// <summary>
+/// Makes a zone file name absolute, without the final dot.
+/// </summary>
+static void AbsoluteName(const char *name, char *result)
+{
+    size_t length = strlen(name);
+    if (strcmp(name, "@") == 0) {
+        snprintf(result, NAME_SIZE, "%s", ZONE_ORIGIN);
+    } else if (length > 0 && name[length - 1] == '.') {
+        snprintf(result, NAME_SIZE, "%.*s", (int)length - 1, name);
+    } else {
+        snprintf(result, NAME_SIZE, "%s.%s", name, ZONE_ORIGIN);
+    }
+}
+
+static ZoneRecord *AddRecord(const char *name, uint16_t type, uint32_t ttl)
+{
+    if (zoneCount == MAX_ZONE_RECORDS) {
+        return NULL;
+    }
+    ZoneRecord *record = &zone[zoneCount++];
+    memset(record, 0, sizeof(*record));
+    snprintf(record->name, sizeof(record->name), "%s", name);
+    record->type = type;
+    record->ttl = ttl;
+    return record;
+}
+
+static ZoneRecord *FindRecord(const char *name, uint16_t type)
+{
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type == type && strcasecmp(zone[i].name, name) == 0) {
+            return &zone[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+/// Loads the PTR, SRV, TXT and A records of a zone file in the subset of the syntax db.home uses.
+/// The SRV targets outside the zone get a documentation address, as the resolver needs one.
+/// </summary>
+static bool LoadZone(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "FAIL: Can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[512];
+    char owner[NAME_SIZE] = ZONE_ORIGIN;
+    uint32_t ttl = 3600;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        char *comment = strchr(line, ';');
+        if (comment) {
+            *comment = '\0';
+        }
+        char *tokens[8];
+        int count = 0;
+        for (char *token = strtok(line, " \t\r\n"); token && count < 8;
+             token = strtok(NULL, " \t\r\n")) {
+            tokens[count++] = token;
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (strcmp(tokens[0], "$TTL") == 0) {
+            ttl = count > 1 ? (uint32_t)strtoul(tokens[1], NULL, 10) : ttl;
+            continue;
+        }
+        // A line starting with a blank is for the previous owner.
+        int t = 0;
+        if (!isspace((unsigned char)line[0])) {
+            AbsoluteName(tokens[t++], owner);
+        }
+        if (t >= count) {
+            continue;
+        }
+
+        const char *type = tokens[t++];
+        ZoneRecord *record = NULL;
+        if (strcmp(type, "PTR") == 0 && t + 1 <= count) {
+            record = AddRecord(owner, ns_t_ptr, ttl);
+            if (record) {
+                AbsoluteName(tokens[t], record->text);
+            }
+        } else if (strcmp(type, "SRV") == 0 && t + 4 <= count) {
+            record = AddRecord(owner, ns_t_srv, ttl);
+            if (record) {
+                record->priority = (uint16_t)atoi(tokens[t]);
+                record->weight = (uint16_t)atoi(tokens[t + 1]);
+                record->port = (uint16_t)atoi(tokens[t + 2]);
+                AbsoluteName(tokens[t + 3], record->text);
+            }
+        } else if (strcmp(type, "TXT") == 0 && t + 1 <= count) {
+            record = AddRecord(owner, ns_t_txt, ttl);
+            if (record) {
+                snprintf(record->text, sizeof(record->text), "%s", tokens[t]);
+            }
+        } else if (strcmp(type, "A") == 0 && t + 1 <= count) {
+            record = AddRecord(owner, ns_t_a, ttl);
+            if (record && inet_pton(AF_INET, tokens[t], &record->address) != 1) {
+                record = NULL;
+            }
+        } else {
+            // SOA, NS: not used by the resolver
+            continue;
+        }
+        if (!record) {
+            fprintf(stderr, "FAIL: Can't load the %s record of [%s]\n", type, owner);
+            ok = false;
+        }
+    }
+    fclose(file);
+
+    for (size_t i = 0, count = zoneCount; ok && i < count; ++i) {
+        if (zone[i].type == ns_t_srv && !FindRecord(zone[i].text, ns_t_a)) {
+            ZoneRecord *record = AddRecord(zone[i].text, ns_t_a, zone[i].ttl);
+            if (!record) {
+                fprintf(stderr, "FAIL: Can't add the A record of [%s]\n", zone[i].text);
+                ok = false;
+            } else {
+                record->address.s_addr = htonl(0xC0000200u + (uint32_t)zoneCount);
+            }
+        }
+    }
+    return ok;
+}
+
+/// <summary>
+/// Answers a DNS query with the zone records of its name and type.
+/// </summary>
+static void DnsServerEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    unsigned char query[512];
+    unsigned char response[2048];
+    struct sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+
+    ssize_t length =
+        recvfrom(fd, query, sizeof(query), 0, (struct sockaddr *)&from, &fromLength);
+    ns_msg msg;
+    ns_rr question;
+    if (length <= 0 || ns_initparse(query, (int)length, &msg) != 0 ||
+        ns_msg_count(msg, ns_s_qd) != 1 || ns_parserr(&msg, ns_s_qd, 0, &question) != 0) {
+        return;
+    }
+    int nameLength = dn_skipname(query + NS_HFIXEDSZ, query + length);
+    if (nameLength < 0) {
+        return;
+    }
+    size_t questionLength = (size_t)nameLength + NS_QFIXEDSZ;
+
+    // Header with the ID of the query, then its question
+    memset(response, 0, NS_HFIXEDSZ);
+    memcpy(response, query, 2);
+    response[2] = 0x85;
+    response[3] = 0x80;
+    response[5] = 1;
+    memcpy(response + NS_HFIXEDSZ, query + NS_HFIXEDSZ, questionLength);
+    unsigned char *p = response + NS_HFIXEDSZ + questionLength;
+    unsigned char *end = response + sizeof(response);
+
+    uint16_t answers = 0;
+    for (size_t i = 0; i < zoneCount; ++i) {
+        const ZoneRecord *record = &zone[i];
+        if (record->type != ns_rr_type(question) ||
+            strcasecmp(record->name, ns_rr_name(question)) != 0) {
+            continue;
+        }
+        unsigned char rdata[NAME_SIZE + 8];
+        int rdataLength = 0;
+        switch (record->type) {
+        case ns_t_ptr:
+            rdataLength = dn_comp(record->text, rdata, sizeof(rdata), NULL, NULL);
+            break;
+        case ns_t_srv:
+            ns_put16(record->priority, rdata);
+            ns_put16(record->weight, rdata + 2);
+            ns_put16(record->port, rdata + 4);
+            rdataLength = dn_comp(record->text, rdata + 6, sizeof(rdata) - 6, NULL, NULL);
+            rdataLength = rdataLength < 0 ? -1 : rdataLength + 6;
+            break;
+        case ns_t_txt:
+            rdata[0] = (unsigned char)strlen(record->text);
+            memcpy(rdata + 1, record->text, rdata[0]);
+            rdataLength = 1 + rdata[0];
+            break;
+        case ns_t_a:
+            memcpy(rdata, &record->address, sizeof(record->address));
+            rdataLength = sizeof(record->address);
+            break;
+        }
+        if (rdataLength < 0 || end - p < NS_RRFIXEDSZ + 2 + rdataLength) {
+            return;
+        }
+        // The owner is the name of the question, right after the header
+        ns_put16(0xC000 | NS_HFIXEDSZ, p);
+        ns_put16(record->type, p + 2);
+        ns_put16(ns_c_in, p + 4);
+        ns_put32(record->ttl, p + 6);
+        ns_put16((unsigned int)rdataLength, p + 10);
+        memcpy(p + 12, rdata, (size_t)rdataLength);
+        p += 12 + rdataLength;
+        answers++;
+    }
+    ns_put16(answers, response + 6);
+
+    sendto(fd, response, (size_t)(p - response), 0, (struct sockaddr *)&from, fromLength);
+}
+
+static void InstanceChangedHandler(const ServiceInstanceDetails *instance,
+                                   ServiceInstanceChange change)
+{
+    if (change == ServiceInstanceChange_Added) {
+        addedCount++;
+    } else if (change == ServiceInstanceChange_Removed) {
+        removedCount++;
+    }
+}
+
+static const ServiceInstanceDetails *FindInstance(const char *name)
+{
+    for (size_t i = 0; i < GetServiceInstanceCount(); ++i) {
+        const ServiceInstanceDetails *instance = GetServiceInstance(i);
+        if (strcasecmp(instance->name, name) == 0) {
+            return instance;
+        }
+    }
+    return NULL;
+}
+
+static long ElapsedMs(const struct timespec *from)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - from->tv_sec) * 1000 + (now.tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/// <summary>
+/// Runs the event loop until the resolved instances match the zone, or timeoutMs.
+/// </summary>
+static bool WaitForInstances(EventLoop *eventLoop, size_t count, const char *removed,
+                             long timeoutMs)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (ElapsedMs(&start) < timeoutMs) {
+        if (EventLoop_Run(eventLoop, 100, true) == EventLoop_Run_Failed) {
+            fprintf(stderr, "FAIL: EventLoop_Run: %s\n", strerror(errno));
+            return false;
+        }
+        if (GetServiceInstanceCount() == count && (!removed || !FindInstance(removed))) {
+            return true;
+        }
+    }
+    fprintf(stderr, "FAIL: %zu instances resolved instead of %zu\n", GetServiceInstanceCount(),
+            count);
+    return false;
+}
+
+static bool CheckInstance(const char *name)
+{
+    const ServiceInstanceDetails *instance = FindInstance(name);
+    const ZoneRecord *srv = FindRecord(name, ns_t_srv);
+    const ZoneRecord *txt = FindRecord(name, ns_t_txt);
+    const ZoneRecord *a = srv ? FindRecord(srv->text, ns_t_a) : NULL;
+    char path[NAME_SIZE];
+    if (!instance || !srv || !txt || !a) {
+        fprintf(stderr, "FAIL: [%s] not resolved\n", name);
+        return false;
+    }
+    if (strcasecmp(instance->host, srv->text) != 0 || instance->port != srv->port ||
+        instance->priority != srv->priority || instance->weight != srv->weight ||
+        instance->ipv4Address.s_addr != a->address.s_addr) {
+        fprintf(stderr, "FAIL: [%s] resolved to %s:%u (%u %u)\n", name, instance->host,
+                instance->port, instance->priority, instance->weight);
+        return false;
+    }
+    if (!GetTxtValue(instance, "path", path, sizeof(path)) ||
+        strcmp(path, strchr(txt->text, '=') + 1) != 0) {
+        fprintf(stderr, "FAIL: [%s] has no path=%s\n", name, strchr(txt->text, '=') + 1);
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Checks that the selection follows the SRV priorities and weights, and fails over from the
+/// instances reported as failed.
+/// </summary>
+static bool CheckSelection(void)
+{
+    unsigned int selected[MAX_ZONE_RECORDS] = {0};
+    for (int i = 0; i < SELECTION_COUNT; ++i) {
+        const ServiceInstanceDetails *instance = SelectServiceInstance();
+        const ZoneRecord *srv = instance ? FindRecord(instance->name, ns_t_srv) : NULL;
+        if (!srv) {
+            fprintf(stderr, "FAIL: SelectServiceInstance returned an unknown instance\n");
+            return false;
+        }
+        selected[srv - zone]++;
+    }
+
+    unsigned int totalWeight = 0;
+    uint16_t lowestPriority = UINT16_MAX;
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type == ns_t_srv && zone[i].priority < lowestPriority) {
+            lowestPriority = zone[i].priority;
+        }
+    }
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type == ns_t_srv && zone[i].priority == lowestPriority) {
+            totalWeight += zone[i].weight;
+        }
+    }
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type != ns_t_srv) {
+            continue;
+        }
+        double share = (double)selected[i] / SELECTION_COUNT;
+        double expected =
+            zone[i].priority == lowestPriority ? (double)zone[i].weight / totalWeight : 0.0;
+        printf("[%s] selected %.1f%% of the time, expected %.1f%%\n", zone[i].name, share * 100,
+               expected * 100);
+        if (share < expected - 0.05 || share > expected + 0.05) {
+            fprintf(stderr, "FAIL: [%s] selected %.1f%% of the time instead of %.1f%%\n",
+                    zone[i].name, share * 100, expected * 100);
+            return false;
+        }
+    }
+
+    // Fail each instance of the lowest priority in turn: the others are selected, then the
+    // instances of the next priority.
+    const ServiceInstanceDetails *backup = NULL;
+    for (size_t i = 0; i < GetServiceInstanceCount(); ++i) {
+        const ServiceInstanceDetails *instance = GetServiceInstance(i);
+        if (instance->priority == lowestPriority) {
+            // A copy, as an App reporting the result of an asynchronous connection would
+            ServiceInstanceDetails *copy = CopyServiceInstanceDetails(instance);
+            if (!copy) {
+                fprintf(stderr, "FAIL: CopyServiceInstanceDetails\n");
+                return false;
+            }
+            ReportServiceInstanceResult(copy, false, 0);
+            const ServiceInstanceHealth *health = GetServiceInstanceHealth(copy);
+            bool reported = health && health->failureCount == 1 && health->consecutiveFailures == 1;
+            FreeServiceInstanceDetails(copy);
+            if (!reported) {
+                fprintf(stderr, "FAIL: The failure of [%s] isn't reported\n", instance->name);
+                return false;
+            }
+        } else {
+            backup = instance;
+        }
+
+        for (int j = 0; j < SELECTION_COUNT / 10; ++j) {
+            const ServiceInstanceDetails *selection = SelectServiceInstance();
+            const ServiceInstanceHealth *health = GetServiceInstanceHealth(selection);
+            if (health->consecutiveFailures != 0) {
+                fprintf(stderr, "FAIL: [%s] selected after it failed\n", selection->name);
+                return false;
+            }
+        }
+    }
+    if (!backup) {
+        fprintf(stderr, "FAIL: No instance of a higher priority to fail over to\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <zone file>\n", argv[0]);
+        return -1;
+    }
+    if (!LoadZone(argv[1])) {
+        return -1;
+    }
+
+    EventLoop *eventLoop = EventLoop_Create();
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(DNS_SERVER_PORT)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (!eventLoop || fd == -1 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        !EventLoop_RegisterIo(eventLoop, fd, EventLoop_Input, DnsServerEventHandler, NULL)) {
+        fprintf(stderr, "FAIL: Can't serve DNS on port %d: %s\n", DNS_SERVER_PORT,
+                strerror(errno));
+        return -1;
+    }
+
+    if (StartServiceDiscovery(eventLoop, SERVICE_TYPE, InstanceChangedHandler) != 0) {
+        fprintf(stderr, "FAIL: StartServiceDiscovery\n");
+        return -1;
+    }
+
+    // All the instances listed by the PTR records are resolved.
+    size_t instanceCount = 0;
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type == ns_t_ptr && strcasecmp(zone[i].name, SERVICE_TYPE) == 0) {
+            instanceCount++;
+        }
+    }
+    if (instanceCount == 0 || !WaitForInstances(eventLoop, instanceCount, NULL, 5000)) {
+        return -1;
+    }
+    for (size_t i = 0; i < zoneCount; ++i) {
+        if (zone[i].type == ns_t_ptr && strcasecmp(zone[i].name, SERVICE_TYPE) == 0 &&
+            !CheckInstance(zone[i].text)) {
+            return -1;
+        }
+    }
+    if (addedCount != instanceCount || removedCount != 0 || warningCount != 0) {
+        fprintf(stderr, "FAIL: %u added, %u removed, %u warnings\n", addedCount, removedCount,
+                warningCount);
+        return -1;
+    }
+
+    if (!CheckSelection()) {
+        return -1;
+    }
+
+    // Remove the first instance, and add instances up to one more than the resolver keeps: the
+    // removal is seen, and the ignored instance is logged.
+    ZoneRecord *removed = FindRecord(SERVICE_TYPE, ns_t_ptr);
+    char removedName[NAME_SIZE];
+    snprintf(removedName, sizeof(removedName), "%s", removed->text);
+    *removed = zone[--zoneCount];
+    // As documented by StartServiceDiscovery
+    size_t maxInstances = 8;
+    const ZoneRecord *srv = FindRecord(removedName, ns_t_srv);
+    for (size_t i = instanceCount - 1; i < maxInstances + 1; ++i) {
+        char name[NAME_SIZE];
+        snprintf(name, sizeof(name), "Extra%zu.%s", i, SERVICE_TYPE);
+        ZoneRecord *ptr = AddRecord(SERVICE_TYPE, ns_t_ptr, srv->ttl);
+        ZoneRecord *extra = AddRecord(name, ns_t_srv, srv->ttl);
+        if (!ptr || !extra) {
+            fprintf(stderr, "FAIL: Zone full\n");
+            return -1;
+        }
+        snprintf(ptr->text, sizeof(ptr->text), "%s", name);
+        *extra = *srv;
+        snprintf(extra->name, sizeof(extra->name), "%s", name);
+    }
+    if (!WaitForInstances(eventLoop, maxInstances, removedName, UPDATE_TIMEOUT_MS)) {
+        return -1;
+    }
+    if (removedCount != 1 || warningCount != 1) {
+        fprintf(stderr, "FAIL: %u removed, %u warnings\n", removedCount, warningCount);
+        return -1;
+    }
+
+    StopServiceDiscovery();
+    close(fd);
+    EventLoop_Close(eventLoop);
+    printf("PASS\n");
+    return 0;
+}
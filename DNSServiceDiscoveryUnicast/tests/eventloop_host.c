@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host implementation of the event loop shim.
+
+#include <applibs/eventloop.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_REGISTRATIONS 16
+
+struct EventRegistration {
+    int fd;
+    EventLoop_IoEvents events;
+    EventLoopIoCallback *callback;
+    void *context;
+    bool used;
+};
+
+struct EventLoop {
+    EventRegistration registrations[MAX_REGISTRATIONS];
+};
+
+EventLoop *EventLoop_Create(void)
+{
+    return calloc(1, sizeof(EventLoop));
+}
+
+void EventLoop_Close(EventLoop *el)
+{
+    free(el);
+}
+
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                        EventLoopIoCallback *callback, void *context)
+{
+    for (int i = 0; i < MAX_REGISTRATIONS; ++i) {
+        EventRegistration *reg = &el->registrations[i];
+        if (!reg->used) {
+            *reg = (EventRegistration){fd, eventBitmask, callback, context, true};
+            return reg;
+        }
+    }
+    errno = ENOMEM;
+    return NULL;
+}
+
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg, EventLoop_IoEvents eventBitmask)
+{
+    reg->events = eventBitmask;
+    return 0;
+}
+
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg)
+{
+    reg->used = false;
+    return 0;
+}
+
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds, bool process_one_event)
+{
+    struct pollfd fds[MAX_REGISTRATIONS];
+    EventRegistration *regs[MAX_REGISTRATIONS];
+    nfds_t count = 0;
+
+    for (int i = 0; i < MAX_REGISTRATIONS; ++i) {
+        EventRegistration *reg = &el->registrations[i];
+        if (reg->used) {
+            fds[count].fd = reg->fd;
+            fds[count].events = (short)(((reg->events & EventLoop_Input) ? POLLIN : 0) |
+                                        ((reg->events & EventLoop_Output) ? POLLOUT : 0));
+            fds[count].revents = 0;
+            regs[count++] = reg;
+        }
+    }
+
+    int ready = poll(fds, count, duration_in_milliseconds);
+    if (ready < 0) {
+        return EventLoop_Run_Failed;
+    }
+
+    for (nfds_t i = 0; i < count; ++i) {
+        // Skip the registrations removed or replaced by an earlier callback.
+        if (fds[i].revents == 0 || !regs[i]->used || regs[i]->fd != fds[i].fd) {
+            continue;
+        }
+        EventLoop_IoEvents events = ((fds[i].revents & POLLIN) ? EventLoop_Input : 0) |
+                                    ((fds[i].revents & POLLOUT) ? EventLoop_Output : 0) |
+                                    ((fds[i].revents & (POLLERR | POLLHUP)) ? EventLoop_Error : 0);
+        regs[i]->callback(el, fds[i].fd, events, regs[i]->context);
+        if (process_one_event) {
+            break;
+        }
+    }
+    return EventLoop_Run_Finished;
+}
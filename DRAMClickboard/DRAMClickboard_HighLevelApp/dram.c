@@ -2,13 +2,29 @@
    Licensed under the MIT License. */
 
 #include "dram.h"
+#include <pthread.h>
 
 // Dummy data
 #define DUMMY 0x00
 
+// Bus speeds: the READ command is limited to 33MHz, FAST_READ and WRITE run at the MT3620 limit.
+#define DRAM_BUS_SPEED 39999999
+#define DRAM_READ_BUS_SPEED 33000000
+
 // File descriptors - initialized to an invalid value
 static int spiFd = -1;
 
+// Serializes the use of the SPI interface between the caller and the transfer engine (dram_async.c)
+static pthread_mutex_t spiLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Sets the address bytes of a command header
+static void set_header_address(uint8_t *header, uint32_t address)
+{
+    header[1] = (uint8_t)((address >> 16) & 0xFF);
+    header[2] = (uint8_t)((address >> 8) & 0xFF);
+    header[3] = (uint8_t)(address & 0xFF);
+}
+
 int dram_init(int spi_interface, int cs_pin, int io3, int io2)
 {
     // Create SPI config object
@@ -33,7 +49,7 @@ int dram_init(int spi_interface, int cs_pin, int io3, int io2)
     }
 
     // Set bus speed for SPI Master
-    int result = SPIMaster_SetBusSpeed(spiFd, 39999999); // MT3620 SPI bus speed < 40MHz
+    int result = SPIMaster_SetBusSpeed(spiFd, DRAM_BUS_SPEED); // MT3620 SPI bus speed < 40MHz
     if (result != 0) {
         Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
         return -1;
@@ -141,6 +157,9 @@ int dram_memory_write(uint32_t address, uint8_t *data_in, uint32_t len)
     // Add the rest of the bytes to the initial transfer (max_per_transfer -  4)
     for (uint16_t i = 1; i <= transfer_count; i++) {
 
+        // Each transfer starts at the address following the previous one
+        set_header_address(data_buf, address);
+
         transfers_array[0].flags = SPI_TransferFlags_Write; // Signal a write
         transfers_array[0].writeData = data_buf;            // Add data to write buff property
         transfers_array[0].length = sizeof(data_buf);       // 24 bit address + 4 bit command code
@@ -174,7 +193,7 @@ int dram_memory_write(uint32_t address, uint8_t *data_in, uint32_t len)
         }
 
         // number of bytes transferred
-        tb = SPIMaster_TransferSequential(spiFd, transfers_array, 2);
+        tb = dram_transfer_sequential(transfers_array, 2, false);
 
         // Check transfer size
         if (!CheckTransferSize("SPIMaster_TransferSequential (dram_memory_write)",
@@ -231,6 +250,8 @@ int dram_memory_read(uint32_t address, uint8_t *data_out, uint32_t len)
 
     for (uint16_t i = 1; i <= transfer_count; i++) {
 
+        set_header_address(data_buf, address);
+
         transfers_array[0].flags = SPI_TransferFlags_Write;
         transfers_array[0].writeData = data_buf;
         transfers_array[0].length = sizeof(data_buf);
@@ -251,19 +272,7 @@ int dram_memory_read(uint32_t address, uint8_t *data_out, uint32_t len)
             transfers_array[1].length = t_length;
         }
 
-        result = SPIMaster_SetBusSpeed(spiFd, 33000000);
-        if (result != 0) {
-            Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-            return -1;
-        }
-
-        tb = SPIMaster_TransferSequential(spiFd, transfers_array, 2);
-
-        result = SPIMaster_SetBusSpeed(spiFd, 39999999);
-        if (result != 0) {
-            Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-            return -1;
-        }
+        tb = dram_transfer_sequential(transfers_array, 2, true);
 
         if (!CheckTransferSize("SPIMaster_TransferSequential (dram_memory_read)",
                                (sizeof(data_buf) + t_length), tb)) {
@@ -320,6 +329,8 @@ int dram_memory_read_fast(uint32_t address, uint8_t *data_out, uint32_t len)
 
     for (uint16_t i = 1; i <= transfer_count; i++) {
 
+        set_header_address(data_buf, address);
+
         transfers_array[0].flags = SPI_TransferFlags_Write;
         transfers_array[0].writeData = data_buf;
         transfers_array[0].length = sizeof(data_buf);
@@ -340,7 +351,7 @@ int dram_memory_read_fast(uint32_t address, uint8_t *data_out, uint32_t len)
             transfers_array[1].length = t_length;
         }
 
-        tb = SPIMaster_TransferSequential(spiFd, transfers_array, 2);
+        tb = dram_transfer_sequential(transfers_array, 2, false);
 
         if (!CheckTransferSize("SPIMaster_TransferSequential (dram_memory_read_fast)",
                                (sizeof(data_buf) + t_length), tb)) {
@@ -383,8 +394,8 @@ int dram_reset()
     transfer2[0].writeData = &data2;              // Add data to write buff property
     transfer2[0].length = 1;
 
-    ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, transfer1, transferCount);
-    ssize_t transferredBytes2 = SPIMaster_TransferSequential(spiFd, transfer2, transferCount);
+    ssize_t transferredBytes = dram_transfer_sequential(transfer1, transferCount, false);
+    ssize_t transferredBytes2 = dram_transfer_sequential(transfer2, transferCount, false);
 
     if (!CheckTransferSize("SPIMaster_TransferSequential (dram_reset) transfer1", sizeof(data),
                            transferredBytes)) {
@@ -422,7 +433,7 @@ bool dram_toggle_wrap_boundary()
     transfers[0].writeData = &data;
     transfers[0].length = 1;
 
-    ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, transfers, transferCount);
+    ssize_t transferredBytes = dram_transfer_sequential(transfers, transferCount, false);
 
     if (!CheckTransferSize("SPIMaster_TransferSequential (dram_toggle_wrap_boundary)", sizeof(data),
                            transferredBytes)) {
@@ -455,8 +466,10 @@ bool dram_read_id(uint8_t *device_id)
     data_buf[2] = DUMMY;
     data_buf[3] = DUMMY;
 
+    pthread_mutex_lock(&spiLock);
     ssize_t transferredBytes =
         SPIMaster_WriteThenRead(spiFd, data_buf, sizeof(data_buf), device_id, sizeof(device_id));
+    pthread_mutex_unlock(&spiLock);
 
     if (!CheckTransferSize("SPIMaster_WriteThenRead (dram_read_id)",
                            sizeof(data_buf) + sizeof(device_id), transferredBytes)) {
@@ -477,6 +490,31 @@ int dram_check_communication()
     return -1;
 }
 
+ssize_t dram_transfer_sequential(const SPIMaster_Transfer *transfers, size_t transferCount,
+                                 bool readSpeed)
+{
+    pthread_mutex_lock(&spiLock);
+
+    if (readSpeed && SPIMaster_SetBusSpeed(spiFd, DRAM_READ_BUS_SPEED) != 0) {
+        Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+        pthread_mutex_unlock(&spiLock);
+        return -1;
+    }
+
+    ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, transfers, transferCount);
+    int transferError = errno;
+
+    if (readSpeed && SPIMaster_SetBusSpeed(spiFd, DRAM_BUS_SPEED) != 0) {
+        Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+        pthread_mutex_unlock(&spiLock);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&spiLock);
+    errno = transferError;
+    return transferredBytes;
+}
+
 // Support functions
 
 /// <summary>
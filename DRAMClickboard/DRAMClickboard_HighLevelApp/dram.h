@@ -181,6 +181,25 @@ bool dram_read_id(uint8_t *device_id);
 /// to the error value.
 /// </returns>
 int dram_check_communication(void);
+/// <summary>
+/// Performs a sequence of transfers with chip select held active, as SPIMaster_TransferSequential,
+/// serialized with the other users of the SPI interface (e.g. the transfer engine in dram_async.h).
+/// </summary>
+/// <param name="transfers">
+/// The transfers, typically a command and address header followed by the data
+/// </param>
+/// <param name="transferCount">
+/// Number of transfers
+/// </param>
+/// <param name="readSpeed">
+/// true to run the transfers at the 33MHz bus speed required by DRAM_CMD_READ
+/// </param>
+/// <returns>
+/// Number of bytes transferred, or -1 for failure, in which case errno is set to the error value.
+/// </returns>
+ssize_t dram_transfer_sequential(const SPIMaster_Transfer *transfers, size_t transferCount,
+                                 bool readSpeed);
+
 /// <summary>
 /// Checks the number of transferred bytes for SPI functions and prints an error
 /// message if the functions failed or if the number of bytes is different than
@@ -0,0 +1,368 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dram_async.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Dummy data
+#define DUMMY 0x00
+
+// Maximum number of transfers per SPI burst: the header and up to 8 data buffers
+#define MAX_BURST_TRANSFERS 9
+
+// Size of a Wrap32 line: bursts wrap around at its end
+#define WRAP_LINE_SIZE 32
+
+// A queued request, with its own copy of the segment array
+typedef struct DRAM_Request {
+    struct DRAM_Request *next;
+    DRAM_Direction direction;
+    DRAM_TransferCallback callback;
+    void *context;
+    int result;
+    size_t segmentCount;
+    DRAM_Segment segments[];
+} DRAM_Request;
+
+// FIFO of requests
+typedef struct {
+    DRAM_Request *head;
+    DRAM_Request *tail;
+} DRAM_RequestList;
+
+static pthread_t workerThread;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static bool workerRunning = false;
+static bool stopRequested = false;
+
+// Requests waiting for the worker thread, and requests waiting for their completion callback.
+// Both are protected by queueLock.
+static DRAM_RequestList submittedRequests;
+static DRAM_RequestList completedRequests;
+static size_t pendingCount = 0;
+
+// Signaled by the worker thread when it adds to completedRequests
+static int completionFd = -1;
+static EventLoop *completionEventLoop = NULL;
+static EventRegistration *completionEventReg = NULL;
+
+static void list_append(DRAM_RequestList *list, DRAM_Request *request)
+{
+    request->next = NULL;
+    if (list->tail == NULL) {
+        list->head = request;
+    } else {
+        list->tail->next = request;
+    }
+    list->tail = request;
+}
+
+static DRAM_Request *list_take_all(DRAM_RequestList *list)
+{
+    DRAM_Request *head = list->head;
+    list->head = NULL;
+    list->tail = NULL;
+    return head;
+}
+
+static void list_free(DRAM_Request *request)
+{
+    while (request != NULL) {
+        DRAM_Request *next = request->next;
+        free(request);
+        request = next;
+    }
+}
+
+// Runs one SPI burst: a command and address header, then data from as many segments as follow
+// each other in DRAM, up to the burst size. Advances segmentIndex/segmentOffset past the bytes
+// transferred. Returns 0, or the errno value of the failure.
+static int run_burst(const DRAM_Request *request, size_t *segmentIndex, uint32_t *segmentOffset)
+{
+    const DRAM_Segment *segment = &request->segments[*segmentIndex];
+    uint32_t address = segment->address + *segmentOffset;
+
+    // Reads always use FAST_READ: its dummy byte costs less than dropping the bus to the 33MHz
+    // required by READ
+    uint8_t header[5];
+    size_t headerLength;
+    if (request->direction == DRAM_Direction_Write) {
+        header[0] = DRAM_CMD_WRITE;
+        headerLength = 4;
+    } else {
+        header[0] = DRAM_CMD_FAST_READ;
+        header[4] = DUMMY;
+        headerLength = 5;
+    }
+    header[1] = (uint8_t)((address >> 16) & 0xFF);
+    header[2] = (uint8_t)((address >> 8) & 0xFF);
+    header[3] = (uint8_t)(address & 0xFF);
+
+    // In Wrap32 mode, a burst must not cross the end of the line it starts in
+    uint32_t budget = max_per_transfer - (uint32_t)headerLength;
+    if (!linear_burst_mode && budget > WRAP_LINE_SIZE - (address % WRAP_LINE_SIZE)) {
+        budget = WRAP_LINE_SIZE - (address % WRAP_LINE_SIZE);
+    }
+
+    SPIMaster_Transfer transfers[MAX_BURST_TRANSFERS];
+    if (SPIMaster_InitTransfers(transfers, MAX_BURST_TRANSFERS) != 0) {
+        return errno;
+    }
+    transfers[0].flags = SPI_TransferFlags_Write;
+    transfers[0].writeData = header;
+    transfers[0].length = headerLength;
+
+    size_t transferCount = 1;
+    size_t dataLength = 0;
+    while (*segmentIndex < request->segmentCount && transferCount < MAX_BURST_TRANSFERS &&
+           budget > 0) {
+        segment = &request->segments[*segmentIndex];
+        if (*segmentOffset == segment->length) {
+            // Empty segment
+            ++*segmentIndex;
+            *segmentOffset = 0;
+            continue;
+        }
+        if (segment->address + *segmentOffset != address + dataLength) {
+            // Not contiguous: the next segment needs its own header
+            break;
+        }
+
+        uint32_t length = segment->length - *segmentOffset;
+        if (length > budget) {
+            length = budget;
+        }
+
+        if (request->direction == DRAM_Direction_Write) {
+            transfers[transferCount].flags = SPI_TransferFlags_Write;
+            transfers[transferCount].writeData = segment->data + *segmentOffset;
+        } else {
+            transfers[transferCount].flags = SPI_TransferFlags_Read;
+            transfers[transferCount].readData = segment->data + *segmentOffset;
+        }
+        transfers[transferCount].length = length;
+        ++transferCount;
+
+        dataLength += length;
+        budget -= length;
+        *segmentOffset += length;
+        if (*segmentOffset == segment->length) {
+            ++*segmentIndex;
+            *segmentOffset = 0;
+        }
+    }
+
+    ssize_t transferredBytes = dram_transfer_sequential(transfers, transferCount, false);
+    if (transferredBytes == -1) {
+        return errno;
+    }
+    if ((size_t)transferredBytes != headerLength + dataLength) {
+        return EIO;
+    }
+    return 0;
+}
+
+static int run_request(const DRAM_Request *request)
+{
+    size_t segmentIndex = 0;
+    uint32_t segmentOffset = 0;
+
+    while (segmentIndex < request->segmentCount) {
+        if (segmentOffset == request->segments[segmentIndex].length) {
+            // Empty segment
+            ++segmentIndex;
+            segmentOffset = 0;
+            continue;
+        }
+
+        int result = run_burst(request, &segmentIndex, &segmentOffset);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static void *worker_thread_main(void *arg)
+{
+    pthread_mutex_lock(&queueLock);
+    while (!stopRequested) {
+        DRAM_Request *request = submittedRequests.head;
+        if (request == NULL) {
+            pthread_cond_wait(&queueCond, &queueLock);
+            continue;
+        }
+
+        submittedRequests.head = request->next;
+        if (submittedRequests.head == NULL) {
+            submittedRequests.tail = NULL;
+        }
+        pthread_mutex_unlock(&queueLock);
+
+        request->result = run_request(request);
+
+        pthread_mutex_lock(&queueLock);
+        list_append(&completedRequests, request);
+        if (eventfd_write(completionFd, 1) != 0) {
+            Log_Debug("ERROR: eventfd_write (dram_async): errno=%d (%s)\n", errno,
+                      strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    return NULL;
+}
+
+static void completion_event_handler(EventLoop *el, int fd, EventLoop_IoEvents events,
+                                     void *context)
+{
+    eventfd_t count;
+    if (eventfd_read(fd, &count) != 0) {
+        Log_Debug("ERROR: eventfd_read (dram_async): errno=%d (%s)\n", errno, strerror(errno));
+        return;
+    }
+
+    pthread_mutex_lock(&queueLock);
+    DRAM_Request *request = list_take_all(&completedRequests);
+    pthread_mutex_unlock(&queueLock);
+
+    // The callbacks may submit new requests, so they run without the lock
+    while (request != NULL) {
+        DRAM_Request *next = request->next;
+
+        pthread_mutex_lock(&queueLock);
+        --pendingCount;
+        pthread_mutex_unlock(&queueLock);
+
+        if (request->callback != NULL) {
+            request->callback(request->result, request->context);
+        }
+        free(request);
+        request = next;
+    }
+}
+
+int dram_async_init(EventLoop *eventLoop)
+{
+    if (workerRunning) {
+        return 0;
+    }
+
+    completionFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (completionFd == -1) {
+        Log_Debug("ERROR: eventfd (dram_async_init): errno=%d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    completionEventReg = EventLoop_RegisterIo(eventLoop, completionFd, EventLoop_Input,
+                                              completion_event_handler, NULL);
+    if (completionEventReg == NULL) {
+        Log_Debug("ERROR: EventLoop_RegisterIo (dram_async_init): errno=%d (%s)\n", errno,
+                  strerror(errno));
+        close(completionFd);
+        completionFd = -1;
+        return -1;
+    }
+    completionEventLoop = eventLoop;
+
+    stopRequested = false;
+    int result = pthread_create(&workerThread, NULL, worker_thread_main, NULL);
+    if (result != 0) {
+        Log_Debug("ERROR: pthread_create (dram_async_init): %d (%s)\n", result, strerror(result));
+        EventLoop_UnregisterIo(eventLoop, completionEventReg);
+        completionEventReg = NULL;
+        close(completionFd);
+        completionFd = -1;
+        errno = result;
+        return -1;
+    }
+    workerRunning = true;
+
+    return 0;
+}
+
+int dram_async_submit(DRAM_Direction direction, const DRAM_Segment *segments, size_t segmentCount,
+                      DRAM_TransferCallback callback, void *context)
+{
+    if (!workerRunning) {
+        Log_Debug("ERROR: dram_async_init was not called\n");
+        errno = EBADF;
+        return -1;
+    }
+
+    if ((segments == NULL && segmentCount > 0) || segmentCount > DRAM_ASYNC_MAX_SEGMENTS) {
+        Log_Debug("ERROR: Invalid segment list\n");
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < segmentCount; i++) {
+        if ((segments[i].data == NULL && segments[i].length > 0) ||
+            segments[i].address > DRAM_MAX_ADDRESS ||
+            segments[i].length > DRAM_MAX_ADDRESS + 1 - segments[i].address) {
+            Log_Debug("ERROR: No data input OR invalid address for segment %zu\n", i);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    DRAM_Request *request = malloc(sizeof(DRAM_Request) + segmentCount * sizeof(DRAM_Segment));
+    if (request == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    request->direction = direction;
+    request->callback = callback;
+    request->context = context;
+    request->result = 0;
+    request->segmentCount = segmentCount;
+    if (segmentCount > 0) {
+        memcpy(request->segments, segments, segmentCount * sizeof(DRAM_Segment));
+    }
+
+    pthread_mutex_lock(&queueLock);
+    list_append(&submittedRequests, request);
+    ++pendingCount;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+
+    return 0;
+}
+
+size_t dram_async_pending(void)
+{
+    pthread_mutex_lock(&queueLock);
+    size_t count = pendingCount;
+    pthread_mutex_unlock(&queueLock);
+    return count;
+}
+
+void dram_async_cleanup(void)
+{
+    if (!workerRunning) {
+        return;
+    }
+
+    pthread_mutex_lock(&queueLock);
+    stopRequested = true;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+
+    pthread_join(workerThread, NULL);
+    workerRunning = false;
+
+    list_free(list_take_all(&submittedRequests));
+    list_free(list_take_all(&completedRequests));
+    pendingCount = 0;
+
+    EventLoop_UnregisterIo(completionEventLoop, completionEventReg);
+    completionEventReg = NULL;
+    completionEventLoop = NULL;
+    close(completionFd);
+    completionFd = -1;
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+/// \file dram_async.h
+/// \brief This header contains the functions available to queue transfers to and from the DRAM
+/// Click board without blocking the caller. The transfers run one after the other on a worker
+/// thread, and their completion callbacks are called on the application's event loop.
+/// dram_init must be called before dram_async_init.
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <applibs/eventloop.h>
+#include "dram.h"
+
+/// <summary>
+/// Maximum number of segments in a request.
+/// </summary>
+#define DRAM_ASYNC_MAX_SEGMENTS 64
+
+/// <summary>
+/// Direction of a request.
+/// </summary>
+typedef enum { DRAM_Direction_Read, DRAM_Direction_Write } DRAM_Direction;
+
+/// <summary>
+/// A contiguous range of DRAM addresses and the application buffer it is transferred to or from.
+/// </summary>
+typedef struct {
+    /// <summary>First DRAM address of the range</summary>
+    uint32_t address;
+    /// <summary>Buffer receiving (read) or providing (write) the data; it must stay valid until the
+    /// completion callback is called</summary>
+    uint8_t *data;
+    /// <summary>Number of bytes</summary>
+    uint32_t length;
+} DRAM_Segment;
+
+/// <summary>
+/// Called on the event loop when a request has completed.
+/// </summary>
+/// <param name="result">
+/// 0 if all the segments were transferred, or the errno value of the failure
+/// </param>
+/// <param name="context">
+/// The context passed to dram_async_submit
+/// </param>
+typedef void (*DRAM_TransferCallback)(int result, void *context);
+
+/// <summary>
+/// Starts the worker thread and registers its completion notifications on the event loop.
+/// </summary>
+/// <param name="eventLoop">
+/// The event loop the completion callbacks are called on
+/// </param>
+/// <returns>
+/// 0 for success, or -1 for failure, in which case errno is set to the error value.
+/// </returns>
+int dram_async_init(EventLoop *eventLoop);
+
+/// <summary>
+/// Queues a scatter-gather request: the segments are transferred in order, as a single operation.
+/// Segments which follow each other in DRAM are sent in the same SPI burst, so one command and
+/// address header covers them all. Reads use DRAM_CMD_FAST_READ, which runs at the full bus speed.
+/// </summary>
+/// <param name="direction">
+/// Whether the segments are read from or written to the DRAM
+/// </param>
+/// <param name="segments">
+/// The segments; the array is copied, the buffers it points to are not
+/// </param>
+/// <param name="segmentCount">
+/// Number of segments, up to DRAM_ASYNC_MAX_SEGMENTS
+/// </param>
+/// <param name="callback">
+/// Called on the event loop once the request has completed, may be NULL
+/// </param>
+/// <param name="context">
+/// Passed to the callback
+/// </param>
+/// <returns>
+/// 0 if the request was queued, or -1 for failure, in which case errno is set to the error value
+/// (EINVAL if a segment is outside of the DRAM address range).
+/// </returns>
+int dram_async_submit(DRAM_Direction direction, const DRAM_Segment *segments, size_t segmentCount,
+                      DRAM_TransferCallback callback, void *context);
+
+/// <summary>
+/// Returns the number of requests whose completion callback has not been called yet.
+/// </summary>
+size_t dram_async_pending(void);
+
+/// <summary>
+/// Waits for the request in progress, if any, then stops the worker thread. The queued requests
+/// are cancelled without calling their completion callback. Must be called before the event loop
+/// is closed.
+/// </summary>
+void dram_async_cleanup(void);
+
+#ifdef __cplusplus
+}
+#endif
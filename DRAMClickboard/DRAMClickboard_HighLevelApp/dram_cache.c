@@ -0,0 +1,514 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dram_cache.h"
+
+// Number of hash buckets of the cache index
+#define CACHE_BUCKET_COUNT 64
+
+// Initial number of free ranges tracked by the allocator
+#define ALLOC_INITIAL_RANGES 16
+
+// A free range of DRAM addresses
+typedef struct {
+    uint32_t address;
+    uint32_t size;
+} DRAM_FreeRange;
+
+// Free ranges, sorted by address and never adjacent to each other
+static DRAM_FreeRange *freeRanges = NULL;
+static uint32_t freeRangeCount = 0;
+static uint32_t freeRangeCapacity = 0;
+static uint32_t allocatedBytes = 0;
+
+// A cache value. Hot entries hold the value in RAM and are in the LRU list; an entry may also hold
+// a copy in DRAM, which stays valid until the value is replaced, so that demoting a value which was
+// promoted doesn't need to write it again.
+typedef struct DRAM_CacheEntry {
+    struct DRAM_CacheEntry *hashNext;
+    struct DRAM_CacheEntry *lruPrev;
+    struct DRAM_CacheEntry *lruNext;
+    bool hot;
+    uint8_t *hotData;
+    uint32_t dramAddress;
+    uint32_t length;
+    char key[];
+} DRAM_CacheEntry;
+
+static DRAM_CacheEntry *buckets[CACHE_BUCKET_COUNT];
+
+// Hot entries, most recently used first
+static DRAM_CacheEntry *lruHead = NULL;
+static DRAM_CacheEntry *lruTail = NULL;
+
+static uint32_t hotCapacity = 0;
+static DRAM_CacheStats cacheStats;
+static uint64_t hotTotalUs = 0;
+static uint64_t coldTotalUs = 0;
+
+// Allocator
+
+static uint32_t round_up_size(uint32_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+    return (size + DRAM_ALLOC_ALIGNMENT - 1) & ~(uint32_t)(DRAM_ALLOC_ALIGNMENT - 1);
+}
+
+int dram_alloc_init(void)
+{
+    free(freeRanges);
+    freeRanges = malloc(ALLOC_INITIAL_RANGES * sizeof(DRAM_FreeRange));
+    if (freeRanges == NULL) {
+        freeRangeCount = 0;
+        freeRangeCapacity = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+    freeRangeCapacity = ALLOC_INITIAL_RANGES;
+    freeRanges[0].address = DRAM_MIN_ADDRESS;
+    freeRanges[0].size = DRAM_MAX_ADDRESS + 1 - DRAM_MIN_ADDRESS;
+    freeRangeCount = 1;
+    allocatedBytes = 0;
+    return 0;
+}
+
+uint32_t dram_alloc(uint32_t size)
+{
+    if (size > DRAM_MAX_ADDRESS + 1) {
+        errno = ENOMEM;
+        return DRAM_NO_ADDRESS;
+    }
+    size = round_up_size(size);
+
+    for (uint32_t i = 0; i < freeRangeCount; i++) {
+        if (freeRanges[i].size < size) {
+            continue;
+        }
+
+        uint32_t address = freeRanges[i].address;
+        freeRanges[i].address += size;
+        freeRanges[i].size -= size;
+        if (freeRanges[i].size == 0) {
+            memmove(&freeRanges[i], &freeRanges[i + 1],
+                    (freeRangeCount - i - 1) * sizeof(DRAM_FreeRange));
+            freeRangeCount--;
+        }
+        allocatedBytes += size;
+        return address;
+    }
+
+    errno = ENOMEM;
+    return DRAM_NO_ADDRESS;
+}
+
+void dram_free(uint32_t address, uint32_t size)
+{
+    if (address == DRAM_NO_ADDRESS) {
+        return;
+    }
+    size = round_up_size(size);
+
+    // Index of the first free range after the block
+    uint32_t i = 0;
+    while (i < freeRangeCount && freeRanges[i].address < address) {
+        i++;
+    }
+
+    bool mergePrevious = i > 0 && freeRanges[i - 1].address + freeRanges[i - 1].size == address;
+    bool mergeNext = i < freeRangeCount && address + size == freeRanges[i].address;
+
+    if (mergePrevious && mergeNext) {
+        freeRanges[i - 1].size += size + freeRanges[i].size;
+        memmove(&freeRanges[i], &freeRanges[i + 1],
+                (freeRangeCount - i - 1) * sizeof(DRAM_FreeRange));
+        freeRangeCount--;
+    } else if (mergePrevious) {
+        freeRanges[i - 1].size += size;
+    } else if (mergeNext) {
+        freeRanges[i].address = address;
+        freeRanges[i].size += size;
+    } else {
+        if (freeRangeCount == freeRangeCapacity) {
+            DRAM_FreeRange *ranges =
+                realloc(freeRanges, 2 * freeRangeCapacity * sizeof(DRAM_FreeRange));
+            if (ranges == NULL) {
+                // The block stays allocated
+                Log_Debug("ERROR: Out of memory, leaking DRAM block %#08lX\n",
+                          (unsigned long)address);
+                return;
+            }
+            freeRanges = ranges;
+            freeRangeCapacity *= 2;
+        }
+        memmove(&freeRanges[i + 1], &freeRanges[i],
+                (freeRangeCount - i) * sizeof(DRAM_FreeRange));
+        freeRanges[i].address = address;
+        freeRanges[i].size = size;
+        freeRangeCount++;
+    }
+
+    allocatedBytes -= size;
+}
+
+void dram_alloc_get_stats(DRAM_AllocStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->usedBytes = allocatedBytes;
+    stats->freeRanges = freeRangeCount;
+    for (uint32_t i = 0; i < freeRangeCount; i++) {
+        stats->freeBytes += freeRanges[i].size;
+        if (freeRanges[i].size > stats->largestFreeBlock) {
+            stats->largestFreeBlock = freeRanges[i].size;
+        }
+    }
+}
+
+// Cache
+
+static uint32_t elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - start->tv_sec) * 1000000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+// FNV-1a hash of the key
+static DRAM_CacheEntry **get_bucket(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = key; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return &buckets[hash % CACHE_BUCKET_COUNT];
+}
+
+static DRAM_CacheEntry *find_entry(const char *key)
+{
+    for (DRAM_CacheEntry *entry = *get_bucket(key); entry != NULL; entry = entry->hashNext) {
+        if (strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void lru_unlink(DRAM_CacheEntry *entry)
+{
+    if (entry->lruPrev != NULL) {
+        entry->lruPrev->lruNext = entry->lruNext;
+    } else {
+        lruHead = entry->lruNext;
+    }
+    if (entry->lruNext != NULL) {
+        entry->lruNext->lruPrev = entry->lruPrev;
+    } else {
+        lruTail = entry->lruPrev;
+    }
+    entry->lruPrev = NULL;
+    entry->lruNext = NULL;
+}
+
+static void lru_push_front(DRAM_CacheEntry *entry)
+{
+    entry->lruPrev = NULL;
+    entry->lruNext = lruHead;
+    if (lruHead != NULL) {
+        lruHead->lruPrev = entry;
+    } else {
+        lruTail = entry;
+    }
+    lruHead = entry;
+}
+
+// Frees the DRAM copy of the value, if any
+static void release_dram_copy(DRAM_CacheEntry *entry)
+{
+    if (entry->dramAddress != DRAM_NO_ADDRESS) {
+        dram_free(entry->dramAddress, entry->length);
+        entry->dramAddress = DRAM_NO_ADDRESS;
+        cacheStats.coldBytes -= entry->length;
+    }
+}
+
+// Writes the value to a new DRAM block. Returns 0, or -1 with errno set.
+static int store_dram_copy(DRAM_CacheEntry *entry, const uint8_t *data)
+{
+    uint32_t address = dram_alloc(entry->length);
+    if (address == DRAM_NO_ADDRESS) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (entry->length > 0 && dram_memory_write(address, (uint8_t *)data, entry->length) != 0) {
+        dram_free(address, entry->length);
+        errno = EIO;
+        return -1;
+    }
+    entry->dramAddress = address;
+    cacheStats.coldBytes += entry->length;
+    return 0;
+}
+
+// Drops the RAM copy of the value, writing it to DRAM first if it has no DRAM copy yet
+static int demote(DRAM_CacheEntry *entry)
+{
+    if (entry->dramAddress == DRAM_NO_ADDRESS && store_dram_copy(entry, entry->hotData) != 0) {
+        return -1;
+    }
+    lru_unlink(entry);
+    free(entry->hotData);
+    entry->hotData = NULL;
+    entry->hot = false;
+    cacheStats.hotBytes -= entry->length;
+    cacheStats.demotions++;
+    return 0;
+}
+
+// Demotes the least recently used values until the RAM tier fits in its capacity
+static int enforce_hot_capacity(void)
+{
+    while (cacheStats.hotBytes > hotCapacity) {
+        if (demote(lruTail) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void destroy_entry(DRAM_CacheEntry *entry)
+{
+    DRAM_CacheEntry **link = get_bucket(entry->key);
+    while (*link != entry) {
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+
+    if (entry->hot) {
+        lru_unlink(entry);
+        free(entry->hotData);
+        cacheStats.hotBytes -= entry->length;
+    }
+    release_dram_copy(entry);
+    cacheStats.entries--;
+    free(entry);
+}
+
+int dram_cache_init(uint32_t capacity)
+{
+    dram_cache_cleanup();
+    memset(&cacheStats, 0, sizeof(cacheStats));
+    hotTotalUs = 0;
+    coldTotalUs = 0;
+    hotCapacity = capacity;
+    return dram_alloc_init();
+}
+
+int dram_cache_put(const char *key, const void *value, uint32_t length)
+{
+    if (key == NULL || strlen(key) > DRAM_CACHE_MAX_KEY_LENGTH || (value == NULL && length > 0)) {
+        Log_Debug("ERROR: Invalid key or value\n");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The previous value of the key is only removed once the new one is stored, so that a failed
+    // replace leaves it in the cache.
+    DRAM_CacheEntry *previous = find_entry(key);
+
+    size_t keySize = strlen(key) + 1;
+    DRAM_CacheEntry *entry = calloc(1, sizeof(DRAM_CacheEntry) + keySize);
+    if (entry == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(entry->key, key, keySize);
+    entry->length = length;
+    entry->dramAddress = DRAM_NO_ADDRESS;
+
+    if (length > hotCapacity) {
+        // Too large for the RAM tier
+        if (store_dram_copy(entry, value) != 0) {
+            free(entry);
+            return -1;
+        }
+    } else {
+        entry->hotData = malloc(length > 0 ? length : 1);
+        if (entry->hotData == NULL) {
+            free(entry);
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(entry->hotData, value, length);
+        entry->hot = true;
+        lru_push_front(entry);
+        cacheStats.hotBytes += length;
+    }
+
+    // The previous value no longer counts towards the RAM tier, so that it isn't demoted to make
+    // room for the value replacing it.
+    if (previous != NULL && previous->hot) {
+        lru_unlink(previous);
+        cacheStats.hotBytes -= previous->length;
+    }
+
+    if (enforce_hot_capacity() != 0) {
+        int error = errno;
+        if (entry->hot) {
+            lru_unlink(entry);
+            free(entry->hotData);
+            cacheStats.hotBytes -= entry->length;
+        }
+        release_dram_copy(entry);
+        free(entry);
+        if (previous != NULL && previous->hot) {
+            lru_push_front(previous);
+            cacheStats.hotBytes += previous->length;
+        }
+        errno = error;
+        return -1;
+    }
+
+    if (previous != NULL) {
+        if (previous->hot) {
+            // Already out of the LRU list and of hotBytes
+            free(previous->hotData);
+            previous->hotData = NULL;
+            previous->hot = false;
+        }
+        destroy_entry(previous);
+    }
+
+    DRAM_CacheEntry **bucket = get_bucket(key);
+    entry->hashNext = *bucket;
+    *bucket = entry;
+    cacheStats.entries++;
+    return 0;
+}
+
+int dram_cache_get(const char *key, void *value, uint32_t capacity, uint32_t *length)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    DRAM_CacheEntry *entry = key != NULL ? find_entry(key) : NULL;
+    if (entry == NULL) {
+        cacheStats.misses++;
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (length != NULL) {
+        *length = entry->length;
+    }
+    if (value == NULL) {
+        return 0;
+    }
+    if (capacity < entry->length) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (entry->hot) {
+        memcpy(value, entry->hotData, entry->length);
+        lru_unlink(entry);
+        lru_push_front(entry);
+
+        uint32_t us = elapsed_us(&start);
+        cacheStats.hotHits++;
+        hotTotalUs += us;
+        if (us > cacheStats.hotMaxUs) {
+            cacheStats.hotMaxUs = us;
+        }
+        return 0;
+    }
+
+    if (entry->length > 0 && dram_memory_read_fast(entry->dramAddress, value, entry->length) != 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    // Promote the value, keeping its DRAM copy for the next demotion
+    if (entry->length <= hotCapacity) {
+        entry->hotData = malloc(entry->length > 0 ? entry->length : 1);
+        if (entry->hotData != NULL) {
+            memcpy(entry->hotData, value, entry->length);
+            entry->hot = true;
+            lru_push_front(entry);
+            cacheStats.hotBytes += entry->length;
+            cacheStats.promotions++;
+            if (enforce_hot_capacity() != 0 && entry->hot) {
+                // The other values could not be demoted: drop this one from RAM instead
+                demote(entry);
+            }
+        }
+    }
+
+    uint32_t us = elapsed_us(&start);
+    cacheStats.coldHits++;
+    coldTotalUs += us;
+    if (us > cacheStats.coldMaxUs) {
+        cacheStats.coldMaxUs = us;
+    }
+    return 0;
+}
+
+int dram_cache_remove(const char *key)
+{
+    DRAM_CacheEntry *entry = key != NULL ? find_entry(key) : NULL;
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    destroy_entry(entry);
+    return 0;
+}
+
+void dram_cache_get_stats(DRAM_CacheStats *stats)
+{
+    *stats = cacheStats;
+    stats->hotAverageUs = cacheStats.hotHits > 0 ? (uint32_t)(hotTotalUs / cacheStats.hotHits) : 0;
+    stats->coldAverageUs =
+        cacheStats.coldHits > 0 ? (uint32_t)(coldTotalUs / cacheStats.coldHits) : 0;
+}
+
+void dram_cache_log_stats(void)
+{
+    DRAM_CacheStats stats;
+    DRAM_AllocStats allocStats;
+    dram_cache_get_stats(&stats);
+    dram_alloc_get_stats(&allocStats);
+
+    uint32_t gets = stats.hotHits + stats.coldHits + stats.misses;
+    double percent = gets > 0 ? 100.0 / gets : 0.0;
+
+    Log_Debug("DRAM cache: %lu entries, %lu B in RAM, %lu B in DRAM\n",
+              (unsigned long)stats.entries, (unsigned long)stats.hotBytes,
+              (unsigned long)stats.coldBytes);
+    Log_Debug("  %lu gets: %.1f%% RAM hits, %.1f%% DRAM hits, %.1f%% misses\n",
+              (unsigned long)gets, stats.hotHits * percent, stats.coldHits * percent,
+              stats.misses * percent);
+    Log_Debug("  latency: RAM avg %lu us max %lu us, DRAM avg %lu us max %lu us\n",
+              (unsigned long)stats.hotAverageUs, (unsigned long)stats.hotMaxUs,
+              (unsigned long)stats.coldAverageUs, (unsigned long)stats.coldMaxUs);
+    Log_Debug("  %lu promotions, %lu demotions\n", (unsigned long)stats.promotions,
+              (unsigned long)stats.demotions);
+    Log_Debug("  DRAM: %lu B used, %lu B free in %lu ranges, largest %lu B\n",
+              (unsigned long)allocStats.usedBytes, (unsigned long)allocStats.freeBytes,
+              (unsigned long)allocStats.freeRanges, (unsigned long)allocStats.largestFreeBlock);
+}
+
+void dram_cache_cleanup(void)
+{
+    for (size_t i = 0; i < CACHE_BUCKET_COUNT; i++) {
+        while (buckets[i] != NULL) {
+            destroy_entry(buckets[i]);
+        }
+    }
+    free(freeRanges);
+    freeRanges = NULL;
+    freeRangeCount = 0;
+    freeRangeCapacity = 0;
+    allocatedBytes = 0;
+}
@@ -0,0 +1,194 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+/// \file dram_cache.h
+/// \brief This header contains an allocator for the memory of the DRAM Click board, and a key/value
+/// cache built on it which keeps the most recently used values in RAM (the hot tier) and spills the
+/// others to the DRAM (the cold tier). It lets an application keep data such as telemetry buffers,
+/// store-and-forward queues or large JSON documents outside of its heap, which counts towards the
+/// user-mode memory limit of the high-level app. dram_init must be called before these functions.
+/// The functions are not thread-safe.
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dram.h"
+
+/// <summary>
+/// Allocation granularity of the DRAM allocator: blocks start on a Wrap32 line.
+/// </summary>
+#define DRAM_ALLOC_ALIGNMENT 32
+
+/// <summary>
+/// Address returned when no DRAM block is allocated.
+/// </summary>
+#define DRAM_NO_ADDRESS 0xFFFFFFFFul
+
+/// <summary>
+/// Maximum length of a cache key, excluding the null terminator.
+/// </summary>
+#define DRAM_CACHE_MAX_KEY_LENGTH 63
+
+/// <summary>
+/// Statistics of the DRAM allocator.
+/// </summary>
+typedef struct {
+    /// <summary>Bytes allocated, rounded up to DRAM_ALLOC_ALIGNMENT</summary>
+    uint32_t usedBytes;
+    /// <summary>Bytes free</summary>
+    uint32_t freeBytes;
+    /// <summary>Size of the largest block which can be allocated</summary>
+    uint32_t largestFreeBlock;
+    /// <summary>Number of free ranges: a measure of the fragmentation</summary>
+    uint32_t freeRanges;
+} DRAM_AllocStats;
+
+/// <summary>
+/// Statistics of the cache. Latencies are in microseconds, and cover the whole dram_cache_get
+/// call, including the DRAM transfers.
+/// </summary>
+typedef struct {
+    /// <summary>Gets served from the RAM tier</summary>
+    uint32_t hotHits;
+    /// <summary>Gets served from the DRAM tier</summary>
+    uint32_t coldHits;
+    /// <summary>Gets of a key which is not in the cache</summary>
+    uint32_t misses;
+    /// <summary>Values copied from the DRAM tier to the RAM tier</summary>
+    uint32_t promotions;
+    /// <summary>Values moved from the RAM tier to the DRAM tier</summary>
+    uint32_t demotions;
+    /// <summary>Values currently in the cache</summary>
+    uint32_t entries;
+    /// <summary>Bytes of values held in RAM</summary>
+    uint32_t hotBytes;
+    /// <summary>Bytes of values held in DRAM</summary>
+    uint32_t coldBytes;
+    /// <summary>Average and maximum latency of the gets served from RAM</summary>
+    uint32_t hotAverageUs;
+    uint32_t hotMaxUs;
+    /// <summary>Average and maximum latency of the gets served from DRAM</summary>
+    uint32_t coldAverageUs;
+    uint32_t coldMaxUs;
+} DRAM_CacheStats;
+
+/// <summary>
+/// Makes the whole DRAM available to dram_alloc, and frees all the blocks previously allocated.
+/// </summary>
+/// <returns>
+/// 0 for success, or -1 for failure, in which case errno is set to the error value.
+/// </returns>
+int dram_alloc_init(void);
+
+/// <summary>
+/// Allocates a block of DRAM (first fit). Only the address range is tracked in RAM.
+/// </summary>
+/// <param name="size">
+/// Size of the block in bytes
+/// </param>
+/// <returns>
+/// The DRAM address of the block, or DRAM_NO_ADDRESS if there is no free range large enough, in
+/// which case errno is set to ENOMEM.
+/// </returns>
+uint32_t dram_alloc(uint32_t size);
+
+/// <summary>
+/// Frees a block allocated with dram_alloc.
+/// </summary>
+/// <param name="address">
+/// The address returned by dram_alloc
+/// </param>
+/// <param name="size">
+/// The size passed to dram_alloc
+/// </param>
+void dram_free(uint32_t address, uint32_t size);
+
+/// <summary>
+/// Gets the statistics of the DRAM allocator.
+/// </summary>
+void dram_alloc_get_stats(DRAM_AllocStats *stats);
+
+/// <summary>
+/// Initializes the cache, and the allocator it uses for the DRAM tier (see dram_alloc_init).
+/// </summary>
+/// <param name="hotCapacity">
+/// Maximum number of bytes of values kept in RAM. The least recently used values are moved to the
+/// DRAM when it is exceeded. Values larger than this are only stored in DRAM.
+/// </param>
+/// <returns>
+/// 0 for success, or -1 for failure, in which case errno is set to the error value.
+/// </returns>
+int dram_cache_init(uint32_t hotCapacity);
+
+/// <summary>
+/// Adds a value to the cache, or replaces the value of an existing key. The value becomes the most
+/// recently used one.
+/// </summary>
+/// <param name="key">
+/// Null-terminated key, up to DRAM_CACHE_MAX_KEY_LENGTH characters
+/// </param>
+/// <param name="value">
+/// The value, copied
+/// </param>
+/// <param name="length">
+/// Length of the value in bytes
+/// </param>
+/// <returns>
+/// 0 for success, or -1 for failure, in which case errno is set to the error value (ENOSPC if the
+/// DRAM is full, ENOMEM if the RAM is).
+/// </returns>
+int dram_cache_put(const char *key, const void *value, uint32_t length);
+
+/// <summary>
+/// Copies a value from the cache. A value found in the DRAM tier is promoted to the RAM tier, unless
+/// it is larger than the RAM tier.
+/// </summary>
+/// <param name="key">
+/// Null-terminated key
+/// </param>
+/// <param name="value">
+/// Receives the value; may be NULL to only get its length
+/// </param>
+/// <param name="capacity">
+/// Size of the value buffer
+/// </param>
+/// <param name="length">
+/// Receives the length of the value; may be NULL
+/// </param>
+/// <returns>
+/// 0 for success, or -1 for failure, in which case errno is set to the error value (ENOENT if the
+/// key is not in the cache, ENOBUFS if the value is larger than capacity).
+/// </returns>
+int dram_cache_get(const char *key, void *value, uint32_t capacity, uint32_t *length);
+
+/// <summary>
+/// Removes a value from the cache.
+/// </summary>
+/// <param name="key">
+/// Null-terminated key
+/// </param>
+/// <returns>
+/// 0 for success, or -1 if the key is not in the cache, in which case errno is set to ENOENT.
+/// </returns>
+int dram_cache_remove(const char *key);
+
+/// <summary>
+/// Gets the statistics of the cache.
+/// </summary>
+void dram_cache_get_stats(DRAM_CacheStats *stats);
+
+/// <summary>
+/// Logs the statistics of the cache and of the DRAM allocator: hit rates, latencies and memory use.
+/// </summary>
+void dram_cache_log_stats(void);
+
+/// <summary>
+/// Removes all the values and frees the memory used by the cache.
+/// </summary>
+void dram_cache_cleanup(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,9 +13,12 @@
 // the sample_appliance header file recursively includes underlying hardware definition headers.
 // See https://aka.ms/azsphere-samples-hardwaredefinitions for further details on this feature.
 #include <hw/sample_appliance.h>
+#include <applibs/applications.h>
 
 // MikroSDK DRAM Clickboard library import
 #include "dram.h"
+#include "dram_async.h"
+#include "dram_cache.h"
 
 // Example dummy values
 #define DEMO_TEXT_MESSAGE_1 "MikroE"
@@ -27,6 +30,186 @@ uint8_t *retr_buf;
 // Use timespec struct to slow down output
 // const struct timespec sleepTime = {.tv_sec = 3, .tv_nsec = 50};
 
+// Throughput benchmark: each size is transferred BENCHMARK_TOTAL_BYTES in total, in at least one
+// and at most BENCHMARK_MAX_COUNT transfers. Transfers larger than BENCHMARK_BUFFER_SIZE reuse the
+// same buffer for each of their segments.
+#define BENCHMARK_TOTAL_BYTES (1024 * 1024)
+#define BENCHMARK_MAX_COUNT 256
+#define BENCHMARK_BUFFER_SIZE (64 * 1024)
+static const uint32_t benchmarkSizes[] = {32, 4 * 1024, 1024 * 1024};
+
+static EventLoop *eventLoop = NULL;
+static size_t benchmarkCompleted = 0;
+static int benchmarkResult = 0;
+
+static double elapsed_seconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void log_throughput(const char *name, uint32_t size, uint32_t count, double seconds)
+{
+    Log_Debug("  %-22s %8lu B x %4lu: %8.3f ms, %6.2f MB/s\n", name, (unsigned long)size,
+              (unsigned long)count, seconds * 1000.0,
+              (double)size * count / (1024.0 * 1024.0) / seconds);
+}
+
+static void benchmark_callback(int result, void *context)
+{
+    if (result != 0) {
+        benchmarkResult = result;
+    }
+    benchmarkCompleted++;
+}
+
+// Runs a blocking transfer of 'size' bytes, in segments of at most BENCHMARK_BUFFER_SIZE
+static int benchmark_sync(int (*transfer)(uint32_t, uint8_t *, uint32_t), uint32_t address,
+                          uint8_t *buffer, uint32_t size)
+{
+    for (uint32_t offset = 0; offset < size; offset += BENCHMARK_BUFFER_SIZE) {
+        uint32_t length =
+            (size - offset > BENCHMARK_BUFFER_SIZE) ? BENCHMARK_BUFFER_SIZE : size - offset;
+        if (transfer(address + offset, buffer, length) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Queues one scatter-gather request of 'size' bytes, in segments of at most BENCHMARK_BUFFER_SIZE
+static int benchmark_submit(DRAM_Direction direction, uint32_t address, uint8_t *buffer,
+                            uint32_t size)
+{
+    DRAM_Segment segments[DRAM_ASYNC_MAX_SEGMENTS];
+    size_t segmentCount = 0;
+    for (uint32_t offset = 0; offset < size; offset += BENCHMARK_BUFFER_SIZE) {
+        segments[segmentCount].address = address + offset;
+        segments[segmentCount].data = buffer;
+        segments[segmentCount].length =
+            (size - offset > BENCHMARK_BUFFER_SIZE) ? BENCHMARK_BUFFER_SIZE : size - offset;
+        segmentCount++;
+    }
+    return dram_async_submit(direction, segments, segmentCount, benchmark_callback, NULL);
+}
+
+// Queues 'count' requests of 'size' bytes at consecutive addresses, then runs the event loop
+// until they have all completed. Logs the time the caller was blocked submitting them, and the
+// time until the last completion callback.
+static int benchmark_async(DRAM_Direction direction, const char *name, uint8_t *buffer,
+                           uint32_t size, uint32_t count)
+{
+    benchmarkCompleted = 0;
+    benchmarkResult = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t address = (uint32_t)(((uint64_t)i * size) % (DRAM_MAX_ADDRESS + 1));
+        if (benchmark_submit(direction, address, buffer, size) != 0) {
+            Log_Debug("ERROR: dram_async_submit: errno=%d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+    double submitSeconds = elapsed_seconds(&start);
+
+    while (benchmarkCompleted < count) {
+        if (EventLoop_Run(eventLoop, -1, true) == EventLoop_Run_Failed && errno != EINTR) {
+            Log_Debug("ERROR: EventLoop_Run: errno=%d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+    double completionSeconds = elapsed_seconds(&start);
+
+    if (benchmarkResult != 0) {
+        Log_Debug("ERROR: %s failed: errno=%d (%s)\n", name, benchmarkResult,
+                  strerror(benchmarkResult));
+        return -1;
+    }
+
+    Log_Debug("  %-22s %8lu B x %4lu: caller blocked %8.3f ms\n", name, (unsigned long)size,
+              (unsigned long)count, submitSeconds * 1000.0);
+    log_throughput(name, size, count, completionSeconds);
+    return 0;
+}
+
+// Compares the blocking transfers (dram_memory_write, dram_memory_read, dram_memory_read_fast)
+// with the queued ones (dram_async_submit) for each of benchmarkSizes
+int run_benchmark(void)
+{
+    uint8_t *pattern = malloc(BENCHMARK_BUFFER_SIZE);
+    uint8_t *buffer = malloc(BENCHMARK_BUFFER_SIZE);
+    if (pattern == NULL || buffer == NULL) {
+        free(pattern);
+        free(buffer);
+        return -1;
+    }
+    for (uint32_t i = 0; i < BENCHMARK_BUFFER_SIZE; i++) {
+        pattern[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    int exitCode = 0;
+    Log_Debug("DRAM throughput benchmark\n");
+
+    for (size_t s = 0; exitCode == 0 && s < sizeof(benchmarkSizes) / sizeof(benchmarkSizes[0]);
+         s++) {
+        uint32_t size = benchmarkSizes[s];
+        uint32_t count = (size < BENCHMARK_TOTAL_BYTES) ? BENCHMARK_TOTAL_BYTES / size : 1;
+        if (count > BENCHMARK_MAX_COUNT) {
+            count = BENCHMARK_MAX_COUNT;
+        }
+        uint32_t checkLength = (size < BENCHMARK_BUFFER_SIZE) ? size : BENCHMARK_BUFFER_SIZE;
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; exitCode == 0 && i < count; i++) {
+            exitCode = benchmark_sync(dram_memory_write, i * size, pattern, size);
+        }
+        if (exitCode == 0) {
+            log_throughput("write", size, count, elapsed_seconds(&start));
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; exitCode == 0 && i < count; i++) {
+            exitCode = benchmark_sync(dram_memory_read, i * size, buffer, size);
+        }
+        if (exitCode == 0) {
+            log_throughput("read", size, count, elapsed_seconds(&start));
+        }
+
+        memset(buffer, 0, checkLength);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; exitCode == 0 && i < count; i++) {
+            exitCode = benchmark_sync(dram_memory_read_fast, i * size, buffer, size);
+        }
+        if (exitCode == 0) {
+            log_throughput("read fast", size, count, elapsed_seconds(&start));
+            if (memcmp(buffer, pattern, checkLength) != 0) {
+                Log_Debug(" ERROR: read fast data mismatch\n");
+                exitCode = -1;
+            }
+        }
+
+        if (exitCode == 0) {
+            exitCode = benchmark_async(DRAM_Direction_Write, "async write", pattern, size, count);
+        }
+
+        memset(buffer, 0, checkLength);
+        if (exitCode == 0) {
+            exitCode = benchmark_async(DRAM_Direction_Read, "async read", buffer, size, count);
+        }
+        if (exitCode == 0 && memcmp(buffer, pattern, checkLength) != 0) {
+            Log_Debug(" ERROR: async read data mismatch\n");
+            exitCode = -1;
+        }
+    }
+
+    free(pattern);
+    free(buffer);
+    return exitCode;
+}
+
 int application_task(unsigned long starting_address)
 {
     // Allocate memory for Buffers to hold data for memory transfers
@@ -128,6 +311,92 @@ int application_task(unsigned long starting_address)
     return 0;
 }
 
+// Cache demo: CACHE_RECORD_COUNT telemetry records of CACHE_RECORD_SIZE bytes, of which only
+// CACHE_HOT_CAPACITY bytes fit in RAM, read mostly from a small working set, plus a document
+// larger than the RAM tier
+#define CACHE_HOT_CAPACITY (16 * 1024)
+#define CACHE_RECORD_COUNT 64
+#define CACHE_RECORD_SIZE 1024
+#define CACHE_WORKING_SET 8
+#define CACHE_GET_COUNT 1000
+#define CACHE_DOCUMENT_SIZE (32 * 1024)
+
+static void fill_record(uint8_t *record, uint32_t size, uint32_t seed)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        record[i] = (uint8_t)(seed * 31 + i);
+    }
+}
+
+// Spills telemetry records and a document to the DRAM through the cache, reads them back and logs
+// the hit rates and latencies
+int run_cache_demo(void)
+{
+    uint8_t *expected = malloc(CACHE_DOCUMENT_SIZE);
+    uint8_t *record = malloc(CACHE_DOCUMENT_SIZE);
+    if (expected == NULL || record == NULL || dram_cache_init(CACHE_HOT_CAPACITY) != 0) {
+        free(expected);
+        free(record);
+        return -1;
+    }
+
+    Log_Debug("DRAM cache demo, user-mode memory %lu KB\n",
+              (unsigned long)Applications_GetUserModeMemoryUsageInKB());
+
+    int exitCode = 0;
+    char key[32];
+    for (uint32_t i = 0; exitCode == 0 && i < CACHE_RECORD_COUNT; i++) {
+        snprintf(key, sizeof(key), "telemetry/%lu", (unsigned long)i);
+        fill_record(expected, CACHE_RECORD_SIZE, i);
+        exitCode = dram_cache_put(key, expected, CACHE_RECORD_SIZE);
+    }
+
+    fill_record(expected, CACHE_DOCUMENT_SIZE, 1000);
+    if (exitCode == 0) {
+        exitCode = dram_cache_put("document", expected, CACHE_DOCUMENT_SIZE);
+    }
+    if (exitCode != 0) {
+        Log_Debug("ERROR: dram_cache_put: errno=%d (%s)\n", errno, strerror(errno));
+    }
+
+    // 9 gets out of 10 go to the working set, the others to any record
+    uint32_t random = 1;
+    for (uint32_t i = 0; exitCode == 0 && i < CACHE_GET_COUNT; i++) {
+        random = random * 1103515245 + 12345;
+        uint32_t index = (random >> 16) % CACHE_RECORD_COUNT;
+        if (i % 10 != 0) {
+            index %= CACHE_WORKING_SET;
+        }
+        snprintf(key, sizeof(key), "telemetry/%lu", (unsigned long)index);
+        uint32_t length = 0;
+        exitCode = dram_cache_get(key, record, CACHE_DOCUMENT_SIZE, &length);
+        fill_record(expected, CACHE_RECORD_SIZE, index);
+        if (exitCode == 0 &&
+            (length != CACHE_RECORD_SIZE || memcmp(record, expected, CACHE_RECORD_SIZE) != 0)) {
+            Log_Debug(" ERROR: %s data mismatch\n", key);
+            exitCode = -1;
+        }
+    }
+
+    if (exitCode == 0) {
+        exitCode = dram_cache_get("document", record, CACHE_DOCUMENT_SIZE, NULL);
+        fill_record(expected, CACHE_DOCUMENT_SIZE, 1000);
+        if (exitCode == 0 && memcmp(record, expected, CACHE_DOCUMENT_SIZE) != 0) {
+            Log_Debug(" ERROR: document data mismatch\n");
+            exitCode = -1;
+        }
+    }
+
+    dram_cache_log_stats();
+    Log_Debug("User-mode memory %lu KB\n",
+              (unsigned long)Applications_GetUserModeMemoryUsageInKB());
+
+    dram_cache_cleanup();
+    free(expected);
+    free(record);
+    return exitCode;
+}
+
 int main(int argc, char *argv[])
 {
     Log_Debug("DRAM Clickboard application starting\n");
@@ -139,6 +408,27 @@ int main(int argc, char *argv[])
         return exitCode;
     }
 
+    eventLoop = EventLoop_Create();
+    if (eventLoop == NULL) {
+        Log_Debug("ERROR: EventLoop_Create: errno=%d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    exitCode = dram_async_init(eventLoop);
+    if (exitCode == 0) {
+        exitCode = run_benchmark();
+        dram_async_cleanup();
+    }
+    EventLoop_Close(eventLoop);
+    if (exitCode != 0) {
+        return exitCode;
+    }
+
+    exitCode = run_cache_demo();
+    if (exitCode != 0) {
+        return exitCode;
+    }
+
     unsigned long starting_address = DRAM_MIN_ADDRESS;
 
     // This task will write to the entire dram click until the max address.
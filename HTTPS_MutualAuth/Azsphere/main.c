@@ -5,7 +5,13 @@
 // at example.com, by using cURL over a secure HTTPS connection.
 // It uses the cURL 'easy' API which is a synchronous (blocking) API.
 //
+// The cURL handle is created once and reused by every download, so that the connection to the
+// server is kept alive when the server allows it, and otherwise the TLS session is resumed instead
+// of running a full mutual-authentication handshake. The response is streamed through a
+// fixed-size ring to a consumer, so the memory used doesn't depend on the size of the response.
+//
 // It uses the following Azure Sphere libraries:
+// - applications (memory usage)
 // - curl (URL transfer library)
 // - eventloop (system invokes handlers for timer events)
 // - log (displays messages in the Device Output window during debugging)
@@ -23,12 +29,14 @@
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
+#include <applibs/applications.h>
 #include <applibs/log.h>
 #include <applibs/networking.h>
 #include <applibs/networking_curl.h>
 #include <applibs/storage.h>
 
 #include "eventloop_timer_utilities.h"
+#include "response_ring.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -43,25 +51,42 @@ typedef enum {
     ExitCode_Init_DownloadTimer = 4,
     ExitCode_Main_EventLoopFail = 5,
     ExitCode_IsNetworkingReady_Failed = 6,
-    ExitCode_CurlSetDefaultProxy_Failed = 7
+    ExitCode_CurlSetDefaultProxy_Failed = 7,
+    ExitCode_Init_Curl = 8
 } ExitCode;
 
 /// <summary>
-///     Data pointer and size of a block of memory allocated on the heap.
+///     State of a download: the ring the response streams through, and whether the transfer is
+///     paused because the ring is full.
 /// </summary>
 typedef struct {
     CURL *curlHandle;
     bool paused;
-    char *data;
-    size_t size;
-} MemoryBlock;
+    ResponseRing ring;
+} DownloadStream;
+
+/// <summary>
+///     Timings of a request, in microseconds from its start.
+/// </summary>
+typedef struct {
+    curl_off_t connectUs;
+    curl_off_t tlsHandshakeUs;
+    curl_off_t totalUs;
+    /// <summary>Number of new connections made, 0 if an existing connection was reused</summary>
+    long newConnections;
+} RequestTimings;
 
 static void TerminationHandler(int signalNumber);
-static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                          void *memoryBlock);
+static size_t StreamDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
+                                           void *stream);
+static size_t LogResponseData(const char *data, size_t length, void *context);
+static size_t DiscardResponseData(const char *data, size_t length, void *context);
 static void LogCurlError(const char *message, int curlErrCode);
-static void PrintResponseAndResetData(MemoryBlock *block);
+static bool OpenCurlSession(void);
+static void CloseCurlSession(void);
+static bool PerformRequest(ResponseConsumer consumer, RequestTimings *timings);
 static void PerformWebPageDownload(void);
+static void RunBenchmark(unsigned int requestCount);
 static void TimerEventHandler(EventLoopTimer *timer);
 static ExitCode InitHandlers(void);
 static void CloseHandlers(void);
@@ -75,15 +100,27 @@ static EventLoopTimer *downloadTimer = NULL;
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
-// The maximum number of characters which are printed from the HTTP response body.
+// The maximum number of characters which are printed in one Log_Debug call.
 static const size_t MaxResponseCharsToPrint = 2048;
 
-// Flag to indicate if all content has been logged.
-static bool printedEntireResponse = false;
+// Size of the buffer cURL receives the response in: the largest chunk passed to
+// StreamDownloadedDataCallback. It must not exceed RESPONSE_RING_SIZE.
+static const long ReceiveBufferSize = 2048;
 
 // By default, do not bypass proxy.
 static bool bypassProxy = false;
 
+// Number of requests of the benchmark requested on the command line, 0 if none.
+static unsigned int benchmarkRequestCount = 0;
+
+// The cURL handle and the certificate paths, kept across downloads.
+static CURL *curlHandle = NULL;
+static char *certificatePath = NULL;
+static char *clientCertPath = NULL;
+static char *clientKeyPath = NULL;
+
+static DownloadStream stream;
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -94,52 +131,61 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Callback for curl_easy_perform() that copies the downloaded chunks in a single memory
-///     block. If the size of the block exceeds MaxResponseCharsToPrint, then the download is
-///     paused.
+///     Callback for curl_easy_perform() that passes the downloaded chunks to the consumer through
+///     the ring. If the ring is too full to hold the chunks, then the download is paused until
+///     the consumer catches up.
 /// <param name="chunks">The pointer to the chunks array</param>
 /// <param name="chunkSize">The size of each chunk</param>
 /// <param name="chunksCount">The count of the chunks</param>
-/// <param name="memoryBlock">The pointer where all the downloaded chunks are aggregated</param>
+/// <param name="stream">The DownloadStream of the transfer</param>
 /// <returns>
-///     Number of additional bytes of memory successfully allocated, 0 if memory
-///     allocation fails or CURL_WRITEFUNC_PAUSE if size of block will exceed
-///     MaxResponseCharsToPrint.
+///     Number of bytes taken, or CURL_WRITEFUNC_PAUSE if the ring is full.
 /// </returns>
 /// </summary>
-static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                          void *memoryBlock)
+static size_t StreamDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
+                                           void *stream)
 {
-    MemoryBlock *block = (MemoryBlock *)memoryBlock;
+    DownloadStream *downloadStream = (DownloadStream *)stream;
 
-    size_t additionalDataSize = chunkSize * chunksCount;
+    size_t length = chunkSize * chunksCount;
 
-    if ((block->size + additionalDataSize + 1) > MaxResponseCharsToPrint) {
-        // Size of block will exceed MaxResponseCharsToPrint. Pause the download.
-        block->paused = true;
+    ResponseRing_Drain(&downloadStream->ring);
+    if (!ResponseRing_Write(&downloadStream->ring, chunks, length)) {
+        // cURL passes the same chunks again once the download is unpaused.
+        downloadStream->paused = true;
         return CURL_WRITEFUNC_PAUSE;
     }
 
-    char *tempDataPtr = realloc(block->data, block->size + additionalDataSize + 1);
-    if (tempDataPtr == NULL) {
-        Log_Debug("Out of memory, realloc returned NULL: errno=%d (%s)\n", errno, strerror(errno));
-        // Signal an error condition to the cURL library. This will cause the transfer to get
-        // aborted.
-        return 0;
-    }
+    return length;
+}
 
-    // Memory successfully allocated.
-    block->data = tempDataPtr;
-    memcpy(block->data + block->size, chunks, additionalDataSize);
-    block->size += additionalDataSize;
-    block->data[block->size] = 0; // Ensure the block of memory is null terminated.
+/// <summary>
+///     Response consumer which logs the response.
+/// </summary>
+static size_t LogResponseData(const char *data, size_t length, void *context)
+{
+    for (size_t offset = 0; offset < length; offset += MaxResponseCharsToPrint) {
+        size_t printLength = length - offset;
+        if (printLength > MaxResponseCharsToPrint) {
+            printLength = MaxResponseCharsToPrint;
+        }
+        Log_Debug("%.*s", (int)printLength, data + offset);
+    }
+    return length;
+}
 
-    return additionalDataSize;
+/// <summary>
+///     Response consumer which drops the response, used by the benchmark.
+/// </summary>
+static size_t DiscardResponseData(const char *data, size_t length, void *context)
+{
+    return length;
 }
 
 /// <summary>
-///     Callback for CURLOPT_XFERINFOFUNCTION. This callback logs the content that is downloaded so
-///     far if the download has been paused.
+///     Callback for CURLOPT_XFERINFOFUNCTION. If the download has been paused, this callback
+///     gives the consumer another chance to empty the ring, and resumes the download once the
+///     ring can hold a full receive buffer.
 /// </summary>
 /// <param name="clientp">Pointer set with CURLOPT_XFERINFODATA</param>
 /// <param name="dltotal">Total number of bytes libcurl expects to download in this
@@ -151,34 +197,25 @@ static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t
 static int TransferInfoCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
                                 curl_off_t ultotal, curl_off_t ulnow)
 {
-    MemoryBlock *block = (MemoryBlock *)clientp;
-    if (block == NULL) {
-        Log_Debug("WARNING: Memory block received in TransferInfoCallback is NULL.\n");
+    DownloadStream *downloadStream = (DownloadStream *)clientp;
+    if (downloadStream == NULL) {
+        Log_Debug("WARNING: Download stream received in TransferInfoCallback is NULL.\n");
         return 0;
     }
 
-    if (block->paused) {
-        // Log the content downloaded so far.
-        PrintResponseAndResetData(block);
-
-        // Unpause the download.
-        block->paused = false;
-        CURLcode res = CURLE_OK;
-        if ((res = curl_easy_pause(block->curlHandle, CURLPAUSE_CONT)) != CURLE_OK) {
-            LogCurlError("curl_easy_pause CURLPAUSE_CONT", res);
-            return 1;
+    if (downloadStream->paused) {
+        ResponseRing_Drain(&downloadStream->ring);
+        if (ResponseRing_GetFreeSpace(&downloadStream->ring) >= (size_t)ReceiveBufferSize) {
+            // Unpause the download.
+            downloadStream->paused = false;
+            CURLcode res = CURLE_OK;
+            if ((res = curl_easy_pause(downloadStream->curlHandle, CURLPAUSE_CONT)) != CURLE_OK) {
+                LogCurlError("curl_easy_pause CURLPAUSE_CONT", res);
+                return 1;
+            }
         }
     }
 
-    // If dltotal equals dlnow, it indicates that download has complete. Print the last bit of
-    // response.
-    // Note: dltotal will be 0 if the Content-Length entity-header is missing in the response
-    // header. In that case, the last bit of response is logged after curl_easy_perform exits.
-    if ((dltotal > 0) && (dltotal == dlnow) && (!printedEntireResponse)) {
-        PrintResponseAndResetData(block);
-        printedEntireResponse = true;
-    }
-
     return 0;
 }
 
@@ -212,60 +249,22 @@ static bool IsNetworkReady(void)
 }
 
 /// <summary>
-///     Print the response contents and reset the data.
+///     Creates the cURL handle and sets the options which don't change between downloads: the
+///     server address, the certificates and the callbacks. The handle keeps its connection and
+///     TLS session cache across downloads.
 /// </summary>
-/// <param name="block">
-///     Pointer to the memory block that holds the data.
-/// </param>
-static void PrintResponseAndResetData(MemoryBlock *block)
+/// <returns>true on success; false on failure, in which case the session is closed.</returns>
+static bool OpenCurlSession(void)
 {
-    if ((block == NULL) || (block->data == NULL)) {
-        Log_Debug(
-            "WARNING: Not printing and resetting data as either memory block or the data is "
-            "null.\n");
-        return;
-    }
-
-    Log_Debug("%s", block->data);
-
-    free(block->data);
-    block->size = 0;
-    block->data = NULL;
-}
-
-/// <summary>
-///     Download a web page over HTTPS protocol using cURL.
-/// </summary>
-static void PerformWebPageDownload(void)
-{
-    CURL *curlHandle = NULL;
     CURLcode res = 0;
-    MemoryBlock block = {.data = NULL, .size = 0, .paused = false};
-    char *certificatePath = NULL;
-    char *clientCertPath = NULL;
-    char *clientKeyPath = NULL;
-
-    printedEntireResponse = false;
-
-    if (IsNetworkReady() == false) {
-        goto exitLabel;
-    }
-
-    Log_Debug("\n -===- START-OF-DOWNLOAD -===-\n");
-
-    // Init the cURL library.
-    if ((res = curl_global_init(CURL_GLOBAL_ALL)) != CURLE_OK) {
-        LogCurlError("curl_global_init", res);
-        goto exitLabel;
-    }
 
     if ((curlHandle = curl_easy_init()) == NULL) {
         Log_Debug("curl_easy_init() failed\n");
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Set the cURL handle to allow access to the cURL handle in callbacks.
-    block.curlHandle = curlHandle;
+    stream.curlHandle = curlHandle;
 
     // Specify URL to download.
     // Important: Any change in the domain name must be reflected in the AllowedConnections
@@ -273,13 +272,14 @@ static void PerformWebPageDownload(void)
 #warning Change the following line to specify the server address and delete this warning!
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_URL, "https://CHANGE.THIS:5000/")) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_URL", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
-    // Set output level to verbose.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_VERBOSE, 1L)) != CURLE_OK) {
+    // Set output level to verbose, except for the benchmark.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_VERBOSE, benchmarkRequestCount == 0 ? 1L : 0L)) !=
+        CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_VERBOSE", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Get the full path to the certificate file used to authenticate the HTTPS server identity.
@@ -287,27 +287,27 @@ static void PerformWebPageDownload(void)
     if (certificatePath == NULL) {
         Log_Debug("The certificate path could not be resolved: errno=%d (%s)\n", errno,
                   strerror(errno));
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Set the path for the certificate file that cURL uses to validate the server certificate.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_CAINFO, certificatePath)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_CAINFO", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
-    clientCertPath= Storage_GetAbsolutePathInImagePackage("certs/device-cert.pem");
+    clientCertPath = Storage_GetAbsolutePathInImagePackage("certs/device-cert.pem");
     if (clientCertPath == NULL) {
         Log_Debug("The client certificate path could not be resolved: errno=%d (%s)\n", errno,
                   strerror(errno));
-        goto cleanupLabel;
+        goto errorLabel;
     }
-    
-    clientKeyPath= Storage_GetAbsolutePathInImagePackage("certs/device-key.pem");
+
+    clientKeyPath = Storage_GetAbsolutePathInImagePackage("certs/device-key.pem");
     if (clientKeyPath == NULL) {
         Log_Debug("The client key path could not be resolved: errno=%d (%s)\n", errno,
                   strerror(errno));
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     curl_easy_setopt(curlHandle, CURLOPT_SSLCERT, clientCertPath);
@@ -316,51 +316,66 @@ static void PerformWebPageDownload(void)
     curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYPEER, 1L);
     curl_easy_setopt(curlHandle, CURLOPT_SSL_VERIFYHOST, 1L);
 
+    // Keep the TLS session of the last connection, so that the next connection to the server
+    // resumes it instead of running a full handshake. This is the default, set explicitly as the
+    // session reuse relies on it.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_SSL_SESSIONID_CACHE, 1L)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_SSL_SESSIONID_CACHE", res);
+        goto errorLabel;
+    }
+
     // Let cURL follow any HTTP 3xx redirects.
     // Important: Any redirection to different domain names requires that domain name to be added to
     // app_manifest.json.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_FOLLOWLOCATION", res);
-        goto cleanupLabel;
+        goto errorLabel;
+    }
+
+    // Receive the response in small pieces, which bounds the memory used by cURL as well as by
+    // the ring.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_BUFFERSIZE, ReceiveBufferSize)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_BUFFERSIZE", res);
+        goto errorLabel;
     }
 
     // Set up callback for cURL to use when downloading data.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, StoreDownloadedDataCallback)) !=
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, StreamDownloadedDataCallback)) !=
         CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_WRITEFUNCTION", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
-    // Set the custom parameter of the callback to the memory block.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void *)&block)) != CURLE_OK) {
+    // Set the custom parameter of the callback to the download stream.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void *)&stream)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_WRITEDATA", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Specify a user agent.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_USERAGENT, "libcurl-agent/1.0")) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_USERAGENT", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Set up callback for cURL to report transfer information.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_XFERINFOFUNCTION, TransferInfoCallback)) !=
         CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_XFERINFOFUNCTION", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
-    // Set the custom parameter of the callback to the memory block. It is not used by cURL but is
-    // only passed along from the application to the callback.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_XFERINFODATA, (void *)&block)) != CURLE_OK) {
+    // Set the custom parameter of the callback to the download stream. It is not used by cURL but
+    // is only passed along from the application to the callback.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_XFERINFODATA, (void *)&stream)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_XFERINFODATA", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Turn on the progress meter. This enables CURLOPT_XFERINFOFUNCTION callbacks.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_NOPROGRESS, 0L)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_NOPROGRESS", res);
-        goto cleanupLabel;
+        goto errorLabel;
     }
 
     // Configure the cURL handle to use the proxy.
@@ -369,38 +384,174 @@ static void PerformWebPageDownload(void)
             Log_Debug("Networking_Curl_SetDefaultProxy failed: errno=%d (%s)\n", errno,
                       strerror(errno));
             exitCode = ExitCode_CurlSetDefaultProxy_Failed;
-            goto cleanupLabel;
+            goto errorLabel;
         }
     }
 
+    return true;
+
+errorLabel:
+    CloseCurlSession();
+    return false;
+}
+
+/// <summary>
+///     Closes the connection and frees the cURL handle and the certificate paths.
+/// </summary>
+static void CloseCurlSession(void)
+{
+    curl_easy_cleanup(curlHandle);
+    curlHandle = NULL;
+    stream.curlHandle = NULL;
+
+    free(certificatePath);
+    certificatePath = NULL;
+    free(clientCertPath);
+    clientCertPath = NULL;
+    free(clientKeyPath);
+    clientKeyPath = NULL;
+}
+
+/// <summary>
+///     Performs a request with the cURL handle, streaming the response to the consumer.
+/// </summary>
+/// <param name="consumer">Consumer of the response</param>
+/// <param name="timings">If not NULL, receives the timings of the request</param>
+/// <returns>true if the request succeeded.</returns>
+static bool PerformRequest(ResponseConsumer consumer, RequestTimings *timings)
+{
+    stream.paused = false;
+    ResponseRing_Init(&stream.ring, consumer, NULL);
+
     // When using libcurl, as with other networking applications, the Azure Sphere OS will
     // allocate socket buffers which are attributed to your application's RAM usage. You can tune
     // the size of these buffers to reduce the RAM footprint of your application as appropriate.
     // Refer to https://learn.microsoft.com/azure-sphere/app-development/ram-usage-best-practices
     // for further details.
 
-    // Perform the download of the web page.
+    // Perform the request.
+    CURLcode res = CURLE_OK;
     if ((res = curl_easy_perform(curlHandle)) != CURLE_OK) {
         LogCurlError("curl_easy_perform", res);
+        return false;
+    }
+
+    // Pass the end of the response to the consumer.
+    ResponseRing_Drain(&stream.ring);
+    if (stream.ring.count > 0) {
+        Log_Debug("WARNING: %zu bytes of the response were not consumed.\n", stream.ring.count);
+    }
+
+    if (timings != NULL) {
+        curl_easy_getinfo(curlHandle, CURLINFO_CONNECT_TIME_T, &timings->connectUs);
+        curl_easy_getinfo(curlHandle, CURLINFO_APPCONNECT_TIME_T, &timings->tlsHandshakeUs);
+        curl_easy_getinfo(curlHandle, CURLINFO_TOTAL_TIME_T, &timings->totalUs);
+        curl_easy_getinfo(curlHandle, CURLINFO_NUM_CONNECTS, &timings->newConnections);
+    }
+
+    return true;
+}
+
+/// <summary>
+///     Download a web page over HTTPS protocol using cURL.
+/// </summary>
+static void PerformWebPageDownload(void)
+{
+    if (IsNetworkReady() == false) {
+        return;
+    }
+
+    if (curlHandle == NULL && !OpenCurlSession()) {
+        return;
+    }
+
+    Log_Debug("\n -===- START-OF-DOWNLOAD -===-\n");
+
+    RequestTimings timings;
+    if (PerformRequest(LogResponseData, &timings)) {
+        Log_Debug("\n%zu bytes in %lld ms (%s, TLS handshake %lld ms)\n",
+                  stream.ring.consumedBytes, (long long)(timings.totalUs / 1000),
+                  timings.newConnections == 0 ? "connection reused" : "new connection",
+                  (long long)((timings.tlsHandshakeUs - timings.connectUs) / 1000));
     } else {
-        if (!printedEntireResponse) {
-            // Log the remaining downloaded content if it wasn't logged in TransferInfoCallback.
-            PrintResponseAndResetData(&block);
-        }
+        // Start again with a new handle on the next download.
+        CloseCurlSession();
     }
 
-cleanupLabel:
-    // Clean up allocated memory.
-    free(block.data);
-    free(certificatePath);
-    // Clean up sample's cURL resources.
-    curl_easy_cleanup(curlHandle);
-    // Clean up cURL library's resources.
-    curl_global_cleanup();
     Log_Debug("\n -===- END-OF-DOWNLOAD -===-\n");
+}
+
+/// <summary>
+///     Logs the latency of requests made with the same cURL handle, then with a new cURL
+///     library and handle each time as when nothing is kept between downloads, and the most
+///     memory in use after a request of each series.
+/// </summary>
+/// <param name="requestCount">Number of requests of each kind</param>
+static void RunBenchmark(unsigned int requestCount)
+{
+    for (int reuse = 1; reuse >= 0; reuse--) {
+        curl_off_t totalUs = 0;
+        curl_off_t handshakeUs = 0;
+        curl_off_t firstUs = 0;
+        curl_off_t maxUs = 0;
+        unsigned int newConnections = 0;
+        unsigned int successCount = 0;
+        size_t maxMemoryKB = 0;
+
+        for (unsigned int i = 0; i < requestCount && exitCode == ExitCode_Success; i++) {
+            if (!reuse) {
+                CloseCurlSession();
+                curl_global_cleanup();
+                curl_global_init(CURL_GLOBAL_ALL);
+            }
+            if (curlHandle == NULL && !OpenCurlSession()) {
+                return;
+            }
+
+            RequestTimings timings;
+            bool performed = PerformRequest(DiscardResponseData, &timings);
+
+            // Sampled while the handle of the request is still open. The app's peak usage would
+            // cover both series, so the series' maximum is kept instead.
+            size_t memoryKB = Applications_GetUserModeMemoryUsageInKB();
+            if (memoryKB > maxMemoryKB) {
+                maxMemoryKB = memoryKB;
+            }
+
+            if (!performed) {
+                CloseCurlSession();
+                continue;
+            }
+
+            successCount++;
+            totalUs += timings.totalUs;
+            if (timings.newConnections > 0) {
+                newConnections++;
+                handshakeUs += timings.tlsHandshakeUs - timings.connectUs;
+            }
+            if (i == 0) {
+                firstUs = timings.totalUs;
+            }
+            if (timings.totalUs > maxUs) {
+                maxUs = timings.totalUs;
+            }
+        }
 
-exitLabel:
-    return;
+        if (successCount == 0) {
+            Log_Debug("Benchmark (%s): no request succeeded\n", reuse ? "reused handle" : "new handle");
+            continue;
+        }
+        Log_Debug("Benchmark (%s): %u/%u requests, average %lld us, first %lld us, max %lld us, "
+                  "%u new connections with an average TLS handshake of %lld us, max memory in use "
+                  "%zu KB\n",
+                  reuse ? "reused handle" : "new handle", successCount, requestCount,
+                  (long long)(totalUs / successCount), (long long)firstUs, (long long)maxUs,
+                  newConnections, newConnections > 0 ? (long long)(handshakeUs / newConnections) : 0,
+                  maxMemoryKB);
+    }
+
+    // The next download opens a new session with the usual options.
+    CloseCurlSession();
 }
 
 /// <summary>
@@ -413,6 +564,14 @@ static void TimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
+    if (benchmarkRequestCount > 0) {
+        if (IsNetworkReady()) {
+            RunBenchmark(benchmarkRequestCount);
+            benchmarkRequestCount = 0;
+        }
+        return;
+    }
+
     PerformWebPageDownload();
 }
 
@@ -436,6 +595,13 @@ static ExitCode InitHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
+    // Init the cURL library, once for all the downloads.
+    CURLcode res = CURLE_OK;
+    if ((res = curl_global_init(CURL_GLOBAL_ALL)) != CURLE_OK) {
+        LogCurlError("curl_global_init", res);
+        return ExitCode_Init_Curl;
+    }
+
     // Issue an HTTPS request at the specified period.
     static const struct timespec tenSeconds = {.tv_sec = 10, .tv_nsec = 0};
     downloadTimer = CreateEventLoopPeriodicTimer(eventLoop, &TimerEventHandler, &tenSeconds);
@@ -451,6 +617,9 @@ static ExitCode InitHandlers(void)
 /// </summary>
 static void CloseHandlers(void)
 {
+    CloseCurlSession();
+    // Clean up cURL library's resources.
+    curl_global_cleanup();
     DisposeEventLoopTimer(downloadTimer);
     EventLoop_Close(eventLoop);
 }
@@ -463,15 +632,20 @@ static void ParseCommandLineArguments(int argc, char *argv[])
     int option = 0;
     static const struct option cmdLineOptions[] = {
         {.name = "BypassProxy", .has_arg = no_argument, .flag = NULL, .val = 'b'},
+        {.name = "Benchmark", .has_arg = required_argument, .flag = NULL, .val = 'n'},
         {.name = NULL, .has_arg = 0, .flag = NULL, .val = 0}};
 
     // Loop over all of the options.
-    while ((option = getopt_long(argc, argv, "b", cmdLineOptions, NULL)) != -1) {
+    while ((option = getopt_long(argc, argv, "bn:", cmdLineOptions, NULL)) != -1) {
         switch (option) {
         case 'b':
             Log_Debug("Bypass Proxy\n");
             bypassProxy = true;
             break;
+        case 'n':
+            benchmarkRequestCount = (unsigned int)strtoul(optarg, NULL, 10);
+            Log_Debug("Benchmark: %u requests\n", benchmarkRequestCount);
+            break;
         default:
             // Unknown options are ignored.
             break;
@@ -490,7 +664,7 @@ int main(int argc, char *argv[])
     ParseCommandLineArguments(argc, argv);
 
     exitCode = InitHandlers();
-    if (exitCode == ExitCode_Success) {
+    if (exitCode == ExitCode_Success && benchmarkRequestCount == 0) {
         // Download the web page immediately.
         PerformWebPageDownload();
     }
@@ -0,0 +1,67 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "response_ring.h"
+
+void ResponseRing_Init(ResponseRing *ring, ResponseConsumer consumer, void *context)
+{
+    ring->start = 0;
+    ring->count = 0;
+    ring->consumedBytes = 0;
+    ring->consumer = consumer;
+    ring->context = context;
+}
+
+size_t ResponseRing_GetFreeSpace(const ResponseRing *ring)
+{
+    return RESPONSE_RING_SIZE - ring->count;
+}
+
+bool ResponseRing_Write(ResponseRing *ring, const char *data, size_t length)
+{
+    if (length > ResponseRing_GetFreeSpace(ring)) {
+        return false;
+    }
+
+    // Copy up to the end of the buffer, then the rest from its beginning.
+    size_t end = (ring->start + ring->count) % RESPONSE_RING_SIZE;
+    size_t firstLength = RESPONSE_RING_SIZE - end;
+    if (firstLength > length) {
+        firstLength = length;
+    }
+    memcpy(ring->data + end, data, firstLength);
+    memcpy(ring->data, data + firstLength, length - firstLength);
+    ring->count += length;
+
+    ResponseRing_Drain(ring);
+    return true;
+}
+
+void ResponseRing_Drain(ResponseRing *ring)
+{
+    while (ring->count > 0) {
+        // The consumer is offered the contiguous bytes up to the end of the buffer.
+        size_t length = RESPONSE_RING_SIZE - ring->start;
+        if (length > ring->count) {
+            length = ring->count;
+        }
+
+        size_t consumed = ring->consumer(ring->data + ring->start, length, ring->context);
+        if (consumed > length) {
+            consumed = length;
+        }
+        ring->start = (ring->start + consumed) % RESPONSE_RING_SIZE;
+        ring->count -= consumed;
+        ring->consumedBytes += consumed;
+        if (ring->count == 0) {
+            // Restart from the beginning so that the next data is offered in one piece.
+            ring->start = 0;
+        }
+
+        if (consumed < length) {
+            return;
+        }
+    }
+}
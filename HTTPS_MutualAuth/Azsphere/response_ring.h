@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/// <summary>
+/// Size of the ring, which bounds the memory used by a response whatever its length.
+/// </summary>
+#define RESPONSE_RING_SIZE 4096
+
+/// <summary>
+/// Applications implement a function with this signature to consume the response data as it
+/// arrives.
+/// </summary>
+/// <param name="data">The next bytes of the response.</param>
+/// <param name="length">Number of bytes available.</param>
+/// <param name="context">The context passed to <see cref="ResponseRing_Init" />.</param>
+/// <returns>The number of bytes consumed, which may be less than length: the others are offered
+/// again with the next data.</returns>
+typedef size_t (*ResponseConsumer)(const char *data, size_t length, void *context);
+
+/// <summary>
+/// Fixed-size ring buffer between the network and a <see cref="ResponseConsumer" />.
+/// </summary>
+typedef struct {
+    char data[RESPONSE_RING_SIZE];
+    /// <summary>Index of the oldest byte</summary>
+    size_t start;
+    /// <summary>Number of bytes held</summary>
+    size_t count;
+    /// <summary>Number of bytes consumed since <see cref="ResponseRing_Init" /></summary>
+    size_t consumedBytes;
+    ResponseConsumer consumer;
+    void *context;
+} ResponseRing;
+
+/// <summary>
+/// Empties the ring and sets its consumer.
+/// </summary>
+void ResponseRing_Init(ResponseRing *ring, ResponseConsumer consumer, void *context);
+
+/// <summary>
+/// Returns the number of bytes which can be written to the ring.
+/// </summary>
+size_t ResponseRing_GetFreeSpace(const ResponseRing *ring);
+
+/// <summary>
+/// Copies data to the ring, then offers it to the consumer.
+/// </summary>
+/// <returns>true if all the data fit in the ring, false if none was copied.</returns>
+bool ResponseRing_Write(ResponseRing *ring, const char *data, size_t length);
+
+/// <summary>
+/// Offers the data held in the ring to the consumer, until it is empty or the consumer stops
+/// consuming.
+/// </summary>
+void ResponseRing_Drain(ResponseRing *ring);
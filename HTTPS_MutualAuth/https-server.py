@@ -15,14 +15,24 @@ def get_ssl_context(certfile, keyfile):
 
 
 class MyHandler(http.server.SimpleHTTPRequestHandler):
+    # Keep the connections alive between requests, so that the device can reuse them.
+    # Idle connections are closed after the timeout.
+    protocol_version = "HTTP/1.1"
+    timeout = 60
+    # The headers and the body are sent separately: don't delay the body.
+    disable_nagle_algorithm = True
+
     def do_POST(self):
         content_length = int(self.headers["Content-Length"])
         post_data = self.rfile.read(content_length)
         print(post_data.decode("utf-8"))
+        self.send_response(200)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
 
 
 server_address = ('', 5000)
-httpd = http.server.HTTPServer(server_address, MyHandler)
+httpd = http.server.ThreadingHTTPServer(server_address, MyHandler)
 
 context = get_ssl_context("server-certs/server-cert.pem", "server-certs/server-key.pem")
 httpd.socket = context.wrap_socket(httpd.socket, server_side=True)
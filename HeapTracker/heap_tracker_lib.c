@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "heap_tracker_lib.h"
 
@@ -23,9 +24,12 @@ const size_t heap_threshold = 250 * 1024;
 // Heap allocated amount (in bytes). This is signed so the user can debug allocation issues.
 volatile ssize_t heap_allocated = 0;
 
-int heap_track_pointer(void *ptr, size_t size);
+int heap_track_pointer(void *ptr, size_t size, void *site);
 int heap_untrack_pointer(void *ptr);
 
+// Return address of the wrapper's caller, used to aggregate stats per call-site.
+#define CALLER_ADDRESS	__builtin_return_address(0)
+
 //////////////////////////////////////////////////////////////////////////////////
 // THREAD SAFETY
 //////////////////////////////////////////////////////////////////////////////////
@@ -48,6 +52,166 @@ void heap_track_init(void)
 #	define MUTEX_UNLOCK
 #endif
 
+//////////////////////////////////////////////////////////////////////////////////
+// EVENT LOG
+//////////////////////////////////////////////////////////////////////////////////
+/*
+*	All events are recorded in a fixed-size ring buffer while holding the mutex, and only
+*	formatted by heap_track_flush_log(). This keeps the wrappers' cost to a few stores per call,
+*	and avoids Log_Debug() re-entering the allocator while the mutex is held.
+*/
+#define HEAP_EVENT_LOG_MASK		(HEAP_EVENT_LOG_SIZE - 1)
+
+static t_heap_event event_log[HEAP_EVENT_LOG_SIZE];
+static uint32_t event_log_head = 0;		// Next write position (free-running).
+static uint32_t event_log_tail = 0;		// Next read position (free-running).
+static uint32_t event_log_dropped = 0;
+static uint32_t event_seq = 0;
+static bool above_threshold = false;
+
+// Must be called with the mutex held.
+static inline void heap_log_event(uint8_t type, void *ptr, void *aux, size_t size)
+{
+	if (event_log_head - event_log_tail == HEAP_EVENT_LOG_SIZE)
+	{
+		event_log_tail++;
+		event_log_dropped++;
+	}
+
+	t_heap_event *evt = &event_log[event_log_head & HEAP_EVENT_LOG_MASK];
+	evt->seq = event_seq++;
+	evt->size = (uint32_t)size;
+	evt->ptr = ptr;
+	evt->aux = aux;
+	evt->type = type;
+	event_log_head++;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// HEAP PROFILING
+//////////////////////////////////////////////////////////////////////////////////
+#if ENABLE_HEAP_PROFILING
+/*
+*	All the profiler's counters are updated in O(1) with the mutex held, from the pointer tracking hooks.
+*	The per-site breakdown at the time of the global peak is captured lazily: each new peak only bumps
+*	'peak_epoch', and a site saves its live bytes the first time it changes after that peak.
+*/
+typedef struct
+{
+	uint32_t alloc_count;
+	uint32_t live_count;
+	uint32_t peak_live_count;
+} t_size_class_stats;
+
+typedef struct
+{
+	size_t peak_bytes;		// Highest live bytes for the site.
+	size_t at_peak_bytes;	// Live bytes for the site, when the global peak was last reached.
+	uint32_t at_peak_epoch;
+} t_site_profile;
+
+static t_size_class_stats size_classes[HEAP_PROFILE_SIZE_CLASSES];
+static uint32_t lifetimes[HEAP_PROFILE_LIFETIME_BUCKETS];
+static t_site_profile site_profiles[HEAP_SITE_TABLE_SIZE + 1];
+static ssize_t peak_allocated = 0;
+static uint32_t peak_epoch = 0;
+static uint32_t total_allocs = 0;
+static uint32_t total_frees = 0;
+
+static inline uint64_t heap_profile_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// Returns floor(log2(value)), capped to max_index (0 for 0 and 1).
+static inline unsigned int heap_profile_log2_index(uint64_t value, unsigned int max_index)
+{
+	unsigned int index = (value > 1) ? 63u - (unsigned int)__builtin_clzll(value) : 0;
+	return index < max_index ? index : max_index;
+}
+
+// Must be called before a site's live bytes change.
+static inline void heap_profile_site_snapshot(uint16_t site, size_t live_bytes)
+{
+	if (site_profiles[site].at_peak_epoch != peak_epoch)
+	{
+		site_profiles[site].at_peak_bytes = live_bytes;
+		site_profiles[site].at_peak_epoch = peak_epoch;
+	}
+}
+
+static inline void heap_profile_on_track(uint16_t site, size_t size, size_t site_live_bytes)
+{
+	t_size_class_stats *cls = &size_classes[heap_profile_log2_index(size, HEAP_PROFILE_SIZE_CLASSES - 1)];
+	cls->alloc_count++;
+	if (++cls->live_count > cls->peak_live_count)
+	{
+		cls->peak_live_count = cls->live_count;
+	}
+
+	if (site_live_bytes > site_profiles[site].peak_bytes)
+	{
+		site_profiles[site].peak_bytes = site_live_bytes;
+	}
+	total_allocs++;
+}
+
+static inline void heap_profile_on_untrack(size_t size, uint64_t alloc_time_us)
+{
+	size_classes[heap_profile_log2_index(size, HEAP_PROFILE_SIZE_CLASSES - 1)].live_count--;
+	lifetimes[heap_profile_log2_index(heap_profile_now_us() - alloc_time_us, HEAP_PROFILE_LIFETIME_BUCKETS - 1)]++;
+	total_frees++;
+}
+
+static inline void heap_profile_update_peak(void)
+{
+	if (heap_allocated > peak_allocated)
+	{
+		peak_allocated = heap_allocated;
+		peak_epoch++;
+	}
+}
+#endif // ENABLE_HEAP_PROFILING
+
+// Must be called with the mutex held: records an event on the upwards threshold crossing only.
+static inline void heap_check_threshold(void)
+{
+#if ENABLE_HEAP_PROFILING
+	heap_profile_update_peak();
+#endif // ENABLE_HEAP_PROFILING
+
+	bool above = heap_allocated > (ssize_t)heap_threshold;
+	if (above && !above_threshold)
+	{
+		heap_log_event(HEAP_EVT_THRESHOLD_EXCEEDED, NULL, NULL, (size_t)heap_allocated);
+	}
+	above_threshold = above;
+}
+
+size_t heap_track_read_events(t_heap_event *events, size_t max_events, uint32_t *dropped)
+{
+	size_t count = 0;
+
+	MUTEX_LOCK;
+
+	while (count < max_events && event_log_tail != event_log_head)
+	{
+		events[count++] = event_log[event_log_tail & HEAP_EVENT_LOG_MASK];
+		event_log_tail++;
+	}
+	if (dropped)
+	{
+		*dropped = event_log_dropped;
+	}
+	event_log_dropped = 0;
+
+	MUTEX_UNLOCK;
+
+	return count;
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // LOGGING
 //////////////////////////////////////////////////////////////////////////////////
@@ -73,6 +237,67 @@ void log_heap_status(void)
 #endif
 }
 
+static void log_heap_event(const t_heap_event *evt)
+{
+	switch (evt->type)
+	{
+#if ENABLE_DEBUG_VERBOSE_LOGS
+	case HEAP_EVT_MALLOC:
+		HeapTracker_Log("#%u malloc(%u)=%p from %p\n", evt->seq, evt->size, evt->ptr, evt->aux);
+		break;
+	case HEAP_EVT_CALLOC:
+		HeapTracker_Log("#%u calloc(%u)=%p from %p\n", evt->seq, evt->size, evt->ptr, evt->aux);
+		break;
+	case HEAP_EVT_ALIGNED_ALLOC:
+		HeapTracker_Log("#%u aligned_alloc(%u)=%p from %p\n", evt->seq, evt->size, evt->ptr, evt->aux);
+		break;
+	case HEAP_EVT_REALLOC:
+		HeapTracker_Log("#%u realloc(%p, %u)=%p\n", evt->seq, evt->aux, evt->size, evt->ptr);
+		break;
+	case HEAP_EVT_FREE:
+		HeapTracker_Log("#%u free(%p) of %u bytes\n", evt->seq, evt->ptr, evt->size);
+		break;
+#endif
+	case HEAP_EVT_UNTRACKED_FREE:
+#if ENABLE_POINTER_TRACKING
+		HeapTracker_Log("#%u WARNING: free(%p) was called for a non-tracked pointer.\n", evt->seq, evt->ptr);
+#else
+		HeapTracker_Log("#%u WARNING! Native free(%p)/realloc() was called instead of _free()/_realloc() helpers: 'heap_allocated' will not be reliable from now on!\n", evt->seq, evt->ptr);
+#endif
+		break;
+	case HEAP_EVT_TRACK_FAILED:
+		HeapTracker_Log("#%u heap_track_pointer(%p,%u) FAILED - out of memory!!\n", evt->seq, evt->ptr, evt->size);
+		break;
+	case HEAP_EVT_THRESHOLD_EXCEEDED:
+		HeapTracker_Log("#%u WARNING: heap_allocated (%u bytes) crossed heap_threshold (%zu bytes)\n", evt->seq, evt->size, heap_threshold);
+		break;
+	default:
+		break;
+	}
+}
+
+void heap_track_flush_log(void)
+{
+	t_heap_event events[16];
+	uint32_t dropped;
+	size_t count;
+
+	// Events are copied out in small batches, so that Log_Debug() never runs under the mutex.
+	while ((count = heap_track_read_events(events, sizeof(events) / sizeof(events[0]), &dropped)) > 0)
+	{
+		if (dropped)
+		{
+			HeapTracker_Log("WARNING: %u events were dropped (HEAP_EVENT_LOG_SIZE=%d)\n", dropped, HEAP_EVENT_LOG_SIZE);
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			log_heap_event(&events[i]);
+		}
+	}
+
+	LogHeapStatus();
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // NATIVE malloc/free WRAPPERS
 //////////////////////////////////////////////////////////////////////////////////
@@ -93,23 +318,22 @@ void __real_free(void *ptr);
 // Heap-tracking malloc() wrapper
 void *__wrap_malloc(size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_malloc(size);
 
-	HeapTracker_Log("malloc(%zu)=%p... ", size, ptr);
+	MUTEX_LOCK;
+
+	heap_log_event(HEAP_EVT_MALLOC, ptr, CALLER_ADDRESS, size);
 	if (NULL != ptr)
 	{
 		heap_allocated += (ssize_t)size;
 
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_pointer(ptr, size, CALLER_ADDRESS);
 #endif // ENABLE_POINTER_TRACKING
 
+		heap_check_threshold();
 	}
 
-	LogHeapStatus();
-
 	MUTEX_UNLOCK;
 
 	return ptr;
@@ -118,21 +342,21 @@ void *__wrap_malloc(size_t size)
 // Custom heap-tracking calloc() wrapper
 void *__wrap_calloc(size_t num, size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_calloc(num, size);
 
-	HeapTracker_Log("calloc(%zu,%zu)=%p...", num, size, ptr);
+	MUTEX_LOCK;
+
+	heap_log_event(HEAP_EVT_CALLOC, ptr, CALLER_ADDRESS, num * size);
 	if (ptr)
 	{
 		heap_allocated += (ssize_t)(num * size);
 
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_pointer(ptr, num * size, CALLER_ADDRESS);
 #endif // ENABLE_POINTER_TRACKING
-	}
 
-	LogHeapStatus();
+		heap_check_threshold();
+	}
 
 	MUTEX_UNLOCK;
 
@@ -142,21 +366,21 @@ void *__wrap_calloc(size_t num, size_t size)
 // Custom heap-tracking aligned_alloc() wrapper
 void *__wrap_aligned_alloc(size_t alignment, size_t size)
 {
-	MUTEX_LOCK;
-
 	void *ptr = __real_aligned_alloc(alignment, size);
 
-	HeapTracker_Log("aligned_alloc(%zu,%zu)=%p...", alignment, size, ptr);
+	MUTEX_LOCK;
+
+	heap_log_event(HEAP_EVT_ALIGNED_ALLOC, ptr, CALLER_ADDRESS, size);
 	if (ptr)
 	{
 		heap_allocated += (ssize_t)size;
 
 #if ENABLE_POINTER_TRACKING
-		heap_track_pointer(ptr, size);
+		heap_track_pointer(ptr, size, CALLER_ADDRESS);
 #endif // ENABLE_POINTER_TRACKING
-	}
 
-	LogHeapStatus();
+		heap_check_threshold();
+	}
 
 	MUTEX_UNLOCK;
 
@@ -166,11 +390,13 @@ void *__wrap_aligned_alloc(size_t alignment, size_t size)
 // Custom heap-tracking realloc() wrapper
 void *__wrap_realloc(void *ptr, size_t new_size)
 {
+	// The native realloc() must run under the mutex, since 'ptr' may be released and
+	// handed out again to another thread before it gets untracked.
 	MUTEX_LOCK;
 
 	void *new_ptr = __real_realloc(ptr, new_size);
 
-	HeapTracker_Log("realloc(%p, %zu)=%p... ", ptr, new_size, new_ptr);
+	heap_log_event(HEAP_EVT_REALLOC, new_ptr, ptr, new_size);
 	if (NULL != new_ptr)
 	{
 		heap_allocated += (ssize_t)(new_size);
@@ -178,43 +404,46 @@ void *__wrap_realloc(void *ptr, size_t new_size)
 #if ENABLE_POINTER_TRACKING
 		if (ptr && -1 == heap_untrack_pointer(ptr))
 		{
-			HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
+			heap_log_event(HEAP_EVT_UNTRACKED_FREE, ptr, CALLER_ADDRESS, 0);
 		}
 
-		if (-1 == heap_track_pointer(new_ptr, new_size))
-		{
-			HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
-		}
+		heap_track_pointer(new_ptr, new_size, CALLER_ADDRESS);
 #else
-		HeapTracker_Log("WARNING! Native realloc(%p,%zu) was called instead of _realloc() helper: 'heap_allocated' will not be reliable from now on!\n", ptr, new_size);
+		heap_log_event(HEAP_EVT_UNTRACKED_FREE, ptr, CALLER_ADDRESS, 0);
 #endif
-	}
 
-	LogHeapStatus();
+		heap_check_threshold();
+	}
 
 	MUTEX_UNLOCK;
 
 	return new_ptr;
 }
 
-// Native free() wrapper (does NOT track heap!)
+// Native free() wrapper (only tracks the heap with ENABLE_POINTER_TRACKING)
 void __wrap_free(void *ptr)
 {
-	MUTEX_LOCK;
+	if (NULL == ptr)
+	{
+		return;
+	}
 
-	HeapTracker_Log("free(%p)... ", ptr);
+	MUTEX_LOCK;
 
 #if ENABLE_POINTER_TRACKING
-	if (ptr && -1 == heap_untrack_pointer(ptr))
+	if (-1 == heap_untrack_pointer(ptr))
+	{
+		heap_log_event(HEAP_EVT_UNTRACKED_FREE, ptr, CALLER_ADDRESS, 0);
+	}
+	else
 	{
-		HeapTracker_Log("WARNING: free(%p) was called for a non-tracked pointer.\n", ptr);
+		// re-arms the threshold event once the usage drops back below it
+		heap_check_threshold();
 	}
 #else
-	HeapTracker_Log("WARNING! Native free(%p) was called instead of _free() helper: 'heap_allocated' will not be reliable from now on!\n", ptr);
+	heap_log_event(HEAP_EVT_UNTRACKED_FREE, ptr, CALLER_ADDRESS, 0);
 #endif // ENABLE_POINTER_TRACKING
 
-	LogHeapStatus();
-
 	__real_free(ptr);
 
 	MUTEX_UNLOCK;
@@ -226,16 +455,14 @@ void _free(void *ptr, size_t size)
 {
 	MUTEX_LOCK;
 
-	HeapTracker_Log("_free(%p,%zu)... ", ptr, size);
-
 	__real_free(ptr);
 	if (ptr)
 	{
+		heap_log_event(HEAP_EVT_FREE, ptr, CALLER_ADDRESS, size);
 		heap_allocated -= (ssize_t)size;
+		heap_check_threshold();
 	}
 
-	LogHeapStatus();
-
 	MUTEX_UNLOCK;
 }
 
@@ -246,14 +473,13 @@ void *_realloc(void *ptr, size_t old_size, size_t new_size)
 
 	void *new_ptr = __real_realloc(ptr, new_size);
 
-	HeapTracker_Log("_realloc(%p,%zu,%zu)=%p... ", ptr, old_size, new_size, new_ptr);
+	heap_log_event(HEAP_EVT_REALLOC, new_ptr, ptr, new_size);
 	if (NULL != new_ptr)
 	{
 		heap_allocated += (ssize_t)(new_size - old_size + 1);
+		heap_check_threshold();
 	}
 
-	LogHeapStatus();
-
 	MUTEX_UNLOCK;
 
 	return new_ptr;
@@ -265,63 +491,344 @@ void *_realloc(void *ptr, size_t old_size, size_t new_size)
 // POINTER TRACKING
 //////////////////////////////////////////////////////////////////////////////////
 #if ENABLE_POINTER_TRACKING
+/*
+*	Pointers are stored in an open-addressing hash table (linear probing, keyed by address),
+*	so both tracking and untracking are O(1) on average. Deletions use backward-shift,
+*	so no tombstones accumulate over the App's lifetime.
+*	Each entry references its call-site slot, so per-site live stats are updated in O(1) too.
+*/
 
 typedef struct
 {
 	void *address;
 	size_t size;
+	uint16_t site;		// Index into site_stats[].
+#if ENABLE_HEAP_PROFILING
+	uint64_t alloc_time_us;
+#endif // ENABLE_HEAP_PROFILING
 } t_pointer;
 
-static t_pointer **allocated_pointers = NULL;
-static size_t allocated_pointers_size = 0;
-static unsigned int allocated_pointers_count = 0;
+static t_pointer *allocated_pointers = NULL;
+static size_t allocated_pointers_capacity = 0;	// Always a power of 2.
+static size_t allocated_pointers_count = 0;
+
+// Slot HEAP_SITE_TABLE_SIZE is the overflow bucket, for call-sites that don't fit in the table.
+#define HEAP_SITE_OVERFLOW		HEAP_SITE_TABLE_SIZE
+static t_heap_site_stats site_stats[HEAP_SITE_TABLE_SIZE + 1];
+
+static inline size_t hash_address(const void *ptr, size_t mask)
+{
+	// Fibonacci hashing: heap addresses are aligned, so the low bits are dropped first.
+	return (size_t)((((uint64_t)(uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
 
-int heap_track_pointer(void *ptr, size_t size)
+static uint16_t heap_site_lookup(void *site)
 {
-	if (NULL == allocated_pointers || allocated_pointers_size < (allocated_pointers_count * sizeof(void *)))
+	const size_t mask = HEAP_SITE_TABLE_SIZE - 1;
+	size_t idx = hash_address(site, mask);
+
+	for (size_t probes = 0; probes < HEAP_SITE_TABLE_SIZE; probes++)
 	{
-		size_t new_size = (allocated_pointers_count + POINTER_TRACK_INC) * sizeof(void *);
-		void *new_ptr = __real_realloc(allocated_pointers, new_size);
-		if (NULL == new_ptr)
+		if (site_stats[idx].site == site)
 		{
-			HeapTracker_Log("heap_track_pointer(%p,%zu) FAILED - out of memory!!", ptr, size);
-			return -1;
+			return (uint16_t)idx;
 		}
-		else
+		if (NULL == site_stats[idx].site)
 		{
-			allocated_pointers = new_ptr;
-			allocated_pointers_size = new_size;
+			site_stats[idx].site = site;
+			return (uint16_t)idx;
 		}
+		idx = (idx + 1) & mask;
 	}
 
-	allocated_pointers[allocated_pointers_count]->address = ptr;
-	allocated_pointers[allocated_pointers_count]->size = size;
+	return HEAP_SITE_OVERFLOW;
+}
+
+// Inserts without checking for growth, used both for tracking and rehashing.
+static void heap_table_insert(t_pointer *table, size_t capacity, const t_pointer *entry)
+{
+	size_t mask = capacity - 1;
+	size_t idx = hash_address(entry->address, mask);
+
+	while (NULL != table[idx].address && entry->address != table[idx].address)
+	{
+		idx = (idx + 1) & mask;
+	}
+	table[idx] = *entry;
+}
+
+static int heap_table_grow(void)
+{
+	size_t new_capacity = allocated_pointers_capacity ? allocated_pointers_capacity * 2 : POINTER_TABLE_INITIAL_SIZE;
+	t_pointer *new_table = __real_calloc(new_capacity, sizeof(t_pointer));
+	if (NULL == new_table)
+	{
+		return -1;
+	}
+
+	for (size_t i = 0; i < allocated_pointers_capacity; i++)
+	{
+		if (NULL != allocated_pointers[i].address)
+		{
+			heap_table_insert(new_table, new_capacity, &allocated_pointers[i]);
+		}
+	}
+
+	__real_free(allocated_pointers);
+	allocated_pointers = new_table;
+	allocated_pointers_capacity = new_capacity;
+
+	return 0;
+}
+
+int heap_track_pointer(void *ptr, size_t size, void *site)
+{
+	// Keep the load factor under 75%, to bound the probe sequences' length.
+	if ((allocated_pointers_count + 1) * 4 > allocated_pointers_capacity * 3 && -1 == heap_table_grow())
+	{
+		heap_log_event(HEAP_EVT_TRACK_FAILED, ptr, site, size);
+		return -1;
+	}
+
+	t_pointer entry = { .address = ptr, .size = size, .site = heap_site_lookup(site) };
+#if ENABLE_HEAP_PROFILING
+	entry.alloc_time_us = heap_profile_now_us();
+#endif // ENABLE_HEAP_PROFILING
+	heap_table_insert(allocated_pointers, allocated_pointers_capacity, &entry);
 	allocated_pointers_count++;
 
+	t_heap_site_stats *stats = &site_stats[entry.site];
+#if ENABLE_HEAP_PROFILING
+	heap_profile_site_snapshot(entry.site, stats->live_bytes);
+#endif // ENABLE_HEAP_PROFILING
+	stats->live_bytes += size;
+	stats->live_count++;
+	stats->total_count++;
+#if ENABLE_HEAP_PROFILING
+	heap_profile_on_track(entry.site, size, stats->live_bytes);
+#endif // ENABLE_HEAP_PROFILING
+
 	return 0;
 }
 
 int heap_untrack_pointer(void *ptr)
 {
-	int pos = 0;
-	t_pointer **cur = allocated_pointers;
-	while (cur && pos < allocated_pointers_count)
+	if (0 == allocated_pointers_count)
+	{
+		return -1;
+	}
+
+	size_t mask = allocated_pointers_capacity - 1;
+	size_t idx = hash_address(ptr, mask);
+
+	while (allocated_pointers[idx].address != ptr)
+	{
+		if (NULL == allocated_pointers[idx].address)
+		{
+			return -1;
+		}
+		idx = (idx + 1) & mask;
+	}
+
+	t_pointer *entry = &allocated_pointers[idx];
+	t_heap_site_stats *stats = &site_stats[entry->site];
+#if ENABLE_HEAP_PROFILING
+	heap_profile_site_snapshot(entry->site, stats->live_bytes);
+	heap_profile_on_untrack(entry->size, entry->alloc_time_us);
+#endif // ENABLE_HEAP_PROFILING
+	stats->live_bytes -= entry->size;
+	stats->live_count--;
+	heap_allocated -= (ssize_t)entry->size;
+	heap_log_event(HEAP_EVT_FREE, ptr, stats->site, entry->size);
+
+	// Backward-shift deletion: move back any following entry whose home slot is at or before the hole.
+	size_t hole = idx;
+	for (size_t next = (hole + 1) & mask; NULL != allocated_pointers[next].address; next = (next + 1) & mask)
+	{
+		size_t home = hash_address(allocated_pointers[next].address, mask);
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			allocated_pointers[hole] = allocated_pointers[next];
+			hole = next;
+		}
+	}
+	memset(&allocated_pointers[hole], 0, sizeof(t_pointer));
+	allocated_pointers_count--;
+
+	return 0;
+}
+
+size_t heap_track_get_site_stats(t_heap_site_stats *stats, size_t max_sites)
+{
+	size_t count = 0;
+
+	MUTEX_LOCK;
+
+	for (size_t i = 0; i <= HEAP_SITE_TABLE_SIZE && count < max_sites; i++)
+	{
+		if (NULL != site_stats[i].site || (HEAP_SITE_OVERFLOW == i && site_stats[i].total_count > 0))
+		{
+			stats[count++] = site_stats[i];
+		}
+	}
+
+	MUTEX_UNLOCK;
+
+	return count;
+}
+
+#if ENABLE_HEAP_PROFILING
+/*
+*	Binary dump format (all fields little-endian, addresses are 32-bit on Azure Sphere):
+*		header:			u32 magic, u16 version, u16 reserved, u32 uptime_ms,
+*						u16 # size classes, u16 # lifetime buckets, u16 # sites, u16 reserved
+*		totals:			i32 heap_allocated, u32 peak_allocated, u32 total allocs, u32 total frees, u32 live pointers
+*		size classes:	{ u32 alloc count, u32 live count, u32 peak live count } x # size classes
+*		lifetimes:		{ u32 count } x # lifetime buckets
+*		sites:			{ u32 address, u32 live bytes, u32 live count, u32 total count, u32 peak bytes, u32 bytes at global peak } x # sites
+*/
+#define HEAP_PROFILE_HEADER_SIZE	(20 + 20)
+#define HEAP_PROFILE_SITE_SIZE		24
+#define HEAP_PROFILE_MAX_SIZE		(HEAP_PROFILE_HEADER_SIZE + HEAP_PROFILE_SIZE_CLASSES * 12 + HEAP_PROFILE_LIFETIME_BUCKETS * 4 + (HEAP_SITE_TABLE_SIZE + 1) * HEAP_PROFILE_SITE_SIZE)
+
+static inline uint8_t *put_u16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	return p + 2;
+}
+
+static inline uint8_t *put_u32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+	return p + 4;
+}
+
+size_t heap_profile_serialize(uint8_t *buf, size_t buf_size)
+{
+	uint8_t *p = buf;
+	uint16_t site_count = 0;
+
+	MUTEX_LOCK;
+
+	for (size_t i = 0; i <= HEAP_SITE_TABLE_SIZE; i++)
 	{
-		if ((*cur)->address == ptr)
+		if (site_stats[i].total_count > 0)
 		{
-			heap_allocated -= (ssize_t)(allocated_pointers[pos]->size);
+			site_count++;
+		}
+	}
 
-			memcpy(allocated_pointers[pos], allocated_pointers[pos + 1], allocated_pointers_size - sizeof(t_pointer));
-			memset(allocated_pointers[allocated_pointers_count - 1], 0, sizeof(t_pointer));
-			allocated_pointers_count--;
+	size_t size = HEAP_PROFILE_HEADER_SIZE + HEAP_PROFILE_SIZE_CLASSES * 12 + HEAP_PROFILE_LIFETIME_BUCKETS * 4 + (size_t)site_count * HEAP_PROFILE_SITE_SIZE;
+	if (size > buf_size)
+	{
+		MUTEX_UNLOCK;
+		return 0;
+	}
+
+	p = put_u32(p, HEAP_PROFILE_MAGIC);
+	p = put_u16(p, HEAP_PROFILE_VERSION);
+	p = put_u16(p, 0);
+	p = put_u32(p, (uint32_t)(heap_profile_now_us() / 1000u));
+	p = put_u16(p, HEAP_PROFILE_SIZE_CLASSES);
+	p = put_u16(p, HEAP_PROFILE_LIFETIME_BUCKETS);
+	p = put_u16(p, site_count);
+	p = put_u16(p, 0);
+
+	p = put_u32(p, (uint32_t)heap_allocated);
+	p = put_u32(p, (uint32_t)peak_allocated);
+	p = put_u32(p, total_allocs);
+	p = put_u32(p, total_frees);
+	p = put_u32(p, (uint32_t)allocated_pointers_count);
+
+	for (size_t i = 0; i < HEAP_PROFILE_SIZE_CLASSES; i++)
+	{
+		p = put_u32(p, size_classes[i].alloc_count);
+		p = put_u32(p, size_classes[i].live_count);
+		p = put_u32(p, size_classes[i].peak_live_count);
+	}
 
-			return 0;
+	for (size_t i = 0; i < HEAP_PROFILE_LIFETIME_BUCKETS; i++)
+	{
+		p = put_u32(p, lifetimes[i]);
+	}
+
+	for (size_t i = 0; i <= HEAP_SITE_TABLE_SIZE; i++)
+	{
+		if (site_stats[i].total_count > 0)
+		{
+			const t_site_profile *prof = &site_profiles[i];
+			size_t at_peak = (prof->at_peak_epoch == peak_epoch) ? prof->at_peak_bytes : site_stats[i].live_bytes;
+
+			p = put_u32(p, (uint32_t)(uintptr_t)site_stats[i].site);
+			p = put_u32(p, (uint32_t)site_stats[i].live_bytes);
+			p = put_u32(p, site_stats[i].live_count);
+			p = put_u32(p, site_stats[i].total_count);
+			p = put_u32(p, (uint32_t)prof->peak_bytes);
+			p = put_u32(p, (uint32_t)at_peak);
+		}
+	}
+
+	MUTEX_UNLOCK;
+
+	return (size_t)(p - buf);
+}
+
+void heap_profile_log_dump(void)
+{
+	static const char hex[] = "0123456789abcdef";
+	const size_t bytes_per_line = 48;
+	char line[48 * 2 + 1];
+
+	// The dump buffer bypasses the wrappers, so that dumping doesn't alter the profile.
+	uint8_t *buf = __real_malloc(HEAP_PROFILE_MAX_SIZE);
+	if (NULL == buf)
+	{
+		HeapTracker_Log("heap_profile_log_dump FAILED - out of memory!!\n");
+		return;
+	}
+
+	size_t size = heap_profile_serialize(buf, HEAP_PROFILE_MAX_SIZE);
+	for (size_t offset = 0; offset < size; offset += bytes_per_line)
+	{
+		size_t count = (size - offset < bytes_per_line) ? size - offset : bytes_per_line;
+		for (size_t i = 0; i < count; i++)
+		{
+			line[i * 2] = hex[buf[offset + i] >> 4];
+			line[i * 2 + 1] = hex[buf[offset + i] & 0x0f];
 		}
+		line[count * 2] = '\0';
+		Log_Debug("HEAPPROF:%s\n", line);
+	}
+	Log_Debug("HEAPPROF:END\n");
+
+	__real_free(buf);
+}
 
-		cur++, pos++;
+void heap_profile_reset(void)
+{
+	MUTEX_LOCK;
+
+	for (size_t i = 0; i < HEAP_PROFILE_SIZE_CLASSES; i++)
+	{
+		size_classes[i].alloc_count = 0;
+		size_classes[i].peak_live_count = size_classes[i].live_count;
 	}
+	memset(lifetimes, 0, sizeof(lifetimes));
+	for (size_t i = 0; i <= HEAP_SITE_TABLE_SIZE; i++)
+	{
+		site_profiles[i].peak_bytes = site_stats[i].live_bytes;
+	}
+	peak_allocated = heap_allocated;
+	peak_epoch++;
+	total_allocs = 0;
+	total_frees = 0;
 
-	return -1;
+	MUTEX_UNLOCK;
 }
+#endif // ENABLE_HEAP_PROFILING
 
-#endif // ENABLE_POINTER_TRACKING
\ No newline at end of file
+#endif // ENABLE_POINTER_TRACKING
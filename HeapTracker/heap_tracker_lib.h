@@ -4,19 +4,61 @@
 */
 #pragma once
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 //////////////////////////////////////////////////////////////////////////////////
 // GLOBAL VARIABLES & DEFINES
 //////////////////////////////////////////////////////////////////////////////////
-#define ENABLE_DEBUG_VERBOSE_LOGS				1	// Enables(1)/Disables(0) verbose logging.
+#define ENABLE_DEBUG_VERBOSE_LOGS				1	// Enables(1)/Disables(0) verbose logging (of every recorded event, when the event log is flushed).
 #define ENABLE_THREAD_SAFETY					1	// Enables(1)/Disables(0) thread safety.
 #define ENABLE_POINTER_TRACKING                 1	// Enables(1)/Disables(0) pointer tracking.
-#define POINTER_TRACK_INC						50	// Defines the growth size (in # of elements) for the internal pointer tracking array, 
-													// once the number of allocated pointers overflows the current array size.
+#define POINTER_TABLE_INITIAL_SIZE				256	// Defines the initial capacity (in # of slots, must be a power of 2) of the internal pointer hash table,
+													// which doubles in size whenever it gets 75% full.
+#define HEAP_SITE_TABLE_SIZE					128	// Defines the max number of distinct call-sites (must be a power of 2) for which live stats are aggregated.
+													// Allocations from call-sites beyond this limit are aggregated in a single 'overflow' site (with site == NULL).
+#define HEAP_EVENT_LOG_SIZE						256	// Defines the size (in # of events, must be a power of 2) of the in-memory event ring buffer.
+													// When the ring is full, the oldest events are overwritten and counted as dropped.
+#define ENABLE_HEAP_PROFILING					0	// Enables(1)/Disables(0) the size-class, lifetime and peak-by-site profiler (requires ENABLE_POINTER_TRACKING).
+#define HEAP_PROFILE_SIZE_CLASSES				24	// Defines the # of power-of-2 size classes (class N holds sizes in [2^N, 2^(N+1)), the last one holds all larger sizes).
+#define HEAP_PROFILE_LIFETIME_BUCKETS			32	// Defines the # of power-of-2 lifetime buckets (bucket N holds lifetimes in [2^N, 2^(N+1)) microseconds).
 extern const size_t		heap_threshold;				// Sets a reference allocation threshold (in bytes) after which the library will log warnings.
 extern volatile ssize_t	heap_allocated;				// Currently allocated heap (in bytes).
 
 
+//////////////////////////////////////////////////////////////////////////////////
+// EVENT LOG & CALL-SITE STATISTICS
+//////////////////////////////////////////////////////////////////////////////////
+typedef enum
+{
+	HEAP_EVT_MALLOC = 1,
+	HEAP_EVT_CALLOC,
+	HEAP_EVT_ALIGNED_ALLOC,
+	HEAP_EVT_REALLOC,
+	HEAP_EVT_FREE,
+	HEAP_EVT_UNTRACKED_FREE,		// free()/realloc() of a pointer that is not in the tracking table.
+	HEAP_EVT_TRACK_FAILED,			// The tracking table could not grow: 'heap_allocated' is no longer reliable.
+	HEAP_EVT_THRESHOLD_EXCEEDED,	// 'heap_allocated' crossed above 'heap_threshold'.
+} t_heap_event_type;
+
+typedef struct
+{
+	uint32_t	seq;		// Monotonic event sequence number (gaps indicate dropped events).
+	uint32_t	size;		// Requested size (in bytes), or freed size for HEAP_EVT_FREE.
+	void		*ptr;		// Resulting pointer (or freed pointer).
+	void		*aux;		// Caller address for allocations, or the original pointer for HEAP_EVT_REALLOC.
+	uint8_t		type;		// One of t_heap_event_type.
+} t_heap_event;
+
+typedef struct
+{
+	void		*site;			// Return address of the allocation's caller (NULL = overflow bucket).
+	size_t		live_bytes;		// Bytes currently allocated from this site.
+	uint32_t	live_count;		// Pointers currently allocated from this site.
+	uint32_t	total_count;	// Total allocations performed from this site.
+} t_heap_site_stats;
+
+
 //////////////////////////////////////////////////////////////////////////////////
 // Heap-tracker initialization function
 //////////////////////////////////////////////////////////////////////////////////
@@ -27,6 +69,71 @@ extern volatile ssize_t	heap_allocated;				// Currently allocated heap (in bytes
 /// <param name="">none</param>
 void heap_track_init(void);
 
+/// <summary>
+///		Moves up to <paramref name="max_events"/> events out of the in-memory ring buffer, oldest first.
+///		This is the binary counterpart of heap_track_flush_log(), for consumers that persist or stream events.
+/// </summary>
+/// <param name="events">The destination array.</param>
+/// <param name="max_events">The capacity (in # of elements) of <paramref name="events"/>.</param>
+/// <param name="dropped">If not NULL, receives the number of events overwritten since the last read.</param>
+/// <returns>The number of events copied.</returns>
+size_t heap_track_read_events(t_heap_event *events, size_t max_events, uint32_t *dropped);
+
+/// <summary>
+///		Drains the event ring buffer to Log_Debug and logs the current heap status.
+///		Allocation wrappers never log synchronously: call this from the App's main loop
+///		(i.e. a periodic timer) and outside of any code path that holds allocator locks.
+/// </summary>
+/// <param name="">none</param>
+void heap_track_flush_log(void);
+
+#if ENABLE_POINTER_TRACKING
+/// <summary>
+///		Takes a snapshot of the live allocation statistics, aggregated by call-site.
+/// </summary>
+/// <param name="stats">The destination array.</param>
+/// <param name="max_sites">The capacity (in # of elements) of <paramref name="stats"/>.</param>
+/// <returns>The number of call-sites copied.</returns>
+size_t heap_track_get_site_stats(t_heap_site_stats *stats, size_t max_sites);
+#endif // ENABLE_POINTER_TRACKING
+
+#if ENABLE_HEAP_PROFILING
+#if !ENABLE_POINTER_TRACKING
+#error "ENABLE_HEAP_PROFILING requires ENABLE_POINTER_TRACKING"
+#endif
+//////////////////////////////////////////////////////////////////////////////////
+// Heap profiling functions
+//////////////////////////////////////////////////////////////////////////////////
+#define HEAP_PROFILE_MAGIC						0x46525048	// "HPRF"
+#define HEAP_PROFILE_VERSION					1
+
+/// <summary>
+///		Serializes the profiler's statistics in the compact binary format documented in the README
+///		(little-endian, to be rendered by tools/heap_profile_report.py).
+/// </summary>
+/// <param name="buf">The destination buffer.</param>
+/// <param name="buf_size">The size (in bytes) of <paramref name="buf"/>.</param>
+/// <returns>
+///		On success, the number of bytes written.
+///		If <paramref name="buf"/> is too small, it returns 0.
+/// </returns>
+size_t heap_profile_serialize(uint8_t *buf, size_t buf_size);
+
+/// <summary>
+///		Serializes the profiler's statistics and outputs them to Log_Debug as hex-encoded
+///		"HEAPPROF:" lines, so that they can be captured from the device output and rendered on the host.
+/// </summary>
+/// <param name="">none</param>
+void heap_profile_log_dump(void);
+
+/// <summary>
+///		Clears the cumulative statistics (allocation counts, lifetimes and peaks),
+///		so that a new profiling window starts from the current live heap state.
+/// </summary>
+/// <param name="">none</param>
+void heap_profile_reset(void);
+#endif // ENABLE_HEAP_PROFILING
+
 #if !ENABLE_POINTER_TRACKING
 ////////////////////////////////////////////////////////////////////////////////////
 // Heap-tracking free and realloc functions (when pointer tracking is disabled)
@@ -54,4 +161,4 @@ void _free(void *ptr, size_t size);
 ///		On failure, it returns NULL.
 /// </returns>
 void *_realloc(void *ptr, size_t old_size, size_t new_size);
-#endif // ENABLE_POINTER_TRACKING
\ No newline at end of file
+#endif // ENABLE_POINTER_TRACKING
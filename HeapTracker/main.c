@@ -14,6 +14,11 @@
 
 #include "heap_tracker_lib.h"
 
+#define RUN_BENCHMARK   0   // Runs(1) the malloc/free throughput benchmark instead of the heap consumption sample.
+
+// Native allocator entry points (bypassing the Heap-Tracker wrappers), used as the benchmark baseline.
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
 
 size_t consumeHeap_malloc(void)
 {
@@ -95,6 +100,70 @@ size_t consumeHeap_realloc(void)
     return allocated;
 }
 
+#if ENABLE_POINTER_TRACKING
+static void logSiteStats(void)
+{
+    t_heap_site_stats stats[16];
+    size_t count = heap_track_get_site_stats(stats, sizeof(stats) / sizeof(stats[0]));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Log_Debug("Site %p: live %zu bytes in %u pointers (%u allocations in total)\n", stats[i].site, stats[i].live_bytes, stats[i].live_count, stats[i].total_count);
+    }
+}
+#endif // ENABLE_POINTER_TRACKING
+
+static double elapsedSeconds(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Measures malloc/free pairs per second, with a working set of 'live_count' pointers
+// kept allocated, so that the tracking table is exercised beyond the trivial empty case.
+static void benchmarkMallocFree(size_t live_count, size_t iterations)
+{
+    void **live = __real_malloc(live_count * sizeof(void *));
+    struct timespec start, end;
+    double tracked_s, native_s;
+
+    assert(live != NULL);
+
+    // Tracking on
+    for (size_t i = 0; i < live_count; i++)
+        live[i] = malloc(16 + (i & 255));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        size_t slot = i % live_count;
+        free(live[slot]);
+        live[slot] = malloc(16 + (i & 255));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    tracked_s = elapsedSeconds(&start, &end);
+    for (size_t i = 0; i < live_count; i++)
+        free(live[i]);
+
+    // Tracking off
+    for (size_t i = 0; i < live_count; i++)
+        live[i] = __real_malloc(16 + (i & 255));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        size_t slot = i % live_count;
+        __real_free(live[slot]);
+        live[slot] = __real_malloc(16 + (i & 255));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    native_s = elapsedSeconds(&start, &end);
+    for (size_t i = 0; i < live_count; i++)
+        __real_free(live[i]);
+
+    __real_free(live);
+
+    Log_Debug("benchmarkMallocFree --> %zu live pointers: tracked %.0f pairs/s, native %.0f pairs/s (%.2fx overhead)\n",
+        live_count, iterations / tracked_s, iterations / native_s, tracked_s / native_s);
+}
+
 int main(void)
 {
     Log_Debug("Starting Heap Tracker test application...\n");
@@ -104,11 +173,22 @@ int main(void)
     heap_track_init();
     while (true) {
 
-#if (0)
+#if RUN_BENCHMARK
+        benchmarkMallocFree(10, 100000);
+        benchmarkMallocFree(1000, 100000);
+        benchmarkMallocFree(10000, 100000);
+#elif (0)
         consumeHeap_malloc();
 #else
         consumeHeap_realloc();
 #endif
+        heap_track_flush_log();
+#if ENABLE_POINTER_TRACKING
+        logSiteStats();
+#endif // ENABLE_POINTER_TRACKING
+#if ENABLE_HEAP_PROFILING
+        heap_profile_log_dump();
+#endif // ENABLE_HEAP_PROFILING
         nanosleep(&sleepTime, NULL);
     }
 
@@ -0,0 +1,193 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+#!/usr/bin/env python3
+# encoding: utf-8
+#
+# Renders the binary heap profiles produced by heap_profile_serialize() / heap_profile_log_dump()
+# in heap_tracker_lib.c. The input can either be a raw binary dump, or a captured device log
+# containing "HEAPPROF:" lines (in which case every dump found in the log is rendered).
+#
+# Usage: python3 heap_profile_report.py <dump.bin | device.log> [--elf app.out] [--addr2line <path>] [--last]
+
+import argparse
+import struct
+import subprocess
+import sys
+
+HEAP_PROFILE_MAGIC = 0x46525048
+HEAP_PROFILE_VERSION = 1
+BAR_WIDTH = 40
+
+
+def parse_profile(data):
+    magic, version, _, uptime_ms, n_classes, n_lifetimes, n_sites, _ = struct.unpack_from("<IHHIHHHH", data, 0)
+    if magic != HEAP_PROFILE_MAGIC:
+        raise ValueError("not a heap profile (bad magic 0x%08x)" % magic)
+    if version != HEAP_PROFILE_VERSION:
+        raise ValueError("unsupported heap profile version %d" % version)
+    offset = 20
+
+    allocated, peak, total_allocs, total_frees, live_pointers = struct.unpack_from("<iIIII", data, offset)
+    offset += 20
+
+    size_classes = []
+    for i in range(n_classes):
+        size_classes.append(struct.unpack_from("<III", data, offset))
+        offset += 12
+
+    lifetimes = list(struct.unpack_from("<%dI" % n_lifetimes, data, offset))
+    offset += 4 * n_lifetimes
+
+    sites = []
+    for i in range(n_sites):
+        address, live_bytes, live_count, total_count, peak_bytes, at_peak_bytes = struct.unpack_from("<IIIIII", data, offset)
+        sites.append({"address": address, "live_bytes": live_bytes, "live_count": live_count,
+                      "total_count": total_count, "peak_bytes": peak_bytes, "at_peak_bytes": at_peak_bytes})
+        offset += 24
+
+    return {"uptime_ms": uptime_ms, "allocated": allocated, "peak": peak, "total_allocs": total_allocs,
+            "total_frees": total_frees, "live_pointers": live_pointers, "size_classes": size_classes,
+            "lifetimes": lifetimes, "sites": sites}
+
+
+def read_dumps(path):
+    with open(path, "rb") as f:
+        raw = f.read()
+
+    if raw[:4] == struct.pack("<I", HEAP_PROFILE_MAGIC):
+        return [raw]
+
+    # Device log: collect the hex payload of each HEAPPROF: ... HEAPPROF:END sequence.
+    dumps, current = [], ""
+    for line in raw.decode("utf-8", errors="replace").splitlines():
+        idx = line.find("HEAPPROF:")
+        if idx < 0:
+            continue
+        payload = line[idx + len("HEAPPROF:"):].strip()
+        if payload == "END":
+            if current:
+                dumps.append(bytes.fromhex(current))
+            current = ""
+        else:
+            current += payload
+    return dumps
+
+
+def size_class_label(index, count):
+    low = 0 if index == 0 else 1 << index
+    if index == count - 1:
+        return ">= %s" % human_bytes(low)
+    return "%s..%s" % (human_bytes(low), human_bytes((1 << (index + 1)) - 1))
+
+
+def lifetime_label(index, count):
+    low = 0 if index == 0 else 1 << index
+    if index == count - 1:
+        return ">= %s" % human_time_us(low)
+    return "< %s" % human_time_us(1 << (index + 1))
+
+
+def human_bytes(value):
+    for unit in ("B", "KB", "MB"):
+        if value < 1024:
+            return "%d%s" % (value, unit)
+        value //= 1024
+    return "%dGB" % value
+
+
+def human_time_us(value):
+    if value < 1000:
+        return "%dus" % value
+    if value < 1000000:
+        return "%.1fms" % (value / 1000.0)
+    return "%.1fs" % (value / 1000000.0)
+
+
+def bar(value, maximum):
+    if maximum == 0:
+        return ""
+    return "#" * max(1 if value else 0, int(round(value * BAR_WIDTH / maximum)))
+
+
+class SymbolResolver:
+    def __init__(self, elf, addr2line):
+        self.elf = elf
+        self.addr2line = addr2line
+        self.cache = {}
+
+    def resolve(self, address):
+        if address == 0:
+            return "<overflow: HEAP_SITE_TABLE_SIZE exceeded>"
+        if not self.elf:
+            return ""
+        if address not in self.cache:
+            try:
+                out = subprocess.run([self.addr2line, "-f", "-C", "-e", self.elf, hex(address)],
+                                     capture_output=True, check=True).stdout.decode("utf-8").split("\n")
+                self.cache[address] = "%s (%s)" % (out[0], out[1]) if len(out) > 1 else out[0]
+            except (OSError, subprocess.CalledProcessError):
+                self.cache[address] = ""
+        return self.cache[address]
+
+
+def render(profile, resolver):
+    print("=== Heap profile at uptime %.1fs ===" % (profile["uptime_ms"] / 1000.0))
+    print("heap_allocated: %d bytes, peak: %d bytes" % (profile["allocated"], profile["peak"]))
+    print("allocations: %d, frees: %d, live pointers: %d" % (profile["total_allocs"], profile["total_frees"], profile["live_pointers"]))
+
+    print("\n--- Size classes ---")
+    print("%-14s %10s %8s %10s" % ("size", "allocs", "live", "peak live"))
+    classes = profile["size_classes"]
+    max_allocs = max([c[0] for c in classes] + [0])
+    for i, (allocs, live, peak_live) in enumerate(classes):
+        if allocs or live:
+            print("%-14s %10d %8d %10d %s" % (size_class_label(i, len(classes)), allocs, live, peak_live, bar(allocs, max_allocs)))
+
+    print("\n--- Allocation lifetimes (freed allocations) ---")
+    lifetimes = profile["lifetimes"]
+    total = sum(lifetimes)
+    cumulative = 0
+    for i, count in enumerate(lifetimes):
+        if count:
+            cumulative += count
+            print("%-10s %10d %6.1f%% %s" % (lifetime_label(i, len(lifetimes)), count, 100.0 * cumulative / total, bar(count, max(lifetimes))))
+
+    print("\n--- Call-sites by peak live bytes ---")
+    print("%-10s %10s %10s %10s %8s %10s  %s" % ("site", "peak", "at peak", "live", "live #", "allocs", "symbol"))
+    for site in sorted(profile["sites"], key=lambda s: s["peak_bytes"], reverse=True):
+        print("0x%08x %10d %10d %10d %8d %10d  %s" % (site["address"], site["peak_bytes"], site["at_peak_bytes"], site["live_bytes"],
+                                                    site["live_count"], site["total_count"], resolver.resolve(site["address"])))
+
+    # Pool/arena candidates: small size classes with a lot of churn compared to their peak live count.
+    candidates = [(i, c) for i, c in enumerate(classes) if c[2] and c[0] >= 100 * c[2] and i < 12]
+    if candidates:
+        print("\n--- Pool allocator candidates (allocs >= 100x peak live) ---")
+        for i, (allocs, live, peak_live) in candidates:
+            print("%-14s %d allocations, at most %d live: a %d-slot pool would serve all of them" % (size_class_label(i, len(classes)), allocs, peak_live, peak_live))
+    print("")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render HeapTracker heap profiles.")
+    parser.add_argument("input", help="binary dump, or device log containing HEAPPROF: lines")
+    parser.add_argument("--elf", help="the App's ELF image (i.e. out/ARM-Debug/HeapTracker.out), to resolve call-sites")
+    parser.add_argument("--addr2line", default="arm-poky-linux-musleabi-addr2line", help="addr2line executable for the App's toolchain")
+    parser.add_argument("--last", action="store_true", help="only render the last dump found in the input")
+    args = parser.parse_args()
+
+    dumps = read_dumps(args.input)
+    if not dumps:
+        print("No heap profile found in %s" % args.input)
+        return 1
+    if args.last:
+        dumps = dumps[-1:]
+
+    resolver = SymbolResolver(args.elf, args.addr2line)
+    for dump in dumps:
+        render(parse_profile(dump), resolver)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
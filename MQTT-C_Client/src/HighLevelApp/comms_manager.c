@@ -10,8 +10,15 @@
 #define RECEIVE_BUFFER_SIZE 512
 #define BILLION 1000000000
 
+/* Outbound publish queue, holds the messages the MQTT-C send buffer can't take yet. */
+#define PUBLISH_QUEUE_SIZE 2048
+#define PUBLISH_QOS MQTT_PUBLISH_QOS_0
+/* Max publishes handed to MQTT-C and not complete yet (unsent, or QoS1 awaiting PUBACK). */
+#define PUBLISH_MAX_INFLIGHT 4
+
 static void mqtt_ping_handler(EventLoopTimer* eventLoopTimer);
 static void mqtt_reconnect_handler(EventLoopTimer* eventLoopTimer);
+static void publish_flush_handler(EventLoopTimer* eventLoopTimer);
 static void mqtt_set_subscriptions(void);
 static void reconnect_client(struct mqtt_client* client, void** reconnect_state_vptr);
 
@@ -43,9 +50,18 @@ struct reconnect_state_t reconnect_state;
 uint8_t sendbuf[SEND_BUFFER_SIZE];
 uint8_t recvbuf[RECEIVE_BUFFER_SIZE];
 
+static MQTT_PUBLISH_QUEUE publish_queue;
+static uint8_t publish_queue_buffer[PUBLISH_QUEUE_SIZE];
+static bool publish_flush_pending = false;
+
+/* Zero-copy publish of large messages, written from the caller's memory (not the send buffer). */
+static MQTT_SG_PUBLISHER sg_publisher;
+static EventLoop_IoEvents socket_events = EventLoop_Input;
+
 // When .period is {0,0} then the timer is a oneshot timer
 DX_TIMER_BINDING mqtt_reconnect_timer = { .period = {0, 0}, .name = "mqtt_reconnect_timer", .handler = mqtt_reconnect_handler };
 DX_TIMER_BINDING mqtt_ping_timer = { .period = {30, 0}, .name = "mqtt_ping_timer", .handler = mqtt_ping_handler };
+DX_TIMER_BINDING publish_flush_timer = { .period = {0, 0}, .name = "publish_flush_timer", .handler = publish_flush_handler };
 
 bool is_mqtt_connected(void) {
 	return mqtt_connected;
@@ -61,16 +77,103 @@ static void mqtt_ping_handler(EventLoopTimer* eventLoopTimer){
 	}
 }
 
-void publish_message(const void* data, size_t data_length, const char* topic) {
-	if (strlen(topic) == 0 || !dx_isNetworkReady()) { return; }
+/// <summary>
+/// Arm the publish flush timer to fire on the next event loop turn, so the messages published
+/// during one turn are sent with a single mqtt_sync.
+/// </summary>
+static void schedule_publish_flush(void) {
+	if (!publish_flush_pending) {
+		dx_timerOneShotSet(&publish_flush_timer, &(struct timespec) { 0, 1 });
+		publish_flush_pending = true;
+	}
+}
+
+/// <summary>
+/// Also wait for the socket to be writable while a scatter-gather publish is pending, so it is
+/// resumed as soon as the socket can take more. While part of its packet is written, received
+/// packets are left in the socket, so only wait for it to be writable.
+/// </summary>
+static void update_socket_events(void) {
+	EventLoop_IoEvents events = EventLoop_Input;
+
+	if (mqtt_sg_writing(&sg_publisher)) {
+		events = EventLoop_Output;
+	} else if (mqtt_sg_pending(&sg_publisher)) {
+		events = EventLoop_Input | EventLoop_Output;
+	}
+
+	if (mqtt_socket_registration != NULL && events != socket_events) {
+		if (EventLoop_ModifyIoEvents(dx_timerGetEventLoop(), mqtt_socket_registration, events) != 0) {
+			Log_Debug("ERROR: EventLoop_ModifyIoEvents: %d (%s)\n", errno, strerror(errno));
+			return;
+		}
+		socket_events = events;
+	}
+}
+
+/// <summary>
+/// Hand the queued messages to MQTT-C and sync once (this also processes received packets).
+/// If PUBACKs received during the sync opened the in-flight window, flush again on the next turn.
+/// MQTT-C must not write while a scatter-gather publish is part way through its packet, so the
+/// queue waits until it is complete.
+/// </summary>
+static void flush_publish_queue(void) {
+	if (mqtt_sg_pending(&sg_publisher)) {
+		mqtt_sg_sync(&sg_publisher);
+	}
+
+	if (!mqtt_sg_pending(&sg_publisher)) {
+		mqtt_pq_flush(&publish_queue);
+
+		if (mqtt_pq_can_publish(&publish_queue)) {
+			schedule_publish_flush();
+		}
+	}
+
+	update_socket_events();
+}
+
+static void publish_flush_handler(EventLoopTimer* eventLoopTimer) {
+	if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+		dx_terminate(DX_ExitCode_ConsumeEventLoopTimeEvent);
+		return;
+	}
+
+	publish_flush_pending = false;
+	if (dx_isNetworkReady()) {
+		flush_publish_queue();
+	}
+}
 
-	mqtt_mq_clean(&client.mq);
+MQTT_PQ_RESULT publish_message(const void* data, size_t data_length, const char* topic) {
+	MQTT_PQ_RESULT result = mqtt_pq_enqueue(&publish_queue, topic, data, data_length);
 
-	if (client.mq.curr_sz >= data_length) {
-		mqtt_publish(&client, topic, data, data_length, MQTT_PUBLISH_QOS_0);
+	/* while disconnected, messages stay queued until the connection is re-established */
+	if (result >= 0 && mqtt_connected) {
+		schedule_publish_flush();
 	}
 
-	mqtt_sync(&client);
+	return result;
+}
+
+MQTT_SG_RESULT publish_message_fragments(const MQTT_SG_FRAGMENT* fragments, size_t fragment_count, const char* topic,
+	MQTT_SG_CALLBACK complete, void* context) {
+	if (!mqtt_connected) {
+		return MQTT_SG_NOT_CONNECTED;
+	}
+
+	MQTT_SG_RESULT result = mqtt_sg_publish(&sg_publisher, topic, fragments, fragment_count, MQTT_PUBLISH_QOS_0,
+		complete, context);
+	if (result == MQTT_SG_OK) {
+		schedule_publish_flush();
+	}
+
+	return result;
+}
+
+void log_publish_queue_stats(void) {
+	mqtt_pq_log_stats(&publish_queue);
+	mqtt_sg_log_stats(&sg_publisher);
 }
 
 /// <summary>
@@ -93,7 +196,7 @@ static void mqtt_reconnect_handler(EventLoopTimer* eventLoopTimer) {
 }
 
 static void msg_handler(EventLoop* el, int fd, EventLoop_IoEvents events, void* context) {
-	mqtt_sync(&client);
+	flush_publish_queue();
 }
 
 static char* get_absolute_storage_path(const char* file, const char* name) {
@@ -129,6 +232,8 @@ static WOLFSSL* open_nb_socket(const char* addr, const char* port) {
 	}
 	if (mqtt_socket_registration != NULL) {
 		EventLoop_UnregisterIo(dx_timerGetEventLoop(), mqtt_socket_registration);
+		mqtt_socket_registration = NULL;
+		socket_events = EventLoop_Input;
 	}
 	if (sockfd != -1) {
 
@@ -288,6 +393,9 @@ static void reconnect_client(struct mqtt_client* client, void** reconnect_state_
 		);
 	}
 
+	/* the rest of a partly written packet must not be sent on the new connection */
+	mqtt_sg_abort(&sg_publisher);
+
 	/* Open a new socket. */
 	WOLFSSL* ssl = open_nb_socket(reconnect_state->hostname, reconnect_state->port);
 	if (ssl == NULL) {
@@ -323,6 +431,11 @@ static void mqtt_set_subscriptions(void) {
 
 		mqtt_connected = true;
 		_mqtt_connected_cb();
+
+		/* publish the messages queued while disconnected */
+		if (mqtt_pq_depth(&publish_queue) > 0) {
+			schedule_publish_flush();
+		}
 	}
 }
 
@@ -345,9 +458,12 @@ void initialize_mqtt(void (*publish_callback)(void** unused, struct mqtt_respons
 	reconnect_state.recvbufsz = sizeof(recvbuf);
 
 	mqtt_init_reconnect(&client, reconnect_client, &reconnect_state, publish_callback);
+	mqtt_pq_init(&publish_queue, &client, publish_queue_buffer, sizeof(publish_queue_buffer), PUBLISH_QOS, PUBLISH_MAX_INFLIGHT);
+	mqtt_sg_init(&sg_publisher, &client);
 
 	dx_timerStart(&mqtt_reconnect_timer);
 	dx_timerStart(&mqtt_ping_timer);
+	dx_timerStart(&publish_flush_timer);
 
 	reconnect_client(&client, &client.reconnect_state);
 }
\ No newline at end of file
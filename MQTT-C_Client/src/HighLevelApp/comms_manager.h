@@ -8,16 +8,27 @@
 #include "dx_timer.h"
 #include "dx_utilities.h"
 #include "mqtt.h"
+#include "mqtt_publish_queue.h"
+#include "mqtt_sg_publish.h"
 #include <applibs/log.h>
 #include <applibs/storage.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/select.h>
 #include <wolfssl/ssl.h>
 
 void initialize_mqtt(void (*publish_callback)(void** unused, struct mqtt_response_publish* published), void (*mqtt_connected_cb)(void),
 	const char** sub_topics, size_t sub_topic_count);
-void publish_message(const void* data, size_t data_length, const char* topic);
+/* Queues a message, it's published on the next event loop turn (or after reconnecting).
+   Returns MQTT_PQ_QUEUED_HIGH_WATER when the caller should slow down, < 0 if the message was dropped. */
+MQTT_PQ_RESULT publish_message(const void* data, size_t data_length, const char* topic);
+/* Publishes a QoS 0 message made of 'fragments' without copying it to the MQTT-C send buffer, so it can
+   be larger than SEND_BUFFER_SIZE. The fragments must stay valid until 'complete' is called. One at a
+   time: returns MQTT_SG_BUSY while the previous one is pending. See mqtt_sg_publish.h. */
+MQTT_SG_RESULT publish_message_fragments(const MQTT_SG_FRAGMENT* fragments, size_t fragment_count, const char* topic,
+	MQTT_SG_CALLBACK complete, void* context);
+void log_publish_queue_stats(void);
 bool is_mqtt_connected(void);
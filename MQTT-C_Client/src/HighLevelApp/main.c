@@ -34,7 +34,18 @@ static void publish_message_timer_handler(EventLoopTimer *eventLoopTimer)
         return;
     }
     if (is_mqtt_connected()) {
-        publish_message(mqtt_msg.message, mqtt_msg.message_length, pub_topic);
+        MQTT_PQ_RESULT result = publish_message(mqtt_msg.message, mqtt_msg.message_length, pub_topic);
+        if (result < 0) {
+            Log_Debug("WARNING: message dropped (%d)\n", result);
+        } else if (result == MQTT_PQ_QUEUED_HIGH_WATER) {
+            Log_Debug("WARNING: publish queue is above its high-water mark\n");
+        }
+    }
+
+    // log the publish queue counters once a minute
+    static unsigned int tick_count = 0;
+    if (++tick_count % 60 == 0) {
+        log_publish_queue_stats();
     }
 }
 
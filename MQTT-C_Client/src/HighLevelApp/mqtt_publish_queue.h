@@ -0,0 +1,104 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt.h"
+
+// Bounded outbound queue in front of MQTT-C.
+//
+// MQTT-C only has the client send buffer: when it is full, mqtt_publish fails and puts the client
+// in an error state (which forces a reconnect). The publish queue holds the messages the send buffer
+// can't take yet, hands them to MQTT-C as space (and the in-flight window) allows, and tells the
+// caller when it should slow down (backpressure) or when a message had to be dropped.
+//
+// All functions must be called from the event loop thread.
+
+typedef enum {
+    MQTT_PQ_QUEUED = 0,               // message queued
+    MQTT_PQ_QUEUED_HIGH_WATER = 1,    // message queued, but the queue is above its high-water mark: slow down
+    MQTT_PQ_DROPPED_FULL = -1,        // queue full, message dropped
+    MQTT_PQ_DROPPED_TOO_LARGE = -2,   // message can never fit in the MQTT-C send buffer, message dropped
+    MQTT_PQ_DROPPED_INVALID = -3      // null or empty topic, message dropped
+} MQTT_PQ_RESULT;
+
+typedef struct {
+    uint32_t enqueued;             // messages accepted by mqtt_pq_enqueue
+    uint32_t published;            // messages handed to mqtt_publish
+    uint32_t dropped_full;
+    uint32_t dropped_too_large;
+    uint32_t high_water_events;    // enqueues that returned MQTT_PQ_QUEUED_HIGH_WATER
+    uint32_t window_stalls;        // flushes stopped by the in-flight window
+    uint32_t buffer_stalls;        // flushes stopped by a full MQTT-C send buffer
+    uint32_t syncs;                // mqtt_sync calls made by mqtt_pq_flush
+    uint32_t max_depth;            // max number of messages queued
+    uint32_t max_inflight;         // max number of publishes in the MQTT-C queue (unsent or awaiting ack)
+    uint32_t max_delay_ms;         // max time between enqueue and mqtt_publish
+    uint64_t total_delay_ms;       // sum of enqueue to mqtt_publish times, divide by 'published' for the mean
+} MQTT_PQ_STATS;
+
+typedef struct {
+    struct mqtt_client *client;
+    uint8_t *buf;
+    size_t bufsz;
+    size_t head;          // offset of the oldest message
+    size_t tail;          // offset where the next message is written
+    size_t used;          // bytes in use, including the space skipped when a message wraps
+    size_t count;         // number of queued messages
+    size_t high_water;    // bytes
+    size_t max_inflight;
+    uint8_t publish_flags;
+    MQTT_PQ_STATS stats;
+} MQTT_PUBLISH_QUEUE;
+
+/// <summary>
+///     Initializes a publish queue for 'client', using 'buf' to hold the queued messages (topic and
+///     payload are copied). 'publish_flags' are the MQTT-C publish flags (i.e. MQTT_PUBLISH_QOS_1),
+///     'max_inflight' is the max number of publishes handed to MQTT-C that are not complete yet (unsent,
+///     or QoS1 messages awaiting their PUBACK). The high-water mark is 3/4 of 'bufsz'.
+/// </summary>
+void mqtt_pq_init(MQTT_PUBLISH_QUEUE *pq, struct mqtt_client *client, uint8_t *buf, size_t bufsz,
+                  uint8_t publish_flags, size_t max_inflight);
+
+/// <summary>
+///     Queues a message. The message isn't sent until mqtt_pq_flush is called, so a burst of messages
+///     published from one event loop turn is written to the socket with a single mqtt_sync.
+/// </summary>
+MQTT_PQ_RESULT mqtt_pq_enqueue(MQTT_PUBLISH_QUEUE *pq, const char *topic, const void *data, size_t data_length);
+
+/// <summary>
+///     Hands as many queued messages to MQTT-C as the in-flight window and the MQTT-C send buffer allow,
+///     then calls mqtt_sync once (which also processes the PUBACKs received, opening the window).
+///     Call it instead of mqtt_sync (i.e. when the socket is readable).
+///     Nothing is published while the client is in an error state (i.e. disconnected): messages stay
+///     queued until the connection is re-established, mqtt_sync is still called to drive the reconnect.
+///     Returns the number of messages handed to MQTT-C.
+/// </summary>
+size_t mqtt_pq_flush(MQTT_PUBLISH_QUEUE *pq);
+
+/// <summary>
+///     Returns true if queued messages could be handed to MQTT-C now (connected, and the in-flight
+///     window is open). The window is opened by PUBACKs processed by the mqtt_sync at the end of
+///     mqtt_pq_flush, so check this after a flush and schedule another one (i.e. on the next event
+///     loop turn) when it returns true.
+/// </summary>
+bool mqtt_pq_can_publish(const MQTT_PUBLISH_QUEUE *pq);
+
+/// <summary>
+///     Number of queued messages (not yet handed to MQTT-C).
+/// </summary>
+size_t mqtt_pq_depth(const MQTT_PUBLISH_QUEUE *pq);
+
+/// <summary>
+///     Number of publishes in the MQTT-C queue that are not complete yet.
+/// </summary>
+size_t mqtt_pq_inflight(const MQTT_PUBLISH_QUEUE *pq);
+
+/// <summary>
+///     Logs the queue counters.
+/// </summary>
+void mqtt_pq_log_stats(const MQTT_PUBLISH_QUEUE *pq);
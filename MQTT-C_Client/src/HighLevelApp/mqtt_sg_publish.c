@@ -0,0 +1,232 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <limits.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "mqtt_sg_publish.h"
+
+// Largest value the MQTT remaining length field can encode.
+#define MQTT_MAX_REMAINING_LENGTH 268435455u
+
+/// <summary>
+///     Returns true if MQTT-C has queued packets it hasn't (completely) written yet.
+/// </summary>
+static bool mq_has_unsent(struct mqtt_client *client)
+{
+    for (ssize_t i = 0; i < mqtt_mq_length(&client->mq); i++) {
+        if (mqtt_mq_get(&client->mq, i)->state == MQTT_QUEUED_UNSENT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Writes up to 'length' bytes. Returns the number of bytes written (0 if the socket would block),
+///     or a negative MQTTErrors value.
+/// </summary>
+static ssize_t write_part(struct mqtt_client *client, const uint8_t *data, size_t length)
+{
+#if defined(MQTT_USE_WOLFSSL)
+    // wolfSSL encrypts straight from 'data', in records of up to 16 KB. When it returns WANT_WRITE it
+    // has kept the records it couldn't send, and must be called again with the same buffer: the part
+    // is resumed from the same offset, so it is.
+    int n = wolfSSL_write(client->socketfd, data, length > INT_MAX ? INT_MAX : (int)length);
+    if (n > 0) {
+        return n;
+    }
+    int error = wolfSSL_get_error(client->socketfd, n);
+    if (error == WOLFSSL_ERROR_WANT_WRITE || error == WOLFSSL_ERROR_WANT_READ) {
+        return 0;
+    }
+    return MQTT_ERROR_SOCKET_ERROR;
+#else
+    return mqtt_pal_sendall(client->socketfd, data, length, 0);
+#endif
+}
+
+static void finish(MQTT_SG_PUBLISHER *sg, MQTT_SG_RESULT result)
+{
+    MQTT_SG_CALLBACK complete = sg->complete;
+    void *context = sg->context;
+
+    sg->state = MQTT_SG_IDLE;
+    sg->complete = NULL;
+    sg->context = NULL;
+
+    if (result == MQTT_SG_OK) {
+        sg->stats.published++;
+    } else {
+        sg->stats.aborted++;
+    }
+
+    // called last, so the callback can start the next publish.
+    if (complete != NULL) {
+        complete(context, result);
+    }
+}
+
+/// <summary>
+///     Writes the parts of the pending packet until it's complete or the socket would block.
+///     Returns true when the packet is complete.
+/// </summary>
+static bool write_parts(MQTT_SG_PUBLISHER *sg)
+{
+    struct mqtt_client *client = sg->client;
+
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    while (sg->part_index < sg->part_count) {
+        const MQTT_SG_FRAGMENT *part = &sg->parts[sg->part_index];
+        ssize_t n = write_part(client, (const uint8_t *)part->data + sg->part_offset,
+                               part->length - sg->part_offset);
+        if (n < 0) {
+            // the peer can't resynchronize in the middle of a packet: drop the connection.
+            client->error = (enum MQTTErrors)n;
+            MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+            finish(sg, MQTT_SG_ABORTED);
+            return false;
+        }
+
+        sg->part_offset += (size_t)n;
+        sg->stats.bytes += (uint64_t)n;
+        if (sg->part_offset < part->length) {
+            sg->stats.would_block++;
+            MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+            return false;
+        }
+
+        sg->part_index++;
+        sg->part_offset = 0;
+    }
+    // the packet counts for the keep alive, as if MQTT-C sent it.
+    client->time_of_last_send = MQTT_PAL_TIME();
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+
+    finish(sg, MQTT_SG_OK);
+    return true;
+}
+
+void mqtt_sg_init(MQTT_SG_PUBLISHER *sg, struct mqtt_client *client)
+{
+    memset(sg, 0, sizeof(*sg));
+    sg->client = client;
+    sg->state = MQTT_SG_IDLE;
+}
+
+MQTT_SG_RESULT mqtt_sg_publish(MQTT_SG_PUBLISHER *sg, const char *topic, const MQTT_SG_FRAGMENT *fragments,
+                               size_t fragment_count, uint8_t publish_flags, MQTT_SG_CALLBACK complete,
+                               void *context)
+{
+    if (sg->state != MQTT_SG_IDLE) {
+        sg->stats.busy++;
+        return MQTT_SG_BUSY;
+    }
+
+    if (topic == NULL || topic[0] == '\0' || fragment_count > MQTT_SG_MAX_FRAGMENTS ||
+        (publish_flags & ~MQTT_PUBLISH_RETAIN) != 0) {
+        return MQTT_SG_INVALID;
+    }
+
+    size_t topic_length = strlen(topic);
+    size_t remaining = 2 + topic_length;
+    for (size_t i = 0; i < fragment_count; i++) {
+        if (fragments[i].data == NULL && fragments[i].length > 0) {
+            return MQTT_SG_INVALID;
+        }
+        remaining += fragments[i].length;
+    }
+    if (topic_length > UINT16_MAX || remaining > MQTT_MAX_REMAINING_LENGTH) {
+        return MQTT_SG_INVALID;
+    }
+
+    if (sg->client->error != MQTT_OK) {
+        return MQTT_SG_NOT_CONNECTED;
+    }
+
+    // fixed header, remaining length, topic length
+    size_t header_length = 0;
+    sg->header[header_length++] = (uint8_t)((MQTT_CONTROL_PUBLISH << 4) | publish_flags);
+    size_t r = remaining;
+    do {
+        uint8_t b = r % 128;
+        r /= 128;
+        sg->header[header_length++] = r > 0 ? (uint8_t)(b | 0x80) : b;
+    } while (r > 0);
+    sg->header[header_length++] = (uint8_t)(topic_length >> 8);
+    sg->header[header_length++] = (uint8_t)(topic_length & 0xFF);
+
+    sg->part_count = 0;
+    if (header_length + topic_length <= sizeof(sg->header)) {
+        memcpy(sg->header + header_length, topic, topic_length);
+        sg->parts[sg->part_count++] = (MQTT_SG_FRAGMENT){sg->header, header_length + topic_length};
+    } else {
+        sg->parts[sg->part_count++] = (MQTT_SG_FRAGMENT){sg->header, header_length};
+        sg->parts[sg->part_count++] = (MQTT_SG_FRAGMENT){topic, topic_length};
+    }
+    for (size_t i = 0; i < fragment_count; i++) {
+        if (fragments[i].length > 0) {
+            sg->parts[sg->part_count++] = fragments[i];
+        }
+    }
+
+    sg->part_index = 0;
+    sg->part_offset = 0;
+    sg->complete = complete;
+    sg->context = context;
+    sg->state = MQTT_SG_WAITING;
+
+    return MQTT_SG_OK;
+}
+
+enum MQTTErrors mqtt_sg_sync(MQTT_SG_PUBLISHER *sg)
+{
+    struct mqtt_client *client = sg->client;
+
+    if (sg->state != MQTT_SG_IDLE && client->error != MQTT_OK) {
+        finish(sg, MQTT_SG_ABORTED);
+    }
+
+    if (sg->state == MQTT_SG_SENDING && !write_parts(sg) && sg->state == MQTT_SG_SENDING) {
+        // the packet is incomplete: MQTT-C must not write (keep alive, acks), and mqtt_sync would, so
+        // received packets wait in the socket until the packet is complete.
+        return client->error;
+    }
+
+    mqtt_sync(client);
+
+    // start writing once the packets MQTT-C queued before are on the wire.
+    if (sg->state == MQTT_SG_WAITING && client->error == MQTT_OK && !mq_has_unsent(client)) {
+        sg->state = MQTT_SG_SENDING;
+        write_parts(sg);
+    }
+
+    return client->error;
+}
+
+bool mqtt_sg_pending(const MQTT_SG_PUBLISHER *sg)
+{
+    return sg->state != MQTT_SG_IDLE;
+}
+
+bool mqtt_sg_writing(const MQTT_SG_PUBLISHER *sg)
+{
+    return sg->state == MQTT_SG_SENDING;
+}
+
+void mqtt_sg_abort(MQTT_SG_PUBLISHER *sg)
+{
+    if (sg->state != MQTT_SG_IDLE) {
+        finish(sg, MQTT_SG_ABORTED);
+    }
+}
+
+void mqtt_sg_log_stats(const MQTT_SG_PUBLISHER *sg)
+{
+    const MQTT_SG_STATS *s = &sg->stats;
+
+    Log_Debug("Scatter-gather publish: %u published (%llu bytes), %u aborted, %u busy, %u blocked writes\n",
+              s->published, (unsigned long long)s->bytes, s->aborted, s->busy, s->would_block);
+}
@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host build shim: Log_Debug prints to stdout.
+#pragma once
+
+#include <stdio.h>
+
+#define Log_Debug printf
@@ -0,0 +1,142 @@
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+#!/usr/bin/env python3
+# encoding: utf-8
+#
+# Minimal MQTT 3.1.1 broker stand-in for the publish queue benchmark (no TLS, no routing).
+# It acknowledges CONNECT, SUBSCRIBE, PINGREQ and QoS1 PUBLISH packets, and can emulate a slow or
+# high-latency link: --rate-kbps throttles how fast it reads from each client (so the client's TCP
+# send buffer, and then the MQTT-C send buffer, fill up), --ack-delay-ms delays every PUBACK.
+# Payloads starting with "seq=<n>" are checked for gaps and reordering.
+#
+# Usage: python3 broker_standin.py [--port 1883] [--rate-kbps 0] [--ack-delay-ms 0]
+
+import argparse
+import asyncio
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+
+class Connection:
+    def __init__(self, args, reader, writer):
+        self.args = args
+        self.reader = reader
+        self.writer = writer
+        self.client_id = "?"
+        self.published = 0
+        self.bytes = 0
+        self.gaps = 0
+        self.reordered = 0
+        self.next_seq = None
+        self.start = time.monotonic()
+
+    async def read_packet(self):
+        header = await self.reader.readexactly(1)
+        length, multiplier = 0, 1
+        while True:
+            b = (await self.reader.readexactly(1))[0]
+            length += (b & 0x7F) * multiplier
+            multiplier *= 128
+            if not b & 0x80:
+                break
+        body = await self.reader.readexactly(length)
+        if self.args.rate_kbps > 0:
+            await asyncio.sleep((length + 2) * 8 / (self.args.rate_kbps * 1000.0))
+        return header[0], body
+
+    def send(self, data):
+        if not self.writer.is_closing():
+            self.writer.write(data)
+
+    def check_sequence(self, payload):
+        if not payload.startswith(b"seq="):
+            return
+        try:
+            seq = int(payload[4:].split(b" ")[0])
+        except ValueError:
+            return
+        if self.next_seq is not None:
+            if seq > self.next_seq:
+                self.gaps += seq - self.next_seq
+            elif seq < self.next_seq:
+                self.reordered += 1
+        self.next_seq = seq + 1
+
+    async def run(self):
+        loop = asyncio.get_running_loop()
+        try:
+            while True:
+                first, body = await self.read_packet()
+                packet_type, flags = first >> 4, first & 0x0F
+
+                if packet_type == CONNECT:
+                    # protocol name, level, flags, keep alive, then the client id
+                    offset = 2 + int.from_bytes(body[0:2], "big") + 4
+                    id_len = int.from_bytes(body[offset:offset + 2], "big")
+                    self.client_id = body[offset + 2:offset + 2 + id_len].decode("utf-8", errors="replace") or "<empty>"
+                    self.send(bytes([CONNACK << 4, 2, 0, 0]))
+                elif packet_type == PUBLISH:
+                    qos = (flags >> 1) & 3
+                    topic_len = int.from_bytes(body[0:2], "big")
+                    offset = 2 + topic_len
+                    packet_id = None
+                    if qos > 0:
+                        packet_id = body[offset:offset + 2]
+                        offset += 2
+                    self.published += 1
+                    self.bytes += len(body) + 2
+                    self.check_sequence(body[offset:])
+                    if packet_id is not None:
+                        ack = bytes([PUBACK << 4, 2]) + packet_id
+                        if self.args.ack_delay_ms > 0:
+                            loop.call_later(self.args.ack_delay_ms / 1000.0, self.send, ack)
+                        else:
+                            self.send(ack)
+                elif packet_type == SUBSCRIBE:
+                    packet_id = body[0:2]
+                    granted, offset = [], 2
+                    while offset < len(body):
+                        topic_len = int.from_bytes(body[offset:offset + 2], "big")
+                        offset += 2 + topic_len
+                        granted.append(min(body[offset], 1))
+                        offset += 1
+                    self.send(bytes([SUBACK << 4, 2 + len(granted)]) + packet_id + bytes(granted))
+                elif packet_type == PINGREQ:
+                    self.send(bytes([PINGRESP << 4, 0]))
+                elif packet_type == DISCONNECT:
+                    break
+                await self.writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            elapsed = time.monotonic() - self.start
+            print("%s: %d PUBLISH received (%d bytes) in %.1fs, %.0f msg/s, %d missing, %d out of order" %
+                  (self.client_id, self.published, self.bytes, elapsed, self.published / elapsed if elapsed else 0,
+                   self.gaps, self.reordered), flush=True)
+            self.writer.close()
+
+
+async def main():
+    parser = argparse.ArgumentParser(description="MQTT broker stand-in for the publish queue benchmark.")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--rate-kbps", type=float, default=0, help="emulated link rate (0 = unlimited)")
+    parser.add_argument("--ack-delay-ms", type=float, default=0, help="delay before each PUBACK is sent")
+    args = parser.parse_args()
+
+    async def on_client(reader, writer):
+        await Connection(args, reader, writer).run()
+
+    server = await asyncio.start_server(on_client, "127.0.0.1", args.port)
+    print("Broker stand-in listening on 127.0.0.1:%d (rate %s, PUBACK delay %g ms)" %
+          (args.port, "%g kbps" % args.rate_kbps if args.rate_kbps else "unlimited", args.ack_delay_ms), flush=True)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Compares the original publish path (mqtt_mq_clean, skip the message if the send buffer looks full,
+// mqtt_publish, mqtt_sync for every message) with the publish queue (mqtt_publish_queue.c), under
+// bursts of messages, against broker_standin.py (or any MQTT broker) on a plain TCP connection.
+//
+// Usage: PublishQueueBenchmark [-h host] [-p port] [-b burst] [-i interval_ms] [-s payload_size]
+//                              [-q qos] [-w window] [-d duration_s]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+#include "mqtt_publish_queue.h"
+
+// Same buffer sizes as the HighLevelApp (comms_manager.c).
+#define SEND_BUFFER_SIZE 512
+#define RECEIVE_BUFFER_SIZE 512
+#define PUBLISH_QUEUE_SIZE 2048
+
+static const char *topic = "azuresphere/sample/host";
+
+typedef struct {
+    const char *host;
+    const char *port;
+    int burst;
+    int interval_ms;
+    int payload_size;
+    uint8_t qos;
+    int window;
+    int duration_s;
+} benchmark_options;
+
+typedef struct {
+    unsigned offered;       // messages the app tried to publish
+    unsigned accepted;      // messages accepted (handed to MQTT-C, or queued)
+    unsigned lost;          // messages skipped without telling the caller (original path)
+    unsigned dropped;       // messages rejected with a backpressure signal (publish queue)
+    unsigned published;     // messages handed to mqtt_publish
+    unsigned syncs;
+    double elapsed_s;       // until every accepted message was sent (and acknowledged for QoS1)
+    enum MQTTErrors error;
+} benchmark_result;
+
+static uint8_t sendbuf[SEND_BUFFER_SIZE];
+static uint8_t recvbuf[RECEIVE_BUFFER_SIZE];
+static uint8_t publish_queue_buffer[PUBLISH_QUEUE_SIZE];
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void publish_callback(void **unused, struct mqtt_response_publish *published)
+{
+}
+
+static int open_socket(const char *host, const char *port)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *servinfo, *p;
+    int sockfd = -1;
+
+    int rv = getaddrinfo(host, port, &hints, &servinfo);
+    if (rv != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (sockfd == -1) {
+            continue;
+        }
+        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == 0) {
+            break;
+        }
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(servinfo);
+
+    if (sockfd != -1) {
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    }
+    return sockfd;
+}
+
+/// <summary>
+///     Number of publishes MQTT-C has not completed yet (unsent, or awaiting PUBACK).
+/// </summary>
+static size_t mq_pending_publishes(struct mqtt_client *client)
+{
+    size_t pending = 0;
+    for (ssize_t i = 0; i < mqtt_mq_length(&client->mq); i++) {
+        struct mqtt_queued_message *msg = mqtt_mq_get(&client->mq, i);
+        if (msg->control_type == MQTT_CONTROL_PUBLISH && msg->state != MQTT_QUEUED_COMPLETE) {
+            pending++;
+        }
+    }
+    return pending;
+}
+
+static int run(const benchmark_options *opt, bool use_queue, benchmark_result *res)
+{
+    struct mqtt_client client;
+    MQTT_PUBLISH_QUEUE pq;
+    char payload[4096];
+
+    memset(res, 0, sizeof(*res));
+
+    int sockfd = open_socket(opt->host, opt->port);
+    if (sockfd == -1) {
+        fprintf(stderr, "Failed to connect to %s:%s\n", opt->host, opt->port);
+        return -1;
+    }
+
+    mqtt_init(&client, sockfd, sendbuf, sizeof(sendbuf), recvbuf, sizeof(recvbuf), publish_callback);
+    mqtt_connect(&client, use_queue ? "benchmark-queue" : "benchmark-direct", NULL, NULL, 0, NULL, NULL,
+                 MQTT_CONNECT_CLEAN_SESSION, 400);
+    mqtt_sync(&client);
+    mqtt_pq_init(&pq, &client, publish_queue_buffer, sizeof(publish_queue_buffer), opt->qos, (size_t)opt->window);
+
+    double start = now_s();
+    double next_burst = start;
+    unsigned seq = 0;
+
+    while (client.error == MQTT_OK) {
+        double now = now_s();
+        bool producing = now - start < opt->duration_s;
+
+        if (producing && now >= next_burst) {
+            next_burst += opt->interval_ms / 1000.0;
+
+            for (int i = 0; i < opt->burst; i++) {
+                int len = snprintf(payload, sizeof(payload), "seq=%u ", seq++);
+                memset(payload + len, 'x', (size_t)(opt->payload_size - len));
+                res->offered++;
+
+                if (use_queue) {
+                    MQTT_PQ_RESULT r = mqtt_pq_enqueue(&pq, topic, payload, (size_t)opt->payload_size);
+                    if (r >= 0) {
+                        res->accepted++;
+                    } else {
+                        res->dropped++;
+                    }
+                } else {
+                    // the original publish_message / SendTelemetry
+                    mqtt_mq_clean(&client.mq);
+                    if (client.mq.curr_sz >= (size_t)opt->payload_size) {
+                        mqtt_publish(&client, topic, payload, (size_t)opt->payload_size, opt->qos);
+                        res->accepted++;
+                        res->published++;
+                    } else {
+                        res->lost++;
+                    }
+                    mqtt_sync(&client);
+                    res->syncs++;
+                }
+            }
+        }
+
+        // one flush per event loop turn
+        if (use_queue) {
+            mqtt_pq_flush(&pq);
+        }
+
+        if (!producing && mqtt_pq_depth(&pq) == 0 && mq_pending_publishes(&client) == 0) {
+            break;
+        }
+        if (now - start > opt->duration_s + 30) {
+            fprintf(stderr, "Timed out waiting for the broker\n");
+            break;
+        }
+
+        struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+        int timeout_ms = producing ? (int)((next_burst - now_s()) * 1000) : 10;
+        if (poll(&pfd, 1, timeout_ms > 0 ? timeout_ms : 0) > 0 && !use_queue) {
+            mqtt_sync(&client);
+            res->syncs++;
+        }
+        // with the queue, the flush at the top of the loop syncs (and publishes more as PUBACKs arrive).
+    }
+
+    res->elapsed_s = now_s() - start;
+    res->error = client.error;
+    if (use_queue) {
+        res->published = pq.stats.published;
+        res->syncs = pq.stats.syncs;
+        mqtt_pq_log_stats(&pq);
+    }
+
+    mqtt_disconnect(&client);
+    mqtt_sync(&client);
+    close(sockfd);
+    return 0;
+}
+
+static void print_result(const char *name, const benchmark_result *res)
+{
+    printf("%-16s offered %6u  accepted %6u  lost (silently) %6u  dropped (reported) %6u  published %6u  "
+           "syncs %6u  %7.0f msg/s  %s\n",
+           name, res->offered, res->accepted, res->lost, res->dropped, res->published, res->syncs,
+           res->published / res->elapsed_s, res->error == MQTT_OK ? "" : mqtt_error_str(res->error));
+}
+
+int main(int argc, char *argv[])
+{
+    benchmark_options opt = {.host = "127.0.0.1", .port = "1883", .burst = 20, .interval_ms = 100,
+                             .payload_size = 100, .qos = MQTT_PUBLISH_QOS_1, .window = 4, .duration_s = 10};
+    int c;
+
+    while ((c = getopt(argc, argv, "h:p:b:i:s:q:w:d:")) != -1) {
+        switch (c) {
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = optarg; break;
+        case 'b': opt.burst = atoi(optarg); break;
+        case 'i': opt.interval_ms = atoi(optarg); break;
+        case 's': opt.payload_size = atoi(optarg); break;
+        case 'q': opt.qos = atoi(optarg) ? MQTT_PUBLISH_QOS_1 : MQTT_PUBLISH_QOS_0; break;
+        case 'w': opt.window = atoi(optarg); break;
+        case 'd': opt.duration_s = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-b burst] [-i interval_ms] [-s payload_size] "
+                            "[-q qos] [-w window] [-d duration_s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opt.payload_size < 16 || opt.payload_size > 4000) {
+        fprintf(stderr, "payload_size must be 16..4000\n");
+        return 1;
+    }
+
+    printf("%d messages of %d bytes every %d ms for %d s, QoS%d, window %d, send buffer %d, queue %d bytes\n",
+           opt.burst, opt.payload_size, opt.interval_ms, opt.duration_s, opt.qos ? 1 : 0, opt.window,
+           SEND_BUFFER_SIZE, PUBLISH_QUEUE_SIZE);
+
+    benchmark_result direct, queued;
+    if (run(&opt, false, &direct) != 0 || run(&opt, true, &queued) != 0) {
+        return 1;
+    }
+
+    print_result("direct publish", &direct);
+    print_result("publish queue", &queued);
+    return 0;
+}
@@ -0,0 +1,298 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Compares mqtt_publish (the whole packet is copied to the MQTT-C send buffer, which must be larger than
+// the message) with the scatter-gather publish (mqtt_sg_publish.c, the payload is written from the
+// application's buffer, the send buffer stays at SEND_BUFFER_SIZE), for QoS 0 messages of several
+// sizes, against broker_standin.py (or any MQTT broker) on a plain TCP connection.
+// TLS is not covered: without MQTT_USE_WOLFSSL the fragments are written with mqtt_pal_sendall, so neither the
+// encryption nor the TLS record written per fragment (wolfSSL_write) on the device is measured.
+// Each run is a child process, so its peak resident set size (ru_maxrss) is measured on its own.
+//
+// Usage: ZeroCopyPublishBenchmark [-h host] [-p port] [-s size,size,...] [-m MB_per_run] [-f fragments]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+#include "mqtt_sg_publish.h"
+
+// Same buffer sizes as the HighLevelApp (comms_manager.c).
+#define SEND_BUFFER_SIZE 512
+#define RECEIVE_BUFFER_SIZE 512
+#define MAX_SIZES 8
+
+static const char *topic = "azuresphere/sample/host";
+
+typedef struct {
+    const char *host;
+    const char *port;
+    size_t sizes[MAX_SIZES];
+    int size_count;
+    size_t bytes_per_run;
+    int fragments;
+} benchmark_options;
+
+typedef struct {
+    unsigned published;
+    double elapsed_s;
+    size_t sendbuf_size;
+    int error;
+} benchmark_result;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void publish_callback(void **unused, struct mqtt_response_publish *published)
+{
+}
+
+static int open_socket(const char *host, const char *port)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *servinfo, *p;
+    int sockfd = -1;
+
+    int rv = getaddrinfo(host, port, &hints, &servinfo);
+    if (rv != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        return -1;
+    }
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (sockfd == -1) {
+            continue;
+        }
+        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == 0) {
+            break;
+        }
+        close(sockfd);
+        sockfd = -1;
+    }
+    freeaddrinfo(servinfo);
+
+    if (sockfd != -1) {
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    }
+    return sockfd;
+}
+
+static bool mq_has_unsent(struct mqtt_client *client)
+{
+    for (ssize_t i = 0; i < mqtt_mq_length(&client->mq); i++) {
+        if (mqtt_mq_get(&client->mq, i)->state == MQTT_QUEUED_UNSENT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wait_for_socket(int sockfd)
+{
+    struct pollfd pfd = {.fd = sockfd, .events = POLLIN | POLLOUT};
+    poll(&pfd, 1, 100);
+}
+
+static void sg_complete(void *context, MQTT_SG_RESULT result)
+{
+    if (result == MQTT_SG_OK) {
+        (*(unsigned *)context)++;
+    }
+}
+
+/// <summary>
+///     Publishes 'count' messages of 'size' bytes, in a child process. Buffers are allocated and
+///     touched here, so they count in the peak RSS of the run.
+/// </summary>
+static void run(const benchmark_options *opt, bool zero_copy, size_t size, unsigned count, benchmark_result *res)
+{
+    struct mqtt_client client;
+    MQTT_SG_PUBLISHER sg;
+
+    memset(res, 0, sizeof(*res));
+
+    // mqtt_publish needs the whole packet, and its queue descriptor, to fit in the send buffer.
+    res->sendbuf_size = zero_copy ? SEND_BUFFER_SIZE : size + strlen(topic) + 64 + sizeof(struct mqtt_queued_message);
+    uint8_t *sendbuf = malloc(res->sendbuf_size);
+    uint8_t *recvbuf = malloc(RECEIVE_BUFFER_SIZE);
+    uint8_t *payload = malloc(size);
+    if (sendbuf == NULL || recvbuf == NULL || payload == NULL) {
+        res->error = -1;
+        return;
+    }
+    memset(sendbuf, 0xFF, res->sendbuf_size);
+    memset(recvbuf, 0xFF, RECEIVE_BUFFER_SIZE);
+    memset(payload, 'x', size);
+
+    int sockfd = open_socket(opt->host, opt->port);
+    if (sockfd == -1) {
+        fprintf(stderr, "Failed to connect to %s:%s\n", opt->host, opt->port);
+        res->error = -1;
+        return;
+    }
+
+    mqtt_init(&client, sockfd, sendbuf, res->sendbuf_size, recvbuf, RECEIVE_BUFFER_SIZE, publish_callback);
+    mqtt_connect(&client, zero_copy ? "benchmark-zero-copy" : "benchmark-copy", NULL, NULL, 0, NULL, NULL,
+                 MQTT_CONNECT_CLEAN_SESSION, 400);
+    mqtt_sync(&client);
+    mqtt_sg_init(&sg, &client);
+
+    // the application's message: the payload split in 'fragments' parts.
+    MQTT_SG_FRAGMENT fragments[MQTT_SG_MAX_FRAGMENTS];
+    size_t fragment_size = (size + (size_t)opt->fragments - 1) / (size_t)opt->fragments;
+    size_t fragment_count = 0;
+    for (size_t offset = 0; offset < size; offset += fragment_size) {
+        fragments[fragment_count].data = payload + offset;
+        fragments[fragment_count].length = size - offset < fragment_size ? size - offset : fragment_size;
+        fragment_count++;
+    }
+
+    double start = now_s();
+    unsigned started = 0;
+
+    while (client.error == MQTT_OK && res->published < count) {
+        // one message at a time: the payload buffer is reused once the previous message is written.
+        mqtt_mq_clean(&client.mq);
+        if (started < count && !mqtt_sg_pending(&sg) && !mq_has_unsent(&client)) {
+            // checked for gaps by broker_standin.py
+            int len = snprintf((char *)payload, size, "seq=%u ", started);
+            payload[len] = ' ';
+
+            if (zero_copy) {
+                if (mqtt_sg_publish(&sg, topic, fragments, fragment_count, MQTT_PUBLISH_QOS_0, sg_complete,
+                                    &res->published) == MQTT_SG_OK) {
+                    started++;
+                }
+            } else if (mqtt_publish(&client, topic, payload, size, MQTT_PUBLISH_QOS_0) == MQTT_OK) {
+                started++;
+            }
+        }
+
+        if (zero_copy) {
+            mqtt_sg_sync(&sg);
+        } else {
+            mqtt_sync(&client);
+            if (!mq_has_unsent(&client)) {
+                res->published = started;
+            }
+        }
+
+        if (mqtt_sg_pending(&sg) || mq_has_unsent(&client)) {
+            wait_for_socket(sockfd);
+        }
+    }
+
+    res->elapsed_s = now_s() - start;
+    res->error = client.error == MQTT_OK ? 0 : client.error;
+
+    mqtt_disconnect(&client);
+    mqtt_sync(&client);
+    close(sockfd);
+}
+
+static int run_child(const benchmark_options *opt, bool zero_copy, size_t size, benchmark_result *res, long *maxrss_kb)
+{
+    unsigned count = (unsigned)(opt->bytes_per_run / size);
+    if (count < 10) {
+        count = 10;
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        run(opt, zero_copy, size, count, res);
+        ssize_t written = write(fds[1], res, sizeof(*res));
+        _exit(written == (ssize_t)sizeof(*res) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    ssize_t n = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+
+    struct rusage usage;
+    int status;
+    if (wait4(pid, &status, 0, &usage) != pid || n != (ssize_t)sizeof(*res) || res->error != 0) {
+        return -1;
+    }
+    *maxrss_kb = usage.ru_maxrss;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    benchmark_options opt = {.host = "127.0.0.1", .port = "1883", .sizes = {1024, 16384, 131072}, .size_count = 3,
+                             .bytes_per_run = 64 * 1024 * 1024, .fragments = 4};
+    int c;
+
+    while ((c = getopt(argc, argv, "h:p:s:m:f:")) != -1) {
+        switch (c) {
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = optarg; break;
+        case 's':
+            opt.size_count = 0;
+            for (char *tok = strtok(optarg, ","); tok != NULL && opt.size_count < MAX_SIZES; tok = strtok(NULL, ",")) {
+                opt.sizes[opt.size_count++] = strtoul(tok, NULL, 0);
+            }
+            break;
+        case 'm': opt.bytes_per_run = strtoul(optarg, NULL, 0) * 1024 * 1024; break;
+        case 'f': opt.fragments = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-s size,size,...] [-m MB_per_run] [-f fragments]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (opt.fragments < 1 || opt.fragments > MQTT_SG_MAX_FRAGMENTS) {
+        fprintf(stderr, "fragments must be 1..%d\n", MQTT_SG_MAX_FRAGMENTS);
+        return 1;
+    }
+    for (int i = 0; i < opt.size_count; i++) {
+        if (opt.sizes[i] < 32 || opt.sizes[i] > 64 * 1024 * 1024) {
+            fprintf(stderr, "sizes must be 32 bytes..64 MB\n");
+            return 1;
+        }
+    }
+
+    printf("QoS 0 over plain TCP (TLS not covered), %zu MB per run, payload in %d fragments (zero-copy)\n\n",
+           opt.bytes_per_run / (1024 * 1024), opt.fragments);
+    printf("%10s  %-10s  %8s  %10s  %10s  %10s  %12s\n", "payload", "publish", "messages", "msg/s", "MB/s",
+           "send buf", "peak RSS KB");
+
+    for (int i = 0; i < opt.size_count; i++) {
+        for (int zero_copy = 0; zero_copy <= 1; zero_copy++) {
+            benchmark_result res;
+            long maxrss_kb;
+            if (run_child(&opt, zero_copy, opt.sizes[i], &res, &maxrss_kb) != 0) {
+                fprintf(stderr, "Run failed (%zu bytes, %s)\n", opt.sizes[i], zero_copy ? "zero-copy" : "copy");
+                return 1;
+            }
+            printf("%10zu  %-10s  %8u  %10.0f  %10.1f  %10zu  %12ld\n", opt.sizes[i], zero_copy ? "zero-copy" : "copy",
+                   res.published, res.published / res.elapsed_s,
+                   (double)res.published * (double)opt.sizes[i] / res.elapsed_s / (1024 * 1024), res.sendbuf_size,
+                   maxrss_kb);
+        }
+    }
+    return 0;
+}
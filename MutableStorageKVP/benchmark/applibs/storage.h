@@ -0,0 +1,20 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host stand-in for the Azure Sphere storage API: mutable storage is a regular file in the working directory.
+
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MUTABLE_STORAGE_HOST_FILE "mutable_storage.bin"
+
+static inline int Storage_OpenMutableFile(void)
+{
+	return open(MUTABLE_STORAGE_HOST_FILE, O_RDWR | O_CREAT, 0600);
+}
+
+static inline int Storage_DeleteMutableFile(void)
+{
+	return unlink(MUTABLE_STORAGE_HOST_FILE);
+}
@@ -0,0 +1,108 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Measures MutableStorageKVP operations per second and the bytes written to storage per update,
+// for stores holding 10, 100 and 1000 keys.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "MutableStorageKVP.h"
+#include <applibs/storage.h>
+
+#define UPDATES_PER_RUN 20000
+
+static size_t bytesWritten = 0;
+
+ssize_t __real_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t ret = __real_pwrite(fd, buf, count, offset);
+	if (ret > 0)
+		bytesWritten += (size_t)ret;
+	return ret;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void runBenchmark(int keyCount)
+{
+	char key[16], value[16], buffer[16];
+
+	Storage_DeleteMutableFile();
+
+	for (int i = 0; i < keyCount; i++)
+	{
+		snprintf(key, sizeof(key), "key%04d", i);
+		snprintf(value, sizeof(value), "v%07d", i);
+		if (!WriteProfileString(key, value))
+		{
+			printf("Failed to write %s\n", key);
+			return;
+		}
+	}
+
+	// updates
+	bytesWritten = 0;
+	double start = now();
+	for (int i = 0; i < UPDATES_PER_RUN; i++)
+	{
+		snprintf(key, sizeof(key), "key%04d", (i * 7919) % keyCount);
+		snprintf(value, sizeof(value), "u%07d", i);
+		if (!WriteProfileString(key, value))
+		{
+			printf("Failed to update %s\n", key);
+			return;
+		}
+	}
+	double updateTime = now() - start;
+	double bytesPerUpdate = (double)bytesWritten / UPDATES_PER_RUN;
+
+	// reads
+	start = now();
+	for (int i = 0; i < UPDATES_PER_RUN; i++)
+	{
+		snprintf(key, sizeof(key), "key%04d", (i * 7919) % keyCount);
+		if (GetProfileString(key, buffer, sizeof(buffer)) == -1)
+		{
+			printf("Failed to read %s\n", key);
+			return;
+		}
+	}
+	double readTime = now() - start;
+
+	// deletes
+	bytesWritten = 0;
+	start = now();
+	for (int i = 0; i < keyCount; i++)
+	{
+		snprintf(key, sizeof(key), "key%04d", i);
+		if (!DeleteProfileString(key))
+		{
+			printf("Failed to delete %s\n", key);
+			return;
+		}
+	}
+	double deleteTime = now() - start;
+
+	printf("%5d keys: %9.0f updates/s, %9.0f reads/s, %9.0f deletes/s, %6.1f bytes written per update, %6.1f per delete\n",
+		keyCount, UPDATES_PER_RUN / updateTime, UPDATES_PER_RUN / readTime, keyCount / deleteTime,
+		bytesPerUpdate, (double)bytesWritten / keyCount);
+}
+
+int main(void)
+{
+	runBenchmark(10);
+	runBenchmark(100);
+	runBenchmark(1000);
+
+	Storage_DeleteMutableFile();
+	return 0;
+}
@@ -4,14 +4,69 @@
 #include "MutableStorageKVP.h"
 #include <applibs/storage.h>
 #include <string.h>
-#include "cJSON/cJSON.h"
 #include <errno.h>
+#ifndef KVP_DISABLE_JSON_MIGRATION
+#include "cJSON/cJSON.h"
+#endif
+
+/*
+   Mutable storage is used as an append-only log of Key/Value records, indexed in memory by a hash table
+   that maps each key to the location of its latest value in the file. Each operation therefore costs O(1)
+   (plus the record's own size) in CPU and flash writes, instead of reading, parsing and rewriting the whole file.
+
+   The file is split in two halves. Only one half is active at a time: when it is full, the live records are
+   compacted into the other half, whose header is written last. Headers and records are protected by a CRC32
+   seeded with the half's generation, so that on startup torn writes and stale records from older generations
+   are ignored, and the active half is the valid one with the highest generation.
+
+   Layout (little-endian):
+     half header: u32 magic, u32 generation, u32 crc
+     record:      u8 type, u8 key length, u16 value length, key, value, u32 crc (commit word)
+*/
+
+#ifndef KVP_STORAGE_SIZE_KB
+#define KVP_STORAGE_SIZE_KB 32		// must match the MutableStorage SizeKB in app_manifest.json
+#endif
 
-ssize_t getStorageString(char **jsonString);
-bool writeJsonToStorage(cJSON *cJson);
+#define KVP_LOG_MAGIC			0x3150564B	// "KVP1"
+#define KVP_HALF_SIZE			((off_t)KVP_STORAGE_SIZE_KB * 1024 / 2)
+#define KVP_HEADER_SIZE			12
+#define KVP_RECORD_HEADER_SIZE	4
+#define KVP_RECORD_CRC_SIZE		4
+#define KVP_MAX_KEY_LENGTH		255
+#define KVP_MAX_VALUE_LENGTH	65535
+#define KVP_INDEX_INITIAL_SIZE	32
 
-/// <summary>  
-///  Writes Key/Value pair (keyName, String) into Mutable storage (JSON).
+enum { KVP_RECORD_PUT = 'P', KVP_RECORD_DELETE = 'D' };
+
+typedef struct
+{
+	char *key;				// NULL for an empty slot
+	uint32_t hash;
+	uint32_t valueOffset;	// absolute file offset of the value
+	uint16_t valueLength;
+} kvpIndexEntry;
+
+static struct
+{
+	bool loaded;
+	bool headerWritten;		// false until the first record of a fresh store is written
+	int half;				// active half (0 or 1)
+	uint32_t generation;
+	off_t writeOffset;		// absolute file offset of the next record
+	kvpIndexEntry *entries;
+	size_t capacity;		// always a power of 2
+	size_t count;
+} kvp;
+
+static uint32_t crcTable[256];
+
+static int openStore(void);
+static bool loadIndex(int fd);
+static bool appendRecord(int fd, uint8_t type, const char *keyName, const char *value, size_t valueLength);
+
+/// <summary>
+///  Writes Key/Value pair (keyName, String) into Mutable storage.
 ///  Returns 'true' on success, 'false' on failure.
 /// </summary>
 bool WriteProfileString(char *keyName, char *value)
@@ -20,44 +75,17 @@ bool WriteProfileString(char *keyName, char *value)
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
-
-	if (length == -1)
+	int fd = openStore();
+	if (fd == -1)
 	{
 		Log_Debug("Error: writing to mutable storage: errno %d\n", errno);
 		return false;
 	}
 
-	cJSON *cJson = NULL;
-	if (length == 0) // nothing in storage.
-	{
-		cJson = cJSON_CreateObject();
-		cJSON_AddStringToObject(cJson, keyName, value);
-	}
-	else
-	{
-		// convert to JSON, read the element.
-		cJson = cJSON_Parse(jsonString);
-
-		cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-		if (pItem == NULL)	// don't have the item in the JSON
-		{
-			cJSON_AddStringToObject(cJson, keyName, value);
-		}
-		else
-		{
-			cJSON *pNewItem = cJSON_CreateString(value);
-			cJSON_ReplaceItemInObjectCaseSensitive(cJson, keyName, pNewItem);
-		}
-	}
-
-	writeJsonToStorage(cJson);
-
-	cJSON_Delete(cJson);
-	free(jsonString);
+	bool ret = appendRecord(fd, KVP_RECORD_PUT, keyName, value, strlen(value));
+	close(fd);
 
-	return true;
+	return ret;
 }
 
 bool DeleteProfileString(char *keyName)
@@ -66,32 +94,21 @@ bool DeleteProfileString(char *keyName)
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
+	int fd = openStore();
 
 	// nothing in storage, bail
-	if (length == -1)
+	if (fd == -1)
 		return false;
 
-	// convert to JSON, read the element.
-	cJSON *cJson = cJSON_Parse(jsonString);
-
-	bool ret = false;
-	cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-	if (pItem != NULL)	// item is in the JSON
-	{
-		cJSON_DeleteItemFromObject(cJson, keyName);
-		writeJsonToStorage(cJson);
-		ret = true;
-	}
-
-	cJSON_Delete(cJson);
-	free(jsonString);
+	bool ret = appendRecord(fd, KVP_RECORD_DELETE, keyName, NULL, 0);
+	close(fd);
 
 	return ret;
 }
 
-/// <summary>  
+static kvpIndexEntry *findEntry(const char *keyName);
+
+/// <summary>
 ///  Gets Value from storage based on KeyName.
 ///  returns -1 for error or no matching Key
 /// </summary>
@@ -101,12 +118,8 @@ ssize_t GetProfileString(char *keyName, char *returnedString, size_t Size)
 	Log_Debug(">>> %s\n", __func__);
 #endif
 
-	char *jsonString = 0x00;
-	ssize_t length = getStorageString(&jsonString);
-
-	// Log_Debug("GetProfileString JSON: %s\n", jsonString);
-
-	if (length <= 0)
+	int fd = openStore();
+	if (fd == -1)
 	{
 		Log_Debug("Error: reading mutable storage: errno %d\n", errno);
 		return -1;
@@ -115,88 +128,589 @@ ssize_t GetProfileString(char *keyName, char *returnedString, size_t Size)
 	ssize_t retVal = -1;
 	memset(returnedString, 0x00, Size);
 
-	// convert to JSON, read the element.
-	cJSON *cJson = cJSON_Parse(jsonString);
-	cJSON *pItem = cJSON_GetObjectItemCaseSensitive(cJson, keyName);
-	if (pItem != NULL)
+	kvpIndexEntry *entry = findEntry(keyName);
+	if (entry != NULL && entry->valueLength <= Size)
 	{
-		size_t sLength = strlen(pItem->valuestring);
-		if (sLength <= Size)
+		if (pread(fd, returnedString, entry->valueLength, entry->valueOffset) == (ssize_t)entry->valueLength)
 		{
-			strncpy(returnedString, pItem->valuestring, sLength);
-			retVal = (ssize_t)sLength;
+			retVal = (ssize_t)entry->valueLength;
 		}
 	}
 
-	cJSON_Delete(cJson);
-	free(jsonString);
+	close(fd);
 
 	return retVal;
 }
 
-/// <summary>  
-///  Reads JSON string from storage
-///  returns -1 for error or length of string on success
-///  caller is responsible for releasing allocated memory
+// ------------------------------------------------------------------------------------------------
+// CRC32 (IEEE 802.3)
+
+static uint32_t crc32Update(uint32_t crc, const void *data, size_t length)
+{
+	if (crcTable[1] == 0)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			crcTable[i] = c;
+		}
+	}
+
+	const uint8_t *p = (const uint8_t *)data;
+	crc = ~crc;
+	while (length--)
+		crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static inline void putU16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void putU32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t getU32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Records are bound to the generation of the half they belong to, so stale records don't validate.
+static uint32_t recordCrc(uint32_t generation, const uint8_t *record, size_t length)
+{
+	uint8_t seed[4];
+	putU32(seed, generation);
+	return crc32Update(crc32Update(0, seed, sizeof(seed)), record, length);
+}
+
+static inline off_t halfStart(int half)
+{
+	return half == 0 ? 0 : KVP_HALF_SIZE;
+}
+
+// ------------------------------------------------------------------------------------------------
+// In-memory index (open addressing, linear probing)
+
+static uint32_t hashKey(const char *keyName)
+{
+	uint32_t hash = 2166136261u;	// FNV-1a
+	while (*keyName)
+	{
+		hash ^= (uint8_t)*keyName++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void clearIndex(void)
+{
+	for (size_t i = 0; i < kvp.capacity; i++)
+	{
+		free(kvp.entries[i].key);
+	}
+	free(kvp.entries);
+	kvp.entries = NULL;
+	kvp.capacity = 0;
+	kvp.count = 0;
+}
+
+static kvpIndexEntry *findEntry(const char *keyName)
+{
+	if (kvp.count == 0)
+		return NULL;
+
+	uint32_t hash = hashKey(keyName);
+	size_t mask = kvp.capacity - 1;
+	for (size_t idx = hash & mask; kvp.entries[idx].key != NULL; idx = (idx + 1) & mask)
+	{
+		if (kvp.entries[idx].hash == hash && strcmp(kvp.entries[idx].key, keyName) == 0)
+			return &kvp.entries[idx];
+	}
+	return NULL;
+}
+
+static bool growIndex(void)
+{
+	size_t newCapacity = kvp.capacity ? kvp.capacity * 2 : KVP_INDEX_INITIAL_SIZE;
+	kvpIndexEntry *newEntries = (kvpIndexEntry *)calloc(newCapacity, sizeof(kvpIndexEntry));
+	if (newEntries == NULL)
+		return false;
+
+	for (size_t i = 0; i < kvp.capacity; i++)
+	{
+		if (kvp.entries[i].key != NULL)
+		{
+			size_t idx = kvp.entries[i].hash & (newCapacity - 1);
+			while (newEntries[idx].key != NULL)
+				idx = (idx + 1) & (newCapacity - 1);
+			newEntries[idx] = kvp.entries[i];
+		}
+	}
+
+	free(kvp.entries);
+	kvp.entries = newEntries;
+	kvp.capacity = newCapacity;
+	return true;
+}
+
+static bool indexPut(const char *keyName, uint32_t valueOffset, uint16_t valueLength)
+{
+	kvpIndexEntry *entry = findEntry(keyName);
+	if (entry == NULL)
+	{
+		// keep the load factor under 75%
+		if ((kvp.count + 1) * 4 > kvp.capacity * 3 && !growIndex())
+			return false;
+
+		char *key = strdup(keyName);
+		if (key == NULL)
+			return false;
+
+		uint32_t hash = hashKey(keyName);
+		size_t idx = hash & (kvp.capacity - 1);
+		while (kvp.entries[idx].key != NULL)
+			idx = (idx + 1) & (kvp.capacity - 1);
+
+		entry = &kvp.entries[idx];
+		entry->key = key;
+		entry->hash = hash;
+		kvp.count++;
+	}
+
+	entry->valueOffset = valueOffset;
+	entry->valueLength = valueLength;
+	return true;
+}
+
+static void indexDelete(kvpIndexEntry *entry)
+{
+	size_t mask = kvp.capacity - 1;
+	size_t hole = (size_t)(entry - kvp.entries);
+
+	free(entry->key);
+
+	// backward-shift deletion, so that no tombstones are needed
+	for (size_t next = (hole + 1) & mask; kvp.entries[next].key != NULL; next = (next + 1) & mask)
+	{
+		size_t home = kvp.entries[next].hash & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			kvp.entries[hole] = kvp.entries[next];
+			hole = next;
+		}
+	}
+	memset(&kvp.entries[hole], 0x00, sizeof(kvpIndexEntry));
+	kvp.count--;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Log
+
+static bool readHalfHeader(int fd, int half, uint32_t *generation)
+{
+	uint8_t header[KVP_HEADER_SIZE];
+	if (pread(fd, header, sizeof(header), halfStart(half)) != (ssize_t)sizeof(header))
+		return false;
+
+	if (getU32(header) != KVP_LOG_MAGIC || getU32(header + 8) != crc32Update(0, header, 8))
+		return false;
+
+	*generation = getU32(header + 4);
+	return true;
+}
+
+static bool writeHalfHeader(int fd, int half, uint32_t generation)
+{
+	uint8_t header[KVP_HEADER_SIZE];
+	putU32(header, KVP_LOG_MAGIC);
+	putU32(header + 4, generation);
+	putU32(header + 8, crc32Update(0, header, 8));
+
+	// the header commits the half: all of its records must be on flash before it
+	if (fsync(fd) == -1)
+		return false;
+	if (pwrite(fd, header, sizeof(header), halfStart(half)) != (ssize_t)sizeof(header))
+		return false;
+	return fsync(fd) == 0;
+}
+
+// Fills in the record's header, key and CRC; the value must already be in place after the key.
+static size_t sealRecord(uint8_t *record, uint32_t generation, uint8_t type, const char *keyName, size_t keyLength, size_t valueLength)
+{
+	record[0] = type;
+	record[1] = (uint8_t)keyLength;
+	putU16(record + 2, (uint16_t)valueLength);
+	memcpy(record + KVP_RECORD_HEADER_SIZE, keyName, keyLength);
+
+	size_t length = KVP_RECORD_HEADER_SIZE + keyLength + valueLength;
+	putU32(record + length, recordCrc(generation, record, length));
+	return length + KVP_RECORD_CRC_SIZE;
+}
+
+static size_t buildRecord(uint8_t *record, uint32_t generation, uint8_t type, const char *keyName, size_t keyLength, const char *value, size_t valueLength)
+{
+	if (valueLength > 0)
+		memcpy(record + KVP_RECORD_HEADER_SIZE + keyLength, value, valueLength);
+	return sealRecord(record, generation, type, keyName, keyLength, valueLength);
+}
+
+// Replays the records of the active half into the index, stopping at the first invalid (torn or stale) record.
+static bool replayLog(int fd)
+{
+	off_t offset = halfStart(kvp.half) + KVP_HEADER_SIZE;
+	off_t end = halfStart(kvp.half) + KVP_HALF_SIZE;
+	size_t maxRecord = KVP_RECORD_HEADER_SIZE + KVP_MAX_KEY_LENGTH + KVP_MAX_VALUE_LENGTH + KVP_RECORD_CRC_SIZE;
+	uint8_t *record = (uint8_t *)malloc(maxRecord);
+	if (record == NULL)
+		return false;
+
+	bool ret = true;
+	while (offset + KVP_RECORD_HEADER_SIZE + KVP_RECORD_CRC_SIZE <= end)
+	{
+		if (pread(fd, record, KVP_RECORD_HEADER_SIZE, offset) != KVP_RECORD_HEADER_SIZE)
+			break;
+
+		uint8_t type = record[0];
+		size_t keyLength = record[1];
+		size_t valueLength = (size_t)record[2] | ((size_t)record[3] << 8);
+		size_t length = KVP_RECORD_HEADER_SIZE + keyLength + valueLength;
+		if ((type != KVP_RECORD_PUT && type != KVP_RECORD_DELETE) || keyLength == 0 || offset + (off_t)(length + KVP_RECORD_CRC_SIZE) > end)
+			break;
+
+		size_t remaining = keyLength + valueLength + KVP_RECORD_CRC_SIZE;
+		if (pread(fd, record + KVP_RECORD_HEADER_SIZE, remaining, offset + KVP_RECORD_HEADER_SIZE) != (ssize_t)remaining ||
+			getU32(record + length) != recordCrc(kvp.generation, record, length))
+			break;
+
+		char key[KVP_MAX_KEY_LENGTH + 1];
+		memcpy(key, record + KVP_RECORD_HEADER_SIZE, keyLength);
+		key[keyLength] = '\0';
+
+		if (type == KVP_RECORD_PUT)
+		{
+			if (!indexPut(key, (uint32_t)(offset + KVP_RECORD_HEADER_SIZE + (off_t)keyLength), (uint16_t)valueLength))
+			{
+				ret = false;
+				break;
+			}
+		}
+		else
+		{
+			kvpIndexEntry *entry = findEntry(key);
+			if (entry != NULL)
+				indexDelete(entry);
+		}
+
+		offset += (off_t)(length + KVP_RECORD_CRC_SIZE);
+	}
+
+	free(record);
+	kvp.writeOffset = offset;
+	return ret;
+}
+
+#ifndef KVP_DISABLE_JSON_MIGRATION
+/// <summary>
+///  Converts a store written by the previous (whole-file JSON) implementation into a log.
+///  The log is built in the second half and committed by its header, so the JSON stays valid until then.
+///  This requires the JSON to fit in the first half, and its records in the second: larger stores are refused.
 /// </summary>
-ssize_t getStorageString(char **jsonString)
+static bool migrateJson(int fd)
 {
-#ifdef SHOW_DEBUG_MSGS
-	Log_Debug(">>> %s\n", __func__);
-#endif
+	off_t length = lseek(fd, 0, SEEK_END);
+	if (length > KVP_HALF_SIZE)
+	{
+		Log_Debug("Error: JSON mutable storage is %ld bytes, only up to %ld can be migrated\n", (long)length, (long)KVP_HALF_SIZE);
+		errno = EFBIG;
+		return false;
+	}
 
-	int fd = Storage_OpenMutableFile();
-	ssize_t ret = -1;
-	if (fd != -1)
+	char *jsonString = (char *)malloc((size_t)length + 1);
+	if (jsonString == NULL)
+		return false;
+
+	bool ret = false;
+	ssize_t numRead = pread(fd, jsonString, (size_t)length, 0);
+	jsonString[numRead > 0 ? numRead : 0] = '\0';
+
+	cJSON *cJson = cJSON_Parse(jsonString);
+	free(jsonString);
+	if (cJson == NULL)
+		return false;
+
+	// the records must all fit in the second half: compacting would overwrite the JSON before the log is committed
+	off_t encodedLength = KVP_HEADER_SIZE;
+	cJSON *pItem = NULL;
+	cJSON_ArrayForEach(pItem, cJson)
+	{
+		if (cJSON_IsString(pItem) && strlen(pItem->string) <= KVP_MAX_KEY_LENGTH && strlen(pItem->valuestring) <= KVP_MAX_VALUE_LENGTH)
+			encodedLength += (off_t)(KVP_RECORD_HEADER_SIZE + strlen(pItem->string) + strlen(pItem->valuestring) + KVP_RECORD_CRC_SIZE);
+	}
+	if (encodedLength > KVP_HALF_SIZE)
+	{
+		Log_Debug("Error: JSON mutable storage needs %ld bytes of records, more than the %ld of a half\n", (long)encodedLength, (long)KVP_HALF_SIZE);
+		cJSON_Delete(cJson);
+		errno = EFBIG;
+		return false;
+	}
+
+	kvp.half = 1;
+	kvp.generation = 1;
+	kvp.writeOffset = halfStart(kvp.half) + KVP_HEADER_SIZE;
+	kvp.headerWritten = true;	// the header is written below, once all the records are
+
+	ret = true;
+	cJSON_ArrayForEach(pItem, cJson)
 	{
-		off_t length = lseek(fd, 0, SEEK_END);
-		*jsonString = (char*)malloc((size_t)length + 1);
+		// keys or values that don't fit in a record are dropped
+		if (cJSON_IsString(pItem) && strlen(pItem->string) <= KVP_MAX_KEY_LENGTH && strlen(pItem->valuestring) <= KVP_MAX_VALUE_LENGTH &&
+			!appendRecord(fd, KVP_RECORD_PUT, pItem->string, pItem->valuestring, strlen(pItem->valuestring)))
+		{
+			ret = false;
+			break;
+		}
+	}
+	cJSON_Delete(cJson);
 
-#ifdef SHOW_DEBUG_MSGS
-		Log_Debug("malloc %s, 0x%lx\n", __func__, jsonString);
+	return ret && writeHalfHeader(fd, kvp.half, kvp.generation);
+}
+#endif
+
+static bool loadIndex(int fd)
+{
+	clearIndex();
+	kvp.loaded = false;
+
+	uint32_t generation[2];
+	bool valid[2] = { readHalfHeader(fd, 0, &generation[0]), readHalfHeader(fd, 1, &generation[1]) };
+
+	if (valid[0] || valid[1])
+	{
+		kvp.half = (valid[1] && (!valid[0] || (int32_t)(generation[1] - generation[0]) > 0)) ? 1 : 0;
+		kvp.generation = generation[kvp.half];
+		kvp.headerWritten = true;
+		if (!replayLog(fd))
+			return false;
+	}
+	else
+	{
+#ifndef KVP_DISABLE_JSON_MIGRATION
+		char first = 0;
+		if (pread(fd, &first, 1, 0) == 1 && first == '{')
+		{
+			if (!migrateJson(fd))
+			{
+				Log_Debug("Error: failed to migrate JSON mutable storage\n");
+				clearIndex();
+				return false;
+			}
+			kvp.loaded = true;
+			return true;
+		}
 #endif
+		// fresh store, the header is written along with the first record
+		kvp.half = 0;
+		kvp.generation = 1;
+		kvp.headerWritten = false;
+		kvp.writeOffset = KVP_HEADER_SIZE;
+	}
+
+	kvp.loaded = true;
+	return true;
+}
 
-		memset(*jsonString, 0x00, (size_t)length + 1);
-		lseek(fd, 0, SEEK_SET);
-		ret = read(fd, *jsonString, (size_t)length);
+// The record is committed but the index could not take it (out of memory): the write succeeded, and the index is
+// rebuilt from the log by the next openStore.
+static void invalidateIndex(void)
+{
+	Log_Debug("Error: mutable storage index update failed, it will be reloaded\n");
+	kvp.loaded = false;
+}
+
+/// <summary>
+///  Opens mutable storage, (re)loading the index when needed. The active header is checked on every call,
+///  so that the index follows external changes to the file (i.e. Storage_DeleteMutableFile).
+///  returns -1 for error or the file descriptor on success
+/// </summary>
+static int openStore(void)
+{
+	int fd = Storage_OpenMutableFile();
+	if (fd == -1)
+		return -1;
+
+	uint32_t generation;
+	bool current = kvp.loaded && (kvp.headerWritten ? (readHalfHeader(fd, kvp.half, &generation) && generation == kvp.generation)
+		: lseek(fd, 0, SEEK_END) == 0);
+
+	if (!current && !loadIndex(fd))
+	{
 		close(fd);
+		return -1;
 	}
 
-	return ret;
+	return fd;
 }
 
-/// <summary>  
-///  Writes JSON string to storage (extracts char * from cJSON object)
-///  Returns 'true' for success, 'false' for failure.
+/// <summary>
+///  Rewrites the live records into the inactive half, applying the pending PUT or DELETE of 'keyName' on the way,
+///  then commits the inactive half by writing its header.
+///  Returns 'true' for success, 'false' for failure (the active half is left untouched).
 /// </summary>
-bool writeJsonToStorage(cJSON *cJson)
+static bool compactLog(int fd, uint8_t type, const char *keyName, const char *value, size_t valueLength)
 {
+	int target = 1 - kvp.half;
+	uint32_t generation = kvp.generation + 1;
+	off_t offset = halfStart(target) + KVP_HEADER_SIZE;
+	off_t end = halfStart(target) + KVP_HALF_SIZE;
+	size_t maxRecord = KVP_RECORD_HEADER_SIZE + KVP_MAX_KEY_LENGTH + KVP_MAX_VALUE_LENGTH + KVP_RECORD_CRC_SIZE;
+	uint8_t *record = (uint8_t *)malloc(maxRecord);
+	uint32_t *newOffsets = (uint32_t *)malloc(kvp.capacity * sizeof(uint32_t));
+	kvpIndexEntry *pending = findEntry(keyName);
+	bool ret = (record != NULL && newOffsets != NULL);
+
+	for (size_t i = 0; ret && i < kvp.capacity; i++)
+	{
+		kvpIndexEntry *entry = &kvp.entries[i];
+		if (entry->key == NULL || entry == pending)
+			continue;
+
+		// read the value straight into the record
+		size_t keyLength = strlen(entry->key);
+		if (pread(fd, record + KVP_RECORD_HEADER_SIZE + keyLength, entry->valueLength, entry->valueOffset) != (ssize_t)entry->valueLength)
+		{
+			ret = false;
+			break;
+		}
+
+		size_t length = sealRecord(record, generation, KVP_RECORD_PUT, entry->key, keyLength, entry->valueLength);
+		if (offset + (off_t)length > end || pwrite(fd, record, length, offset) != (ssize_t)length)
+		{
+			ret = false;
+			break;
+		}
+
+		newOffsets[i] = (uint32_t)(offset + KVP_RECORD_HEADER_SIZE + (off_t)keyLength);
+		offset += (off_t)length;
+	}
+
+	// a pending DELETE needs no record, since the key was not rewritten
+	size_t keyLength = strlen(keyName);
+	off_t pendingOffset = offset;
+	if (ret && type == KVP_RECORD_PUT)
+	{
+		size_t length = buildRecord(record, generation, type, keyName, keyLength, value, valueLength);
+		ret = offset + (off_t)length <= end && pwrite(fd, record, length, offset) == (ssize_t)length;
+		offset += (off_t)length;
+	}
+
+	ret = ret && writeHalfHeader(fd, target, generation);
+
+	if (ret)
+	{
+		for (size_t i = 0; i < kvp.capacity; i++)
+		{
+			if (kvp.entries[i].key != NULL && &kvp.entries[i] != pending)
+				kvp.entries[i].valueOffset = newOffsets[i];
+		}
+		kvp.half = target;
+		kvp.generation = generation;
+		kvp.headerWritten = true;
+		kvp.writeOffset = offset;
+
+		if (type == KVP_RECORD_PUT)
+		{
+			if (!indexPut(keyName, (uint32_t)(pendingOffset + KVP_RECORD_HEADER_SIZE + (off_t)keyLength), (uint16_t)valueLength))
+				invalidateIndex();
+		}
+		else
+		{
+			indexDelete(pending);
+		}
+	}
 #ifdef SHOW_DEBUG_MSGS
-	Log_Debug(">>> %s\n", __func__);
+	else
+	{
+		Log_Debug("Error: mutable storage compaction failed\n");
+	}
 #endif
 
-	bool bRet = false;
-	Storage_DeleteMutableFile();	// delete original file before writing new file
-	int fd = Storage_OpenMutableFile();
-	if (fd != -1)
+	free(newOffsets);
+	free(record);
+	return ret;
+}
+
+/// <summary>
+///  Appends a PUT or DELETE record to the active half (compacting it first if it is full), and updates the index.
+///  Returns 'true' for success, 'false' for failure.
+/// </summary>
+static bool appendRecord(int fd, uint8_t type, const char *keyName, const char *value, size_t valueLength)
+{
+	kvpIndexEntry *entry = findEntry(keyName);
+	if (type == KVP_RECORD_DELETE && entry == NULL)
+		return false;
+
+	// skip rewriting a value that is already stored, to save flash writes
+	if (type == KVP_RECORD_PUT && entry != NULL && entry->valueLength == valueLength)
 	{
-		char *data = cJSON_Print(cJson);
-		size_t dataLen = strlen(data);
-		lseek(fd, 0, SEEK_SET);
-		ssize_t numWritten=write(fd, data, dataLen);
-		close(fd);
-		free(data);
+		char *current = (char *)malloc(valueLength + 1);
+		bool same = current != NULL && pread(fd, current, valueLength, entry->valueOffset) == (ssize_t)valueLength &&
+			memcmp(current, value, valueLength) == 0;
+		free(current);
+		if (same)
+			return true;
+	}
+
+	size_t keyLength = strlen(keyName);
+	if (keyLength == 0 || keyLength > KVP_MAX_KEY_LENGTH || valueLength > KVP_MAX_VALUE_LENGTH)
+		return false;
+
+	size_t length = KVP_RECORD_HEADER_SIZE + keyLength + valueLength + KVP_RECORD_CRC_SIZE;
+	uint8_t *record = (uint8_t *)malloc(length);
+	if (record == NULL)
+		return false;
+	buildRecord(record, kvp.generation, type, keyName, keyLength, value, valueLength);
 
-		if (numWritten == (ssize_t)dataLen)
-			bRet = true;
+	bool ret;
+	if (kvp.writeOffset + (off_t)length > halfStart(kvp.half) + KVP_HALF_SIZE)
+	{
+		ret = compactLog(fd, type, keyName, value, valueLength);
+	}
+	else
+	{
+		ret = (kvp.headerWritten || writeHalfHeader(fd, kvp.half, kvp.generation)) &&
+			pwrite(fd, record, length, kvp.writeOffset) == (ssize_t)length;
+		if (ret)
+		{
+			kvp.headerWritten = true;
+			if (type == KVP_RECORD_PUT)
+			{
+				if (!indexPut(keyName, (uint32_t)(kvp.writeOffset + KVP_RECORD_HEADER_SIZE + (off_t)keyLength), (uint16_t)valueLength))
+					invalidateIndex();
+			}
+			else
+			{
+				indexDelete(entry);
+			}
+			kvp.writeOffset += (off_t)length;
+		}
 	}
 
 #ifdef SHOW_DEBUG_MSGS
-	if (bRet == false)
+	if (ret == false)
 	{
-		Log_Debug("Error: error writing json to mutable storage\n");
+		Log_Debug("Error: error writing record to mutable storage\n");
 	}
 #endif
 
-	return bRet;
+	free(record);
+	return ret;
 }
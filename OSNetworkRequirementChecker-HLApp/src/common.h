@@ -37,11 +37,14 @@ typedef enum {
     ExitCode_TimeSync_CustomNtp_Failed = 10,
     ExitCode_TimeSync_GetLastSyncInfo_Failed = 11,
     ExitCode_SyncStatusTimer_Consume = 12,
-    ExitCode_Init_CreateNtpSyncStatusTimer = 13
+    ExitCode_Init_CreateNtpSyncStatusTimer = 13,
+
+    ExitCode_Init_ProbeTimer = 14,
+    ExitCode_ProbeTimer_Consume = 15
 } ExitCode;
 
-// Termination state
-volatile sig_atomic_t exitCode;
+// Termination state, defined in main.c
+extern volatile sig_atomic_t exitCode;
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
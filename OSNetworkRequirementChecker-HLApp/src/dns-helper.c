@@ -2,21 +2,20 @@
    Licensed under the MIT License. */
 
 #include "dns-helper.h"
+#include "probe-helper.h"
 #include <resolv.h>
 
 #define DNS_SERVER_PORT 53
 #define QUERY_BUF_SIZE 2048u
 #define ANSWER_BUF_SIZE 2048u
 #define DISPLAY_BUF_SIZE 256u
-#define QUERY_RETRY_MAX 5
 #define NCSI_RETRY_MAX 5
 
-// File descriptors - initialized to invalid value
-int dnsSocketFd = -1;
 bool isNetworkStackReady = false;
-EventLoopTimer *connectionTimer = NULL;
-EventRegistration *dnsEventReg = NULL;
-EventLoop *dnsEventLoop = NULL;
+
+// DNS server the queries are sent to: the OS resolver, unless overridden with SetDnsServer
+static in_addr_t dnsServerAddress = INADDR_LOOPBACK;
+static uint16_t dnsServerPort = DNS_SERVER_PORT;
 
 // If using DNS in an internet-connected network, consider setting the desired status to be
 // Networking_InterfaceConnectionStatus_ConnectedToInternet instead.
@@ -43,10 +42,35 @@ const char *ServerList[] = {"anse.azurewatson.microsoft.com",
                             "sphere.sb.dl.delivery.mp.microsoft.com",
                             "www.msftconnecttest.com"};
 const unsigned int ServerListLen = 17;
+
+// Endpoints the OS connects to over TCP, see
+// https://learn.microsoft.com/azure-sphere/network/ports-protocols-domains
+typedef struct {
+    const char *host;
+    uint16_t port;
+} TcpEndpoint;
+
+const TcpEndpoint TcpEndpointList[] = {{"global.azure-devices-provisioning.net", 8883},
+                                       {"global.azure-devices-provisioning.net", 443},
+                                       {"www.msftconnecttest.com", 80},
+                                       {"prod.update.sphere.azure.net", 80},
+                                       {"anse.azurewatson.microsoft.com", 443},
+                                       {"prod.core.sphere.azure.net", 443},
+                                       {"prod.device.core.sphere.azure.net", 443},
+                                       {"prod.deviceauth.sphere.azure.net", 443},
+                                       {"prod.dinsights.core.sphere.azure.net", 443},
+                                       {"prod.releases.sphere.azure.net", 443},
+                                       {"prodmsimg.blob.core.windows.net", 443},
+                                       {"prodmsimg-secondary.blob.core.windows.net", 443},
+                                       {"prodptimg.blob.core.windows.net", 443},
+                                       {"prodptimg-secondary.blob.core.windows.net", 443},
+                                       {"sphereblobeus.azurewatson.microsoft.com", 443},
+                                       {"sphereblobweus.azurewatson.microsoft.com", 443},
+                                       {"sphere.sb.dl.delivery.mp.microsoft.com", 443}};
+const unsigned int TcpEndpointListLen = sizeof(TcpEndpointList) / sizeof(TcpEndpointList[0]);
+
+// Last answer of each DNS probe, indexed like ServerList
 ServiceInstanceDetails *InstanceList[17];
-int instanceIndex = 0;
-int queryRetryCounter = 0;
-int NCSIRetryCounter = 0;
 
 int SendDnsQuery(const char *dName, int class, int type, int fd)
 {
@@ -74,8 +98,8 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
     struct sockaddr_in si;
     memset(&si, 0, sizeof(si));
     si.sin_family = AF_INET;
-    si.sin_port = htons(DNS_SERVER_PORT);
-    si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    si.sin_port = htons(dnsServerPort);
+    si.sin_addr.s_addr = htonl(dnsServerAddress);
     ret = sendto(fd, queryBuf, (size_t)messageSize, 0, (struct sockaddr *)&si, sizeof(si));
     if (ret == -1) {
         Log_Debug("ERROR: sendto: %s (%d)\n", strerror(errno), errno);
@@ -84,6 +108,12 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
     return 0;
 }
 
+void SetDnsServer(struct in_addr address, uint16_t port)
+{
+    dnsServerAddress = ntohl(address.s_addr);
+    dnsServerPort = port;
+}
+
 int SendServiceDiscoveryQuery(const char *dName, int fd)
 {
     return SendDnsQuery(dName, ns_c_in, ns_t_ptr, fd);
@@ -210,6 +240,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
                     "errno: %s (%d)\n",
                     sizeof(answerBuf), strerror(errno), errno);
             }
+            free((*instanceDetails)->name);
             (*instanceDetails)->name = strdup(answerBuf);
             // Aggregate alias information
             if (!((*instanceDetails)->alias)) {
@@ -226,6 +257,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
                 memcpy(updated + originLen + indentLen, ns_rr_name(rr), suffixLen);
                 updated[suffixLen + originLen + indentLen] = '\0';
                 (*instanceDetails)->alias = updated;
+                free(original);
             }
             break;
         }
@@ -238,7 +270,6 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
 
 int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails)
 {
-    Log_Debug("EVENT: Process DNS Response.\n");
     char answerBuf[ANSWER_BUF_SIZE];
     ns_msg msg;
     struct sockaddr_in socketAddress;
@@ -250,8 +281,8 @@ int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails)
         return -1;
     }
 
-    // Check the response has come from the loopback address
-    if (socketAddress.sin_addr.s_addr != htonl(INADDR_LOOPBACK)) {
+    // Check the response has come from the DNS server
+    if (socketAddress.sin_addr.s_addr != htonl(dnsServerAddress)) {
         Log_Debug("ERROR: recvfrom unexpected address: %x\n", socketAddress.sin_addr);
         return -1;
     }
@@ -293,36 +324,6 @@ void FreeServiceInstanceDetails(ServiceInstanceDetails *details)
     }
 }
 
-ExitCode InitializeDNS(void)
-{
-    struct sigaction action;
-    memset(&action, 0, sizeof(struct sigaction));
-    action.sa_handler = TerminationHandler;
-    sigaction(SIGTERM, &action, NULL);
-
-    dnsEventLoop = EventLoop_Create();
-    if (dnsEventLoop == NULL) {
-        Log_Debug("ERROR: Could not create event loop.\n");
-        return ExitCode_Init_EventLoop;
-    }
-
-    dnsSocketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
-    if (dnsSocketFd == -1) {
-        Log_Debug("ERROR: Failed to create dnsSocketFd: %s (%d)\n", strerror(errno), errno);
-        return ExitCode_Init_Socket;
-    }
-
-    // Check network interface status at the specified period until it is ready.
-    static const struct timespec checkInterval = {.tv_sec = 1, .tv_nsec = 0};
-    connectionTimer =
-        CreateEventLoopPeriodicTimer(dnsEventLoop, &ConnectionTimerEventHandler, &checkInterval);
-    if (connectionTimer == NULL) {
-        return ExitCode_Init_ConnectionTimer;
-    }
-
-    return ExitCode_Success;
-}
-
 int IsConnectionReady(const char *interface, bool *ipAddressAvailable)
 {
     Networking_InterfaceConnectionStatus status;
@@ -343,159 +344,98 @@ int IsConnectionReady(const char *interface, bool *ipAddressAvailable)
     return 0;
 }
 
-void HandleReceivedDnsDiscoveryResponse(EventLoop *el, int fd, EventLoop_IoEvents events,
-                                        void *context)
+void CloseFdAndPrintError(int fd, const char *fdName)
 {
-    // Read received DNS response over socket.
-    // Process received response, if it contains PRT message, but no SRV or TXT message, send
-    // instance details request for each PTR instance. Otherwise, get the instance details.
-    ServiceInstanceDetails *details = NULL;
-    int result = ProcessDnsResponse(dnsSocketFd, &details);
-    if (result != 0) {
-        goto fail;
-    }
-    if (details) {
-        if (details->name) {
-            Log_Debug("INFO: DNS Service Discovery has found a instance: %s\n", details->name);
-            if (!details->host) {
-                // Found real domain, send out type a record query
-                if (details->alias) {
-                    SendARecordQuery(details->name, dnsSocketFd);
-                    Log_Debug("EVENT: Send Type A Record Query to: %s\n", details->name);
-                    dnsEventReg = EventLoop_RegisterIo(dnsEventLoop, dnsSocketFd, EventLoop_Input,
-                                                       &HandleReceivedDnsDiscoveryResponse,
-                                                       /* context */ NULL);
-                    InstanceList[instanceIndex] = details;
-                    return;
-                } else {
-                    Log_Debug("INFO: Requesting SRV and TXT details for the instance.\n");
-                    SendServiceInstanceDetailsQuery(details->name, dnsSocketFd);
-                    FreeServiceInstanceDetails(details);
-                }
-            } else {
-                // Found local domain instance
-                InstanceList[instanceIndex] = details;
-            }
-        } else {
-            // Update type a record response
-            (InstanceList[instanceIndex])->ipv4Address = details->ipv4Address;
-            FreeServiceInstanceDetails(details);
+    if (fd >= 0) {
+        int result = close(fd);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
         }
     }
-
-fail:
-    if ((++instanceIndex) >= ServerListLen) {
-        exitCode = ExitCode_Test_Finish;
-    }
-    // Initialize test for next server address
-    exitCode = InitializeDNS();
-    queryRetryCounter = 0;
 }
 
-void ConnectionTimerEventHandler(EventLoopTimer *timer)
+void WaitForNetworkReady(void)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ConnectionTimer_Consume;
-        return;
-    }
-
-    // Check whether the network connection is ready.
-    bool isConnectionReady = false;
-    if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
-        exitCode = ExitCode_ConnectionTimer_ConnectionReady;
-    } else if (isConnectionReady || (NCSIRetryCounter++) >= NCSI_RETRY_MAX) {
-        // Connection is ready, unregister the connection event handler. Register DNS response
-        // handler, then start DNS service discovery.
-        bool success = false;
-        NCSIRetryCounter = 0;
-        if (DisarmEventLoopTimer(connectionTimer) == 0) {
-            dnsEventReg = EventLoop_RegisterIo(dnsEventLoop, dnsSocketFd, EventLoop_Input,
-                                               &HandleReceivedDnsDiscoveryResponse,
-                                               /* context */ NULL);
-
-            success = (dnsEventReg != NULL);
-        }
-
-        if (!success) {
-            Log_Debug("ERROR: Connection Failure.\n");
-            exitCode = ExitCode_ConnectionTimer_Disarm;
-            return;
+    for (int retry = 0; retry < NCSI_RETRY_MAX; ++retry) {
+        bool isConnectionReady = false;
+        if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
+            break;
         }
         if (isConnectionReady) {
             Log_Debug("EVENT: Established Connection!\n");
-        } else {
-            Log_Debug("EVENT: Try DNS lookups despite the networking stack is not ready.\n");
+            return;
         }
-        SendServiceDiscoveryQuery(ServerList[instanceIndex], dnsSocketFd);
+        sleep(1);
     }
+    Log_Debug("EVENT: Try DNS lookups despite the networking stack is not ready.\n");
 }
 
-void CloseFdAndPrintError(int fd, const char *fdName)
+static int SendDnsProbe(Probe *probe)
 {
-    if (fd >= 0) {
-        int result = close(fd);
-        if (result != 0) {
-            Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
-        }
+    probe->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (probe->fd == -1) {
+        return -1;
     }
+    return SendARecordQuery(probe->host, probe->fd);
 }
 
-void DNSResolverCleanUp(void)
+static int ReceiveDnsProbe(Probe *probe)
 {
-    for (int i = 0; i < ServerListLen; ++i) {
-        FreeServiceInstanceDetails(InstanceList[i]);
+    ServiceInstanceDetails *details = NULL;
+    if (ProcessDnsResponse(probe->fd, &details) != 0) {
+        return -1;
+    }
+    if (!details || details->ipv4Address.s_addr == INADDR_NONE) {
+        FreeServiceInstanceDetails(details);
+        errno = ENOENT;
+        return -1;
     }
 
-    DisposeEventLoopTimer(connectionTimer);
-    EventLoop_UnregisterIo(dnsEventLoop, dnsEventReg);
-    EventLoop_Close(dnsEventLoop);
+    probe->address = details->ipv4Address;
 
-    CloseFdAndPrintError(dnsSocketFd, "DNS Socket");
+    // Keep the last answer for the summary.
+    ServiceInstanceDetails **answer = (ServiceInstanceDetails **)probe->context;
+    if (answer) {
+        FreeServiceInstanceDetails(*answer);
+        *answer = details;
+    } else {
+        FreeServiceInstanceDetails(details);
+    }
+    return 1;
 }
 
-bool RunDNSDiagnostic(void)
+static const ProbeOps DnsProbeOps = {
+    .events = EventLoop_Input, .send = SendDnsProbe, .receive = ReceiveDnsProbe};
+
+bool AddDNSProbes(void)
 {
-    exitCode = ExitCode_Success;
-    for (int i = 0; i < ServerListLen; ++i) {
+    bool success = true;
+    for (unsigned int i = 0; i < ServerListLen; ++i) {
         InstanceList[i] = NULL;
+        success &= AddProbe(ProbeType_Dns, ServerList[i], 0, &DnsProbeOps, &InstanceList[i]) != NULL;
     }
-
-    Log_Debug("INFO: Starting DNS Test\n");
-    instanceIndex = 0;
-    queryRetryCounter = 0;
-
-    exitCode = InitializeDNS();
-
-    // DNS resolver loop
-    // Use event loop to wait for events and trigger handlers, until an error or SIGTERM happens
-    while (exitCode == ExitCode_Success) {
-        EventLoop_Run_Result result = EventLoop_Run(dnsEventLoop, EVENT_LOOP_DURATION, true);
-        if (exitCode == ExitCode_Success) {
-            Log_Debug("Resolving address: %s\n", ServerList[instanceIndex]);
-        }
-        // Continue if interrupted by signal, e.g. due to breakpoint being set.
-        if (result == EventLoop_Run_Failed && errno != EINTR) {
-            exitCode = ExitCode_Main_EventLoopFail;
-        }
-        if ((queryRetryCounter++) >= QUERY_RETRY_MAX) {
-            ++instanceIndex;
-            queryRetryCounter = 0;
-            exitCode = InitializeDNS();
-        }
-        if (instanceIndex >= ServerListLen) {
-            exitCode = ExitCode_Test_Finish;
+    for (unsigned int i = 0; i < TcpEndpointListLen; ++i) {
+        Probe *resolver = FindProbe(ProbeType_Dns, TcpEndpointList[i].host, 0);
+        if (!resolver) {
+            resolver = AddProbe(ProbeType_Dns, TcpEndpointList[i].host, 0, &DnsProbeOps, NULL);
         }
+        success &= AddTcpProbe(resolver, TcpEndpointList[i].port) != NULL;
     }
+    return success;
+}
+
+void DNSResolverCleanUp(void)
+{
     for (int i = 0; i < ServerListLen; ++i) {
-        if (!InstanceList[i]) {
-            return false;
-        }
+        FreeServiceInstanceDetails(InstanceList[i]);
+        InstanceList[i] = NULL;
     }
-    return true;
 }
 
-void PrintDNSSummary(void)
+bool PrintDNSSummary(void)
 {
+    bool success = true;
+
     // Print out DNS hostname resolution list
     Log_Debug("\n\nDiagnostic App Summary:\nDNS Hostname Resolution List:\n");
     for (int i = 0; i < ServerListLen; ++i) {
@@ -505,20 +445,33 @@ void PrintDNSSummary(void)
                 // Local instance
                 Log_Debug(
                     "\tIndex: \t%d\n\tName: \t%s\n\tHost: \t%s\n\tIPv4: \t%s\n\tPort: \t%hd\n\tTXT "
-                    "Data: \t%.*s\n\n",
+                    "Data: \t%.*s\n",
                     i, details->name, details->host, inet_ntoa(details->ipv4Address), details->port,
                     details->txtDataLength, details->txtData);
             } else if (details->alias) {
                 // CNAME record
-                Log_Debug("\tIndex: \t%d\n\tName: \t%s\n\tIPv4: \t%s\n\tAlias: \t%s\n\n", i,
+                Log_Debug("\tIndex: \t%d\n\tName: \t%s\n\tIPv4: \t%s\n\tAlias: \t%s\n", i,
                           details->name, inet_ntoa(details->ipv4Address), details->alias);
+            } else {
+                Log_Debug("\tIndex: \t%d\n\tName: \t%s\n\tIPv4: \t%s\n", i, ServerList[i],
+                          inet_ntoa(details->ipv4Address));
             }
-        } else if (instanceIndex >= i) {
-            // Failed case
-            Log_Debug("\tIndex: \t%d\n\tERROR: \tFailed to resolve: %s\n\n", i, ServerList[i]);
         } else {
-            // Skipped test
-            Log_Debug("\tIndex: \t%d\n\tSkip test with %s\n\n", i, ServerList[i]);
+            // Failed case
+            Log_Debug("\tIndex: \t%d\n\tERROR: \tFailed to resolve: %s\n", i, ServerList[i]);
+            success = false;
         }
+        Log_Debug("\tDNS: \t");
+        PrintProbeLatency(FindProbe(ProbeType_Dns, ServerList[i], 0));
+        Log_Debug("\n");
+    }
+
+    Log_Debug("TCP Connection List:\n");
+    for (int i = 0; i < TcpEndpointListLen; ++i) {
+        Probe *probe = FindProbe(ProbeType_Tcp, TcpEndpointList[i].host, TcpEndpointList[i].port);
+        Log_Debug("\t%s:%u \t", TcpEndpointList[i].host, TcpEndpointList[i].port);
+        PrintProbeLatency(probe);
+        success &= probe != NULL && probe->sampleCount > 0;
     }
+    return success;
 }
\ No newline at end of file
@@ -26,6 +26,14 @@ typedef struct {
     char *alias;
 } ServiceInstanceDetails;
 
+/// <summary>
+/// Sends the DNS queries to the given server instead of the OS resolver (127.0.0.1:53), e.g. a
+/// local stub server.
+/// </summary>
+/// <param name="address">IPv4 address of the DNS server</param>
+/// <param name="port">UDP port of the DNS server</param>
+void SetDnsServer(struct in_addr address, uint16_t port);
+
 /// <summary>
 /// Send a service discovery query
 /// </summary>
@@ -64,15 +72,6 @@ int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails);
 /// <param name="instance">The ServiceInstanceDetails struct to free</param>
 void FreeServiceInstanceDetails(ServiceInstanceDetails *instance);
 
-/// <summary>
-///     Set up SIGTERM termination handler and event handlers.
-/// </summary>
-/// <returns>
-///     ExitCode_Success if all resources were allocated successfully; otherwise another
-///     ExitCode value which indicates the specific failure.
-/// </returns>
-ExitCode InitializeDNS(void);
-
 /// <summary>
 ///     Check whether the required network connection status has been met.
 /// </summary>
@@ -82,20 +81,9 @@ ExitCode InitializeDNS(void);
 int IsConnectionReady(const char *interface, bool *ipAddressAvailable);
 
 /// <summary>
-///     Handle DNS service discover response received event.
-///     This function follows the <see cref="EventLoopIoCallback" /> signature.
+///     Waits (up to a few seconds) until the network interface has an IP address.
 /// </summary>
-/// <param name="el"> The EventLoop in which the callback was registered </param>
-/// <param name="fd"> The descriptor for which the event fired </param>
-/// <param name="events"> The bitmask of events fired </param>
-/// <param name="context"> An optional context pointer that was passed in the registration. </param>
-void HandleReceivedDnsDiscoveryResponse(EventLoop *el, int fd, EventLoop_IoEvents events,
-                                        void *context);
-
-/// <summary>
-///     The timer event handler to check whether network connection is ready.
-/// </summary>
-void ConnectionTimerEventHandler(EventLoopTimer *timer);
+void WaitForNetworkReady(void);
 
 /// <summary>
 ///     Closes a file descriptor and prints an error on failure.
@@ -105,16 +93,19 @@ void ConnectionTimerEventHandler(EventLoopTimer *timer);
 void CloseFdAndPrintError(int fd, const char *fdName);
 
 /// <summary>
-///     Clean up the resources previously allocated for DNS resolver test.
+///     Adds a DNS probe for each endpoint, and a TCP connect probe for each endpoint and port
+///     the OS connects to. They run with <see cref="RunProbes"/>.
 /// </summary>
-void DNSResolverCleanUp(void);
+/// <returns>false if some probes couldn't be added.</returns>
+bool AddDNSProbes(void);
 
 /// <summary>
-///     Run DNS resolver diagnostic test.
+///     Clean up the resources previously allocated for DNS resolver test.
 /// </summary>
-bool RunDNSDiagnostic(void);
+void DNSResolverCleanUp(void);
 
 /// <summary>
-///     Print DNS resolver diagnostic summary.
+///     Print DNS resolver and TCP connection diagnostic summary.
 /// </summary>
-void PrintDNSSummary(void);
\ No newline at end of file
+/// <returns>true if all the endpoints were resolved and connected to.</returns>
+bool PrintDNSSummary(void);
\ No newline at end of file
@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "histogram.h"
+#include <string.h>
+
+static const uint32_t bucketBoundsUs[HISTOGRAM_BUCKET_COUNT - 1] = {
+    100,    200,     500,     1000,    2000,    5000,    10000,   20000,
+    50000,  100000,  200000,  500000,  1000000, 2000000, 5000000, 10000000};
+
+static uint64_t AbsoluteValue(int64_t value)
+{
+    return value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+}
+
+void ResetHistogram(Histogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void AddHistogramValue(Histogram *histogram, int64_t valueUs)
+{
+    uint64_t magnitude = AbsoluteValue(valueUs);
+    unsigned int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKET_COUNT - 1 && magnitude > bucketBoundsUs[bucket]) {
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+
+    if (histogram->count == 0 || valueUs < histogram->min) {
+        histogram->min = valueUs;
+    }
+    if (histogram->count == 0 || valueUs > histogram->max) {
+        histogram->max = valueUs;
+    }
+    histogram->sum += valueUs;
+    histogram->count++;
+}
+
+void AddHistogramFailures(Histogram *histogram, uint32_t failures)
+{
+    histogram->failures += failures;
+}
+
+uint32_t GetHistogramBucketBound(unsigned int bucket)
+{
+    return bucket < HISTOGRAM_BUCKET_COUNT - 1 ? bucketBoundsUs[bucket] : UINT32_MAX;
+}
+
+uint64_t GetHistogramPercentile(const Histogram *histogram, unsigned int percent)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t largest = AbsoluteValue(histogram->min) > AbsoluteValue(histogram->max)
+                           ? AbsoluteValue(histogram->min)
+                           : AbsoluteValue(histogram->max);
+    uint64_t rank = ((uint64_t)percent * histogram->count + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT - 1; ++bucket) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank && seen > 0) {
+            return bucketBoundsUs[bucket] < largest ? bucketBoundsUs[bucket] : largest;
+        }
+    }
+    return largest;
+}
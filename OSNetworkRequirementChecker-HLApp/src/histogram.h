@@ -0,0 +1,53 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+// Every histogram has the same fixed buckets: a 1-2-5 series of upper bounds from 100 us to 10 s,
+// plus an overflow bucket. A histogram is a constant-size block of counters, cheap to keep per
+// endpoint for as long as the monitor runs and to export as is.
+#define HISTOGRAM_BUCKET_COUNT 17
+
+/// <summary>
+/// Histogram of measurements in microseconds. Values are bucketed by their absolute value (e.g.
+/// NTP clock offsets), min, max and sum keep their sign.
+/// </summary>
+typedef struct {
+    /// <summary>Number of values added</summary>
+    uint32_t count;
+    /// <summary>Number of measurements that failed, which have no value</summary>
+    uint32_t failures;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    uint32_t buckets[HISTOGRAM_BUCKET_COUNT];
+} Histogram;
+
+/// <summary>
+///     Clears all the counters.
+/// </summary>
+void ResetHistogram(Histogram *histogram);
+
+/// <summary>
+///     Adds a measurement (microseconds).
+/// </summary>
+void AddHistogramValue(Histogram *histogram, int64_t valueUs);
+
+/// <summary>
+///     Counts failed measurements.
+/// </summary>
+void AddHistogramFailures(Histogram *histogram, uint32_t failures);
+
+/// <summary>
+///     Returns the upper bound (microseconds, inclusive) of a bucket, or UINT32_MAX for the
+///     overflow bucket.
+/// </summary>
+uint32_t GetHistogramBucketBound(unsigned int bucket);
+
+/// <summary>
+///     Returns an estimate of the 'percent' percentile of the absolute values: the upper bound of
+///     the bucket holding the nearest rank, capped to the largest absolute value added. Returns 0
+///     if the histogram is empty.
+/// </summary>
+uint64_t GetHistogramPercentile(const Histogram *histogram, unsigned int percent);
@@ -0,0 +1,8 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Linux stand-in for the Azure Sphere log library: messages go to stderr.
+
+#pragma once
+
+int Log_Debug(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,19 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Linux stand-in for the Azure Sphere networking library: every interface has an IP address.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t Networking_InterfaceConnectionStatus;
+enum {
+    Networking_InterfaceConnectionStatus_InterfaceUp = 1 << 0,
+    Networking_InterfaceConnectionStatus_ConnectedToNetwork = 1 << 1,
+    Networking_InterfaceConnectionStatus_IpAvailable = 1 << 2,
+    Networking_InterfaceConnectionStatus_ConnectedToInternet = 1 << 3
+};
+
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName,
+                                            Networking_InterfaceConnectionStatus *outStatus);
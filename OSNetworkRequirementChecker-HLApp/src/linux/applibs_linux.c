@@ -0,0 +1,155 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Linux implementation of the subset of the Azure Sphere application libraries used by the app.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/networking.h>
+
+struct EventLoop {
+    int epollFd;
+};
+
+struct EventRegistration {
+    int fd;
+    EventLoopIoCallback *callback;
+    void *context;
+};
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int Networking_GetInterfaceConnectionStatus(const char *networkInterfaceName,
+                                            Networking_InterfaceConnectionStatus *outStatus)
+{
+    *outStatus = Networking_InterfaceConnectionStatus_InterfaceUp |
+                 Networking_InterfaceConnectionStatus_ConnectedToNetwork |
+                 Networking_InterfaceConnectionStatus_IpAvailable;
+    return 0;
+}
+
+EventLoop *EventLoop_Create(void)
+{
+    EventLoop *el = malloc(sizeof(EventLoop));
+    if (el == NULL) {
+        return NULL;
+    }
+    el->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epollFd == -1) {
+        free(el);
+        return NULL;
+    }
+    return el;
+}
+
+void EventLoop_Close(EventLoop *el)
+{
+    if (el != NULL) {
+        close(el->epollFd);
+        free(el);
+    }
+}
+
+int EventLoop_GetWaitDescriptor(EventLoop *el)
+{
+    return el->epollFd;
+}
+
+static uint32_t ToEpollEvents(EventLoop_IoEvents events)
+{
+    return ((events & EventLoop_Input) ? EPOLLIN : 0) | ((events & EventLoop_Output) ? EPOLLOUT : 0);
+}
+
+static EventLoop_IoEvents FromEpollEvents(uint32_t events)
+{
+    return ((events & EPOLLIN) ? EventLoop_Input : 0) | ((events & EPOLLOUT) ? EventLoop_Output : 0) |
+           ((events & (EPOLLERR | EPOLLHUP)) ? EventLoop_Error : 0);
+}
+
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                        EventLoopIoCallback *callback, void *context)
+{
+    EventRegistration *reg = malloc(sizeof(EventRegistration));
+    if (reg == NULL) {
+        return NULL;
+    }
+    reg->fd = fd;
+    reg->callback = callback;
+    reg->context = context;
+
+    struct epoll_event event = {.events = ToEpollEvents(eventBitmask), .data.ptr = reg};
+    if (epoll_ctl(el->epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        free(reg);
+        return NULL;
+    }
+    return reg;
+}
+
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg, EventLoop_IoEvents eventBitmask)
+{
+    struct epoll_event event = {.events = ToEpollEvents(eventBitmask), .data.ptr = reg};
+    return epoll_ctl(el->epollFd, EPOLL_CTL_MOD, reg->fd, &event);
+}
+
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg)
+{
+    if (reg == NULL) {
+        return 0;
+    }
+    int result = epoll_ctl(el->epollFd, EPOLL_CTL_DEL, reg->fd, NULL);
+    free(reg);
+    return result;
+}
+
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds,
+                                   bool process_one_event)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    EventLoop_Run_Result result = EventLoop_Run_FinishedEmpty;
+    for (;;) {
+        int timeout = duration_in_milliseconds;
+        if (timeout > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout -= (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
+
+        // One event at a time: a callback may unregister any other registration.
+        struct epoll_event event;
+        int count = epoll_wait(el->epollFd, &event, 1, timeout);
+        if (count == -1) {
+            return EventLoop_Run_Failed;
+        }
+        if (count == 0) {
+            return result;
+        }
+
+        EventRegistration *reg = event.data.ptr;
+        reg->callback(el, reg->fd, FromEpollEvents(event.events), reg->context);
+        result = EventLoop_Run_Finished;
+        if (process_one_event || timeout == 0) {
+            return result;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Linux command line build of the network-quality monitor: the same probes and histograms as the
+// monitor mode of the high-level app, with the servers configurable so that it can run against
+// local stub servers (see stub_servers.py).
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+
+#include "dns-helper.h"
+#include "monitor.h"
+#include "ntp-helper.h"
+#include "probe-helper.h"
+
+volatile sig_atomic_t exitCode = ExitCode_Success;
+
+void TerminationHandler(int signalNumber)
+{
+    exitCode = ExitCode_TermHandler_SigTerm;
+}
+
+static void Usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d ADDR[:PORT]  DNS server (default 127.0.0.1:53)\n"
+            "  -n ADDR[:PORT]  NTP server, can be repeated (default: the Azure Sphere time "
+            "servers)\n"
+            "  -p PORT         connect every TCP probe to PORT\n"
+            "  -i SECONDS      time between two rounds of probes (default %d)\n"
+            "  -c ROUNDS       stop after ROUNDS rounds (default: run until interrupted)\n"
+            "  -o FILE         write the snapshot to FILE after each round (default: stdout)\n"
+            "  -b              binary snapshot instead of JSON\n",
+            program, MONITOR_DEFAULT_INTERVAL_S);
+}
+
+/// <summary>
+///     Splits "ADDR[:PORT]" in place.
+/// </summary>
+static bool ParseAddress(char *text, uint16_t defaultPort, struct in_addr *address, uint16_t *port)
+{
+    *port = defaultPort;
+    char *separator = strchr(text, ':');
+    if (separator) {
+        *separator = '\0';
+        long value = strtol(separator + 1, NULL, 10);
+        if (value <= 0 || value > UINT16_MAX) {
+            return false;
+        }
+        *port = (uint16_t)value;
+    }
+    return inet_aton(text, address) != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int interval = MONITOR_DEFAULT_INTERVAL_S;
+    unsigned int rounds = 0;
+    const char *snapshotPath = NULL;
+    MonitorSnapshotFormat format = MonitorSnapshotFormat_Json;
+    struct in_addr address;
+    uint16_t port;
+
+    int option;
+    while ((option = getopt(argc, argv, "d:n:p:i:c:o:bh")) != -1) {
+        switch (option) {
+        case 'd':
+            if (!ParseAddress(optarg, 53, &address, &port)) {
+                fprintf(stderr, "Invalid DNS server: %s\n", optarg);
+                return 1;
+            }
+            SetDnsServer(address, port);
+            break;
+        case 'n':
+            if (!ParseAddress(optarg, 123, &address, &port) || !AddNTPServer(optarg, port)) {
+                fprintf(stderr, "Invalid NTP server: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            SetTcpPortOverride((uint16_t)atoi(optarg));
+            break;
+        case 'i':
+            interval = (unsigned int)atoi(optarg);
+            break;
+        case 'c':
+            rounds = (unsigned int)atoi(optarg);
+            break;
+        case 'o':
+            snapshotPath = optarg;
+            break;
+        case 'b':
+            format = MonitorSnapshotFormat_Binary;
+            break;
+        default:
+            Usage(argv[0]);
+            return option == 'h' ? 0 : 1;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    int snapshotFd = STDOUT_FILENO;
+    if (snapshotPath) {
+        snapshotFd = open(snapshotPath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (snapshotFd == -1) {
+            fprintf(stderr, "Could not open %s: %s\n", snapshotPath, strerror(errno));
+            return 1;
+        }
+    }
+
+    bool success = AddDNSProbes();
+    success &= AddNTPProbes();
+    ExitCode result = RunMonitor(interval, rounds, snapshotFd, format);
+
+    ProbeCleanUp();
+    DNSResolverCleanUp();
+    if (snapshotPath) {
+        CloseFdAndPrintError(snapshotFd, snapshotPath);
+    }
+
+    if (result == ExitCode_TermHandler_SigTerm) {
+        result = ExitCode_Success;
+    }
+    return success ? result : 1;
+}
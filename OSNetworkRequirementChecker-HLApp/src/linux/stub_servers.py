@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+#  Copyright (c) Microsoft Corporation. All rights reserved.
+#  Licensed under the MIT License.
+
+"""Local stub servers for the Linux build of the network-quality monitor.
+
+- DNS (UDP): answers every A query with 127.0.0.1.
+- NTP (UDP): answers SNTP client requests with the local time.
+- TCP: accepts and closes connections.
+
+Usage:
+    python3 stub_servers.py [--dns-port 5353] [--ntp-port 1123] [--tcp-port 8443] [--delay-ms 0]
+    ./network-monitor -d 127.0.0.1:5353 -n 127.0.0.1:1123 -p 8443 -i 5
+"""
+
+import argparse
+import socket
+import struct
+import threading
+import time
+
+NTP_TIMESTAMP_DELTA = 2208988800
+
+
+def ntp_timestamp(now):
+    seconds = int(now)
+    return struct.pack("!II", seconds + NTP_TIMESTAMP_DELTA, int((now - seconds) * (1 << 32)))
+
+
+def serve_dns(port, delay):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port))
+    while True:
+        query, client = sock.recvfrom(512)
+        if len(query) < 12:
+            continue
+        time.sleep(delay)
+        # Header: same id, response + recursion desired/available, 1 question, 1 answer.
+        header = query[:2] + b"\x81\x80" + struct.pack("!HHHH", 1, 1, 0, 0)
+        question = query[12:]
+        # Answer: pointer to the name in the question, type A, class IN, TTL 60, 127.0.0.1.
+        answer = b"\xc0\x0c" + struct.pack("!HHIH", 1, 1, 60, 4) + socket.inet_aton("127.0.0.1")
+        sock.sendto(header + question + answer, client)
+
+
+def serve_ntp(port, delay):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port))
+    while True:
+        request, client = sock.recvfrom(512)
+        if len(request) < 48 or request[0] & 0x07 != 3:
+            continue
+        received = ntp_timestamp(time.time())
+        time.sleep(delay)
+        # No leap warning, version 4, mode 4 (server), stratum 2; originate = client transmit time.
+        reply = bytes([(4 << 3) | 4, 2, request[2], 0xEC]) + bytes(12)
+        reply += received + request[40:48] + received + ntp_timestamp(time.time())
+        sock.sendto(reply, client)
+
+
+def serve_tcp(port, delay):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("127.0.0.1", port))
+    sock.listen(64)
+    while True:
+        connection, _ = sock.accept()
+        connection.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--dns-port", type=int, default=5353)
+    parser.add_argument("--ntp-port", type=int, default=1123)
+    parser.add_argument("--tcp-port", type=int, default=8443)
+    parser.add_argument("--delay-ms", type=float, default=0, help="delay of the DNS and NTP answers")
+    args = parser.parse_args()
+
+    delay = args.delay_ms / 1000
+    servers = [(serve_dns, args.dns_port), (serve_ntp, args.ntp_port), (serve_tcp, args.tcp_port)]
+    for serve, port in servers:
+        threading.Thread(target=serve, args=(port, delay), daemon=True).start()
+    print("DNS on udp/%d, NTP on udp/%d, TCP on tcp/%d" % (args.dns_port, args.ntp_port, args.tcp_port))
+    while True:
+        time.sleep(3600)
+
+
+if __name__ == "__main__":
+    main()
@@ -4,15 +4,27 @@
 // This sample C application tests:
 //  1. DNS resolver against known prod endpoints
 //  (https://learn.microsoft.com/en-us/azure-sphere/network/ports-protocols-domains).
-//  2. NTP time sync with known time servers
+//  2. TCP connections to the ports of these endpoints used by the OS
+//  3. NTP requests to known time servers
+// All the probes run concurrently, each measured several times to report latency percentiles.
+// With the "--monitor" command line argument (CmdArgs in app_manifest.json), the probes run again
+// every minute until the app is stopped, and histograms of the measurements are kept as a JSON
+// snapshot in mutable storage.
 //
 // It uses the APIs in the following Azure Sphere application libraries:
 // - log (displays messages in the Device Output window during debugging)
 // - networking (get network interface connection status)
 // - eventloop (system invokes handlers for timer events)
+// - storage (keeps the monitor snapshot in mutable storage)
+
+#include <applibs/storage.h>
 
 #include "dns-helper.h"
+#include "monitor.h"
 #include "ntp-helper.h"
+#include "probe-helper.h"
+
+volatile sig_atomic_t exitCode = ExitCode_Success;
 
 void TerminationHandler(int signalNumber)
 {
@@ -20,16 +32,53 @@ void TerminationHandler(int signalNumber)
     exitCode = ExitCode_TermHandler_SigTerm;
 }
 
-int main(void)
+/// <summary>
+///     Runs the probes every MONITOR_DEFAULT_INTERVAL_S seconds until the app is stopped, keeping
+///     the histograms of their measurements in mutable storage.
+/// </summary>
+static ExitCode RunMonitorMode(void)
+{
+    int snapshotFd = Storage_OpenMutableFile();
+    if (snapshotFd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage, no snapshot will be kept: %s (%d).\n",
+                  strerror(errno), errno);
+    }
+
+    ExitCode result =
+        RunMonitor(MONITOR_DEFAULT_INTERVAL_S, 0, snapshotFd, MonitorSnapshotFormat_Json);
+    CloseFdAndPrintError(snapshotFd, "MutableStorage");
+    return result;
+}
+
+int main(int argc, char *argv[])
 {
-    bool success = RunDNSDiagnostic();
-    success &= RunNTPDiagnostic();
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    exitCode = ExitCode_Success;
+    WaitForNetworkReady();
+
+    bool success = AddDNSProbes();
+    success &= AddNTPProbes();
+
+    if (argc > 1 && strcmp(argv[1], "--monitor") == 0) {
+        ExitCode result = RunMonitorMode();
+        ProbeCleanUp();
+        DNSResolverCleanUp();
+        Log_Debug("INFO: Application exiting.\n");
+        return result;
+    }
+
+    exitCode = RunProbes();
+    success &= exitCode == ExitCode_Success;
 
-    PrintDNSSummary();
-    PrintNTPSummary();
+    success &= PrintDNSSummary();
+    success &= PrintNTPSummary();
 
+    ProbeCleanUp();
     DNSResolverCleanUp();
-    CustomNTPCleanUp();
 
     if (success) {
         Log_Debug("PASS: Diagnostic App Finished Successfully.\n");
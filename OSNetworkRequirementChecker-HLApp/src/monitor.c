@@ -0,0 +1,245 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "monitor.h"
+#include "ntp-helper.h"
+#include "probe-helper.h"
+#include <stdio.h>
+
+// Histograms of each probe, indexed like the probes
+typedef struct {
+    Histogram latency;
+    Histogram ntpOffset;
+    Histogram ntpDelay;
+} MonitorEntry;
+
+static MonitorEntry entries[PROBE_MAX_COUNT];
+static uint32_t roundCount = 0;
+static struct timespec monitorStart;
+
+static const char *const probeTypeNames[] = {"dns", "tcp", "ntp"};
+
+static uint32_t ElapsedSeconds(const struct timespec *from)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec - from->tv_sec);
+}
+
+/// <summary>
+///     Adds the measurements of the last round to the histograms.
+/// </summary>
+static void RecordRound(void)
+{
+    unsigned int attempts = 0;
+    unsigned int successes = 0;
+
+    for (unsigned int i = 0; i < GetProbeCount(); ++i) {
+        const Probe *probe = GetProbe(i);
+        MonitorEntry *entry = &entries[i];
+
+        for (unsigned int sample = 0; sample < probe->sampleCount; ++sample) {
+            AddHistogramValue(&entry->latency, probe->latencyUs[sample]);
+
+            int64_t offsetUs, delayUs;
+            if (GetNTPSample(probe, sample, &offsetUs, &delayUs)) {
+                AddHistogramValue(&entry->ntpOffset, offsetUs);
+                AddHistogramValue(&entry->ntpDelay, delayUs);
+            }
+        }
+
+        uint32_t failures = probe->attempts - probe->sampleCount;
+        AddHistogramFailures(&entry->latency, failures);
+        if (probe->type == ProbeType_Ntp) {
+            AddHistogramFailures(&entry->ntpOffset, failures);
+            AddHistogramFailures(&entry->ntpDelay, failures);
+        }
+
+        attempts += probe->attempts;
+        successes += probe->sampleCount;
+    }
+
+    roundCount++;
+    Log_Debug("INFO: Monitor round %lu: %u/%u measurements succeeded.\n", (unsigned long)roundCount,
+              successes, attempts);
+}
+
+static int WriteAll(int fd, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static int WriteJsonHistogram(int fd, const char *name, const Histogram *histogram)
+{
+    long long mean = histogram->count > 0 ? (long long)(histogram->sum / histogram->count) : 0;
+    if (dprintf(fd,
+                ",\"%s\":{\"count\":%lu,\"failures\":%lu,\"min_us\":%lld,\"max_us\":%lld,"
+                "\"mean_us\":%lld,\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"buckets\":[",
+                name, (unsigned long)histogram->count, (unsigned long)histogram->failures,
+                (long long)histogram->min, (long long)histogram->max, mean,
+                (unsigned long long)GetHistogramPercentile(histogram, 50),
+                (unsigned long long)GetHistogramPercentile(histogram, 90),
+                (unsigned long long)GetHistogramPercentile(histogram, 99)) < 0) {
+        return -1;
+    }
+    for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        if (dprintf(fd, bucket == 0 ? "%lu" : ",%lu", (unsigned long)histogram->buckets[bucket]) <
+            0) {
+            return -1;
+        }
+    }
+    return dprintf(fd, "]}") < 0 ? -1 : 0;
+}
+
+static int WriteJsonSnapshot(int fd)
+{
+    if (dprintf(fd, "{\"version\":%d,\"rounds\":%lu,\"elapsed_s\":%lu,\"bucket_bounds_us\":[",
+                MONITOR_SNAPSHOT_VERSION, (unsigned long)roundCount,
+                (unsigned long)ElapsedSeconds(&monitorStart)) < 0) {
+        return -1;
+    }
+    for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT - 1; ++bucket) {
+        if (dprintf(fd, bucket == 0 ? "%lu" : ",%lu",
+                    (unsigned long)GetHistogramBucketBound(bucket)) < 0) {
+            return -1;
+        }
+    }
+    if (dprintf(fd, "],\"probes\":[") < 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < GetProbeCount(); ++i) {
+        const Probe *probe = GetProbe(i);
+        if (dprintf(fd, "%s{\"type\":\"%s\",\"host\":\"%s\",\"port\":%u", i == 0 ? "" : ",",
+                    probeTypeNames[probe->type], probe->host, probe->port) < 0 ||
+            WriteJsonHistogram(fd, "latency", &entries[i].latency) != 0) {
+            return -1;
+        }
+        if (probe->type == ProbeType_Ntp &&
+            (WriteJsonHistogram(fd, "offset", &entries[i].ntpOffset) != 0 ||
+             WriteJsonHistogram(fd, "delay", &entries[i].ntpDelay) != 0)) {
+            return -1;
+        }
+        if (dprintf(fd, "}") < 0) {
+            return -1;
+        }
+    }
+    return dprintf(fd, "]}\n") < 0 ? -1 : 0;
+}
+
+static int WriteBinaryRecord(int fd, const Probe *probe, MonitorMetric metric,
+                             const Histogram *histogram)
+{
+    MonitorSnapshotRecord record;
+    memset(&record, 0, sizeof(record));
+    record.probeType = (uint8_t)probe->type;
+    record.metric = (uint8_t)metric;
+    record.port = probe->port;
+    strncpy(record.host, probe->host, sizeof(record.host) - 1);
+    record.count = histogram->count;
+    record.failures = histogram->failures;
+    record.min = histogram->min;
+    record.max = histogram->max;
+    record.sum = histogram->sum;
+    memcpy(record.buckets, histogram->buckets, sizeof(record.buckets));
+    return WriteAll(fd, &record, sizeof(record));
+}
+
+static int WriteBinarySnapshot(int fd)
+{
+    MonitorSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MONITOR_SNAPSHOT_MAGIC;
+    header.version = MONITOR_SNAPSHOT_VERSION;
+    header.bucketCount = HISTOGRAM_BUCKET_COUNT;
+    header.rounds = roundCount;
+    header.elapsedS = ElapsedSeconds(&monitorStart);
+    for (unsigned int i = 0; i < GetProbeCount(); ++i) {
+        header.recordCount += GetProbe(i)->type == ProbeType_Ntp ? 3 : 1;
+    }
+    for (unsigned int bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT - 1; ++bucket) {
+        header.bucketBoundsUs[bucket] = GetHistogramBucketBound(bucket);
+    }
+    if (WriteAll(fd, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < GetProbeCount(); ++i) {
+        const Probe *probe = GetProbe(i);
+        if (WriteBinaryRecord(fd, probe, MonitorMetric_Latency, &entries[i].latency) != 0) {
+            return -1;
+        }
+        if (probe->type == ProbeType_Ntp &&
+            (WriteBinaryRecord(fd, probe, MonitorMetric_NtpOffset, &entries[i].ntpOffset) != 0 ||
+             WriteBinaryRecord(fd, probe, MonitorMetric_NtpDelay, &entries[i].ntpDelay) != 0)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int WriteMonitorSnapshot(int fd, MonitorSnapshotFormat format)
+{
+    return format == MonitorSnapshotFormat_Binary ? WriteBinarySnapshot(fd) : WriteJsonSnapshot(fd);
+}
+
+ExitCode RunMonitor(unsigned int intervalSeconds, unsigned int rounds, int snapshotFd,
+                    MonitorSnapshotFormat format)
+{
+    for (unsigned int i = 0; i < PROBE_MAX_COUNT; ++i) {
+        ResetHistogram(&entries[i].latency);
+        ResetHistogram(&entries[i].ntpOffset);
+        ResetHistogram(&entries[i].ntpDelay);
+    }
+    roundCount = 0;
+    clock_gettime(CLOCK_MONOTONIC, &monitorStart);
+
+    Log_Debug("INFO: Monitoring %u probes every %u seconds.\n", GetProbeCount(), intervalSeconds);
+    while (exitCode == ExitCode_Success) {
+        struct timespec roundStart;
+        clock_gettime(CLOCK_MONOTONIC, &roundStart);
+
+        ResetProbes();
+        ExitCode result = RunProbes();
+        if (result != ExitCode_Success) {
+            return result;
+        }
+        RecordRound();
+
+        if (snapshotFd >= 0) {
+            // Rewrite a file from the start, append to a pipe.
+            if (lseek(snapshotFd, 0, SEEK_SET) == 0 && ftruncate(snapshotFd, 0) == -1) {
+                Log_Debug("ERROR: Could not truncate the snapshot: %s (%d).\n", strerror(errno),
+                          errno);
+            }
+            if (WriteMonitorSnapshot(snapshotFd, format) != 0) {
+                Log_Debug("ERROR: Could not write the snapshot: %s (%d).\n", strerror(errno),
+                          errno);
+            }
+        }
+
+        if (rounds != 0 && roundCount >= rounds) {
+            break;
+        }
+
+        // Wait for the next round; sleep is interrupted by the termination signal.
+        uint32_t elapsed = ElapsedSeconds(&roundStart);
+        unsigned int remaining = elapsed < intervalSeconds ? intervalSeconds - elapsed : 0;
+        while (remaining > 0 && exitCode == ExitCode_Success) {
+            remaining = sleep(remaining);
+        }
+    }
+    return exitCode;
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "common.h"
+#include "histogram.h"
+
+// Monitor mode: the probes run again every interval, and every measurement is added to the
+// histograms of its probe: DNS resolution and TCP handshake latency, NTP request latency, clock
+// offset and round-trip delay. After each round, a snapshot of all the histograms is written out.
+#define MONITOR_DEFAULT_INTERVAL_S 60
+
+#define MONITOR_SNAPSHOT_MAGIC 0x314D514Eu // "NQM1"
+#define MONITOR_SNAPSHOT_VERSION 1
+#define MONITOR_HOST_LENGTH 48
+
+typedef enum { MonitorSnapshotFormat_Json, MonitorSnapshotFormat_Binary } MonitorSnapshotFormat;
+
+typedef enum {
+    MonitorMetric_Latency = 0,
+    MonitorMetric_NtpOffset = 1,
+    MonitorMetric_NtpDelay = 2
+} MonitorMetric;
+
+/// <summary>
+/// Header of a binary snapshot, followed by 'recordCount' records. All the fields are in the byte
+/// order of the device (little-endian).
+/// </summary>
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bucketCount;
+    uint32_t rounds;
+    /// <summary>Seconds since the monitor started</summary>
+    uint32_t elapsedS;
+    uint32_t recordCount;
+    /// <summary>Upper bound of each bucket but the overflow one</summary>
+    uint32_t bucketBoundsUs[HISTOGRAM_BUCKET_COUNT - 1];
+} MonitorSnapshotHeader;
+
+/// <summary>
+/// One histogram of a probe in a binary snapshot.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>ProbeType</summary>
+    uint8_t probeType;
+    /// <summary>MonitorMetric</summary>
+    uint8_t metric;
+    uint16_t port;
+    /// <summary>Null-terminated, truncated if needed</summary>
+    char host[MONITOR_HOST_LENGTH];
+    uint32_t count;
+    uint32_t failures;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    uint32_t buckets[HISTOGRAM_BUCKET_COUNT];
+} MonitorSnapshotRecord;
+
+/// <summary>
+///     Runs the probes added so far every 'intervalSeconds', adding their measurements to the
+///     histograms, and writes a snapshot to 'snapshotFd' after each round.
+/// </summary>
+/// <param name="intervalSeconds">Time between the start of two rounds</param>
+/// <param name="rounds">Number of rounds, 0 to run until exitCode is set</param>
+/// <param name="snapshotFd">File the snapshot is written to (rewritten from the start if it's
+/// seekable), or -1</param>
+/// <param name="format">Format of the snapshot</param>
+/// <returns>ExitCode_Success, or the ExitCode which stopped the monitor.</returns>
+ExitCode RunMonitor(unsigned int intervalSeconds, unsigned int rounds, int snapshotFd,
+                    MonitorSnapshotFormat format);
+
+/// <summary>
+///     Writes a snapshot of the histograms at the current position of 'fd'. JSON snapshots are
+///     written on a single line.
+/// </summary>
+/// <returns>0 on success, or -1 with errno set.</returns>
+int WriteMonitorSnapshot(int fd, MonitorSnapshotFormat format);
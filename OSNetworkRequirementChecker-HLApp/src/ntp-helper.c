@@ -2,10 +2,13 @@
    Licensed under the MIT License. */
 
 #include "ntp-helper.h"
+#include "probe-helper.h"
+#include <sys/socket.h>
 
-#define NTP_TIME_OUT 30
+#define NTP_PORT 123
+#define NTP_TIMESTAMP_DELTA 2208988800ull // 70 years in seconds
 #define TIME_BUFFER_SIZE 26
-#define NTP_SERVER_LEN 256
+#define NTP_MAX_SERVERS 16
 
 // List of time server to be tested
 const char *NTPServerList[] = { "168.61.215.74", "129.6.15.28", "20.43.94.199", "20.189.79.72",
@@ -13,192 +16,197 @@ const char *NTPServerList[] = { "168.61.215.74", "129.6.15.28", "20.43.94.199",
                                 "20.101.57.9", "51.137.137.111", "51.145.123.29",
                                 "52.148.114.188", "52.231.114.183"};
 const unsigned int NTPServerListLen = 13;
-char **timeBeforeSyncList = NULL;
-char **timeAfterSyncList = NULL;
-int ntpIndex = 0;
-int ntpRetryCounter = 0;
 
-const char *secondaryNtpServer = NULL;
-Networking_NtpOption fallbackServerNtpOption = Networking_NtpOption_FallbackServerDisabled;
-
-bool networkReady = false;
-EventLoopTimer *ntpSyncStatusTimer = NULL;
-EventLoop *ntpEventLoop = NULL;
-
-ExitCode InitializeNTP(void)
+// Time servers added with AddNTPServer, probed instead of NTPServerList
+static const char *customServerList[NTP_MAX_SERVERS];
+static uint16_t customServerPorts[NTP_MAX_SERVERS];
+static unsigned int customServerListLen = 0;
+
+// SNTP packet (RFC 4330), all fields big-endian.
+typedef struct {
+    uint8_t li_vn_mode;
+    uint8_t stratum;
+    uint8_t poll;
+    uint8_t precision;
+    uint32_t rootDelay;
+    uint32_t rootDispersion;
+    uint32_t refId;
+    uint32_t refTm_s;
+    uint32_t refTm_f;
+    uint32_t origTm_s;
+    uint32_t origTm_f;
+    uint32_t rxTm_s;
+    uint32_t rxTm_f;
+    uint32_t txTm_s;
+    uint32_t txTm_f;
+} NtpPacket;
+
+// State of the probe of each server, indexed like NTPServerList
+typedef struct {
+    // Transmit timestamp of the request, echoed as originate timestamp by the server
+    uint32_t requestTm_s;
+    uint32_t requestTm_f;
+    // Transmit time of the last answer
+    time_t serverTime;
+    // Clock offset and round-trip delay of each measurement, indexed like Probe.latencyUs
+    int64_t offsetUs[PROBE_SAMPLES];
+    int64_t delayUs[PROBE_SAMPLES];
+} NtpProbeState;
+
+NtpProbeState ntpProbeStates[NTP_MAX_SERVERS];
+
+// Converts an NTP timestamp (seconds and fraction since 1900) to microseconds.
+static int64_t NtpTimestampToUs(uint32_t seconds, uint32_t fraction)
 {
-    struct sigaction action;
-    memset(&action, 0, sizeof(struct sigaction));
-    action.sa_handler = TerminationHandler;
-    sigaction(SIGTERM, &action, NULL);
-
-    ntpEventLoop = EventLoop_Create();
-    if (ntpEventLoop == NULL) {
-        Log_Debug("ERROR: Could not create event loop.\n");
-        return ExitCode_Init_EventLoop;
-    }
-
-    static const struct timespec ntpSyncStatusTimerInterval = {.tv_sec = 1, .tv_nsec = 0};
-    ntpSyncStatusTimer = CreateEventLoopPeriodicTimer(ntpEventLoop, &NtpSyncStatusTimerEventHandler,
-                                                      &ntpSyncStatusTimerInterval);
-
-    if (ntpSyncStatusTimer == NULL) {
-        return ExitCode_Init_CreateNtpSyncStatusTimer;
-    }
-    return ExitCode_Success;
+    return (int64_t)seconds * 1000000 + (int64_t)(((uint64_t)fraction * 1000000) >> 32);
 }
 
-void ConfigureCustomNtpServer(const char *primaryNtpServer, const char *secondaryNtpServer)
+static int SendNtpProbe(Probe *probe)
 {
-    Log_Debug("EVENT: Configuring Custom NTP server\nINFO: Primary Server: %s\n", primaryNtpServer);
-    if (secondaryNtpServer != NULL) {
-        Log_Debug("INFO: Secondary Server: %s\n", secondaryNtpServer);
-    }
-    Log_Debug("INFO: Fallback Server NTP Option: %d\n", fallbackServerNtpOption);
-    if (Networking_TimeSync_EnableCustomNtp(primaryNtpServer, secondaryNtpServer,
-                                            fallbackServerNtpOption) == -1) {
-        Log_Debug("ERROR: Configure Custom NTP failed: %d (%s)\n", errno, strerror(errno));
-        exitCode = ExitCode_TimeSync_CustomNtp_Failed;
-    }
+    NtpProbeState *state = (NtpProbeState *)probe->context;
+
+    probe->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (probe->fd == -1) {
+        return -1;
+    }
+
+    // Client request: no leap warning, version 4, mode 3 (client). The transmit timestamp is
+    // only used to match the answer, so it doesn't need to be the real time.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    state->requestTm_s = (uint32_t)((uint64_t)now.tv_sec + NTP_TIMESTAMP_DELTA);
+    state->requestTm_f = (uint32_t)(((uint64_t)now.tv_nsec << 32) / 1000000000);
+
+    NtpPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.li_vn_mode = (0 << 6) | (4 << 3) | 3;
+    packet.txTm_s = htonl(state->requestTm_s);
+    packet.txTm_f = htonl(state->requestTm_f);
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(probe->port);
+    server.sin_addr = probe->address;
+    if (sendto(probe->fd, &packet, sizeof(packet), 0, (struct sockaddr *)&server,
+               sizeof(server)) == -1) {
+        return -1;
+    }
+    return 0;
 }
 
-void NtpSyncStatusTimerEventHandler(EventLoopTimer *timer)
+static int ReceiveNtpProbe(Probe *probe)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_SyncStatusTimer_Consume;
-        return;
-    }
-    bool currentNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&currentNetworkingReady) == -1)) {
-        Log_Debug("INFO: Error in retrieving ready state from IsNetworkingReady.\n");
-    }
-    if (currentNetworkingReady != networkReady) {
-        // Toggle the states.
-        ntpRetryCounter = 0;
-        networkReady = currentNetworkingReady;
-
-        // Retrieve and record time sync information
-        GetLastNtpSyncInformation();
-        if ((++ntpIndex) >= NTPServerListLen) {
-            exitCode = ExitCode_Test_Finish;
-        } else {
-            networkReady = false;
-            ConfigureCustomNtpServer(NTPServerList[ntpIndex], secondaryNtpServer);
-            exitCode = InitializeNTP();
-        }
-    }
-    if ((++ntpRetryCounter) >= NTP_TIME_OUT) {
-        timeBeforeSyncList[ntpIndex++] = NULL;
-        timeAfterSyncList[ntpIndex] = NULL;
-        if ((ntpIndex) >= NTPServerListLen) {
-            exitCode = ExitCode_Test_Finish;
-        } else {
-            ConfigureCustomNtpServer(NTPServerList[ntpIndex], secondaryNtpServer);
-        }
-        ntpRetryCounter = 0;
-    }
+    NtpProbeState *state = (NtpProbeState *)probe->context;
+    NtpPacket packet;
+
+    ssize_t length = recv(probe->fd, &packet, sizeof(packet), 0);
+    if (length == -1) {
+        return -1;
+    }
+    if ((size_t)length < sizeof(packet) || ntohl(packet.origTm_s) != state->requestTm_s ||
+        ntohl(packet.origTm_f) != state->requestTm_f) {
+        // Not the answer to this request.
+        return 0;
+    }
+    if ((packet.li_vn_mode & 0x07) != 4 || packet.stratum == 0) {
+        // Not a server answer, or a "kiss-o'-death" (e.g. rate limited).
+        errno = EPROTO;
+        return -1;
+    }
+
+    // Clock offset and round-trip delay as per RFC 4330: T1 request sent, T2 request received by
+    // the server, T3 answer sent by the server, T4 answer received.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t t1 = NtpTimestampToUs(state->requestTm_s, state->requestTm_f);
+    int64_t t2 = NtpTimestampToUs(ntohl(packet.rxTm_s), ntohl(packet.rxTm_f));
+    int64_t t3 = NtpTimestampToUs(ntohl(packet.txTm_s), ntohl(packet.txTm_f));
+    int64_t t4 = ((int64_t)now.tv_sec + (int64_t)NTP_TIMESTAMP_DELTA) * 1000000 + now.tv_nsec / 1000;
+    state->offsetUs[probe->sampleCount] = ((t2 - t1) + (t3 - t4)) / 2;
+    state->delayUs[probe->sampleCount] = (t4 - t1) - (t3 - t2);
+
+    state->serverTime = (time_t)((uint64_t)ntohl(packet.txTm_s) - NTP_TIMESTAMP_DELTA);
+    return 1;
 }
 
-void GetLastNtpSyncInformation(void)
+static const ProbeOps NtpProbeOps = {
+    .events = EventLoop_Input, .send = SendNtpProbe, .receive = ReceiveNtpProbe};
+
+static unsigned int GetServerCount(void)
 {
-    if (!networkReady) {
-        Log_Debug("EVENT: Device has not yet successfully time synced.\n");
-        return;
-    }
-    size_t ntpServerLength = NTP_SERVER_LEN;
-    char ntpServer[ntpServerLength];
-    struct tm timeBeforeSync;
-    struct tm adjustedNtpTime;
-
-    if (Networking_TimeSync_GetLastNtpSyncInfo(ntpServer, &ntpServerLength, &timeBeforeSync,
-                                               &adjustedNtpTime) == -1) {
-        if (errno == ENOENT) {
-            Log_Debug("INFO: The device has not yet successfully completed a time sync.\n");
-            return;
-        }
-        if (errno == ENOBUFS) {
-            Log_Debug("ERROR: Buffer is too small to hold the NTP server. Size required is %zu\n",
-                      ntpServerLength);
-        }
-        Log_Debug("ERROR: Get last NTP sync info failed: %d (%s)\n", errno, strerror(errno));
-        exitCode = ExitCode_TimeSync_GetLastSyncInfo_Failed;
-        return;
-    }
-    Log_Debug("EVENT: Successfully time synced to server %s\n", ntpServer);
-    char *displayTimeBuffer = (char *)malloc(TIME_BUFFER_SIZE);
+    return customServerListLen > 0 ? customServerListLen : NTPServerListLen;
+}
 
-    if (strftime(displayTimeBuffer, TIME_BUFFER_SIZE, "%c", &timeBeforeSync) != 0) {
-        timeBeforeSyncList[ntpIndex] = displayTimeBuffer;
-    } else {
-        free(displayTimeBuffer);
+static const char *GetServer(unsigned int index, uint16_t *port)
+{
+    if (customServerListLen > 0) {
+        *port = customServerPorts[index];
+        return customServerList[index];
     }
+    *port = NTP_PORT;
+    return NTPServerList[index];
+}
 
-    displayTimeBuffer = (char *)malloc(TIME_BUFFER_SIZE);
-    if (strftime(displayTimeBuffer, TIME_BUFFER_SIZE, "%c", &adjustedNtpTime) != 0) {
-        timeAfterSyncList[ntpIndex] = displayTimeBuffer;
-    } else {
-        free(displayTimeBuffer);
+bool AddNTPServer(const char *address, uint16_t port)
+{
+    if (customServerListLen >= NTP_MAX_SERVERS) {
+        return false;
     }
+    customServerList[customServerListLen] = address;
+    customServerPorts[customServerListLen] = port;
+    customServerListLen++;
+    return true;
 }
 
-void CustomNTPCleanUp(void)
+bool AddNTPProbes(void)
 {
-    for (int i = 0; i < NTPServerListLen; ++i) {
-        if (timeBeforeSyncList[i]) {
-            free(timeBeforeSyncList[i]);
-            free(timeAfterSyncList[i]);
+    bool success = true;
+    for (unsigned int i = 0; i < GetServerCount(); ++i) {
+        uint16_t port;
+        const char *server = GetServer(i, &port);
+        memset(&ntpProbeStates[i], 0, sizeof(ntpProbeStates[i]));
+        Probe *probe = AddProbe(ProbeType_Ntp, server, port, &NtpProbeOps, &ntpProbeStates[i]);
+        if (probe) {
+            inet_aton(server, &probe->address);
         }
+        success &= probe != NULL;
     }
-
-    free(timeBeforeSyncList);
-    free(timeAfterSyncList);
-
-    DisposeEventLoopTimer(ntpSyncStatusTimer);
-    EventLoop_Close(ntpEventLoop);
+    return success;
 }
 
-bool RunNTPDiagnostic(void)
+bool GetNTPSample(const Probe *probe, unsigned int sample, int64_t *offsetUs, int64_t *delayUs)
 {
-    exitCode = ExitCode_Success;
-    timeBeforeSyncList = (char **)malloc(NTPServerListLen * sizeof(char *));
-    timeAfterSyncList = (char **)malloc(NTPServerListLen * sizeof(char *));
-    Log_Debug("INFO: Custom NTP Test starting in 3 seconds.\n");
-    sleep(3);
-
-    exitCode = InitializeNTP();
-    ConfigureCustomNtpServer(NTPServerList[ntpIndex], secondaryNtpServer);
-
-    // Custom NTP loop
-    while (exitCode == ExitCode_Success) {
-        EventLoop_Run_Result result = EventLoop_Run(ntpEventLoop, -1, true);
-        // Continue if interrupted by signal, e.g. due to breakpoint being set.
-        if (result == EventLoop_Run_Failed && errno != EINTR) {
-            exitCode = ExitCode_Main_EventLoopFail;
-            Log_Debug("Error: eventloop failed with error code: %d %d %s\n", result, errno,
-                      strerror(errno));
-        }
-    }
-    for (int i = 0; i < NTPServerListLen; ++i) {
-        if (!timeBeforeSyncList[i]) {
-            return false;
-        }
+    if (probe->type != ProbeType_Ntp || sample >= probe->sampleCount) {
+        return false;
     }
+    const NtpProbeState *state = (const NtpProbeState *)probe->context;
+    *offsetUs = state->offsetUs[sample];
+    *delayUs = state->delayUs[sample];
     return true;
 }
 
-void PrintNTPSummary(void)
+bool PrintNTPSummary(void)
 {
-    // Print out Custom NTP time sync result
-    Log_Debug("\n\nCustom NTP Time Server Sync list:\n");
-    for (int i = 0; i < NTPServerListLen; ++i) {
-        if (!timeBeforeSyncList[i]) {
-            Log_Debug("\tIndex: %d,\tName: %s,\tERROR: Failed to sync from timer server\n", i,
-                      NTPServerList[i]);
-            continue;
+    bool success = true;
+
+    // Print out NTP time server result
+    Log_Debug("\n\nNTP Time Server List:\n");
+    for (unsigned int i = 0; i < GetServerCount(); ++i) {
+        uint16_t port;
+        const char *server = GetServer(i, &port);
+        Probe *probe = FindProbe(ProbeType_Ntp, server, port);
+        if (!probe || probe->sampleCount == 0) {
+            Log_Debug("\tIndex: %u,\tName: %s,\tERROR: No answer from time server,\t", i, server);
+            success = false;
+        } else {
+            char displayTimeBuffer[TIME_BUFFER_SIZE];
+            struct tm serverTime;
+            gmtime_r(&ntpProbeStates[i].serverTime, &serverTime);
+            strftime(displayTimeBuffer, sizeof(displayTimeBuffer), "%c", &serverTime);
+            Log_Debug("\tIndex: %u,\tName: %s,\tUTC time: %s,\t", i, server, displayTimeBuffer);
         }
-        char *displayTimeBufferBefore = timeBeforeSyncList[i];
-        char *displayTimeBufferAfter = timeAfterSyncList[i];
-        Log_Debug("\tIndex: %d,\tName: %s,\tUTC time before sync: %s,\tafter sync: %s\n\n", i,
-                  NTPServerList[i], displayTimeBufferBefore, displayTimeBufferAfter);
+        PrintProbeLatency(probe);
     }
-}
\ No newline at end of file
+    return success;
+}
@@ -3,41 +3,33 @@
 
 #pragma once
 #include "common.h"
+#include "probe-helper.h"
 
 /// <summary>
-///     Set up event handlers.
+///     Probes this time server instead of the built-in list, e.g. a local stub server. Can be
+///     called several times, before <see cref="AddNTPProbes"/>.
 /// </summary>
-/// <returns>ExitCode_Success if all resources were allocated successfully; otherwise another
-/// ExitCode value which indicates the specific failure.</returns>
-ExitCode InitializeNTP(void);
+/// <param name="address">IPv4 address of the server, must stay valid</param>
+/// <param name="port">UDP port of the server</param>
+/// <returns>false if too many servers were added.</returns>
+bool AddNTPServer(const char *address, uint16_t port);
 
 /// <summary>
-///     Configures custom NTP server. Sets the exit code if it encounters any error.
+///     Adds an NTP probe (an SNTP request on UDP port 123) for each time server. They run with
+///     <see cref="RunProbes"/>.
 /// </summary>
-void ConfigureCustomNtpServer(const char *primaryNtpServer, const char *secondaryNtpServer);
+/// <returns>false if some probes couldn't be added.</returns>
+bool AddNTPProbes(void);
 
 /// <summary>
-///     NTP sync status timer: Checks the NTP sync status of the device.
+///     Gets the clock offset (server clock minus local clock) and the round-trip delay of a
+///     successful measurement of an NTP probe, computed from the SNTP timestamps.
 /// </summary>
-/// <param name="timer">Timer which has fired.</param>
-void NtpSyncStatusTimerEventHandler(EventLoopTimer *timer);
+/// <returns>false if 'probe' isn't an NTP probe or 'sample' is out of range.</returns>
+bool GetNTPSample(const Probe *probe, unsigned int sample, int64_t *offsetUs, int64_t *delayUs);
 
 /// <summary>
-///     Retrieves the last NTP sync information.
+///     Print NTP time server diagnostic summary.
 /// </summary>
-void GetLastNtpSyncInformation(void);
-
-/// <summary>
-///     Clean up the resources previously allocated for custom NTP test.
-/// </summary>
-void CustomNTPCleanUp(void);
-
-/// <summary>
-///     Run custom NTP diagnostic test.
-/// </summary>
-bool RunNTPDiagnostic(void);
-
-/// <summary>
-///     Print custom NTP diagnostic summary.
-/// </summary>
-void PrintNTPSummary(void);
\ No newline at end of file
+/// <returns>true if all the time servers answered.</returns>
+bool PrintNTPSummary(void);
\ No newline at end of file
@@ -0,0 +1,355 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "probe-helper.h"
+#include <sys/socket.h>
+
+static Probe probes[PROBE_MAX_COUNT];
+static unsigned int probeCount = 0;
+static unsigned int inFlight = 0;
+static EventLoop *probeEventLoop = NULL;
+static EventLoopTimer *probeTimer = NULL;
+static uint16_t tcpPortOverride = 0;
+
+static int SendTcpConnect(Probe *probe);
+static int ReceiveTcpConnect(Probe *probe);
+
+static const ProbeOps TcpProbeOps = {
+    .events = EventLoop_Output, .send = SendTcpConnect, .receive = ReceiveTcpConnect};
+
+static int64_t ElapsedUs(const struct timespec *from, const struct timespec *to)
+{
+    return (int64_t)(to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static void AddMilliseconds(struct timespec *result, const struct timespec *from, long ms)
+{
+    result->tv_sec = from->tv_sec + ms / 1000;
+    result->tv_nsec = from->tv_nsec + (ms % 1000) * 1000000;
+    if (result->tv_nsec >= 1000000000) {
+        result->tv_sec++;
+        result->tv_nsec -= 1000000000;
+    }
+}
+
+Probe *AddProbe(ProbeType type, const char *host, uint16_t port, const ProbeOps *ops,
+                void *context)
+{
+    if (probeCount >= PROBE_MAX_COUNT) {
+        Log_Debug("ERROR: Too many probes, %s skipped.\n", host);
+        return NULL;
+    }
+
+    Probe *probe = &probes[probeCount++];
+    memset(probe, 0, sizeof(*probe));
+    probe->type = type;
+    probe->host = host;
+    probe->port = port;
+    probe->address.s_addr = INADDR_NONE;
+    probe->ops = ops;
+    probe->context = context;
+    probe->fd = -1;
+    return probe;
+}
+
+Probe *AddTcpProbe(Probe *resolver, uint16_t port)
+{
+    if (!resolver) {
+        return NULL;
+    }
+    Probe *probe = AddProbe(ProbeType_Tcp, resolver->host, port, &TcpProbeOps, NULL);
+    if (probe) {
+        probe->resolver = resolver;
+    }
+    return probe;
+}
+
+void SetTcpPortOverride(uint16_t port)
+{
+    tcpPortOverride = port;
+}
+
+unsigned int GetProbeCount(void)
+{
+    return probeCount;
+}
+
+Probe *GetProbe(unsigned int index)
+{
+    return index < probeCount ? &probes[index] : NULL;
+}
+
+Probe *FindProbe(ProbeType type, const char *host, uint16_t port)
+{
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        if (probes[i].type == type && probes[i].port == port && strcmp(probes[i].host, host) == 0) {
+            return &probes[i];
+        }
+    }
+    return NULL;
+}
+
+static int SendTcpConnect(Probe *probe)
+{
+    probe->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (probe->fd == -1) {
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(tcpPortOverride != 0 ? tcpPortOverride : probe->port);
+    address.sin_addr = probe->address;
+    if (connect(probe->fd, (struct sockaddr *)&address, sizeof(address)) == -1 &&
+        errno != EINPROGRESS) {
+        return -1;
+    }
+    return 0;
+}
+
+static int ReceiveTcpConnect(Probe *probe)
+{
+    // The socket is writable once the connection is established or failed.
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 1;
+}
+
+static void CloseProbeSocket(Probe *probe)
+{
+    if (probe->registration) {
+        EventLoop_UnregisterIo(probeEventLoop, probe->registration);
+        probe->registration = NULL;
+    }
+    if (probe->fd >= 0) {
+        close(probe->fd);
+        probe->fd = -1;
+        inFlight--;
+    }
+}
+
+static void FinishMeasurement(Probe *probe, int error, const struct timespec *now)
+{
+    CloseProbeSocket(probe);
+
+    if (error == 0) {
+        probe->latencyUs[probe->sampleCount++] = (uint32_t)ElapsedUs(&probe->sentAt, now);
+    } else {
+        probe->lastError = error;
+        if (error == ETIMEDOUT) {
+            probe->timeouts++;
+        }
+    }
+
+    if (probe->attempts >= PROBE_SAMPLES) {
+        probe->done = true;
+    } else {
+        AddMilliseconds(&probe->nextAt, now, PROBE_INTERVAL_MS);
+    }
+}
+
+static void ProbeEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Probe *probe = (Probe *)context;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int result = probe->ops->receive(probe);
+    if (result == 0) {
+        return;
+    }
+    FinishMeasurement(probe, result > 0 ? 0 : errno, &now);
+}
+
+static void StartMeasurement(Probe *probe)
+{
+    probe->attempts++;
+    clock_gettime(CLOCK_MONOTONIC, &probe->sentAt);
+
+    int result = probe->ops->send(probe);
+    int error = errno;
+    if (probe->fd >= 0) {
+        inFlight++;
+    }
+    if (result == 0) {
+        probe->registration = EventLoop_RegisterIo(probeEventLoop, probe->fd, probe->ops->events,
+                                                   &ProbeEventHandler, probe);
+        if (probe->registration) {
+            return;
+        }
+        error = errno;
+    }
+    FinishMeasurement(probe, error, &probe->sentAt);
+}
+
+/// <summary>
+///     Expires the measurements past their deadline and starts the next ones.
+/// </summary>
+static void ProbeTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_ProbeTimer_Consume;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    bool allDone = true;
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        Probe *probe = &probes[i];
+        if (probe->done) {
+            continue;
+        }
+        allDone = false;
+
+        if (probe->fd >= 0) {
+            if (ElapsedUs(&probe->sentAt, &now) >= PROBE_TIMEOUT_MS * 1000LL) {
+                FinishMeasurement(probe, ETIMEDOUT, &now);
+            }
+            continue;
+        }
+        if (ElapsedUs(&probe->nextAt, &now) < 0 || inFlight >= PROBE_MAX_IN_FLIGHT) {
+            continue;
+        }
+
+        if (probe->resolver) {
+            if (probe->resolver->sampleCount == 0) {
+                // Not resolved yet, or not at all.
+                if (probe->resolver->done) {
+                    probe->lastError = probe->resolver->lastError;
+                    probe->done = true;
+                }
+                continue;
+            }
+            probe->address = probe->resolver->address;
+        }
+        StartMeasurement(probe);
+    }
+
+    if (allDone) {
+        exitCode = ExitCode_Test_Finish;
+    }
+}
+
+ExitCode RunProbes(void)
+{
+    probeEventLoop = EventLoop_Create();
+    if (probeEventLoop == NULL) {
+        Log_Debug("ERROR: Could not create event loop.\n");
+        return ExitCode_Init_EventLoop;
+    }
+
+    static const struct timespec tickInterval = {.tv_sec = 0, .tv_nsec = PROBE_TICK_MS * 1000000};
+    probeTimer = CreateEventLoopPeriodicTimer(probeEventLoop, &ProbeTimerEventHandler, &tickInterval);
+    if (probeTimer == NULL) {
+        return ExitCode_Init_ProbeTimer;
+    }
+
+    Log_Debug("INFO: Starting %u probes, %d measurements each (timeout %d ms).\n", probeCount,
+              PROBE_SAMPLES, PROBE_TIMEOUT_MS);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (exitCode == ExitCode_Success) {
+        EventLoop_Run_Result result = EventLoop_Run(probeEventLoop, -1, true);
+        // Continue if interrupted by signal, e.g. due to breakpoint being set.
+        if (result == EventLoop_Run_Failed && errno != EINTR) {
+            exitCode = ExitCode_Main_EventLoopFail;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    Log_Debug("INFO: Survey finished in %lld ms.\n", (long long)(ElapsedUs(&start, &end) / 1000));
+
+    if (exitCode == ExitCode_Test_Finish) {
+        // Ready to run the probes again.
+        exitCode = ExitCode_Success;
+    }
+    return exitCode;
+}
+
+static int CompareLatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint32_t GetProbeLatencyPercentile(const Probe *probe, unsigned int percent)
+{
+    if (probe->sampleCount == 0) {
+        return 0;
+    }
+
+    uint32_t sorted[PROBE_SAMPLES];
+    memcpy(sorted, probe->latencyUs, probe->sampleCount * sizeof(sorted[0]));
+    qsort(sorted, probe->sampleCount, sizeof(sorted[0]), CompareLatency);
+
+    unsigned int rank = (percent * probe->sampleCount + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void PrintProbeLatency(const Probe *probe)
+{
+    if (!probe) {
+        Log_Debug("not run\n");
+        return;
+    }
+    if (probe->attempts == 0) {
+        Log_Debug("not run (host not resolved)\n");
+        return;
+    }
+    if (probe->sampleCount == 0) {
+        Log_Debug("FAILED 0/%u, last error: %s (%d)\n", probe->attempts,
+                  strerror(probe->lastError), probe->lastError);
+        return;
+    }
+
+    // with PROBE_SAMPLES measurements, higher percentiles than p50 are the max.
+    uint32_t p50 = GetProbeLatencyPercentile(probe, 50);
+    uint32_t max = GetProbeLatencyPercentile(probe, 100);
+    Log_Debug("%u/%u succeeded, latency p50 %lu.%lu ms, max %lu.%lu ms", probe->sampleCount,
+              probe->attempts, (unsigned long)p50 / 1000, (unsigned long)p50 % 1000 / 100,
+              (unsigned long)max / 1000, (unsigned long)max % 1000 / 100);
+    if (probe->sampleCount < probe->attempts) {
+        Log_Debug(", %u timeouts, last error: %s (%d)", probe->timeouts, strerror(probe->lastError),
+                  probe->lastError);
+    }
+    Log_Debug("\n");
+}
+
+void ResetProbes(void)
+{
+    ProbeCleanUp();
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        Probe *probe = &probes[i];
+        memset(&probe->nextAt, 0, sizeof(probe->nextAt));
+        probe->attempts = 0;
+        probe->timeouts = 0;
+        probe->sampleCount = 0;
+        probe->lastError = 0;
+        probe->done = false;
+    }
+}
+
+void ProbeCleanUp(void)
+{
+    for (unsigned int i = 0; i < probeCount; ++i) {
+        CloseProbeSocket(&probes[i]);
+    }
+    DisposeEventLoopTimer(probeTimer);
+    probeTimer = NULL;
+    if (probeEventLoop) {
+        EventLoop_Close(probeEventLoop);
+        probeEventLoop = NULL;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "common.h"
+
+// All the probes (DNS lookups, TCP connects, NTP requests) run concurrently on one event loop.
+// Each probe takes PROBE_SAMPLES measurements, one after the other, each with its own deadline,
+// so the whole survey takes about as long as the slowest probe.
+#define PROBE_SAMPLES 5
+#define PROBE_TIMEOUT_MS 5000
+#define PROBE_INTERVAL_MS 250
+#define PROBE_MAX_COUNT 64
+// Bounds the number of sockets open at the same time.
+#define PROBE_MAX_IN_FLIGHT 32
+#define PROBE_TICK_MS 10
+
+typedef enum { ProbeType_Dns, ProbeType_Tcp, ProbeType_Ntp } ProbeType;
+
+typedef struct Probe Probe;
+
+/// <summary>
+/// Protocol of a probe.
+/// </summary>
+typedef struct {
+    /// <summary>Events to wait for once the request is sent</summary>
+    EventLoop_IoEvents events;
+    /// <summary>
+    /// Opens probe->fd (non-blocking) and sends the request. Returns 0, or -1 with errno set.
+    /// </summary>
+    int (*send)(Probe *probe);
+    /// <summary>
+    /// Reads the answer once the events fired. Returns 1 if the measurement succeeded, 0 to keep
+    /// waiting (e.g. unrelated packet), or -1 with errno set.
+    /// </summary>
+    int (*receive)(Probe *probe);
+} ProbeOps;
+
+struct Probe {
+    ProbeType type;
+    /// <summary>Host name, or IPv4 address for NTP</summary>
+    const char *host;
+    /// <summary>TCP or NTP port, 0 for DNS</summary>
+    uint16_t port;
+    /// <summary>TCP: the DNS probe of the host, which provides the address</summary>
+    Probe *resolver;
+    /// <summary>DNS: the last address resolved; TCP and NTP: the address to connect to</summary>
+    struct in_addr address;
+    const ProbeOps *ops;
+    /// <summary>Protocol specific state</summary>
+    void *context;
+
+    int fd;
+    EventRegistration *registration;
+    struct timespec sentAt;
+    struct timespec nextAt;
+
+    unsigned int attempts;
+    unsigned int timeouts;
+    unsigned int sampleCount;
+    uint32_t latencyUs[PROBE_SAMPLES];
+    /// <summary>errno of the last failure, ETIMEDOUT if the deadline passed</summary>
+    int lastError;
+    bool done;
+};
+
+/// <summary>
+///     Adds a probe to the survey. Returns NULL if there are too many.
+/// </summary>
+Probe *AddProbe(ProbeType type, const char *host, uint16_t port, const ProbeOps *ops,
+                void *context);
+
+/// <summary>
+///     Adds a TCP connect probe to the address resolved by the DNS probe 'resolver'. Its first
+///     measurement starts once the host is resolved.
+/// </summary>
+Probe *AddTcpProbe(Probe *resolver, uint16_t port);
+
+/// <summary>
+///     Connects every TCP probe to 'port' instead of the port of its endpoint (0 to disable),
+///     e.g. to test against a single local stub server.
+/// </summary>
+void SetTcpPortOverride(uint16_t port);
+
+/// <summary>
+///     Returns the number of probes added.
+/// </summary>
+unsigned int GetProbeCount(void);
+
+/// <summary>
+///     Returns the probe at 'index' (in the order they were added), or NULL.
+/// </summary>
+Probe *GetProbe(unsigned int index);
+
+/// <summary>
+///     Returns the probe of the given type, host and port (0 for DNS), or NULL.
+/// </summary>
+Probe *FindProbe(ProbeType type, const char *host, uint16_t port);
+
+/// <summary>
+///     Runs all the probes until each has taken its measurements, or until exitCode is set (e.g.
+///     by the termination handler).
+/// </summary>
+/// <returns>ExitCode_Success, or the ExitCode of the failure.</returns>
+ExitCode RunProbes(void);
+
+/// <summary>
+///     Returns the latency (microseconds) under which 'percent' % of the measurements of the
+///     probe completed (nearest rank), or 0 if none succeeded.
+/// </summary>
+uint32_t GetProbeLatencyPercentile(const Probe *probe, unsigned int percent);
+
+/// <summary>
+///     Logs the success count and the latency percentiles of the probe, on one line.
+/// </summary>
+void PrintProbeLatency(const Probe *probe);
+
+/// <summary>
+///     Closes the sockets and clears the measurements of every probe, so that
+///     <see cref="RunProbes"/> can run them again.
+/// </summary>
+void ResetProbes(void);
+
+/// <summary>
+///     Closes the sockets and frees the event loop.
+/// </summary>
+void ProbeCleanUp(void);
\ No newline at end of file
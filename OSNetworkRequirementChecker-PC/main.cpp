@@ -12,13 +12,20 @@
 #   include <unistd.h>
 #	include <netinet/in.h>
 #	include <arpa/inet.h>
+#	include <fcntl.h>
 #	include <netdb.h>
 #endif
 
+#include <errno.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 const char *const ntpServers[] =
 {
@@ -77,7 +84,14 @@ const t_endpoint endpoints[] =
 #define NTP_PORT			123				// NTP standard listening port
 #define NTP_PORT_OUT		124				// NTP requests from Azure Sphere are sourced through local port 124
 #define NTP_TIMESTAMP_DELTA 2208988800ull	// 70 years in seconds
-#define SOCKET_TIMEOUT_SEC	10				// The socket timeout for receiving (in seconds)
+
+// Every probe runs concurrently with the others: one thread per endpoint, and one thread for all the
+// NTP servers (they share the socket bound to NTP_PORT_OUT). Each probe takes PROBE_SAMPLES
+// measurements, each with its own deadline, so the whole survey takes about as long as the slowest
+// probe.
+#define PROBE_SAMPLES		5				// Measurements per probe
+#define PROBE_TIMEOUT_MS	5000			// Deadline of each measurement (in milliseconds)
+#define PROBE_INTERVAL_MS	250				// Delay between two measurements of a probe (in milliseconds)
 
 typedef struct
 {
@@ -114,8 +128,45 @@ typedef struct
 
 } ntp_packet;				 // Total: 384 bits or 48 bytes.
 
-int query_ntp_server(const char *hostname, int ntp_port, int src_port);
-int resolve_hostname(const char *hostname, int port);
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+#	define PROBE_ERROR_TIMEOUT	WSAETIMEDOUT
+#else
+#	define PROBE_ERROR_TIMEOUT	ETIMEDOUT
+#endif
+
+typedef std::chrono::steady_clock probe_clock;
+
+// Measurements of one probe
+typedef struct
+{
+	int attempts;
+	int timeouts;
+	int last_error;						// Error code of the last failure
+	std::vector<double> latencies_ms;	// Latency of each successful measurement
+	std::string address;				// IP address the probe resolved or connected to
+} t_probe_result;
+
+// State of the probe of one NTP server
+typedef struct
+{
+	const char *hostname;
+	bool resolved;
+	struct sockaddr_in server_addr;
+	bool in_flight;
+	uint32_t request_tm_s;				// Transmit time-stamp of the request, echoed back
+	uint32_t request_tm_f;				// by the server as the originate time-stamp
+	probe_clock::time_point sent_at;
+	probe_clock::time_point next_at;
+	time_t server_time;					// Transmit time of the last reply
+	t_probe_result result;
+} t_ntp_probe;
+
+// Probes of one endpoint
+typedef struct
+{
+	t_probe_result dns;
+	t_probe_result tcp;
+} t_endpoint_probe;
 
 
 int getSocketErrorCode(void)
@@ -128,238 +179,520 @@ int getSocketErrorCode(void)
 #endif
 }
 
-int query_ntp_server(const char *hostname, int ntp_port, int src_port)
+static void close_socket(int sock_fd)
 {
-	int iRes = 0;
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	closesocket(sock_fd);
+#else
+	close(sock_fd);
+#endif
+}
 
-	// Build the NTP packet
-	ntp_packet packet = { 0 };
-	packet.li = 0;		// No warning
-	packet.vn = 4;		// Version 4 (aka IPv4-only)
-	packet.mode = 3;	// Client Mode
+static int set_non_blocking(int sock_fd)
+{
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	u_long mode = 1;
+	if (ioctlsocket(sock_fd, FIONBIO, &mode) != 0)
+	{
+		return getSocketErrorCode();
+	}
+#else
+	int flags = fcntl(sock_fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		return getSocketErrorCode();
+	}
+#endif
+	return 0;
+}
 
+// Is the error the one of a non-blocking operation which would block?
+static bool is_would_block(int error)
+{
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	return error == WSAEWOULDBLOCK;
+#else
+	return error == EINPROGRESS || error == EAGAIN || error == EWOULDBLOCK;
+#endif
+}
 
-	// Log the requested hostname.
-	std::cout << "- time from " << hostname;
+static double elapsed_ms(probe_clock::time_point from, probe_clock::time_point to)
+{
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
 
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-	WSADATA wsaData;
-	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+static struct timeval to_timeval(probe_clock::duration duration)
+{
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	if (us < 0)
 	{
-		iRes = getSocketErrorCode();
-		std::cerr << "WSAStartup() failed with error code " << iRes << std::endl;
+		us = 0;
+	}
+
+	struct timeval tv;
+	tv.tv_sec = (long)(us / 1000000);
+	tv.tv_usec = (long)(us % 1000000);
+	return tv;
+}
+
+// Formats an IPv4 address. Unlike inet_ntoa, which returns a static buffer, it can be called from
+// the probe threads.
+static std::string format_ipv4(const struct in_addr *address)
+{
+	char text[INET_ADDRSTRLEN];
+	if (inet_ntop(AF_INET, address, text, sizeof(text)) == NULL)
+	{
+		return "?";
+	}
+	return text;
+}
+
+// Returns the latency under which 'percent' % of the successful measurements completed (nearest rank).
+static double latency_percentile(const t_probe_result *result, int percent)
+{
+	std::vector<double> sorted(result->latencies_ms);
+	std::sort(sorted.begin(), sorted.end());
+
+	size_t rank = (percent * sorted.size() + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Formats the success count, the median and the maximum latency of a probe.
+static std::string format_result(const t_probe_result *result)
+{
+	char text[160];
+	if (result->attempts == 0)
+	{
+		return "not run";
+	}
+	if (result->latencies_ms.empty())
+	{
+		snprintf(text, sizeof(text), "FAILED 0/%d (errno=%d)", result->attempts, result->last_error);
+		return text;
+	}
+
+	// With PROBE_SAMPLES measurements, any percentile above the median is the maximum.
+	int length = snprintf(text, sizeof(text), "%d/%d, p50 %.1f ms, max %.1f ms",
+		(int)result->latencies_ms.size(), result->attempts,
+		latency_percentile(result, 50), latency_percentile(result, 100));
+	if ((int)result->latencies_ms.size() < result->attempts)
+	{
+		snprintf(text + length, sizeof(text) - length, " (%d timeouts, last errno=%d)", result->timeouts, result->last_error);
+	}
+	return text;
+}
 
-		WSACleanup();
+static void record_failure(t_probe_result *result, int error)
+{
+	result->last_error = error;
+	if (error == PROBE_ERROR_TIMEOUT)
+	{
+		result->timeouts++;
+	}
+}
+
+// Resolves the IPv4 address of the host. getaddrinfo() is used as, unlike gethostbyname(), it is
+// thread-safe on every platform.
+static int resolve_ipv4(const char *hostname, struct in_addr *address)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *addresses = NULL;
+	int iRes = getaddrinfo(hostname, NULL, &hints, &addresses);
+	if (iRes != 0)
+	{
 		return iRes;
 	}
-#endif
+	*address = ((struct sockaddr_in *)addresses->ai_addr)->sin_addr;
+	freeaddrinfo(addresses);
+	return 0;
+}
+
+// Opens a TCP connection, failing with PROBE_ERROR_TIMEOUT if it isn't established within timeout_ms.
+static int connect_with_timeout(const struct sockaddr_in *server_addr, int timeout_ms)
+{
+	int sock_fd = (int)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock_fd < 0)
+	{
+		return getSocketErrorCode();
+	}
 
-	// Does the host exist?
-	struct hostent *server = gethostbyname(hostname);
-	if (server == NULL)
+	int iRes = set_non_blocking(sock_fd);
+	if (iRes == 0 && connect(sock_fd, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0)
 	{
 		iRes = getSocketErrorCode();
-		std::cerr << "<???> --> gethostbyname() error " << iRes << std::endl;
+		if (is_would_block(iRes))
+		{
+			// The socket becomes writable once connected (Windows reports failures in the exception set).
+			fd_set write_fds, except_fds;
+			FD_ZERO(&write_fds);
+			FD_ZERO(&except_fds);
+			FD_SET(sock_fd, &write_fds);
+			FD_SET(sock_fd, &except_fds);
+			struct timeval tv = to_timeval(std::chrono::milliseconds(timeout_ms));
+
+			int ready = select(sock_fd + 1, NULL, &write_fds, &except_fds, &tv);
+			if (ready < 0)
+			{
+				iRes = getSocketErrorCode();
+			}
+			else if (ready == 0)
+			{
+				iRes = PROBE_ERROR_TIMEOUT;
+			}
+			else
+			{
+				int error = 0;
+				socklen_t error_len = sizeof(error);
+				if (getsockopt(sock_fd, SOL_SOCKET, SO_ERROR, (char *)&error, &error_len) < 0)
+				{
+					error = getSocketErrorCode();
+				}
+				iRes = error;
+			}
+		}
 	}
-	else
+
+	close_socket(sock_fd);
+	return iRes;
+}
+
+// Thread of an endpoint: resolves the hostname and connects to it, PROBE_SAMPLES times.
+static void probe_endpoint(const t_endpoint *endpoint, t_endpoint_probe *probe)
+{
+	for (int i = 0; i < PROBE_SAMPLES; i++)
 	{
-		// Setup the server address
+		if (i > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(PROBE_INTERVAL_MS));
+		}
+
 		struct sockaddr_in server_addr;
 		memset(&server_addr, 0, sizeof(server_addr));
 		server_addr.sin_family = AF_INET;
-		server_addr.sin_addr.s_addr = *(long *)(server->h_addr_list[0]);
-		server_addr.sin_port = htons(ntp_port);
-		char server_ip_addr[INET_ADDRSTRLEN];
-		sprintf(server_ip_addr, "%s", inet_ntoa(*((struct in_addr *)server->h_addr)));
-
-		// Log the resolved IP address.
-		std::cout << "<" << server_ip_addr << "> --> ";
-
-		// Setup the source address (for source port customization)
-		struct sockaddr_in client_addr;
-		memset(&client_addr, 0, sizeof(client_addr));
-		client_addr.sin_family = AF_INET;
-		client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-		// Optionally, set the given outbound port
-		if (src_port > 0)
+		server_addr.sin_port = htons(endpoint->port);
+
+		// getaddrinfo() can't be given a deadline: a late answer is still used to connect, but
+		// counts as a timeout.
+		probe->dns.attempts++;
+		probe_clock::time_point start = probe_clock::now();
+		int iRes = resolve_ipv4(endpoint->hostname, &server_addr.sin_addr);
+		double latency_ms = elapsed_ms(start, probe_clock::now());
+		if (iRes != 0)
+		{
+			record_failure(&probe->dns, iRes);
+			continue;
+		}
+		if (latency_ms > PROBE_TIMEOUT_MS)
+		{
+			record_failure(&probe->dns, PROBE_ERROR_TIMEOUT);
+		}
+		else
 		{
-			client_addr.sin_port = htons(src_port);
+			probe->dns.latencies_ms.push_back(latency_ms);
 		}
+		probe->dns.address = format_ipv4(&server_addr.sin_addr);
 
-		// Open an UDP socket
-		int sock_fd = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-		if (sock_fd < 0)
+		probe->tcp.attempts++;
+		start = probe_clock::now();
+		iRes = connect_with_timeout(&server_addr, PROBE_TIMEOUT_MS);
+		if (iRes != 0)
 		{
-			iRes = getSocketErrorCode();
-			std::cerr << "socket() open error " << iRes << std::endl;
+			record_failure(&probe->tcp, iRes);
 		}
 		else
 		{
-			// Set a receive timeout
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-			DWORD timeout = SOCKET_TIMEOUT_SEC * 1000;
-			if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout)) < 0)
+			probe->tcp.latencies_ms.push_back(elapsed_ms(start, probe_clock::now()));
+		}
+	}
+}
+
+static int send_ntp_request(int sock_fd, t_ntp_probe *probe, uint32_t request_id)
+{
+	// Build the NTP packet
+	ntp_packet packet = { 0 };
+	packet.li = 0;		// No warning
+	packet.vn = 4;		// Version 4 (aka IPv4-only)
+	packet.mode = 3;	// Client Mode
+
+	// The transmit time-stamp is only used to match the reply, so the fraction carries a request
+	// identifier unique across the servers.
+	probe->request_tm_s = (uint32_t)((uint64_t)time(NULL) + NTP_TIMESTAMP_DELTA);
+	probe->request_tm_f = request_id;
+	packet.txTm_s = htonl(probe->request_tm_s);
+	packet.txTm_f = htonl(probe->request_tm_f);
+
+	probe->result.attempts++;
+	probe->sent_at = probe_clock::now();
+	if (sendto(sock_fd, (const char *)&packet, sizeof(packet), 0, (struct sockaddr *)&probe->server_addr, sizeof(probe->server_addr)) < 0)
+	{
+		return getSocketErrorCode();
+	}
+	probe->in_flight = true;
+	return 0;
+}
+
+static void receive_ntp_replies(int sock_fd, std::vector<t_ntp_probe> &probes)
+{
+	ntp_packet packet;
+	int recv_bytes;
+	while ((recv_bytes = recvfrom(sock_fd, (char *)&packet, sizeof(packet), 0, NULL, NULL)) >= 0)
+	{
+		probe_clock::time_point now = probe_clock::now();
+		if (recv_bytes < (int)sizeof(packet))
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < probes.size(); i++)
+		{
+			t_ntp_probe *probe = &probes[i];
+			if (!probe->in_flight || ntohl(packet.origTm_s) != probe->request_tm_s || ntohl(packet.origTm_f) != probe->request_tm_f)
 			{
-				iRes = getSocketErrorCode();
-				std::cerr << "setsockopt() failed with error " << iRes << std::endl;
+				continue;
 			}
-#else
-			struct timeval tv;
-			tv.tv_sec = SOCKET_TIMEOUT_SEC;
-			tv.tv_usec = 0;
-			if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv)) < 0)
+
+			probe->in_flight = false;
+			probe->next_at = now + std::chrono::milliseconds(PROBE_INTERVAL_MS);
+			if (packet.mode != 4 || packet.stratum == 0)
 			{
-				iRes = getSocketErrorCode();
-				std::cerr << "setsockopt() failed with error " << iRes << std::endl;
+				// Not a server reply, or a "kiss-o'-death" (e.g. rate limited).
+				record_failure(&probe->result, EPROTO);
+				break;
 			}
-#endif
-			// Bind it to the client w/optional desired source port
-			if (bind(sock_fd, (struct sockaddr *)&client_addr, sizeof(client_addr)) < 0)
+
+			// txTm_s contains the number of seconds passed since 00:00:00 UTC Jan 1st 1900, as of when the packet left the NTP server.
+			// The Unix epoch is the number of seconds since 00:00:00 UTC Jan 1st 1970,
+			// therefore we subtract 70 years worth of seconds from the time returned by the NTP server.
+			probe->server_time = (time_t)((uint64_t)ntohl(packet.txTm_s) - NTP_TIMESTAMP_DELTA);
+			probe->result.latencies_ms.push_back(elapsed_ms(probe->sent_at, now));
+			break;
+		}
+	}
+}
+
+// Thread of the NTP servers: all the requests go through one socket bound to src_port, like the
+// Azure Sphere OS does, and the replies are matched to the requests by their originate time-stamp.
+static void probe_ntp_servers(std::vector<t_ntp_probe> *probes, int ntp_port, int src_port)
+{
+	// Resolve the server names concurrently
+	std::vector<std::thread> resolvers;
+	for (size_t i = 0; i < probes->size(); i++)
+	{
+		resolvers.push_back(std::thread([probes, i, ntp_port]()
+		{
+			t_ntp_probe *probe = &(*probes)[i];
+			memset(&probe->server_addr, 0, sizeof(probe->server_addr));
+			probe->server_addr.sin_family = AF_INET;
+			probe->server_addr.sin_port = htons(ntp_port);
+
+			int iRes = resolve_ipv4(probe->hostname, &probe->server_addr.sin_addr);
+			probe->resolved = iRes == 0;
+			if (probe->resolved)
 			{
-				iRes = getSocketErrorCode();
-				std::cerr << "bind() failed with error " << iRes << std::endl;
+				probe->result.address = format_ipv4(&probe->server_addr.sin_addr);
 			}
 			else
 			{
-				// Send the NTP packet
-				int sent_bytes = sendto(sock_fd, (const char *)&packet, sizeof(packet), 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
-				if (sent_bytes < 0)
-				{
-					iRes = getSocketErrorCode();
-					std::cerr << "sendto() failed with error " << iRes << std::endl;
-				}
-				else
-				{
-					// Receive the NTP data back
-					socklen_t client_addr_len = sizeof(client_addr);
-					int recv_bytes = recvfrom(sock_fd, (char *)&packet, sizeof(packet), 0, (struct sockaddr *)&client_addr, &client_addr_len);
-					if (recv_bytes < 0)
-					{
-						iRes = getSocketErrorCode();
-						std::cerr << "recvfrom() failed with error " << iRes << std::endl;
-					}
-					else
-					{
-						// Firstly, the "endianness" of txTm_s needs to be converted from the network's big-endian to the local host's one.
-						// txTm_s contains the number of seconds passed since 00:00:00 UTC Jan 1st 1900, as of when the packet left the NTP server.
-						packet.txTm_s = ntohl(packet.txTm_s);
-
-						// The Unix epoch is the number of seconds since 00:00:00 UTC Jan 1st 1970,
-						// therefore we subtract 70 years worth of seconds from the time returned by the NTP server.
-						time_t txTm = (time_t)((uint64_t)packet.txTm_s - NTP_TIMESTAMP_DELTA);
-
-						// Print the time we got from the NTP server, accounting the local timezone and conversion from UTC time.
-						std::cout << ctime((const time_t *)&txTm);
-					}
-				}
+				probe->result.last_error = iRes;
 			}
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-			closesocket(sock_fd);
-#else
-			close(sock_fd);
-#endif
-		}
+		}));
 	}
-
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-	WSACleanup();
-#endif
-
-	return iRes;
-}
-
-int resolve_hostname(const char *hostname, int port)
-{
-	int iRes = 0;
-
-
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-	WSADATA wsaData;
-	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	for (size_t i = 0; i < resolvers.size(); i++)
 	{
-		iRes = getSocketErrorCode();
-		std::cerr << "WSAStartup() failed with error code " << iRes << std::endl;
+		resolvers[i].join();
+	}
 
-		WSACleanup();
-		return iRes;
+	// Open an UDP socket
+	int sock_fd = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock_fd < 0)
+	{
+		std::cerr << "socket() open error " << getSocketErrorCode() << std::endl;
+		return;
 	}
-#endif
 
-	// Does the host exist?
-	std::cout << "- Resolving " << hostname << "... ";
-	struct hostent *server = gethostbyname(hostname);
-	if (server == NULL)
+	// Bind it to the desired source port
+	struct sockaddr_in client_addr;
+	memset(&client_addr, 0, sizeof(client_addr));
+	client_addr.sin_family = AF_INET;
+	client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	client_addr.sin_port = htons(src_port);
+	if (bind(sock_fd, (struct sockaddr *)&client_addr, sizeof(client_addr)) < 0 || set_non_blocking(sock_fd) != 0)
 	{
-		iRes = getSocketErrorCode();
-		std::cout << "FAILED (errno=" << iRes << ")" << std::endl;
+		std::cerr << "bind() failed with error " << getSocketErrorCode() << std::endl;
+		close_socket(sock_fd);
+		return;
 	}
-	else
+
+	probe_clock::time_point now = probe_clock::now();
+	for (size_t i = 0; i < probes->size(); i++)
 	{
-		// Retrieve the server address
-		struct sockaddr_in server_addr;
-		memset(&server_addr, 0, sizeof(server_addr));
-		server_addr.sin_family = AF_INET;
-		server_addr.sin_addr.s_addr = *(long *)(server->h_addr_list[0]);
+		(*probes)[i].next_at = now;
+	}
 
-		// Let's attempt a dummy connection
-		std::cout << "success --> connecting to " << inet_ntoa(*((struct in_addr *)server->h_addr)) << ":" << port << "... ";
-		int sock_fd = (int)socket(AF_INET, SOCK_STREAM, 0);
-		if (sock_fd < 0)
-		{
-			iRes = getSocketErrorCode();
-			std::cerr << "socket() open error " << iRes << std::endl;
-		}
-		else
+	for (;;)
+	{
+		// Expire the requests past their deadline, send the next ones and find when to wake up next.
+		now = probe_clock::now();
+		probe_clock::time_point wake_at = now + std::chrono::milliseconds(PROBE_TIMEOUT_MS);
+		bool pending = false;
+		for (size_t i = 0; i < probes->size(); i++)
 		{
-			server_addr.sin_port = htons(port);
-			if (connect(sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+			t_ntp_probe *probe = &(*probes)[i];
+			if (!probe->resolved)
 			{
-				iRes = getSocketErrorCode();
-				std::cout << "FAILED (errno=" << iRes << ")" << std::endl;
+				continue;
+			}
+
+			if (probe->in_flight)
+			{
+				probe_clock::time_point deadline = probe->sent_at + std::chrono::milliseconds(PROBE_TIMEOUT_MS);
+				if (now < deadline)
+				{
+					pending = true;
+					wake_at = std::min(wake_at, deadline);
+					continue;
+				}
+				probe->in_flight = false;
+				probe->next_at = now + std::chrono::milliseconds(PROBE_INTERVAL_MS);
+				record_failure(&probe->result, PROBE_ERROR_TIMEOUT);
+			}
+			if (probe->result.attempts >= PROBE_SAMPLES)
+			{
+				continue;
+			}
+
+			pending = true;
+			if (now < probe->next_at)
+			{
+				wake_at = std::min(wake_at, probe->next_at);
+				continue;
+			}
+			uint32_t request_id = (uint32_t)(i << 8 | probe->result.attempts);
+			int iRes = send_ntp_request(sock_fd, probe, request_id);
+			if (iRes != 0)
+			{
+				record_failure(&probe->result, iRes);
+				probe->next_at = now + std::chrono::milliseconds(PROBE_INTERVAL_MS);
+				wake_at = std::min(wake_at, probe->next_at);
 			}
 			else
 			{
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-				closesocket(sock_fd);
-#else
-				close(sock_fd);
-#endif
-				std::cout << "success!" << std::endl;
+				wake_at = std::min(wake_at, probe->sent_at + std::chrono::milliseconds(PROBE_TIMEOUT_MS));
 			}
 		}
-	}
+		if (!pending)
+		{
+			break;
+		}
 
-#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
-	WSACleanup();
-#endif
+		// Wait for replies
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(sock_fd, &read_fds);
+		struct timeval tv = to_timeval(wake_at - probe_clock::now());
+		if (select(sock_fd + 1, &read_fds, NULL, NULL, &tv) > 0)
+		{
+			receive_ntp_replies(sock_fd, *probes);
+		}
+	}
 
-	return iRes;
+	close_socket(sock_fd);
 }
 
 int main(int argc, char **argv)
 {
 	std::cout << "Azure Sphere network-checkup utility." << std::endl << std::endl;
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		std::cerr << "WSAStartup() failed with error code " << getSocketErrorCode() << std::endl;
+		return 1;
+	}
+#endif
+
 	try
 	{
-		std::cout << "Querying required NTP servers..." << std::endl;
+		std::vector<t_ntp_probe> ntp_probes;
 		for (int i = 0; *ntpServers[i]; i++)
 		{
-			query_ntp_server(ntpServers[i], NTP_PORT, NTP_PORT_OUT);
+			t_ntp_probe probe = t_ntp_probe();
+			probe.hostname = ntpServers[i];
+			ntp_probes.push_back(probe);
+		}
+
+		int endpoint_count = 0;
+		while (*endpoints[endpoint_count].hostname)
+		{
+			endpoint_count++;
+		}
+		std::vector<t_endpoint_probe> endpoint_probes(endpoint_count, t_endpoint_probe());
+
+		// Start every probe, then wait for all of them
+		std::cout << "Probing " << ntp_probes.size() << " NTP servers and the required endpoints, "
+			<< PROBE_SAMPLES << " measurements each (timeout " << PROBE_TIMEOUT_MS << " ms)..." << std::endl;
+		probe_clock::time_point start = probe_clock::now();
+
+		std::vector<std::thread> workers;
+		workers.push_back(std::thread(probe_ntp_servers, &ntp_probes, NTP_PORT, NTP_PORT_OUT));
+		for (int i = 0; i < endpoint_count; i++)
+		{
+			if (-1 != endpoints[i].port)
+			{
+				workers.push_back(std::thread(probe_endpoint, &endpoints[i], &endpoint_probes[i]));
+			}
+		}
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+
+		std::cout << "Survey finished in " << (long long)elapsed_ms(start, probe_clock::now()) << " ms." << std::endl;
+
+		std::cout << std::endl << "Querying required NTP servers..." << std::endl;
+		for (size_t i = 0; i < ntp_probes.size(); i++)
+		{
+			const t_ntp_probe *probe = &ntp_probes[i];
+			std::cout << "- time from " << probe->hostname;
+			if (!probe->resolved)
+			{
+				std::cout << "<???> --> getaddrinfo() error " << probe->result.last_error << std::endl;
+				continue;
+			}
+
+			std::cout << "<" << probe->result.address << "> --> ";
+			if (!probe->result.latencies_ms.empty())
+			{
+				// Print the time we got from the NTP server, accounting the local timezone and conversion from UTC time.
+				char time_text[32];
+				strftime(time_text, sizeof(time_text), "%a %b %d %H:%M:%S %Y", localtime(&probe->server_time));
+				std::cout << time_text << ", ";
+			}
+			std::cout << format_result(&probe->result) << std::endl;
 		}
 
 		std::cout << std::endl << "Querying required endpoints..." << std::endl;
-		for (int i = 0; *endpoints[i].hostname; i++)
+		for (int i = 0; i < endpoint_count; i++)
 		{
 			if (-1 == endpoints[i].port)
 			{
 				// This entry is a group description
 				std::cout << std::endl << endpoints[i].hostname << std::endl;
+				continue;
 			}
-			else
+
+			const t_endpoint_probe *probe = &endpoint_probes[i];
+			std::cout << "- " << endpoints[i].hostname << ":" << endpoints[i].port;
+			if (!probe->dns.address.empty())
 			{
-				resolve_hostname(endpoints[i].hostname, endpoints[i].port);
+				std::cout << "<" << probe->dns.address << ">";
 			}
+			std::cout << " --> DNS " << format_result(&probe->dns) << " | TCP " << format_result(&probe->tcp) << std::endl;
 		}
 		std::cout << std::endl;
 	}
@@ -368,5 +701,9 @@ int main(int argc, char **argv)
 		std::cout << std::endl << "Unexpected exception executing checks!" << std::endl;
 	}
 
+#if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER)
+	WSACleanup();
+#endif
+
 	return 0;
 }
@@ -0,0 +1,335 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This high-level application streams an 8-bit PCM clip to the PWMAudio real-time app, which
+// plays it on PWM0. The clip (an ascending C major scale) is synthesized at startup and sent one
+// block at a time, each time the real-time app reports a free buffer. The playback statistics
+// (sample clock jitter and underruns) reported by the real-time app are logged.
+//
+// It uses the following Azure Sphere libraries
+// - log (displays messages in the Device Output window during debugging)
+// - application (establish a connection with a real-time capable application)
+// - eventloop (system invokes handlers for timer and socket events)
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <applibs/application.h>
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "../pcm_protocol.h"
+#include "eventloop_timer_utilities.h"
+
+/// <summary>
+/// Exit codes for this application. These are used for the
+/// application exit code. They must all be between zero and 255,
+/// where zero is reserved for successful termination.
+/// </summary>
+typedef enum {
+    ExitCode_Success = 0,
+    ExitCode_TermHandler_SigTerm = 1,
+    ExitCode_TimerHandler_Consume = 2,
+    ExitCode_SendMsg_Send = 3,
+    ExitCode_SocketHandler_Recv = 4,
+    ExitCode_Init_EventLoop = 5,
+    ExitCode_Init_ReplayTimer = 6,
+    ExitCode_Init_Connection = 7,
+    ExitCode_Init_SetSockOpt = 8,
+    ExitCode_Init_RegisterIo = 9,
+    ExitCode_Init_Clip = 10,
+    ExitCode_Main_EventLoopFail = 11
+} ExitCode;
+
+// Requested sample rate: the real-time app plays at the closest supported rate.
+#define CLIP_SAMPLE_RATE 8192
+#define CLIP_NOTE_MS 300
+#define CLIP_AMPLITUDE 100      // out of 127
+#define CLIP_REPLAY_DELAY_SECONDS 2
+
+#define TWO_PI 6.28318531f
+
+static const char rtAppComponentId[] = "2d9ed42d-cc67-4f0d-ae83-2df45a2ecb1b";
+
+static const float notesHz[] = {262, 294, 330, 350, 392, 440, 494, 523};
+
+static EventLoop *eventLoop = NULL;
+static EventLoopTimer *replayTimer = NULL;
+static EventRegistration *socketEventReg = NULL;
+static int sockFd = -1;
+static volatile sig_atomic_t exitCode = ExitCode_Success;
+
+static uint8_t *clip = NULL;
+static size_t clipLength = 0;
+static size_t clipPosition = 0;
+static bool stopSent = false;
+
+static void TerminationHandler(int signalNumber);
+static void ReplayTimerEventHandler(EventLoopTimer *timer);
+static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static ExitCode InitHandlers(void);
+static void CloseHandlers(void);
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    exitCode = ExitCode_TermHandler_SigTerm;
+}
+
+/// <summary>
+///     Synthesizes the clip: one sine tone per note, with a short fade in and out so the notes
+///     don't click.
+/// </summary>
+static bool SynthesizeClip(void)
+{
+    const size_t noteLength = CLIP_SAMPLE_RATE * CLIP_NOTE_MS / 1000;
+    const size_t fadeLength = noteLength / 10;
+    const size_t noteCount = sizeof(notesHz) / sizeof(notesHz[0]);
+
+    clip = malloc(noteLength * noteCount);
+    if (clip == NULL) {
+        return false;
+    }
+
+    uint8_t *sample = clip;
+    for (size_t note = 0; note < noteCount; note++) {
+        for (size_t i = 0; i < noteLength; i++) {
+            float envelope = 1.0f;
+            if (i < fadeLength) {
+                envelope = (float)i / fadeLength;
+            } else if (i >= noteLength - fadeLength) {
+                envelope = (float)(noteLength - i) / fadeLength;
+            }
+            float value = sinf(TWO_PI * notesHz[note] * i / CLIP_SAMPLE_RATE);
+            *sample++ = (uint8_t)(128 + lrintf(CLIP_AMPLITUDE * envelope * value));
+        }
+    }
+
+    clipLength = noteLength * noteCount;
+    return true;
+}
+
+/// <summary>
+///     Sends a message to the real-time app.
+/// </summary>
+static void SendMessage(const void *message, size_t size)
+{
+    if (send(sockFd, message, size, 0) == -1) {
+        Log_Debug("ERROR: Unable to send message: %d (%s)\n", errno, strerror(errno));
+        exitCode = ExitCode_SendMsg_Send;
+    }
+}
+
+/// <summary>
+///     Asks the real-time app to play the clip from the start. It replies with two
+///     PCM_MSG_BUFFER_FREE messages.
+/// </summary>
+static void StartClip(void)
+{
+    const pcm_start_message_t start = {.type = PCM_CMD_START, .sampleRate = CLIP_SAMPLE_RATE};
+
+    clipPosition = 0;
+    stopSent = false;
+    Log_Debug("Playing %zu samples at %d Hz\n", clipLength, CLIP_SAMPLE_RATE);
+    SendMessage(&start, sizeof(start));
+}
+
+/// <summary>
+///     Sends the next block of the clip, or PCM_CMD_STOP once all of it was sent.
+/// </summary>
+static void SendNextBlock(void)
+{
+    static pcm_data_message_t data = {.type = PCM_CMD_DATA};
+
+    if (clipPosition < clipLength) {
+        size_t length = clipLength - clipPosition;
+        if (length > PCM_BLOCK_SIZE) {
+            length = PCM_BLOCK_SIZE;
+        }
+        data.length = (uint32_t)length;
+        memcpy(data.samples, clip + clipPosition, length);
+        clipPosition += length;
+        SendMessage(&data, offsetof(pcm_data_message_t, samples) + length);
+    } else if (!stopSent) {
+        const pcm_header_t stop = {.type = PCM_CMD_STOP};
+        stopSent = true;
+        SendMessage(&stop, sizeof(stop));
+
+        static const struct timespec replayDelay = {.tv_sec = CLIP_REPLAY_DELAY_SECONDS, .tv_nsec = 0};
+        SetEventLoopTimerOneShot(replayTimer, &replayDelay);
+    }
+}
+
+static void LogStats(const pcm_stats_message_t *stats)
+{
+    Log_Debug("PCM %lu Hz: %lu samples played, %lu underruns (%lu samples of silence), "
+              "sample period min %lu ns, max %lu ns, mean %lu ns\n",
+              (unsigned long)stats->sampleRate, (unsigned long)stats->samplesPlayed,
+              (unsigned long)stats->underruns, (unsigned long)stats->underrunSamples,
+              (unsigned long)stats->periodMinNs, (unsigned long)stats->periodMaxNs,
+              (unsigned long)stats->periodMeanNs);
+}
+
+/// <summary>
+///     Handle socket event by reading the messages of the real-time app.
+/// </summary>
+static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    pcm_stats_message_t message;
+
+    ssize_t bytesReceived = recv(fd, &message, sizeof(message), 0);
+    if (bytesReceived == -1) {
+        Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
+        exitCode = ExitCode_SocketHandler_Recv;
+        return;
+    }
+    if ((size_t)bytesReceived < sizeof(pcm_header_t)) {
+        return;
+    }
+
+    switch (message.type) {
+    case PCM_MSG_BUFFER_FREE:
+        SendNextBlock();
+        break;
+
+    case PCM_MSG_STATS:
+        if ((size_t)bytesReceived == sizeof(pcm_stats_message_t)) {
+            LogStats(&message);
+        }
+        break;
+
+    default:
+        Log_Debug("Unexpected message type 0x%lx\n", (unsigned long)message.type);
+        break;
+    }
+}
+
+/// <summary>
+///     Handle the replay timer event by playing the clip again.
+/// </summary>
+static void ReplayTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_TimerHandler_Consume;
+        return;
+    }
+
+    StartClip();
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, the replay timer and the connection to the
+///     real-time app.
+/// </summary>
+/// <returns>
+///     ExitCode_Success if all resources were allocated successfully; otherwise another
+///     ExitCode value which indicates the specific failure.
+/// </returns>
+static ExitCode InitHandlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    if (!SynthesizeClip()) {
+        return ExitCode_Init_Clip;
+    }
+
+    eventLoop = EventLoop_Create();
+    if (eventLoop == NULL) {
+        Log_Debug("Could not create event loop.\n");
+        return ExitCode_Init_EventLoop;
+    }
+
+    replayTimer = CreateEventLoopDisarmedTimer(eventLoop, &ReplayTimerEventHandler);
+    if (replayTimer == NULL) {
+        return ExitCode_Init_ReplayTimer;
+    }
+
+    // Open a connection to the RTApp.
+    sockFd = Application_Connect(rtAppComponentId);
+    if (sockFd == -1) {
+        Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_Connection;
+    }
+
+    // Set timeout, to handle case where real-time capable application does not respond.
+    static const struct timeval recvTimeout = {.tv_sec = 5, .tv_usec = 0};
+    int result = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+    if (result == -1) {
+        Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_SetSockOpt;
+    }
+
+    // Register handler for incoming messages from real-time capable application.
+    socketEventReg = EventLoop_RegisterIo(eventLoop, sockFd, EventLoop_Input, SocketEventHandler,
+                                          /* context */ NULL);
+    if (socketEventReg == NULL) {
+        Log_Debug("ERROR: Unable to register socket event: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_RegisterIo;
+    }
+
+    StartClip();
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     Closes a file descriptor and prints an error on failure.
+/// </summary>
+static void CloseFdAndPrintError(int fd, const char *fdName)
+{
+    if (fd >= 0) {
+        int result = close(fd);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
+        }
+    }
+}
+
+/// <summary>
+///     Clean up the resources previously allocated.
+/// </summary>
+static void CloseHandlers(void)
+{
+    DisposeEventLoopTimer(replayTimer);
+    EventLoop_UnregisterIo(eventLoop, socketEventReg);
+    EventLoop_Close(eventLoop);
+
+    Log_Debug("Closing file descriptors.\n");
+    CloseFdAndPrintError(sockFd, "Socket");
+
+    free(clip);
+}
+
+int main(void)
+{
+    Log_Debug("PWMAudio high-level application\n");
+    Log_Debug("Streams a PCM clip to the PWMAudio real-time app and logs its playback statistics.\n");
+
+    exitCode = InitHandlers();
+
+    while (exitCode == ExitCode_Success) {
+        EventLoop_Run_Result result = EventLoop_Run(eventLoop, -1, true);
+        // Continue if interrupted by signal, e.g. due to breakpoint being set.
+        if (result == EventLoop_Run_Failed && errno != EINTR) {
+            exitCode = ExitCode_Main_EventLoopFail;
+        }
+    }
+
+    CloseHandlers();
+    Log_Debug("Application exiting.\n");
+    return exitCode;
+}
@@ -12,13 +12,40 @@
 #include "lib/GPIO.h"
 #include "lib/mt3620/gpio.h"
 #include "lib/GPT.h"
-#include "lib/UART.h"
-#include "lib/Print.h"
-#include "lib/GPT.h"
+
+#include "Socket.h"
+#include "pcm_player.h"
+
+// Plays the C major scale at startup instead of waiting for PCM from the high-level app.
+// #define PLAY_SCALE_DEMO
 
 #define USE_2M_SOURCE
 // #define USE_32K_SOURCE
 
+// Component ID of the high-level app (HLApp) streaming the samples.
+static const Component_Id A7ID =
+{
+    .seg_0 = 0xc1e5a2f4,
+    .seg_1 = 0x6b3d,
+    .seg_2 = 0x4e8a,
+    .seg_3_4 = {0x9f, 0x17, 0x2d, 0x5b, 0x8c, 0x0e, 0x4a, 0x93}
+};
+
+static Socket *socket = NULL;
+static GPT *statsTimer = NULL;
+static pcm_data_message_t msg;
+static bool reportStats = false;
+
+// Callbacks
+typedef struct CallbackNode {
+    bool enqueued;
+    struct CallbackNode *next;
+    void *data;
+    void (*cb)(void*);
+} CallbackNode;
+
+static void EnqueueCallback(CallbackNode *node);
+
 const uint32_t notes_hz[8] = {
     262, // c
     294, // d
@@ -49,22 +76,199 @@ void set_pwm0(int frequency_hz) {
     PWM_ConfigurePin(0, base_frequency, tick_value, tick_value);
 }
 
+#if defined(PLAY_SCALE_DEMO)
+static void playScale(void)
+{
+    GPT *timer = GPT_Open(MT3620_UNIT_GPT1, 32768, GPT_MODE_REPEAT);
+
+    for (int i = 0; i < 8; i++) {
+        set_pwm0(notes_hz[i]);
+        GPT_WaitTimer_Blocking(timer, 500, GPT_UNITS_MILLISEC);
+    }
+
+    for (int i = 7; i >= 0; i--) {
+        set_pwm0(notes_hz[i]);
+        GPT_WaitTimer_Blocking(timer, 500, GPT_UNITS_MILLISEC);
+    }
+
+    GPT_Close(timer);
+}
+#endif
+
+static void sendMessage(const void *message, uint32_t size)
+{
+    // Fails while the HLApp isn't connected: it starts a new clip when it connects.
+    (void)Socket_Write(socket, &A7ID, message, size);
+}
+
+static void sendStats(void)
+{
+    pcm_stats_message_t stats;
+    PcmPlayer_GetStats(&stats);
+    stats.type = PCM_MSG_STATS;
+    sendMessage(&stats, sizeof(stats));
+}
+
+static void handleBufferFree(void *data)
+{
+    (void)data;
+
+    const pcm_header_t header = { .type = PCM_MSG_BUFFER_FREE };
+    sendMessage(&header, sizeof(header));
+}
+
+// Called from the sample interrupt: the message is sent from the main loop.
+static void handleBufferFreeIrq(void)
+{
+    static CallbackNode cbn = { .enqueued = false, .cb = handleBufferFree };
+    EnqueueCallback(&cbn);
+}
+
+static void handleStatsTimer(void *data)
+{
+    (void)data;
+
+    if (!reportStats) {
+        return;
+    }
+
+    sendStats();
+
+    // After PCM_CMD_STOP, a final report once the last samples have been played.
+    if (!PcmPlayer_IsPlaying()) {
+        reportStats = false;
+    }
+}
+
+static void handleStatsTimerIrq(GPT *timer)
+{
+    (void)timer;
+
+    static CallbackNode cbn = { .enqueued = false, .cb = handleStatsTimer };
+    EnqueueCallback(&cbn);
+}
+
+static void handleRecvMsg(void *handle)
+{
+    Socket *socket = (Socket*)handle;
+
+    Component_Id senderId;
+    uint32_t msg_size = sizeof(msg);
+
+    if (Socket_NegotiationPending(socket)) {
+        // NB: this is blocking, if you want to protect against hanging,
+        //     add a timeout
+        if (Socket_Negotiate(socket) != ERROR_NONE) {
+            return;
+        }
+    }
+
+    if (Socket_Read(socket, &senderId, &msg, &msg_size) != ERROR_NONE || msg_size < sizeof(pcm_header_t)) {
+        return;
+    }
+
+    const pcm_start_message_t *start = (const pcm_start_message_t *)&msg;
+    const pcm_header_t header = { .type = PCM_MSG_BUFFER_FREE };
+
+    switch (msg.type) {
+        case PCM_CMD_START:
+            if (msg_size < sizeof(pcm_start_message_t) || PcmPlayer_Start(start->sampleRate) == 0) {
+                break;
+            }
+            reportStats = true;
+
+            // Both buffers are free.
+            sendMessage(&header, sizeof(header));
+            sendMessage(&header, sizeof(header));
+            break;
+
+        case PCM_CMD_DATA:
+            if (msg_size < offsetof(pcm_data_message_t, samples) ||
+                msg.length > msg_size - offsetof(pcm_data_message_t, samples)) {
+                break;
+            }
+            // Only sent after PCM_MSG_BUFFER_FREE, so a buffer is free unless the HLApp
+            // doesn't follow the protocol: the samples are then dropped.
+            PcmPlayer_Queue(msg.samples, msg.length);
+            break;
+
+        case PCM_CMD_STOP:
+            PcmPlayer_StopWhenDrained();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void handleRecvMsgWrapper(Socket *handle)
+{
+    static CallbackNode cbn = {.enqueued = false, .cb = handleRecvMsg, .data = NULL};
+
+    if (!cbn.data) {
+        cbn.data = handle;
+    }
+
+    EnqueueCallback(&cbn);
+}
+
+static CallbackNode *volatile callbacks = NULL;
+
+static void EnqueueCallback(CallbackNode *node)
+{
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    if (!node->enqueued) {
+        CallbackNode *prevHead = callbacks;
+        node->enqueued = true;
+        callbacks = node;
+        node->next = prevHead;
+    }
+    NVIC_RestoreIRQs(prevBasePri);
+}
+
+static void InvokeCallbacks(void)
+{
+    CallbackNode *node;
+    do {
+        uint32_t prevBasePri = NVIC_BlockIRQs();
+        node = callbacks;
+        if (node) {
+            node->enqueued = false;
+            callbacks = node->next;
+        }
+        NVIC_RestoreIRQs(prevBasePri);
+
+        if (node) {
+            (node->cb)(node->data);
+        }
+    } while (node);
+}
+
 _Noreturn void RTCoreMain(void)
 {
     VectorTableInit();
     CPUFreq_Set(26000000);
 
-    GPT *timer = GPT_Open(MT3620_UNIT_GPT1, 32768, GPT_MODE_REPEAT);
+#if defined(PLAY_SCALE_DEMO)
+    playScale();
+#endif
 
-    while(1) {
-        for (int i = 0; i < 8; i++) {
-            set_pwm0(notes_hz[i]);
-            GPT_WaitTimer_Blocking(timer, 500, GPT_UNITS_MILLISEC);
+    if (PcmPlayer_Init(handleBufferFreeIrq) != ERROR_NONE) {
+        for (;;) {
+            __asm__("wfi");
         }
+    }
 
-        for (int i = 7; i >= 0; i--) {
-            set_pwm0(notes_hz[i]);
-            GPT_WaitTimer_Blocking(timer, 500, GPT_UNITS_MILLISEC);
-        }
+    // Stats once a second, on the other 32 kHz timer (hardware repeat).
+    statsTimer = GPT_Open(MT3620_UNIT_GPT1, 32768, GPT_MODE_REPEAT);
+    if (statsTimer) {
+        GPT_StartTimeout(statsTimer, 1000, GPT_UNITS_MILLISEC, handleStatsTimerIrq);
     }
-}
\ No newline at end of file
+
+    socket = Socket_Open(handleRecvMsgWrapper);
+
+    for (;;) {
+        __asm__("wfi");
+        InvokeCallbacks();
+    }
+}
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lib/CPUFreq.h"
+#include "lib/NVIC.h"
+#include "lib/GPIO.h"
+#include "lib/mt3620/gpio.h"
+#include "lib/GPT.h"
+
+#include "pcm_player.h"
+
+// PWM0 (GPIO 0) is output 0 of PWM controller 0.
+#define PCM_PWM_PIN 0
+#define PCM_PWM_CONTROLLER 0
+
+// Carrier period in ticks of the 26 MHz clock: ~102 kHz, well above the audio band, and one tick
+// per sample level.
+#define PCM_PWM_PERIOD 255
+#define PCM_SILENCE 128
+
+// Sample clock: GPT0 in repeat mode (reloaded by hardware, so the interrupt latency doesn't add
+// up). GPT4 runs free at the CPU clock to time the interrupts.
+#define PCM_SAMPLE_TIMER MT3620_UNIT_GPT0
+#define PCM_CLOCK_TIMER MT3620_UNIT_GPT4
+
+typedef struct {
+    uint8_t samples[PCM_BLOCK_SIZE];
+    uint32_t length;
+    volatile bool full;     // set by PcmPlayer_Queue, cleared by the interrupt once played
+} PcmBuffer;
+
+static PcmBuffer buffers[2];
+static uint32_t playIndex = 0;      // buffer the interrupt plays from
+static uint32_t playPosition = 0;
+static uint32_t fillIndex = 0;      // buffer PcmPlayer_Queue fills next
+
+static GPT *sampleTimer = NULL;
+static GPT *clockTimer = NULL;
+static uint32_t clockHz = 0;
+static uint32_t sampleRate = 0;
+static void (*bufferFreeCallback)(void) = NULL;
+
+static volatile bool playing = false;
+static volatile bool stopWhenDrained = false;
+static bool priming = false;        // no samples played yet: waiting isn't an underrun
+static bool inUnderrun = false;
+
+// Written by the interrupt, read and reset by PcmPlayer_GetStats with the interrupts blocked.
+static uint32_t samplesPlayed = 0;
+static uint32_t underruns = 0;
+static uint32_t underrunSamples = 0;
+static uint32_t lastTick = 0;
+static bool haveLastTick = false;
+static uint32_t periodMin = UINT32_MAX;
+static uint32_t periodMax = 0;
+static uint64_t periodSum = 0;
+static uint32_t periodCount = 0;
+
+static inline void SetDuty(uint8_t sample)
+{
+    // Keep both phases at least one tick long.
+    uint32_t on = sample < 1 ? 1 : (sample > PCM_PWM_PERIOD - 1 ? PCM_PWM_PERIOD - 1 : sample);
+
+    // Only the on/off times change: the clock and control setup by PWM_ConfigurePin are kept,
+    // and the kick latches the new times.
+    mt3620_pwm[PCM_PWM_CONTROLLER]->pwm0_param_s0 = ((PCM_PWM_PERIOD - on) << 16) | on;
+    MT3620_PWM_FIELD_WRITE(PCM_PWM_CONTROLLER, pwm0_ctrl, kick, 1);
+}
+
+static void SampleTimerIrq(GPT *timer)
+{
+    (void)timer;
+
+    uint32_t now = GPT_GetCount(clockTimer);
+    if (haveLastTick) {
+        uint32_t period = now - lastTick;
+        if (period < periodMin) {
+            periodMin = period;
+        }
+        if (period > periodMax) {
+            periodMax = period;
+        }
+        periodSum += period;
+        periodCount++;
+    }
+    lastTick = now;
+    haveLastTick = true;
+
+    if (!playing) {
+        return;
+    }
+
+    PcmBuffer *buffer = &buffers[playIndex];
+    if (!buffer->full) {
+        if (stopWhenDrained) {
+            playing = false;
+        } else if (!priming) {
+            if (!inUnderrun) {
+                underruns++;
+                inUnderrun = true;
+            }
+            underrunSamples++;
+        }
+        SetDuty(PCM_SILENCE);
+        return;
+    }
+
+    priming = false;
+    inUnderrun = false;
+    SetDuty(buffer->samples[playPosition++]);
+    samplesPlayed++;
+
+    if (playPosition >= buffer->length) {
+        playPosition = 0;
+        buffer->full = false;
+        playIndex ^= 1;
+        if (bufferFreeCallback) {
+            bufferFreeCallback();
+        }
+    }
+}
+
+int32_t PcmPlayer_Init(void (*bufferFree)(void))
+{
+    bufferFreeCallback = bufferFree;
+
+    int32_t error = PWM_ConfigurePin(PCM_PWM_PIN, MT3620_PWM_XTAL, PCM_SILENCE, PCM_PWM_PERIOD - PCM_SILENCE);
+    if (error != ERROR_NONE) {
+        return error;
+    }
+
+    clockHz = CPUFreq_Get();
+    clockTimer = GPT_Open(PCM_CLOCK_TIMER, clockHz, GPT_MODE_NONE);
+    if (!clockTimer) {
+        return ERROR;
+    }
+    if ((error = GPT_Start_Freerun(clockTimer)) != ERROR_NONE) {
+        return error;
+    }
+    float speed;
+    if (GPT_GetSpeed(clockTimer, &speed) == ERROR_NONE) {
+        clockHz = (uint32_t)speed;
+    }
+
+    sampleTimer = GPT_Open(PCM_SAMPLE_TIMER, PCM_TIMER_HZ, GPT_MODE_REPEAT);
+    if (!sampleTimer) {
+        return ERROR;
+    }
+
+    return ERROR_NONE;
+}
+
+uint32_t PcmPlayer_Start(uint32_t requestedRate)
+{
+    if (!sampleTimer || requestedRate == 0) {
+        return 0;
+    }
+
+    // Closest rate PCM_TIMER_HZ / n, within the supported range.
+    uint32_t divider = (PCM_TIMER_HZ + requestedRate / 2) / requestedRate;
+    uint32_t minDivider = PCM_TIMER_HZ / PCM_MAX_SAMPLE_RATE;
+    uint32_t maxDivider = PCM_TIMER_HZ / PCM_MIN_SAMPLE_RATE;
+    divider = divider < minDivider ? minDivider : (divider > maxDivider ? maxDivider : divider);
+
+    if (GPT_IsEnabled(sampleTimer)) {
+        GPT_Stop(sampleTimer);
+    }
+
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    buffers[0].full = false;
+    buffers[1].full = false;
+    playIndex = 0;
+    playPosition = 0;
+    fillIndex = 0;
+    priming = true;
+    inUnderrun = false;
+    stopWhenDrained = false;
+    haveLastTick = false;
+    samplesPlayed = 0;
+    underruns = 0;
+    underrunSamples = 0;
+    periodMin = UINT32_MAX;
+    periodMax = 0;
+    periodSum = 0;
+    periodCount = 0;
+    playing = true;
+    NVIC_RestoreIRQs(prevBasePri);
+
+    // The timeout is given in microseconds: round up, so it converts back to 'divider' ticks.
+    uint32_t timeoutUs = (divider * 1000000 + PCM_TIMER_HZ - 1) / PCM_TIMER_HZ;
+    if (GPT_StartTimeout(sampleTimer, timeoutUs, GPT_UNITS_MICROSEC, SampleTimerIrq) != ERROR_NONE) {
+        playing = false;
+        return 0;
+    }
+
+    sampleRate = PCM_TIMER_HZ / divider;
+    return sampleRate;
+}
+
+void PcmPlayer_StopWhenDrained(void)
+{
+    stopWhenDrained = true;
+}
+
+bool PcmPlayer_IsPlaying(void)
+{
+    return playing;
+}
+
+bool PcmPlayer_Queue(const uint8_t *samples, uint32_t length)
+{
+    PcmBuffer *buffer = &buffers[fillIndex];
+    if (buffer->full || length == 0) {
+        return false;
+    }
+
+    if (length > PCM_BLOCK_SIZE) {
+        length = PCM_BLOCK_SIZE;
+    }
+    memcpy(buffer->samples, samples, length);
+    buffer->length = length;
+
+    // The samples must be written before the interrupt sees the buffer as full.
+    __asm__ volatile("dmb" ::: "memory");
+    buffer->full = true;
+    fillIndex ^= 1;
+    return true;
+}
+
+void PcmPlayer_GetStats(pcm_stats_message_t *stats)
+{
+    uint32_t prevBasePri = NVIC_BlockIRQs();
+    uint32_t min = periodMin, max = periodMax, count = periodCount;
+    uint64_t sum = periodSum;
+    stats->samplesPlayed = samplesPlayed;
+    stats->underruns = underruns;
+    stats->underrunSamples = underrunSamples;
+    periodMin = UINT32_MAX;
+    periodMax = 0;
+    periodSum = 0;
+    periodCount = 0;
+    NVIC_RestoreIRQs(prevBasePri);
+
+    stats->sampleRate = sampleRate;
+    if (count == 0 || clockHz == 0) {
+        stats->periodMinNs = stats->periodMaxNs = stats->periodMeanNs = 0;
+        return;
+    }
+    stats->periodMinNs = (uint32_t)((uint64_t)min * 1000000000ULL / clockHz);
+    stats->periodMaxNs = (uint32_t)((uint64_t)max * 1000000000ULL / clockHz);
+    stats->periodMeanNs = (uint32_t)(sum * 1000000000ULL / count / clockHz);
+}
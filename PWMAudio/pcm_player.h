@@ -0,0 +1,44 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pcm_protocol.h"
+
+// 8-bit PCM playback on PWM0: a GPT interrupt at the sample rate writes each sample to the duty
+// cycle of a ~100 kHz PWM carrier (26 MHz XTAL clock, 255 ticks per period), so the buzzer (or an
+// RC filter) averages it into the audio waveform. Samples are double buffered: the interrupt plays
+// one buffer while the other is filled from the intercore messages.
+
+/// <summary>
+/// Opens the timers and the PWM. 'bufferFree' is called from the sample interrupt when a buffer
+/// has been played and can be refilled (defer any work, i.e. sending a message).
+/// </summary>
+/// <returns>ERROR_NONE on success or an error code.</returns>
+int32_t PcmPlayer_Init(void (*bufferFree)(void));
+
+/// <summary>
+/// Starts playing at the supported rate closest to 'sampleRate' (PCM_TIMER_HZ / n), and marks
+/// both buffers free and resets the stats. Returns the actual rate, or 0 on failure.
+/// </summary>
+uint32_t PcmPlayer_Start(uint32_t sampleRate);
+
+/// <summary>
+/// Stops once the buffered samples have been played (PcmPlayer_IsPlaying then returns false).
+/// </summary>
+void PcmPlayer_StopWhenDrained(void);
+
+bool PcmPlayer_IsPlaying(void);
+
+/// <summary>
+/// Copies 'length' samples to a free buffer. Returns false if both buffers are full.
+/// </summary>
+bool PcmPlayer_Queue(const uint8_t *samples, uint32_t length);
+
+/// <summary>
+/// Fills 'stats' (without its type) and resets the interval counters.
+/// </summary>
+void PcmPlayer_GetStats(pcm_stats_message_t *stats);
@@ -0,0 +1,58 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// Messages between the high-level app (HLApp) and the PCM player on the real-time core.
+// This header is used by both apps. All fields are little-endian.
+//
+// The HLApp sends PCM_CMD_START, then a PCM_CMD_DATA block each time the RT app reports a free
+// buffer with PCM_MSG_BUFFER_FREE (both buffers are free after PCM_CMD_START). The RT app plays
+// one buffer while the other is filled; if neither is full when a sample is due, it plays silence
+// and counts an underrun. PCM_MSG_STATS is sent once a second while playing, and after PCM_CMD_STOP.
+
+// Samples per PCM_CMD_DATA message: 125 ms at 8192 Hz. With the message header it stays under
+// the 1040 byte intercore payload limit.
+#define PCM_BLOCK_SIZE 1024
+
+// The sample clock is the 32768 Hz GPT divided by an integer: 8192, 10923 or 16384 Hz (4, 3 or 2 ticks).
+#define PCM_TIMER_HZ 32768
+#define PCM_MIN_SAMPLE_RATE 8000
+#define PCM_MAX_SAMPLE_RATE 16384
+
+typedef enum {
+    PCM_CMD_START = 1,          // pcm_start_message_t
+    PCM_CMD_DATA = 2,           // pcm_data_message_t
+    PCM_CMD_STOP = 3,           // pcm_header_t: plays the buffered samples, then stops
+
+    PCM_MSG_BUFFER_FREE = 0x81, // pcm_header_t: send the next PCM_CMD_DATA
+    PCM_MSG_STATS = 0x82        // pcm_stats_message_t
+} pcm_message_type_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t type;
+} pcm_header_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t type;
+    uint32_t sampleRate;        // requested rate, the closest supported one is used
+} pcm_start_message_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t type;
+    uint32_t length;            // number of samples, up to PCM_BLOCK_SIZE
+    uint8_t samples[PCM_BLOCK_SIZE];  // unsigned 8-bit, 128 is silence
+} pcm_data_message_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t type;
+    uint32_t sampleRate;        // actual sample rate
+    uint32_t samplesPlayed;
+    uint32_t underruns;         // gaps: a sample was due and no buffer was full
+    uint32_t underrunSamples;   // samples of silence played during the gaps
+    uint32_t periodMinNs;       // shortest and longest interval between two sample interrupts,
+    uint32_t periodMaxNs;       // since the previous PCM_MSG_STATS
+    uint32_t periodMeanNs;
+} pcm_stats_message_t;
@@ -875,3 +875,124 @@ int FS_ReadFileForIndex(char* dirName, size_t fileIndex, uint8_t* data, size_t s
 	return 0;
 }
 
+
+/// <summary>
+/// Reads up to maxFiles consecutive files, starting at fileIndex (0 is the oldest file), using as few
+/// reads of the underlying media as possible: consecutive file slots are fetched with one ReadBlockCallback
+/// call of up to FS_MAX_READ_SIZE bytes, rather than two calls per file (header, data).
+/// The first 'size' bytes of each file are copied to data + (n * size), all files must be at least 'size' bytes.
+/// </summary>
+/// <param name="fileInfo">optional (may be NULL), receives maxFiles file entries</param>
+/// <returns> -1 on error, otherwise the number of files read (0 if fileIndex is past the newest file)</returns>
+int FS_ReadFilesForIndex(char* dirName, size_t fileIndex, size_t maxFiles, uint8_t* data, size_t size, struct fileEntry* fileInfo)
+{
+#ifdef SHOW_FUNCTION_TRACE
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	static uint8_t readBuffer[FS_MAX_READ_SIZE];
+
+	// If we haven't been initialized, bail.
+	if (!FS_IsFileSystemReady())
+	{
+		return -1;
+	}
+
+	// does the directory exist?
+	int dirIndex = 0;
+	struct dirEntry pDirEntry;
+	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
+	if (result == -1)
+		return -1;
+
+	struct directory pDir;
+	FS_GetFullDirectory(dirIndex, &pDir);
+
+	int numFiles = FS_GetNumberOfFilesInDirectory(dirName);
+	if (numFiles == -1)
+		return -1;
+
+	if (fileIndex >= (size_t)numFiles)
+		return 0;
+
+	if (maxFiles > (size_t)numFiles - fileIndex)
+		maxFiles = (size_t)numFiles - fileIndex;
+
+	uint32_t blocksPerSlot = FS_GetNumberOfBlocksPerFile(&pDir) + 1;	// file header + data blocks
+	uint32_t slotsPerRead = FS_MAX_READ_SIZE / (blocksPerSlot * BLOCK_SIZE);
+	if (slotsPerRead == 0 || size > pDir.maxFileSize)
+		return -1;
+
+	size_t filesRead = 0;
+	while (filesRead < maxFiles)
+	{
+		size_t slot = (fileIndex + filesRead + pDir.tail) % pDir.maxFiles;
+
+		// a single read can't wrap around the end of the directory
+		size_t count = maxFiles - filesRead;
+		if (count > slotsPerRead)
+			count = slotsPerRead;
+		if (count > pDir.maxFiles - slot)
+			count = pDir.maxFiles - slot;
+
+		result = _readBlockCallback(pDir.firstBlock + (uint32_t)(slot * blocksPerSlot), readBuffer, count * blocksPerSlot * BLOCK_SIZE);
+		if (result == -1)
+			return -1;
+
+		for (size_t x = 0; x < count; x++)
+		{
+			uint8_t* slotData = readBuffer + (x * blocksPerSlot * BLOCK_SIZE);
+			struct fileEntry* pFile = (struct fileEntry*)slotData;
+
+			if (size > pFile->fileSize)
+				return -1;
+
+			if (fileInfo != NULL)
+				memcpy(&fileInfo[filesRead], pFile, sizeof(struct fileEntry));
+
+			memcpy(data + (filesRead * size), slotData + BLOCK_SIZE, size);
+			filesRead++;
+		}
+	}
+
+	return (int)filesRead;
+}
+
+/// <summary>
+/// Deletes the numFiles oldest files in the circular buffer with a single root block write
+/// </summary>
+/// <param name="dirName"></param>
+/// <param name="numFiles"></param>
+/// <returns> returns -1 on error (directory doesn't exist, fewer files than numFiles), returns 0 on success</returns>
+int FS_DeleteOldestFilesInDirectory(char* dirName, size_t numFiles)
+{
+#ifdef SHOW_FUNCTION_TRACE
+	Log_Debug(">>> %s\n", __func__);
+#endif
+
+	// If we haven't been initialized, bail.
+	if (!FS_IsFileSystemReady())
+	{
+		return -1;
+	}
+
+	int dirIndex = 0;
+	struct dirEntry pDirEntry;
+	int result = FS_GetDirectoryFromName(dirName, &dirIndex, &pDirEntry);
+	if (result == -1)
+		return -1;
+
+	struct directory pDir;
+	FS_GetFullDirectory(dirIndex, &pDir);
+
+	int filesInDir = FS_GetNumberOfFilesInDirectory(dirName);
+	if (filesInDir == -1 || numFiles == 0 || numFiles > (size_t)filesInDir)
+		return -1;
+
+	pDir.dirFull = 0;
+	pDir.tail = (uint32_t)((pDir.tail + numFiles) % pDir.maxFiles);
+
+	result = FS_WriteDirectoryToRoot(&pDir, dirIndex);
+
+	return result;
+}
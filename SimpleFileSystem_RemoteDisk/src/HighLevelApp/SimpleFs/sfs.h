@@ -7,6 +7,12 @@
 
 #define BLOCK_SIZE 512
 
+// Largest single read issued by FS_ReadFilesForIndex, consecutive files are fetched with one
+// ReadBlockCallback call of up to this many bytes (the callback must support reads of this size).
+#ifndef FS_MAX_READ_SIZE
+#define FS_MAX_READ_SIZE (8 * BLOCK_SIZE)
+#endif
+
 struct dirEntry
 {
 	uint32_t	maxFiles;		// maxFiles * maxFileSize cannot exceed number of storage blocks
@@ -48,6 +54,10 @@ int FS_DeleteOldestFileInDirectory(char* dirName);
 int FS_GetFileInfoForIndex(char* dirName, size_t fileIndex, struct fileEntry* fileInfo);
 int FS_ReadFileForIndex(char* dirName, size_t fileIndex, uint8_t* data, size_t size);
 
+// Batch APIs (FIFO drain)
+int FS_ReadFilesForIndex(char* dirName, size_t fileIndex, size_t maxFiles, uint8_t* data, size_t size, struct fileEntry* fileInfo);
+int FS_DeleteOldestFilesInDirectory(char* dirName, size_t numFiles);
+
 
 
 
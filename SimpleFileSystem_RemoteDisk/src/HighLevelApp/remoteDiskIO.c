@@ -8,7 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-static uint8_t readBuffer[4096];
+static uint8_t readBuffer[REMOTE_DISK_MAX_READ_SIZE + 1];	// + 1 for the terminating null written by write_data
 
 // Curl stuff.
 struct url_data {
@@ -31,7 +31,7 @@ static size_t write_data(void* ptr, size_t size, size_t nmemb, struct url_data*
 	size_t n = (size * nmemb);
 
 	// bug out if the data returned is too large.
-	if (data->size + n > sizeof(readBuffer))
+	if (data->size + n > REMOTE_DISK_MAX_READ_SIZE)
 		return 0;
 
 	data->size += n;
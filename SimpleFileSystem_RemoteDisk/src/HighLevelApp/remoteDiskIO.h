@@ -4,5 +4,9 @@
 #pragma once
 
 #include <stdint.h>
+
+// Largest block range that can be fetched with one readBlockData call (see FS_MAX_READ_SIZE in sfs.h)
+#define REMOTE_DISK_MAX_READ_SIZE 4096
+
 uint8_t* readBlockData(uint32_t offset, uint32_t size);
 int writeBlockData(uint8_t* sectorData, uint32_t size, uint32_t offset);
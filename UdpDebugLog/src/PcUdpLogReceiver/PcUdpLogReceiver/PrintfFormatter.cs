@@ -0,0 +1,272 @@
+﻿/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+using System;
+using System.Globalization;
+using System.Text;
+
+namespace PcUdpLogReceiver
+{
+    // Formats the binary records sent by UdpLog_Binary: walks the printf format string, consuming the
+    // arguments encoded by the device as { u8 tag, value } (see udplog.c in SphereUdpLogSender).
+    static class PrintfFormatter
+    {
+        private const byte ArgInt32 = 4;
+        private const byte ArgInt64 = 8;
+        private const byte ArgDouble = (byte)'f';
+        private const byte ArgString = (byte)'s';
+
+        public static string Format(string format, byte[] bytes, int offset, int end)
+        {
+            StringBuilder output = new StringBuilder();
+
+            for (int i = 0; i < format.Length; i++)
+            {
+                if (format[i] != '%')
+                {
+                    output.Append(format[i]);
+                    continue;
+                }
+                if (++i >= format.Length)
+                {
+                    break;
+                }
+                if (format[i] == '%')
+                {
+                    output.Append('%');
+                    continue;
+                }
+
+                // flags, width, precision and length modifiers
+                bool leftAlign = false, zeroPad = false, plus = false, space = false, alternate = false;
+                int width = 0;
+                int precision = -1;
+                for (; i < format.Length && "-+ #0".IndexOf(format[i]) >= 0; i++)
+                {
+                    switch (format[i])
+                    {
+                        case '-': leftAlign = true; break;
+                        case '0': zeroPad = true; break;
+                        case '+': plus = true; break;
+                        case ' ': space = true; break;
+                        case '#': alternate = true; break;
+                    }
+                }
+                width = ReadNumber(format, ref i, bytes, ref offset, end);
+                if (width < 0)
+                {
+                    leftAlign = true;
+                    width = -width;
+                }
+                if (i < format.Length && format[i] == '.')
+                {
+                    i++;
+                    precision = Math.Max(0, ReadNumber(format, ref i, bytes, ref offset, end));
+                }
+                while (i < format.Length && "hlzjtL".IndexOf(format[i]) >= 0)
+                {
+                    i++;
+                }
+                if (i >= format.Length)
+                {
+                    break;
+                }
+
+                char conversion = format[i];
+                string text;
+                switch (conversion)
+                {
+                    case 'd':
+                    case 'i':
+                        {
+                            long value = ReadSigned(bytes, ref offset, end);
+                            text = ApplyPrecision(Math.Abs(value).ToString(CultureInfo.InvariantCulture), precision);
+                            if (value == long.MinValue)
+                            {
+                                text = "9223372036854775808";
+                            }
+                            text = (value < 0 ? "-" : plus ? "+" : space ? " " : "") + text;
+                            break;
+                        }
+                    case 'u':
+                        text = ApplyPrecision(ReadUnsigned(bytes, ref offset, end).ToString(CultureInfo.InvariantCulture), precision);
+                        break;
+                    case 'x':
+                    case 'X':
+                        {
+                            ulong value = ReadUnsigned(bytes, ref offset, end);
+                            text = ApplyPrecision(value.ToString(conversion == 'x' ? "x" : "X"), precision);
+                            if (alternate && value != 0)
+                            {
+                                text = (conversion == 'x' ? "0x" : "0X") + text;
+                            }
+                            break;
+                        }
+                    case 'o':
+                        text = ApplyPrecision(Convert.ToString((long)ReadUnsigned(bytes, ref offset, end), 8), precision);
+                        break;
+                    case 'c':
+                        text = ((char)ReadUnsigned(bytes, ref offset, end)).ToString();
+                        break;
+                    case 'p':
+                        text = "0x" + ReadUnsigned(bytes, ref offset, end).ToString("x");
+                        break;
+                    case 's':
+                        text = ReadString(bytes, ref offset, end);
+                        if (precision >= 0 && text.Length > precision)
+                        {
+                            text = text.Substring(0, precision);
+                        }
+                        break;
+                    case 'f':
+                    case 'F':
+                    case 'e':
+                    case 'E':
+                    case 'g':
+                    case 'G':
+                    case 'a':
+                    case 'A':
+                        {
+                            double value = ReadDouble(bytes, ref offset, end);
+                            text = FormatDouble(value, char.ToLowerInvariant(conversion), precision < 0 ? 6 : precision);
+                            if (char.IsUpper(conversion))
+                            {
+                                text = text.ToUpperInvariant();
+                            }
+                            if (value >= 0 && (plus || space))
+                            {
+                                text = (plus ? "+" : " ") + text;
+                            }
+                            break;
+                        }
+                    default:
+                        text = "";
+                        break;
+                }
+
+                if (text.Length < width)
+                {
+                    if (leftAlign)
+                    {
+                        text = text.PadRight(width);
+                    }
+                    else if (zeroPad && "sc".IndexOf(conversion) < 0)
+                    {
+                        int sign = (text.StartsWith("-") || text.StartsWith("+") || text.StartsWith(" ")) ? 1 : 0;
+                        text = text.Substring(0, sign) + text.Substring(sign).PadLeft(width - sign, '0');
+                    }
+                    else
+                    {
+                        text = text.PadLeft(width);
+                    }
+                }
+                output.Append(text);
+            }
+
+            return output.ToString();
+        }
+
+        private static int ReadNumber(string format, ref int i, byte[] bytes, ref int offset, int end)
+        {
+            if (i < format.Length && format[i] == '*')
+            {
+                i++;
+                return (int)ReadSigned(bytes, ref offset, end);
+            }
+
+            int value = 0;
+            for (; i < format.Length && char.IsDigit(format[i]); i++)
+            {
+                value = value * 10 + (format[i] - '0');
+            }
+            return value;
+        }
+
+        private static string ApplyPrecision(string digits, int precision)
+        {
+            return (precision > digits.Length) ? digits.PadLeft(precision, '0') : digits;
+        }
+
+        private static long ReadSigned(byte[] bytes, ref int offset, int end)
+        {
+            if (offset >= end)
+            {
+                return 0;
+            }
+            byte tag = bytes[offset];
+            ulong value = ReadUnsigned(bytes, ref offset, end);
+            return (tag == ArgInt32) ? (int)(uint)value : (long)value;
+        }
+
+        private static ulong ReadUnsigned(byte[] bytes, ref int offset, int end)
+        {
+            if (offset >= end)
+            {
+                return 0;
+            }
+            byte tag = bytes[offset++];
+            ulong value = 0;
+            if (tag == ArgInt32 && offset + 4 <= end)
+            {
+                value = Program.ReadU32(bytes, offset);
+                offset += 4;
+            }
+            else if ((tag == ArgInt64 || tag == ArgDouble) && offset + 8 <= end)
+            {
+                value = ((ulong)Program.ReadU32(bytes, offset) << 32) | Program.ReadU32(bytes, offset + 4);
+                offset += 8;
+            }
+            else if (tag == ArgString && offset < end)
+            {
+                offset += 1 + bytes[offset];
+            }
+            return value;
+        }
+
+        private static double ReadDouble(byte[] bytes, ref int offset, int end)
+        {
+            if (offset >= end || bytes[offset] != ArgDouble)
+            {
+                return (double)ReadSigned(bytes, ref offset, end);
+            }
+            return BitConverter.Int64BitsToDouble((long)ReadUnsigned(bytes, ref offset, end));
+        }
+
+        private static string ReadString(byte[] bytes, ref int offset, int end)
+        {
+            if (offset + 2 > end || bytes[offset] != ArgString)
+            {
+                ReadUnsigned(bytes, ref offset, end);
+                return "(?)";
+            }
+            int length = Math.Min(bytes[offset + 1], end - offset - 2);
+            string value = Encoding.UTF8.GetString(bytes, offset + 2, length);
+            offset += 2 + length;
+            return value;
+        }
+
+        private static string FormatDouble(double value, char conversion, int precision)
+        {
+            if (double.IsNaN(value))
+            {
+                return "nan";
+            }
+            if (double.IsInfinity(value))
+            {
+                return value > 0 ? "inf" : "-inf";
+            }
+
+            switch (conversion)
+            {
+                case 'f':
+                    return value.ToString("F" + precision, CultureInfo.InvariantCulture);
+                case 'e':
+                    return value.ToString((precision > 0 ? "0." + new string('0', precision) : "0") + "e+00", CultureInfo.InvariantCulture);
+                case 'g':
+                    return value.ToString("G" + Math.Max(1, precision), CultureInfo.InvariantCulture).ToLowerInvariant();
+                default:
+                    return value.ToString("R", CultureInfo.InvariantCulture);
+            }
+        }
+    }
+}
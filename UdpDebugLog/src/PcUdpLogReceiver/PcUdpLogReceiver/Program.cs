@@ -17,13 +17,33 @@ namespace PcUdpLogReceiver
         private const int listenPort = 1824;
         private static ConsoleColor Concolor = ConsoleColor.Gray;
 
+        // Binary datagram format, see udplog.c in SphereUdpLogSender.
+        private const int DatagramHeaderSize = 16;
+        private const int RecordHeaderSize = 7;
+        private const byte RecordText = 1;
+        private const byte RecordBinary = 2;
+        private const byte RecordFormat = 3;
+
+        // Per-device state: format strings for binary records, and counters to detect lost datagrams.
+        class DeviceState
+        {
+            public Dictionary<ushort, string> Formats = new Dictionary<ushort, string>();
+            public uint? LastSequence;
+            public uint LastDropped;
+            public ulong LostDatagrams;
+            public ulong BadDatagrams;
+        }
+
+        private static readonly Dictionary<uint, DeviceState> devices = new Dictionary<uint, DeviceState>();
+        private static bool showDateTime = true;
+        private static uint DeviceHash = 0xffffffff;
+        private static string outFile;
+
         static void Main(string[] args)
         {
             Console.Clear();
             Console.ForegroundColor = ConsoleColor.White;
 
-            bool showDateTime = true;
-            uint DeviceHash = 0xffffffff;
             if (args.Length == 1)       // see if we have a hex value for a device hash to show.
             {
                 DeviceHash=(uint) Convert.ToUInt32(args[0], 16);
@@ -33,7 +53,7 @@ namespace PcUdpLogReceiver
             UdpClient listener = new UdpClient(listenPort);
             IPEndPoint groupEP = new IPEndPoint(IPAddress.Any, listenPort);
 
-            string outFile = Path.Combine(Directory.GetCurrentDirectory(), "deviceLog.txt");
+            outFile = Path.Combine(Directory.GetCurrentDirectory(), "deviceLog.txt");
 
             Console.WriteLine("Azure Sphere Console Debug Client");
 
@@ -50,74 +70,190 @@ namespace PcUdpLogReceiver
 
                         if (DeviceHash == 0xffffffff || (DeviceHash == rxDeviceId))
                         {
-
-                            // Encoding.ASCII.GetString(bytes, 0, bytes.Length);
-                            string output = Encoding.UTF8.GetString(bytes, 4, bytes.Length - 4);
-
-                            Concolor = ConsoleColor.Gray;
-
-                            if (output.Trim().ToLower().StartsWith("information:") || output.Trim().ToLower().StartsWith("info:"))
-                            {
-                                Concolor = ConsoleColor.Cyan;
-                            }
-
-                            if (output.Trim().ToLower().StartsWith("error:") || output.Trim().ToLower().StartsWith("warning:"))
+                            // text datagrams never start with a 0 byte after the device Id.
+                            if (bytes[4] == 0 && bytes.Length >= DatagramHeaderSize)
                             {
-                                Concolor = ConsoleColor.Red;
+                                ProcessBinaryDatagram(rxDeviceId, bytes);
                             }
-
-                            if (Concolor != ConsoleColor.Gray)
+                            else
                             {
-                                Console.ForegroundColor = Concolor;
+                                // Encoding.ASCII.GetString(bytes, 0, bytes.Length);
+                                ShowMessage(rxDeviceId, Encoding.UTF8.GetString(bytes, 4, bytes.Length - 4));
                             }
+                        }
+                    }
+                    else
+                    {
+                        Debug.WriteLine($"Rx'd buffer {bytes.Length} bytes.");
+                    }
+                }
+            }
+            catch (SocketException e)
+            {
+                Console.WriteLine(e);
+            }
+            finally
+            {
+                listener.Close();
+            }
+        }
 
-                            if (DeviceHash == 0xffffffff)
-                            {
+        static void ProcessBinaryDatagram(uint rxDeviceId, byte[] bytes)
+        {
+            if (!devices.TryGetValue(rxDeviceId, out DeviceState device))
+            {
+                device = new DeviceState();
+                devices[rxDeviceId] = device;
+            }
 
-                                Console.Write($"{rxDeviceId,0:X8} ");
-                            }
+            uint sequence = ReadU32(bytes, 8);
+            uint dropped = ReadU32(bytes, 12);
 
-                            if (showDateTime)
-                            {
-                                DateTime dt = DateTime.Now;
-                                Console.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
-                                Debug.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
+            // gaps in the sequence numbers are datagrams lost on the network, the dropped counter
+            // covers the records the device couldn't send (rate limited or send errors).
+            if (device.LastSequence.HasValue && sequence != device.LastSequence.Value + 1)
+            {
+                uint lost = sequence - device.LastSequence.Value - 1;
+                if (lost < 0x80000000)
+                {
+                    device.LostDatagrams += lost;
+                    ShowMessage(rxDeviceId, $"Warning: {lost} datagram(s) lost on the network ({device.LostDatagrams} in total)\n");
+                }
+                else
+                {
+                    ShowMessage(rxDeviceId, "Info: device restarted\n");
+                    device.LastDropped = 0;
+                    device.Formats.Clear();
+                }
+            }
+            if (dropped > device.LastDropped)
+            {
+                ShowMessage(rxDeviceId, $"Warning: {dropped - device.LastDropped} log record(s) dropped by the device ({dropped} in total)\n");
+            }
+            device.LastSequence = sequence;
+            device.LastDropped = dropped;
 
-                                string dateString = string.Format("{0} {1}:", dt.ToShortDateString(), dt.ToShortTimeString());
-                                File.AppendAllText(outFile, dateString + Environment.NewLine);
-                            }
+            if (!ProcessRecords(rxDeviceId, device, bytes))
+            {
+                device.BadDatagrams++;
+                ShowMessage(rxDeviceId, $"Warning: malformed datagram {sequence} dropped ({device.BadDatagrams} in total)\n");
+            }
+        }
 
-                            Console.Write($"{output}");
-                            Debug.Write($"{output}");
-                            File.AppendAllText(outFile, output);
+        // returns false if a record is malformed: the records before it are shown, the rest of the datagram is dropped.
+        static bool ProcessRecords(uint rxDeviceId, DeviceState device, byte[] bytes)
+        {
+            ushort recordCount = ReadU16(bytes, 6);
+            int offset = DatagramHeaderSize;
+            for (int i = 0; i < recordCount && offset + RecordHeaderSize <= bytes.Length; i++)
+            {
+                byte type = bytes[offset];
+                int length = ReadU16(bytes, offset + 1);
+                int payload = offset + RecordHeaderSize;
+                if (payload + length > bytes.Length)
+                {
+                    return false;
+                }
+                // format and binary records start with a 2 byte format Id.
+                if ((type == RecordFormat || type == RecordBinary) && length < 2)
+                {
+                    return false;
+                }
 
-                            if (!output.Contains('\n'))
+                try
+                {
+                    switch (type)
+                    {
+                        case RecordText:
+                            ShowMessage(rxDeviceId, Encoding.UTF8.GetString(bytes, payload, length));
+                            break;
+                        case RecordFormat:
+                            device.Formats[ReadU16(bytes, payload)] = Encoding.UTF8.GetString(bytes, payload + 2, length - 2);
+                            break;
+                        case RecordBinary:
+                            ushort formatId = ReadU16(bytes, payload);
+                            if (device.Formats.TryGetValue(formatId, out string format))
                             {
-                                Console.WriteLine();
-                                Debug.WriteLine("");
-                                File.AppendAllText(outFile, Environment.NewLine);
+                                ShowMessage(rxDeviceId, PrintfFormatter.Format(format, bytes, payload + 2, payload + length));
                             }
-
-                            if (Concolor != ConsoleColor.Gray)
+                            else
                             {
-                                Console.ForegroundColor = ConsoleColor.Gray;
+                                ShowMessage(rxDeviceId, $"<binary record with unknown format {formatId}>\n");
                             }
-                        }
-                    }
-                    else
-                    {
-                        Debug.WriteLine($"Rx'd buffer {bytes.Length} bytes.");
+                            break;
                     }
                 }
+                catch (Exception e) when (e is ArgumentException || e is IndexOutOfRangeException || e is FormatException)
+                {
+                    Debug.WriteLine(e);
+                    return false;
+                }
+
+                offset = payload + length;
             }
-            catch (SocketException e)
+            return true;
+        }
+
+        static void ShowMessage(uint rxDeviceId, string output)
+        {
+            Concolor = ConsoleColor.Gray;
+
+            if (output.Trim().ToLower().StartsWith("information:") || output.Trim().ToLower().StartsWith("info:"))
             {
-                Console.WriteLine(e);
+                Concolor = ConsoleColor.Cyan;
             }
-            finally
+
+            if (output.Trim().ToLower().StartsWith("error:") || output.Trim().ToLower().StartsWith("warning:"))
             {
-                listener.Close();
+                Concolor = ConsoleColor.Red;
             }
+
+            if (Concolor != ConsoleColor.Gray)
+            {
+                Console.ForegroundColor = Concolor;
+            }
+
+            if (DeviceHash == 0xffffffff)
+            {
+
+                Console.Write($"{rxDeviceId,0:X8} ");
+            }
+
+            if (showDateTime)
+            {
+                DateTime dt = DateTime.Now;
+                Console.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
+                Debug.Write($"{dt.ToShortDateString()} {dt.ToShortTimeString()}: ");
+
+                string dateString = string.Format("{0} {1}:", dt.ToShortDateString(), dt.ToShortTimeString());
+                File.AppendAllText(outFile, dateString + Environment.NewLine);
+            }
+
+            Console.Write($"{output}");
+            Debug.Write($"{output}");
+            File.AppendAllText(outFile, output);
+
+            if (!output.Contains('\n'))
+            {
+                Console.WriteLine();
+                Debug.WriteLine("");
+                File.AppendAllText(outFile, Environment.NewLine);
+            }
+
+            if (Concolor != ConsoleColor.Gray)
+            {
+                Console.ForegroundColor = ConsoleColor.Gray;
+            }
+        }
+
+        internal static ushort ReadU16(byte[] bytes, int offset)
+        {
+            return (ushort)((bytes[offset] << 8) | bytes[offset + 1]);
+        }
+
+        internal static uint ReadU32(byte[] bytes, int offset)
+        {
+            return (uint)((bytes[offset] << 24) | (bytes[offset + 1] << 16) | (bytes[offset + 2] << 8) | bytes[offset + 3]);
         }
     }
 }
@@ -36,6 +36,11 @@ int main(void)
             Log_Debug("Error: some error information - counter %d\n", counter);
         }
 
+#ifdef USE_SOCKET_LOG
+        // Binary records are formatted by PcUdpLogReceiver, which keeps the cost of frequent logging low on the device.
+        UdpLog_Binary("Info: tick %d, uptime %.1f s\n", counter, (double)counter);
+#endif
+
         if (counter == 15)
         {
             counter = 0;
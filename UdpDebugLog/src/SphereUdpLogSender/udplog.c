@@ -10,63 +10,471 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <stdarg.h>
+#include <stddef.h>
 
 #define PORT 1824
 
+// Datagram layout (big-endian, so that the device ID stays in the same place as in the original text format):
+//   header: u32 device id, u8 0x00 (marks the binary format, text datagrams never start with 0), u8 version,
+//           u16 record count, u32 datagram sequence number, u32 dropped records (cumulative)
+//   record: u8 type, u16 payload length, u32 timestamp (ms), payload
+//     RECORD_TEXT:    formatted text
+//     RECORD_BINARY:  u16 format id, arguments as { u8 tag, value } (see UdpLog_Binary)
+//     RECORD_FORMAT:  u16 format id, format string
+#define PROTOCOL_VERSION        2
+#define DATAGRAM_HEADER_SIZE    16
+#define RECORD_HEADER_SIZE      7
+
+enum { RECORD_TEXT = 1, RECORD_BINARY = 2, RECORD_FORMAT = 3 };
+enum { ARG_INT32 = 4, ARG_INT64 = 8, ARG_DOUBLE = 'f', ARG_STRING = 's' };
+
+#define FORMAT_REFRESH_INTERVAL_MS  30000
+#define MAX_STRING_ARG_LENGTH       255
+
 static int 	sock=-1;
 
 static struct sockaddr_in broadcast_addr;
 static socklen_t addr_len;
-static int ret;
-static char sock_buffer[500];
 
-static bool slogInit = false;
+static pthread_once_t slogOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t slogMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t datagram[UDPLOG_MAX_DATAGRAM_SIZE];
+static size_t datagramLength = DATAGRAM_HEADER_SIZE;
+static uint16_t recordCount = 0;
+static uint32_t firstRecordTime = 0;
+
+static uint32_t deviceId = 0xffffffff;
+static uint32_t sequenceNumber = 0;
+static uint32_t droppedRecords = 0;
+
+// token bucket, refilled at UDPLOG_MAX_DATAGRAMS_PER_SEC
+static uint32_t tokens = UDPLOG_MAX_DATAGRAMS_PER_SEC;
+static uint32_t lastRefillTime = 0;
+
+static const char *formats[UDPLOG_MAX_FORMATS];
+static uint16_t formatCount = 0;
+static uint32_t lastFormatRefreshTime = 0;
 
 void initSlog(void);
 
-#ifdef USE_SOCKET_LOG
-int Log_Debug(const char *fmt, ...)
+static uint32_t nowMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+static inline void putU16(uint8_t *p, uint16_t value)
+{
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+}
+
+static inline void putU32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+static bool takeToken(uint32_t now)
+{
+	uint32_t refill = (now - lastRefillTime) * UDPLOG_MAX_DATAGRAMS_PER_SEC / 1000u;
+	if (refill > 0)
+	{
+		tokens = (tokens + refill > UDPLOG_MAX_DATAGRAMS_PER_SEC) ? UDPLOG_MAX_DATAGRAMS_PER_SEC : tokens + refill;
+		lastRefillTime = now;
+	}
+
+	if (tokens == 0)
+		return false;
+
+	tokens--;
+	return true;
+}
+
+/// <summary>
+///  Sends the pending records, if the rate limit allows it. Must be called with slogMutex held.
+///  Returns 'true' if the datagram is now empty.
+/// </summary>
+static bool flushLocked(uint32_t now)
+{
+	if (recordCount == 0)
+		return true;
+
+	if (!takeToken(now))
+		return false;
+
+	putU32(datagram, deviceId);
+	datagram[4] = 0x00;
+	datagram[5] = PROTOCOL_VERSION;
+	putU16(datagram + 6, recordCount);
+	putU32(datagram + 8, sequenceNumber++);
+	putU32(datagram + 12, droppedRecords);
+
+	if (sock == -1 || sendto(sock, datagram, datagramLength, 0, (struct sockaddr*) &broadcast_addr, addr_len) == -1)
+	{
+		droppedRecords += recordCount;
+	}
+
+	datagramLength = DATAGRAM_HEADER_SIZE;
+	recordCount = 0;
+	return true;
+}
+
+/// <summary>
+///  Reserves room for a record with a payload of up to 'maxPayload' bytes, flushing the datagram if needed.
+///  Must be called with slogMutex held. Returns a pointer to the payload, or NULL if the record must be dropped.
+/// </summary>
+static uint8_t *beginRecord(uint8_t type, size_t maxPayload, uint32_t now)
 {
-	if (!slogInit)
+	if (datagramLength + RECORD_HEADER_SIZE + maxPayload > sizeof(datagram) && !flushLocked(now))
+	{
+		droppedRecords++;
+		return NULL;
+	}
+
+	if (recordCount == 0)
+		firstRecordTime = now;
+
+	uint8_t *record = datagram + datagramLength;
+	record[0] = type;
+	putU32(record + 3, now);
+	return record + RECORD_HEADER_SIZE;
+}
+
+static void endRecord(size_t payloadLength)
+{
+	putU16(datagram + datagramLength + 1, (uint16_t)payloadLength);
+	datagramLength += RECORD_HEADER_SIZE + payloadLength;
+	recordCount++;
+}
+
+static void *flushThread(void *arg)
+{
+	(void)arg;
+	const struct timespec interval = { .tv_sec = 0, .tv_nsec = UDPLOG_FLUSH_INTERVAL_MS * 1000000L };
+
+	while (true)
 	{
-		initSlog();
+		nanosleep(&interval, NULL);
+
+		pthread_mutex_lock(&slogMutex);
+		uint32_t now = nowMs();
+		if (recordCount > 0 && now - firstRecordTime >= UDPLOG_FLUSH_INTERVAL_MS)
+		{
+			flushLocked(now);
+		}
+		pthread_mutex_unlock(&slogMutex);
 	}
 
-	memset(sock_buffer, 0x00, sizeof(sock_buffer));
+	return NULL;
+}
+
+#ifdef USE_SOCKET_LOG
+int Log_Debug(const char *fmt, ...)
+{
+	pthread_once(&slogOnce, initSlog);
+
+	const size_t maxPayload = sizeof(datagram) - DATAGRAM_HEADER_SIZE - RECORD_HEADER_SIZE;
 	va_list args;
 	va_start(args, fmt);
 
-	// You could use the first four bytes to contain a unique value per device.
-	sock_buffer[3] = 0xff;
-	sock_buffer[2] = 0xff;
-	sock_buffer[1] = 0xff;
-	sock_buffer[0] = 0xff;
+	pthread_mutex_lock(&slogMutex);
+
+	uint32_t now = nowMs();
 
-	int vsRet=vsnprintf(sock_buffer+4, sizeof(sock_buffer) - 4, fmt, args);
+	// a record needs at least its header and vsnprintf's terminator: flush the datagram first if they don't fit
+	if (datagramLength + RECORD_HEADER_SIZE + 1 > sizeof(datagram) && beginRecord(RECORD_TEXT, 1, now) == NULL)
+	{
+		pthread_mutex_unlock(&slogMutex);
+		va_end(args);
+		return -1;
+	}
+
+	uint8_t *payload = datagram + datagramLength + RECORD_HEADER_SIZE;
+	size_t available = sizeof(datagram) - datagramLength - RECORD_HEADER_SIZE;
+
+	// format straight into the datagram: messages are only formatted twice if they don't fit in the current one
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	int length = vsnprintf((char *)payload, available, fmt, argsCopy);
+	va_end(argsCopy);
+
+	if (length >= 0 && (size_t)length >= available)
+	{
+		payload = beginRecord(RECORD_TEXT, (size_t)length < maxPayload ? (size_t)length + 1 : maxPayload, now);
+		if (payload != NULL)
+		{
+			available = sizeof(datagram) - datagramLength - RECORD_HEADER_SIZE;
+			vsnprintf((char *)payload, available, fmt, args);
+		}
+	}
+	else if (length >= 0)
+	{
+		payload = beginRecord(RECORD_TEXT, (size_t)length, now);
+	}
 	va_end(args);
 
-	if (vsRet < 0)	// encoding error
+	if (length < 0)	// encoding error
 	{
+		pthread_mutex_unlock(&slogMutex);
 		perror("Log_Debug - Cannot compose message\n");
 		return -1;
 	}
 
-	ret = sendto(sock, sock_buffer, strnlen(sock_buffer + 4, sizeof(sock_buffer) - 4)+4, 0, (struct sockaddr*) &broadcast_addr, addr_len);
-	return ret;
+	if (payload == NULL)
+	{
+		pthread_mutex_unlock(&slogMutex);
+		return -1;
+	}
+
+	// truncated messages don't carry vsnprintf's terminator
+	endRecord(((size_t)length < available) ? (size_t)length : available - 1);
+
+	pthread_mutex_unlock(&slogMutex);
+	return length;
 }
 #endif
 
+/// <summary>
+///  Returns the ID of a format string, queuing its definition the first time it is used and every
+///  FORMAT_REFRESH_INTERVAL_MS. Must be called with slogMutex held. Returns -1 if the table is full.
+/// </summary>
+static int getFormatId(const char *fmt, uint32_t now)
+{
+	int id = -1;
+	for (uint16_t i = 0; i < formatCount; i++)
+	{
+		if (formats[i] == fmt)
+		{
+			id = i;
+			break;
+		}
+	}
+
+	bool refresh = (now - lastFormatRefreshTime >= FORMAT_REFRESH_INTERVAL_MS);
+	if (id == -1)
+	{
+		if (formatCount == UDPLOG_MAX_FORMATS)
+			return -1;
+		id = formatCount;
+		formats[formatCount++] = fmt;
+	}
+	else if (!refresh)
+	{
+		return id;
+	}
+
+	// (re)send either this definition, or all of them when the refresh is due
+	uint16_t first = refresh ? 0 : (uint16_t)id;
+	uint16_t last = refresh ? formatCount : (uint16_t)(id + 1);
+	if (refresh)
+		lastFormatRefreshTime = now;
+
+	for (uint16_t i = first; i < last; i++)
+	{
+		size_t length = strlen(formats[i]);
+		if (length > sizeof(datagram) - DATAGRAM_HEADER_SIZE - RECORD_HEADER_SIZE - 2)
+			length = sizeof(datagram) - DATAGRAM_HEADER_SIZE - RECORD_HEADER_SIZE - 2;
+
+		uint8_t *payload = beginRecord(RECORD_FORMAT, length + 2, now);
+		if (payload == NULL)
+			return -1;
+		putU16(payload, i);
+		memcpy(payload + 2, formats[i], length);
+		endRecord(length + 2);
+	}
+
+	return id;
+}
+
+int UdpLog_Binary(const char *fmt, ...)
+{
+	pthread_once(&slogOnce, initSlog);
+
+	// Encode the arguments first, walking the format string the same way printf does, but without formatting anything.
+	uint8_t args[256];
+	size_t length = 2;
+	va_list ap;
+	va_start(ap, fmt);
+
+	for (const char *p = fmt; *p; p++)
+	{
+		if (*p != '%')
+			continue;
+		if (*++p == '%')
+			continue;
+
+		char size = 0;	// length modifier: 0, 'l' (long), 'q' (long long), 'z' (size_t), 'j', 't' or 'L'
+		for (; *p; p++)
+		{
+			if (*p == '*')
+			{
+				if (length + 5 > sizeof(args))
+					break;
+				args[length++] = ARG_INT32;
+				putU32(args + length, (uint32_t)va_arg(ap, int));
+				length += 4;
+			}
+			else if (*p == 'l')
+			{
+				size = (size == 'l') ? 'q' : 'l';
+			}
+			else if (*p == 'z' || *p == 'j' || *p == 't' || *p == 'L')
+			{
+				size = *p;
+			}
+			else if (strchr("-+ #0123456789.h", *p) == NULL)
+			{
+				break;
+			}
+		}
+		if (*p == '\0')
+			break;
+
+		if (length + 1 + 8 > sizeof(args))
+			break;
+
+		switch (*p)
+		{
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		{
+			// integers are sent with their size on the device (i.e. long is 32 bits on the ARM core)
+			uint64_t value;
+			size_t valueSize;
+			switch (size)
+			{
+			case 'l': value = (uint64_t)va_arg(ap, long); valueSize = sizeof(long); break;
+			case 'q': value = (uint64_t)va_arg(ap, long long); valueSize = sizeof(long long); break;
+			case 'z': value = (uint64_t)va_arg(ap, size_t); valueSize = sizeof(size_t); break;
+			case 'j': value = (uint64_t)va_arg(ap, intmax_t); valueSize = sizeof(intmax_t); break;
+			case 't': value = (uint64_t)va_arg(ap, ptrdiff_t); valueSize = sizeof(ptrdiff_t); break;
+			default: value = (uint64_t)va_arg(ap, int); valueSize = sizeof(int); break;
+			}
+
+			if (valueSize == 8)
+			{
+				args[length++] = ARG_INT64;
+				putU32(args + length, (uint32_t)(value >> 32));
+				putU32(args + length + 4, (uint32_t)value);
+				length += 8;
+			}
+			else
+			{
+				args[length++] = ARG_INT32;
+				putU32(args + length, (uint32_t)value);
+				length += 4;
+			}
+			break;
+		}
+		case 'p':
+		{
+			uint64_t value = (uint64_t)(uintptr_t)va_arg(ap, void *);
+			args[length++] = ARG_INT64;
+			putU32(args + length, (uint32_t)(value >> 32));
+			putU32(args + length + 4, (uint32_t)value);
+			length += 8;
+			break;
+		}
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		{
+			double value = (size == 'L') ? (double)va_arg(ap, long double) : va_arg(ap, double);
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			args[length++] = ARG_DOUBLE;
+			putU32(args + length, (uint32_t)(bits >> 32));
+			putU32(args + length + 4, (uint32_t)bits);
+			length += 8;
+			break;
+		}
+		case 's':
+		{
+			const char *value = va_arg(ap, const char *);
+			size_t valueLength = value ? strnlen(value, MAX_STRING_ARG_LENGTH) : 0;
+			if (length + 2 + valueLength > sizeof(args))
+				valueLength = sizeof(args) - length - 2;
+			args[length++] = ARG_STRING;
+			args[length++] = (uint8_t)valueLength;
+			memcpy(args + length, value, valueLength);
+			length += valueLength;
+			break;
+		}
+		default:	// %n and unknown conversions take a pointer and output nothing
+			(void)va_arg(ap, void *);
+			break;
+		}
+	}
+	va_end(ap);
+
+	pthread_mutex_lock(&slogMutex);
+
+	uint32_t now = nowMs();
+	int ret = -1;
+	int id = getFormatId(fmt, now);
+	if (id != -1)
+	{
+		uint8_t *payload = beginRecord(RECORD_BINARY, length, now);
+		if (payload != NULL)
+		{
+			putU16(args, (uint16_t)id);
+			memcpy(payload, args, length);
+			endRecord(length);
+			ret = 0;
+		}
+	}
+	else
+	{
+		droppedRecords++;
+	}
+
+	pthread_mutex_unlock(&slogMutex);
+	return ret;
+}
+
+void UdpLog_SetDeviceId(uint32_t id)
+{
+	pthread_mutex_lock(&slogMutex);
+	deviceId = id;
+	pthread_mutex_unlock(&slogMutex);
+}
+
+void UdpLog_Flush(void)
+{
+	pthread_mutex_lock(&slogMutex);
+	if (!flushLocked(nowMs()))
+	{
+		// bypass the rate limit, the caller asked for delivery
+		tokens = 1;
+		flushLocked(nowMs());
+	}
+	pthread_mutex_unlock(&slogMutex);
+}
+
+uint32_t UdpLog_GetDroppedCount(void)
+{
+	pthread_mutex_lock(&slogMutex);
+	uint32_t count = droppedRecords;
+	pthread_mutex_unlock(&slogMutex);
+	return count;
+}
+
 void initSlog(void)
 {
 	int yes = 1;
+	int ret;
 
-	slogInit = true;
+	lastRefillTime = nowMs();
 	sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock < 0) {
 		perror("sock error");
@@ -86,4 +494,11 @@ void initSlog(void)
 	broadcast_addr.sin_family = AF_INET;
 	broadcast_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
 	broadcast_addr.sin_port = htons(PORT);
-}
\ No newline at end of file
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, flushThread, NULL) != 0) {
+		perror("pthread_create error");
+		return;
+	}
+	pthread_detach(thread);
+}
@@ -3,5 +3,40 @@
 
 #pragma once
 
+#include <stdint.h>
+
+// Log records are coalesced into datagrams of up to UDPLOG_MAX_DATAGRAM_SIZE bytes, which are sent
+// when full, or UDPLOG_FLUSH_INTERVAL_MS after the first record was queued.
+#define UDPLOG_MAX_DATAGRAM_SIZE        1472    // Ethernet MTU - IP header - UDP header
+#define UDPLOG_FLUSH_INTERVAL_MS        50
+// Rate limit: records logged while the limit is exceeded and the datagram is full are dropped (and counted).
+#define UDPLOG_MAX_DATAGRAMS_PER_SEC    50
+// Max number of distinct format strings that can be used with UdpLog_Binary.
+#define UDPLOG_MAX_FORMATS              128
+
 int Log_Debug(const char *fmt, ...);
 
+/// <summary>
+///  Logs a record without formatting it on the device: only an ID of the format string and the raw
+///  arguments are sent, and the PcUdpLogReceiver formats the message. The format string is sent once,
+///  the first time it is used (and periodically after that, for receivers started later).
+///  'fmt' must be a string literal, since format strings are identified by their address.
+///  Supports the printf conversions d, i, u, o, x, X, c, s, p, f, F, e, E, g, G, a, A and '*' width/precision.
+///  Returns 0 on success, -1 if the record was dropped.
+/// </summary>
+int UdpLog_Binary(const char *fmt, ...);
+
+/// <summary>
+///  Sets the ID sent in every datagram, to identify the device (defaults to 0xffffffff).
+/// </summary>
+void UdpLog_SetDeviceId(uint32_t deviceId);
+
+/// <summary>
+///  Sends the pending records immediately (i.e. before the app exits).
+/// </summary>
+void UdpLog_Flush(void);
+
+/// <summary>
+///  Returns the number of records dropped (rate limited or undeliverable) since the app started.
+/// </summary>
+uint32_t UdpLog_GetDroppedCount(void);
@@ -26,6 +26,14 @@
 #define VS1053_REG_CLOCKF 0x03
 #define VS1053_REG_VOLUME 0x0B
 
+// DREQ high means the SDI FIFO (2048 bytes) has room for at least 32 bytes.
+#define VS1053_SDI_BURST_SIZE 32
+
+// While DREQ is low, sleep between polls instead of spinning. The FIFO holds over 50 ms of audio
+// at 320 kbps, so a few ms of sleep can't starve the decoder.
+#define VS1053_DREQ_POLL_INTERVAL_US 2000
+#define VS1053_DREQ_TIMEOUT_MS 1000
+
 static int WaitOnDREQHigh(void);
 
 static void controlModeOn(void);
@@ -222,13 +230,47 @@ void dumpRegs(void)
 	Log_Debug("%s = 0x", Modes[0x08]); Log_Debug("%04x\n", sciRead(modeVal[0x08]));
 }
 
-void VS1053_PlayByte(uint8_t data)
+int VS1053_PlayBuffer(const uint8_t* data, size_t length)
 {
+	int ret = 0;
+
+	// Data mode is selected once for the whole buffer (not per byte), and each DREQ assertion
+	// is used for a 32 byte SPI transfer.
 	dataModeOn();
-	WaitOnDREQHigh();
 
-	write(vs1053_fd, &data, 1);
+	size_t offset = 0;
+	while (offset < length)
+	{
+		if (WaitOnDREQHigh() == -1)
+		{
+			Log_Debug("ERROR: VS1053 DREQ timeout\n");
+			ret = -1;
+			break;
+		}
+
+		size_t burst = length - offset;
+		if (burst > VS1053_SDI_BURST_SIZE)
+		{
+			burst = VS1053_SDI_BURST_SIZE;
+		}
+
+		ssize_t written = write(vs1053_fd, data + offset, burst);
+		if (written <= 0)
+		{
+			Log_Debug("ERROR: VS1053 SDI write failed: %s (%d)\n", strerror(errno), errno);
+			ret = -1;
+			break;
+		}
+		offset += (size_t)written;
+	}
+
 	dataModeOff();
+	return ret;
+}
+
+void VS1053_PlayByte(uint8_t data)
+{
+	VS1053_PlayBuffer(&data, 1);
 }
 
 void VS1053_SetVolume(uint16_t volume)
@@ -242,6 +284,7 @@ static int WaitOnDREQHigh(void)
 	int ret=0;
 	GPIO_Value_Type dReq;
 	struct timespec ts_beg, ts_end, ts_diff;
+	const struct timespec pollInterval = { .tv_sec = 0, .tv_nsec = VS1053_DREQ_POLL_INTERVAL_US * 1000 };
 
 	clock_gettime(CLOCK_MONOTONIC, &ts_beg);
 
@@ -256,11 +299,14 @@ static int WaitOnDREQHigh(void)
 		clock_gettime(CLOCK_MONOTONIC, &ts_end);
 		timespec_diff(&ts_beg, &ts_end, &ts_diff);
 		long ms = (ts_diff.tv_sec * 1000) + (ts_diff.tv_nsec / 1000000);
-		if (ms > 1000)	// 
+		if (ms > VS1053_DREQ_TIMEOUT_MS)
 		{
 			ret = -1;
 			break;
 		}
+
+		// High-level apps can't get GPIO interrupts: yield the CPU until the FIFO has drained a bit.
+		nanosleep(&pollInterval, NULL);
 	}
 	return ret;
 }
@@ -10,5 +10,8 @@
 int VS1053_Init(void);
 void VS1053_SetVolume(uint16_t volume);
 void VS1053_PlayByte(uint8_t data);
+// Sends 'length' bytes of audio in 32 byte bursts, one per DREQ assertion. Returns 0, or -1 on a
+// DREQ timeout or SPI error.
+int VS1053_PlayBuffer(const uint8_t* data, size_t length);
 void VS1053_Cleanup(void);
 
@@ -0,0 +1,276 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <applibs/log.h>
+
+#include "http_stream.h"
+
+void HttpStream_Init(HTTP_STREAM* stream)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->state = HTTP_STREAM_STATUS_LINE;
+}
+
+/// <summary>
+///     Returns the value of header 'line' if its name is 'name' (case insensitive), else NULL.
+/// </summary>
+static const char* HeaderValue(const char* line, const char* name)
+{
+    size_t nameLength = strlen(name);
+    if (strncasecmp(line, name, nameLength) != 0 || line[nameLength] != ':')
+    {
+        return NULL;
+    }
+
+    const char* value = line + nameLength + 1;
+    while (*value == ' ' || *value == '\t')
+    {
+        value++;
+    }
+    return value;
+}
+
+static void ParseStatusLine(HTTP_STREAM* stream)
+{
+    // "HTTP/1.1 200 OK", or "ICY 200 OK" from SHOUTcast servers.
+    const char* code = strchr(stream->line, ' ');
+    if ((strncmp(stream->line, "HTTP/", 5) != 0 && strncmp(stream->line, "ICY", 3) != 0) || code == NULL)
+    {
+        Log_Debug("Unexpected response: %s\n", stream->line);
+        stream->state = HTTP_STREAM_ERROR;
+        return;
+    }
+
+    stream->statusCode = atoi(code + 1);
+    if (stream->statusCode != 200)
+    {
+        Log_Debug("Stream not available: %s\n", stream->line);
+        stream->state = HTTP_STREAM_ERROR;
+        return;
+    }
+
+    stream->state = HTTP_STREAM_HEADERS;
+}
+
+static void ParseHeader(HTTP_STREAM* stream)
+{
+    const char* value;
+
+    if (stream->lineLength == 0)
+    {
+        // End of the headers.
+        Log_Debug("Stream: %s, ICY metadata every %u bytes\n", stream->chunked ? "chunked" : "not chunked",
+                  stream->icyMetaInterval);
+        stream->state = HTTP_STREAM_BODY;
+        stream->chunkState = HTTP_CHUNK_SIZE;
+        stream->audioUntilMeta = stream->icyMetaInterval;
+        return;
+    }
+
+    if ((value = HeaderValue(stream->line, "Transfer-Encoding")) != NULL)
+    {
+        stream->chunked = strncasecmp(value, "chunked", 7) == 0;
+    }
+    else if ((value = HeaderValue(stream->line, "icy-metaint")) != NULL)
+    {
+        stream->icyMetaInterval = (uint32_t)strtoul(value, NULL, 10);
+    }
+    else if ((value = HeaderValue(stream->line, "icy-name")) != NULL)
+    {
+        Log_Debug("Station: %s\n", value);
+    }
+}
+
+/// <summary>
+///     Accumulates a CR LF terminated line. Returns the number of bytes used, and sets '*complete'
+///     when the line ends (stream->line then holds it without the CR LF). Longer lines are truncated.
+/// </summary>
+static size_t ReadLine(HTTP_STREAM* stream, const uint8_t* data, size_t length, bool* complete)
+{
+    *complete = false;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+        {
+            if (stream->lineLength > 0 && stream->line[stream->lineLength - 1] == '\r')
+            {
+                stream->lineLength--;
+            }
+            stream->line[stream->lineLength] = '\0';
+            *complete = true;
+            return i + 1;
+        }
+        if (stream->lineLength < sizeof(stream->line) - 1)
+        {
+            stream->line[stream->lineLength++] = (char)data[i];
+        }
+    }
+    return length;
+}
+
+static void ParseMetadata(HTTP_STREAM* stream)
+{
+    // StreamTitle='Artist - Title';StreamUrl='...';
+    stream->meta[stream->metaLength] = '\0';
+    const char* start = strstr(stream->meta, "StreamTitle='");
+    if (start == NULL)
+    {
+        return;
+    }
+    start += strlen("StreamTitle='");
+    const char* end = strstr(start, "';");
+    size_t length = end != NULL ? (size_t)(end - start) : strlen(start);
+    if (length >= sizeof(stream->title))
+    {
+        length = sizeof(stream->title) - 1;
+    }
+
+    if (strncmp(stream->title, start, length) != 0 || stream->title[length] != '\0')
+    {
+        memcpy(stream->title, start, length);
+        stream->title[length] = '\0';
+        Log_Debug("Now playing: %s\n", stream->title);
+    }
+}
+
+/// <summary>
+///     Separates the audio from the ICY metadata in the (dechunked) body.
+/// </summary>
+static void ParseBody(HTTP_STREAM* stream, const uint8_t* data, size_t length,
+                      HTTP_STREAM_AUDIO_CALLBACK audio, void* context)
+{
+    if (stream->icyMetaInterval == 0)
+    {
+        stream->audioBytes += length;
+        audio(context, data, length);
+        return;
+    }
+
+    while (length > 0)
+    {
+        size_t n;
+
+        if (stream->audioUntilMeta > 0)
+        {
+            n = length < stream->audioUntilMeta ? length : stream->audioUntilMeta;
+            stream->audioBytes += n;
+            audio(context, data, n);
+            stream->audioUntilMeta -= (uint32_t)n;
+        }
+        else if (stream->metaRemaining == 0)
+        {
+            // Metadata length byte, in units of 16 bytes (0: no metadata this time).
+            n = 1;
+            stream->metaRemaining = (size_t)data[0] * 16;
+            stream->metaLength = 0;
+            stream->metaBlocks++;
+            if (stream->metaRemaining == 0)
+            {
+                stream->audioUntilMeta = stream->icyMetaInterval;
+            }
+        }
+        else
+        {
+            n = length < stream->metaRemaining ? length : stream->metaRemaining;
+            size_t keep = sizeof(stream->meta) - 1 - stream->metaLength;
+            if (keep > n)
+            {
+                keep = n;
+            }
+            memcpy(stream->meta + stream->metaLength, data, keep);
+            stream->metaLength += keep;
+            stream->metaRemaining -= n;
+
+            if (stream->metaRemaining == 0)
+            {
+                ParseMetadata(stream);
+                stream->audioUntilMeta = stream->icyMetaInterval;
+            }
+        }
+
+        data += n;
+        length -= n;
+    }
+}
+
+int HttpStream_Parse(HTTP_STREAM* stream, const uint8_t* data, size_t length,
+                     HTTP_STREAM_AUDIO_CALLBACK audio, void* context)
+{
+    while (length > 0 && stream->state != HTTP_STREAM_ERROR && stream->state != HTTP_STREAM_DONE)
+    {
+        bool complete;
+        size_t used;
+
+        if (stream->state == HTTP_STREAM_STATUS_LINE || stream->state == HTTP_STREAM_HEADERS)
+        {
+            used = ReadLine(stream, data, length, &complete);
+            if (complete)
+            {
+                if (stream->state == HTTP_STREAM_STATUS_LINE)
+                {
+                    ParseStatusLine(stream);
+                }
+                else
+                {
+                    ParseHeader(stream);
+                }
+                stream->lineLength = 0;
+            }
+        }
+        else if (!stream->chunked)
+        {
+            ParseBody(stream, data, length, audio, context);
+            used = length;
+        }
+        else if (stream->chunkState == HTTP_CHUNK_DATA)
+        {
+            used = length < stream->chunkRemaining ? length : stream->chunkRemaining;
+            ParseBody(stream, data, used, audio, context);
+            stream->chunkRemaining -= used;
+            if (stream->chunkRemaining == 0)
+            {
+                stream->chunkState = HTTP_CHUNK_DATA_END;
+            }
+        }
+        else
+        {
+            // Chunk size line ("1f40;extension"), the CR LF after the data, or the trailer.
+            used = ReadLine(stream, data, length, &complete);
+            if (complete)
+            {
+                if (stream->chunkState == HTTP_CHUNK_SIZE)
+                {
+                    if (!isxdigit((unsigned char)stream->line[0]))
+                    {
+                        Log_Debug("Malformed chunk size: %s\n", stream->line);
+                        stream->state = HTTP_STREAM_ERROR;
+                    }
+                    else
+                    {
+                        stream->chunkRemaining = (size_t)strtoul(stream->line, NULL, 16);
+                        stream->chunkState = stream->chunkRemaining > 0 ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
+                    }
+                }
+                else if (stream->chunkState == HTTP_CHUNK_DATA_END)
+                {
+                    stream->chunkState = HTTP_CHUNK_SIZE;
+                }
+                else if (stream->lineLength == 0)
+                {
+                    stream->state = HTTP_STREAM_DONE;
+                }
+                stream->lineLength = 0;
+            }
+        }
+
+        data += used;
+        length -= used;
+    }
+
+    return stream->state == HTTP_STREAM_ERROR ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental parser for the response of an HTTP (or SHOUTcast "ICY") audio stream. The status line
+// and headers are parsed once, then the body is decoded as it arrives, in pieces of any size:
+//  - Transfer-Encoding: chunked is removed,
+//  - ICY metadata blocks (every icy-metaint audio bytes, when the request asked for them with
+//    "Icy-MetaData: 1") are removed, and the stream title is logged when it changes.
+// Only the audio bytes are passed to the callback.
+
+#define HTTP_STREAM_LINE_SIZE 256
+#define HTTP_STREAM_TITLE_SIZE 128
+
+typedef void (*HTTP_STREAM_AUDIO_CALLBACK)(void* context, const uint8_t* data, size_t length);
+
+typedef enum
+{
+    HTTP_STREAM_STATUS_LINE,
+    HTTP_STREAM_HEADERS,
+    HTTP_STREAM_BODY,
+    HTTP_STREAM_DONE,       // last chunk received
+    HTTP_STREAM_ERROR       // not a 200 response, or malformed
+} HTTP_STREAM_STATE;
+
+typedef enum
+{
+    HTTP_CHUNK_SIZE,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_END,    // CRLF after the chunk data
+    HTTP_CHUNK_TRAILER
+} HTTP_CHUNK_STATE;
+
+typedef struct
+{
+    HTTP_STREAM_STATE state;
+    int statusCode;
+    char line[HTTP_STREAM_LINE_SIZE];
+    size_t lineLength;
+
+    bool chunked;
+    HTTP_CHUNK_STATE chunkState;
+    size_t chunkRemaining;
+
+    uint32_t icyMetaInterval;       // 0: no metadata in the stream
+    uint32_t audioUntilMeta;
+    size_t metaRemaining;           // metadata bytes still to skip
+    char meta[HTTP_STREAM_TITLE_SIZE + 16];
+    size_t metaLength;
+    char title[HTTP_STREAM_TITLE_SIZE];
+
+    uint64_t audioBytes;
+    uint32_t metaBlocks;
+} HTTP_STREAM;
+
+void HttpStream_Init(HTTP_STREAM* stream);
+
+// Parses the next 'length' bytes received. Returns 0, or -1 once the response is known to be
+// unusable (stream->state is HTTP_STREAM_ERROR, stream->statusCode holds the status if known).
+int HttpStream_Parse(HTTP_STREAM* stream, const uint8_t* data, size_t length,
+                     HTTP_STREAM_AUDIO_CALLBACK audio, void* context);
@@ -0,0 +1,75 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "jitter_buffer.h"
+
+int JitterBuffer_Init(JITTER_BUFFER* jb, uint8_t* buffer, size_t size)
+{
+    if (size == 0 || (size & (size - 1)) != 0)
+    {
+        return -1;
+    }
+
+    jb->buffer = buffer;
+    jb->size = size;
+    atomic_init(&jb->head, 0);
+    atomic_init(&jb->tail, 0);
+    return 0;
+}
+
+size_t JitterBuffer_Write(JITTER_BUFFER* jb, const uint8_t* data, size_t length)
+{
+    size_t head = atomic_load_explicit(&jb->head, memory_order_relaxed);
+    // acquire: the consumer is done with the bytes before 'tail'.
+    size_t tail = atomic_load_explicit(&jb->tail, memory_order_acquire);
+
+    size_t space = jb->size - (head - tail);
+    if (length > space)
+    {
+        length = space;
+    }
+
+    size_t offset = head & (jb->size - 1);
+    size_t first = jb->size - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(jb->buffer + offset, data, first);
+    memcpy(jb->buffer, data + first, length - first);
+
+    // release: the bytes are in the ring before the consumer sees the new head.
+    atomic_store_explicit(&jb->head, head + length, memory_order_release);
+    return length;
+}
+
+size_t JitterBuffer_Peek(JITTER_BUFFER* jb, const uint8_t** data)
+{
+    size_t tail = atomic_load_explicit(&jb->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&jb->head, memory_order_acquire);
+
+    size_t offset = tail & (jb->size - 1);
+    size_t available = head - tail;
+    if (available > jb->size - offset)
+    {
+        available = jb->size - offset;
+    }
+
+    *data = jb->buffer + offset;
+    return available;
+}
+
+void JitterBuffer_Consume(JITTER_BUFFER* jb, size_t length)
+{
+    size_t tail = atomic_load_explicit(&jb->tail, memory_order_relaxed);
+    atomic_store_explicit(&jb->tail, tail + length, memory_order_release);
+}
+
+size_t JitterBuffer_Level(JITTER_BUFFER* jb)
+{
+    size_t tail = atomic_load_explicit(&jb->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&jb->head, memory_order_acquire);
+    return head - tail;
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single producer / single consumer byte ring between the network thread and the playback thread.
+// No locks: the producer only moves 'head' and the consumer only moves 'tail'. Both indexes count
+// bytes since the start and wrap naturally, so the ring size must be a power of two.
+typedef struct
+{
+    uint8_t* buffer;
+    size_t size;
+    atomic_size_t head;     // bytes written (producer)
+    atomic_size_t tail;     // bytes read (consumer)
+} JITTER_BUFFER;
+
+// Returns -1 if 'size' is not a power of two.
+int JitterBuffer_Init(JITTER_BUFFER* jb, uint8_t* buffer, size_t size);
+
+// Producer: copies as much of 'data' as fits, returns the number of bytes copied.
+size_t JitterBuffer_Write(JITTER_BUFFER* jb, const uint8_t* data, size_t length);
+
+// Consumer: sets '*data' to the oldest buffered bytes and returns how many are contiguous
+// (0 if the buffer is empty). The bytes stay valid until JitterBuffer_Consume.
+size_t JitterBuffer_Peek(JITTER_BUFFER* jb, const uint8_t** data);
+
+// Consumer: releases 'length' bytes returned by JitterBuffer_Peek.
+void JitterBuffer_Consume(JITTER_BUFFER* jb, size_t length);
+
+// Bytes buffered (either thread).
+size_t JitterBuffer_Level(JITTER_BUFFER* jb);
@@ -1,12 +1,14 @@
 ﻿/* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -19,17 +21,48 @@
 #include <applibs/storage.h>
 
 #include "vs1053.h"
+#include "http_stream.h"
+#include "jitter_buffer.h"
+
+// Jitter buffer between the network thread and the playback thread (must be a power of two),
+// and how much of it is filled before playback starts, or restarts after an underrun.
+// 32 KB is 8 s of a 32 kbps stream, 16 KB of pre-buffer 4 s.
+#ifndef RADIO_JITTER_BUFFER_SIZE
+#define RADIO_JITTER_BUFFER_SIZE (32 * 1024)
+#endif
+#ifndef RADIO_PREBUFFER_BYTES
+#define RADIO_PREBUFFER_BYTES (16 * 1024)
+#endif
+
+// Largest write to the codec: the playback thread gets back to the jitter buffer at least this often.
+#define RADIO_PLAYBACK_CHUNK 512
+// How long a thread sleeps when the jitter buffer is empty (playback) or full (network).
+#define RADIO_WAIT_MS 10
 
 // KOUW/NPR Seattle 32kbps audio stream
 static char httpRequest[1024];
 static uint8_t audioBuffer[4096];
+static uint8_t jitterStorage[RADIO_JITTER_BUFFER_SIZE];
 
 // NPR/KUOW 32kbps stream: https://17853.live.streamtheworld.com/KUOWFM_LOW_MP3.mp3
 static const char* streamHost = "17853.live.streamtheworld.com";
 static const char* streamPath = "KUOWFM_LOW_MP3.mp3";
-static const char *request_template = "GET /%s HTTP/1.1\r\nHost: %s\r\nContent-Type: audio/mpeg\r\n\r\n";
-static const char* httpOK = "HTTP/1.0 200 OK";
-static const char* httpServiceNotAvailable = "HTTP/1.0 503";
+static const char *request_template =
+    "GET /%s HTTP/1.1\r\nHost: %s\r\nIcy-MetaData: 1\r\nConnection: close\r\n\r\n";
+
+typedef struct
+{
+    JITTER_BUFFER jitter;
+    HTTP_STREAM http;
+    int sockFd;
+    atomic_bool networkDone;    // set by the network thread at the end of the stream (or on error)
+    atomic_bool stop;           // set by the playback thread to stop the network thread
+    atomic_uint overruns;       // times the network thread found the jitter buffer full
+    unsigned int underruns;     // times playback found the jitter buffer empty
+    size_t minLevel;            // lowest jitter buffer level while playing
+} RADIO_PLAYER;
+
+static RADIO_PLAYER radio;
 
 int ReadEmbeddedAudio(char* audioFile, uint8_t **audioData, ssize_t *audioLength)
 {
@@ -101,9 +134,11 @@ int PlayEmbeddedResource(void)
     {
         VS1053_SetVolume(20);
 
-        for (ssize_t x = 0; x < audioLength; x++)
+        // VS1053_PlayBuffer logs why it stopped.
+        if (VS1053_PlayBuffer(pAudio, (size_t)audioLength) != 0)
         {
-            VS1053_PlayByte(pAudio[x]);
+            Log_Debug("Failed to play the audio\n");
+            ret = -1;
         }
 
         free(pAudio);
@@ -114,10 +149,130 @@ int PlayEmbeddedResource(void)
     else
     {
         Log_Debug("Failed to initialize VS1053 hardware\n");
+        free(pAudio);
         return -1;
     }
 
-    return 0;
+    return ret;
+}
+
+static void SleepMs(long ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+/// <summary>
+///     Called by the HTTP parser with the audio bytes of the stream: copies them to the jitter
+///     buffer, waiting for room when it's full (TCP flow control then slows the server down).
+/// </summary>
+static void QueueAudio(void* context, const uint8_t* data, size_t length)
+{
+    RADIO_PLAYER* player = (RADIO_PLAYER*)context;
+    bool full = false;
+
+    while (length > 0 && !atomic_load(&player->stop))
+    {
+        size_t written = JitterBuffer_Write(&player->jitter, data, length);
+        data += written;
+        length -= written;
+
+        if (length > 0)
+        {
+            if (!full)
+            {
+                atomic_fetch_add(&player->overruns, 1);
+                full = true;
+            }
+            SleepMs(RADIO_WAIT_MS);
+        }
+    }
+}
+
+/// <summary>
+///     Network thread: reads the HTTP response, and queues the audio in the jitter buffer.
+///     A slow read no longer holds up the codec, and vice versa.
+/// </summary>
+static void* NetworkThread(void* arg)
+{
+    RADIO_PLAYER* player = (RADIO_PLAYER*)arg;
+
+    while (!atomic_load(&player->stop))
+    {
+        ssize_t length = read(player->sockFd, audioBuffer, sizeof(audioBuffer));
+        if (length <= 0)
+        {
+            Log_Debug(length == 0 ? "Stream closed by the server\n" : "!read\n");
+            break;
+        }
+
+        if (HttpStream_Parse(&player->http, audioBuffer, (size_t)length, QueueAudio, player) != 0 ||
+            player->http.state == HTTP_STREAM_DONE)
+        {
+            break;
+        }
+    }
+
+    atomic_store(&player->networkDone, true);
+    return NULL;
+}
+
+/// <summary>
+///     Playback: waits for RADIO_PREBUFFER_BYTES, then feeds the codec from the jitter buffer.
+///     If the buffer runs dry, playback pauses until it's refilled to the pre-buffer depth.
+/// </summary>
+static void PlayFromJitterBuffer(RADIO_PLAYER* player)
+{
+    bool playing = false;
+    player->minLevel = RADIO_JITTER_BUFFER_SIZE;
+
+    while (true)
+    {
+        // networkDone first: the network thread sets it after its last write, so a level read after it
+        // includes the final bytes of the stream.
+        bool networkDone = atomic_load(&player->networkDone);
+        size_t level = JitterBuffer_Level(&player->jitter);
+
+        if (!playing)
+        {
+            if (level < RADIO_PREBUFFER_BYTES && !networkDone)
+            {
+                SleepMs(RADIO_WAIT_MS);
+                continue;
+            }
+            Log_Debug("Playing (%zu bytes buffered)\n", level);
+            playing = true;
+        }
+
+        if (level == 0)
+        {
+            if (networkDone)
+            {
+                break;
+            }
+            player->underruns++;
+            Log_Debug("Underrun %u, re-buffering\n", player->underruns);
+            playing = false;
+            continue;
+        }
+
+        if (level < player->minLevel)
+        {
+            player->minLevel = level;
+        }
+
+        const uint8_t* data;
+        size_t length = JitterBuffer_Peek(&player->jitter, &data);
+        if (length > RADIO_PLAYBACK_CHUNK)
+        {
+            length = RADIO_PLAYBACK_CHUNK;
+        }
+        if (VS1053_PlayBuffer(data, length) != 0)
+        {
+            break;
+        }
+        JitterBuffer_Consume(&player->jitter, length);
+    }
 }
 
 int PlayInternetRadio(void)
@@ -134,42 +289,38 @@ int PlayInternetRadio(void)
     {
         VS1053_SetVolume(20);
 
-        ssize_t length = 0;
-
         // setup the HTTP request
         snprintf(httpRequest, 1024, request_template, streamPath, streamHost);
         Log_Debug("Request: %s\n", httpRequest);
         // write the HTTP Request.
         write(SockFd, httpRequest, strlen(httpRequest));
 
-        while (true)
+        JitterBuffer_Init(&radio.jitter, jitterStorage, sizeof(jitterStorage));
+        HttpStream_Init(&radio.http);
+        radio.sockFd = SockFd;
+        atomic_init(&radio.networkDone, false);
+        atomic_init(&radio.stop, false);
+        atomic_init(&radio.overruns, 0);
+        radio.underruns = 0;
+
+        pthread_t networkThread;
+        if (pthread_create(&networkThread, NULL, NetworkThread, &radio) != 0)
         {
-            // read audio data
-            length = read(SockFd, audioBuffer, 4096);
-            if (length <= 0)
-            {
-                Log_Debug("!read\n");
-                break;
-            }
-            else
-            {
-                if (strncmp(audioBuffer, httpServiceNotAvailable, strlen(httpServiceNotAvailable)) == 0)
-                {
-                    Log_Debug("Service not available\n");
-                    break;
-                }
-                if (strncmp(audioBuffer, httpOK, strlen(httpOK)) == 0)
-                {
-                    Log_Debug("Skip HTTP OK Response\n");
-                }
-                else
-                {
-                    for (int x = 0; x < length; x++)
-                    {
-                        VS1053_PlayByte(audioBuffer[x]);
-                    }
-                }
-            }
+            Log_Debug("Failed to start the network thread\n");
+        }
+        else
+        {
+            PlayFromJitterBuffer(&radio);
+
+            // Unblock the network thread if it's waiting in read().
+            atomic_store(&radio.stop, true);
+            shutdown(SockFd, SHUT_RDWR);
+            pthread_join(networkThread, NULL);
+
+            Log_Debug("Stream: %llu audio bytes, %u metadata blocks; jitter buffer: %u underruns, %u overruns, "
+                      "lowest level %zu bytes\n",
+                      (unsigned long long)radio.http.audioBytes, radio.http.metaBlocks, radio.underruns,
+                      atomic_load(&radio.overruns), radio.minLevel);
         }
 
         VS1053_SetVolume(0);
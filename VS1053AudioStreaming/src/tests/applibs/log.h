@@ -0,0 +1,9 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host stand-in for the Azure Sphere log API.
+
+#pragma once
+#include <stdio.h>
+
+#define Log_Debug(...) printf(__VA_ARGS__)
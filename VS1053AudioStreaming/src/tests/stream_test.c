@@ -0,0 +1,242 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host test of the radio stream: a chunked response carrying ICY metadata, split at random
+// boundaries, goes through the parser, and a stream of bytes goes through a small jitter buffer
+// between two threads. The audio must come out unchanged.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_stream.h"
+#include "jitter_buffer.h"
+
+#define AUDIO_SIZE 50000
+#define ICY_META_INTERVAL 100
+#define STREAM_TITLE "Song A"
+#define PARSE_TRIALS 20
+#define RING_SIZE 64
+#define RING_TRANSFER_SIZE (256 * 1024)
+
+static uint8_t audio[AUDIO_SIZE];
+static uint8_t response[4 * AUDIO_SIZE];
+static size_t responseLength;
+
+static uint8_t parsed[AUDIO_SIZE];
+static size_t parsedLength;
+static bool parsedOverflow;
+
+static JITTER_BUFFER ring;
+static uint8_t ringStorage[RING_SIZE];
+
+static void AudioCallback(void* context, const uint8_t* data, size_t length)
+{
+    if (parsedLength + length > sizeof(parsed))
+    {
+        parsedOverflow = true;
+        return;
+    }
+    memcpy(&parsed[parsedLength], data, length);
+    parsedLength += length;
+}
+
+/// <summary>
+///     Builds a chunked HTTP response of random audio, with an ICY metadata block after every
+///     ICY_META_INTERVAL audio bytes: the stream title in every third one, the others empty.
+/// </summary>
+static void BuildResponse(void)
+{
+    static uint8_t body[2 * AUDIO_SIZE];
+    size_t bodyLength = 0;
+
+    for (size_t i = 0; i < AUDIO_SIZE; i++)
+    {
+        if (i > 0 && i % ICY_META_INTERVAL == 0)
+        {
+            if ((i / ICY_META_INTERVAL) % 3 == 1)
+            {
+                const char* meta = "StreamTitle='" STREAM_TITLE "';";
+                size_t blocks = (strlen(meta) + 15) / 16;
+                body[bodyLength++] = (uint8_t)blocks;
+                memset(&body[bodyLength], 0, blocks * 16);
+                memcpy(&body[bodyLength], meta, strlen(meta));
+                bodyLength += blocks * 16;
+            }
+            else
+            {
+                body[bodyLength++] = 0;
+            }
+        }
+        audio[i] = (uint8_t)rand();
+        body[bodyLength++] = audio[i];
+    }
+
+    responseLength = (size_t)sprintf((char*)response,
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nicy-metaint: %d\r\nicy-name: Test\r\n\r\n",
+        ICY_META_INTERVAL);
+    for (size_t offset = 0; offset < bodyLength;)
+    {
+        size_t chunk = 1 + (size_t)rand() % 3000;
+        if (chunk > bodyLength - offset)
+        {
+            chunk = bodyLength - offset;
+        }
+        // with a chunk extension, which is ignored
+        responseLength += (size_t)sprintf((char*)&response[responseLength], "%zx;ext=1\r\n", chunk);
+        memcpy(&response[responseLength], &body[offset], chunk);
+        responseLength += chunk;
+        memcpy(&response[responseLength], "\r\n", 2);
+        responseLength += 2;
+        offset += chunk;
+    }
+    responseLength += (size_t)sprintf((char*)&response[responseLength], "0\r\n\r\n");
+}
+
+static bool TestParser(void)
+{
+    BuildResponse();
+
+    // byte by byte first, then in random pieces
+    for (int trial = 0; trial < PARSE_TRIALS; trial++)
+    {
+        HTTP_STREAM stream;
+        HttpStream_Init(&stream);
+        parsedLength = 0;
+        parsedOverflow = false;
+
+        for (size_t offset = 0; offset < responseLength;)
+        {
+            size_t length = trial == 0 ? 1 : 1 + (size_t)rand() % 700;
+            if (length > responseLength - offset)
+            {
+                length = responseLength - offset;
+            }
+            if (HttpStream_Parse(&stream, &response[offset], length, AudioCallback, NULL) != 0)
+            {
+                fprintf(stderr, "FAIL: HttpStream_Parse failed at byte %zu\n", offset);
+                return false;
+            }
+            offset += length;
+        }
+
+        if (parsedOverflow || parsedLength != AUDIO_SIZE || memcmp(parsed, audio, AUDIO_SIZE) != 0)
+        {
+            fprintf(stderr, "FAIL: %zu audio bytes parsed instead of %d, or different\n", parsedLength, AUDIO_SIZE);
+            return false;
+        }
+        if (stream.state != HTTP_STREAM_DONE || strcmp(stream.title, STREAM_TITLE) != 0)
+        {
+            fprintf(stderr, "FAIL: state %d, title '%s'\n", stream.state, stream.title);
+            return false;
+        }
+    }
+
+    HTTP_STREAM stream;
+    HttpStream_Init(&stream);
+    const char* notFound = "ICY 404 Not Found\r\n\r\n";
+    if (HttpStream_Parse(&stream, (const uint8_t*)notFound, strlen(notFound), AudioCallback, NULL) != -1 ||
+        stream.state != HTTP_STREAM_ERROR || stream.statusCode != 404)
+    {
+        fprintf(stderr, "FAIL: 404 not reported\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void* RingProducer(void* arg)
+{
+    uint8_t data[97];
+    size_t written = 0;
+    unsigned int seed = 1;
+
+    while (written < RING_TRANSFER_SIZE)
+    {
+        size_t length = 1 + (size_t)rand_r(&seed) % sizeof(data);
+        if (length > RING_TRANSFER_SIZE - written)
+        {
+            length = RING_TRANSFER_SIZE - written;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            data[i] = (uint8_t)((written + i) * 7);
+        }
+        // the buffer may take only part of it, or nothing while it's full
+        size_t copied = JitterBuffer_Write(&ring, data, length);
+        if (copied == 0)
+        {
+            sched_yield();
+        }
+        written += copied;
+    }
+    return NULL;
+}
+
+static bool TestJitterBuffer(void)
+{
+    if (JitterBuffer_Init(&ring, ringStorage, RING_SIZE - 1) != -1)
+    {
+        fprintf(stderr, "FAIL: JitterBuffer_Init accepted a size that isn't a power of two\n");
+        return false;
+    }
+    if (JitterBuffer_Init(&ring, ringStorage, RING_SIZE) != 0)
+    {
+        fprintf(stderr, "FAIL: JitterBuffer_Init\n");
+        return false;
+    }
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, RingProducer, NULL) != 0)
+    {
+        fprintf(stderr, "FAIL: pthread_create\n");
+        return false;
+    }
+
+    size_t read = 0;
+    bool ok = true;
+    // after a failure, keep reading so that the producer finishes
+    while (read < RING_TRANSFER_SIZE)
+    {
+        if (ok && JitterBuffer_Level(&ring) > RING_SIZE)
+        {
+            fprintf(stderr, "FAIL: %zu bytes buffered in a ring of %d\n", JitterBuffer_Level(&ring), RING_SIZE);
+            ok = false;
+        }
+
+        const uint8_t* data;
+        size_t length = JitterBuffer_Peek(&ring, &data);
+        for (size_t i = 0; i < length && ok; i++)
+        {
+            if (data[i] != (uint8_t)((read + i) * 7))
+            {
+                fprintf(stderr, "FAIL: byte %zu is different\n", read + i);
+                ok = false;
+            }
+        }
+        if (length == 0)
+        {
+            sched_yield();
+        }
+        JitterBuffer_Consume(&ring, length);
+        read += length;
+    }
+
+    pthread_join(producer, NULL);
+    return ok;
+}
+
+int main(void)
+{
+    srand(1);
+
+    if (!TestParser() || !TestJitterBuffer())
+    {
+        return -1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}